@@ -7,5 +7,21 @@
 #include "mips_mem.h"
 #include "mips_cpu.h"
 #include "mips_test.h"
+#include "mips_cpu_state.h"
+#include "mips_checkpoint.h"
+#include "mips_hostcall.h"
+#include "mips_cpu_run.h"
+#include "mips_breakpoint.h"
+#include "mips_reverse.h"
+#include "mips_gdb.h"
+#include "mips_asm.h"
+#include "mips_farm.h"
+#include "mips_plugin.h"
+#include "mips_aot.h"
+#include "mips_coverage.h"
+#include "mips_elf.h"
+#include "mips_event.h"
+#include "mips_isa.h"
+#include "mips_profile.h"
 
 #endif
@@ -0,0 +1,197 @@
+/*! \file mips_aot.h
+    Translating fixed binaries into C++ ahead of time.
+*/
+#ifndef mips_aot_header
+#define mips_aot_header
+
+#include "mips_cpu_state.h"
+#include "mips_cpu_run.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_aot Static Translation
+    \ingroup mips_cpu
+    \addtogroup mips_aot
+    @{
+
+    Programs which never change (such as the binaries in fragments) can be
+    translated into C++ once, and then compiled with a normal compiler,
+    so each MIPS instruction becomes a few host instructions rather than
+    a trip through the interpreter. The translator follows the control
+    flow from the entry points, through branches, jumps and calls, and
+    treats every instruction it reaches as code. Anything it didn't
+    reach is left to the interpreter.
+
+    The steps are:
+
+        mips_translate -e 0 f_fibonacci-mips.bin fib_aot.cpp
+        g++ -O2 -shared -fPIC -I include fib_aot.cpp -o fib_aot.so
+
+    and then in the simulator:
+
+        const mips_aot_module *mod;
+        mips_aot_load("./fib_aot.so", 0, &mod);
+        // ... load f_fibonacci-mips.bin into mem ...
+        mips_aot_check(mod, mem);
+        mips_cpu_run_translated(cpu, mod, UINT64_MAX, 0);
+
+    Translated code gives exactly the same results as the interpreter,
+    including the instruction count. Whenever it reaches something it
+    can't handle (a SYSCALL or BREAK, an instruction which would cause
+    an exception, a memory error, or a jump to an address it has no
+    translation for), it stops before that instruction has any effect,
+    and \ref mips_cpu_run_translated executes that one instruction with
+    the interpreter before going back to translated code. Loads may
+    happen twice when this occurs, so memories where reads have side
+    effects should not be used.
+
+    The translation is only valid while the image in memory is unchanged,
+    so programs which modify their own code can't be translated.
+*/
+
+/*! Increased whenever the interface between modules and the simulator changes. */
+#define MIPS_AOT_VERSION 2
+
+/*! The state shared between \ref mips_cpu_run_translated and the
+    translated code. Memory is accessed through the function pointers,
+    so modules do not need to link against the simulator. */
+typedef struct _mips_aot_context{
+    mips_cpu_arch_state arch;   //!< Registers, updated when the code returns
+    mips_mem_h mem;
+    uint64_t limit;             //!< Execute at most this many instructions
+    uint64_t count;             //!< Receives the number actually executed
+
+    mips_error (*read_word)(mips_mem_h mem, uint32_t address, uint32_t *value);
+    mips_error (*write_word)(mips_mem_h mem, uint32_t address, uint32_t value);
+    mips_error (*read_masked)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut, uint32_t byteMask);
+    mips_error (*write_masked)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn, uint32_t byteMask);
+}mips_aot_context;
+
+/*! Describes a translated image. Each generated file defines one of these. */
+typedef struct _mips_aot_module{
+    unsigned version;       //!< MIPS_AOT_VERSION when it was generated
+    uint32_t base;          //!< Address the image was translated at
+    uint32_t length;        //!< Bytes in the image
+    uint64_t digest;        //!< 64-bit FNV-1a hash of the image
+
+    /*! Runs translated code from ctx->arch.pc until it reaches something
+        it can't handle, or until it has executed ctx->limit instructions.
+        Returns straight away if there is no translation for the pc, or
+        the CPU is in a delay slot. */
+    void (*run)(mips_aot_context *ctx);
+}mips_aot_module;
+
+/*! Writes a C++ translation of an image to dst.
+
+    \param image Bytes of the binary, exactly as they will be in memory.
+
+    \param length Number of bytes (a multiple of four).
+
+    \param base Address the image will be loaded at. This is always
+        an entry point.
+
+    \param entries Addresses which execution can start at (or return to)
+        other than base, for example functions called by the host. May
+        be NULL if entryCount is zero.
+
+    \param entryCount Number of entries.
+
+    \param symbol Name for the mips_aot_module in the output, or NULL for
+        "mips_aot_image".
+
+    \param dst Where to write the source code.
+
+    \retval mips_ErrorInvalidArgument The image or base are not word aligned.
+    \retval mips_ErrorFileWriteError Writing to dst failed.
+*/
+mips_error mips_aot_translate(
+    const uint8_t *image,
+    uint32_t length,
+    uint32_t base,
+    const uint32_t *entries,
+    unsigned entryCount,
+    const char *symbol,
+    FILE *dst
+);
+
+/*! Loads a compiled translation from a shared library. The library stays
+    loaded until the process exits.
+
+    \param fileName Path to the library, as for dlopen.
+
+    \param symbol The name given to mips_aot_translate, or NULL for the default.
+
+    \param module Receives the module.
+
+    \retval mips_ErrorFileReadError The library could not be loaded (or
+        this platform can't load libraries).
+    \retval mips_ErrorInvalidArgument The library does not contain the
+        symbol, or it was made for a different MIPS_AOT_VERSION.
+*/
+mips_error mips_aot_load(
+    const char *fileName,
+    const char *symbol,
+    const mips_aot_module **module
+);
+
+/*! Checks that memory holds exactly the image the module was made from.
+    \retval mips_ErrorInvalidArgument The contents are different.
+*/
+mips_error mips_aot_check(
+    const mips_aot_module *module,
+    mips_mem_h mem
+);
+
+/*! The same as \ref mips_cpu_run, but using translated code where it can.
+
+    If the CPU is being observed in a way translated code can't support
+    (watchpoints, instrumentation, coverage, journaling, reverse execution,
+    debug output, or breakpoints within the translated image), or part of
+    the image is not executable, then this just calls mips_cpu_run. Breakpoints elsewhere work as normal, which is
+    useful for stopping when the program returns to a sentinel address.
+*/
+mips_error mips_cpu_run_translated(
+    mips_cpu_h state,
+    const mips_aot_module *module,
+    uint64_t maxSteps,
+    uint64_t *stepsDone
+);
+
+/*! Reads the bytes selected by mask in the word at address (which must
+    be aligned), for use by translated code. The other bytes of value
+    are zero. */
+static inline mips_error mips_aot_read_masked(mips_aot_context *ctx, uint32_t address, uint32_t mask, uint32_t *value)
+{
+    uint8_t b[4]={0, 0, 0, 0};
+    uint32_t enables=((mask>>24)&1) | ((mask>>15)&2) | ((mask>>6)&4) | ((mask<<3)&8);
+    mips_error err=ctx->read_masked(ctx->mem, address, 4, b, enables);
+    if(err)
+        return err;
+    *value=((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+    return mips_Success;
+}
+
+/*! Replaces the bytes selected by mask in the word at address, for use
+    by translated code. */
+static inline mips_error mips_aot_write_masked(mips_aot_context *ctx, uint32_t address, uint32_t value, uint32_t mask)
+{
+    uint8_t b[4];
+    uint32_t enables=((mask>>24)&1) | ((mask>>15)&2) | ((mask>>6)&4) | ((mask<<3)&8);
+    b[0]=(uint8_t)(value>>24);
+    b[1]=(uint8_t)(value>>16);
+    b[2]=(uint8_t)(value>>8);
+    b[3]=(uint8_t)value;
+    return ctx->write_masked(ctx->mem, address, 4, b, enables);
+}
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
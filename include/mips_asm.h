@@ -0,0 +1,296 @@
+/*! \file mips_asm.h
+    A small assembler for building test programs directly in memory.
+*/
+#ifndef mips_asm_header
+#define mips_asm_header
+
+#include "mips_mem.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_asm Assembler
+    \addtogroup mips_asm
+    @{
+
+    Writing tests involves a lot of working out bit-wise encodings
+    by hand, and then writing them into memory one word at a time. The
+    assembler does the encoding, works out branch offsets and jump
+    targets from labels, and then writes the whole program into memory
+    with one transaction, in big-endian order.
+
+    From C++ the \ref mips_asm class gives one method per instruction,
+    which can be chained together:
+
+        mips_asm a(0x1000);     // Program starts at address 0x1000
+        a.addiu(8, 0, 10)
+         .label("loop")
+         .addiu(8, 8, -1)
+         .bne(8, 0, "loop")
+         .nop()                 // Delay slot
+         .jr(31)
+         .nop();
+        mips_error err=a.write(mem);
+
+    Register operands are numbers (e.g. 31 rather than $ra), and the operand
+    order matches assembly language: destination first, and memory operands
+    as (rt, offset, base). Because `and`, `or`, `xor` and `nor` are reserved
+    words in C++, those methods have a trailing underscore.
+
+    From C the same thing is done with the lower level functions, which take
+    encoded instructions:
+
+        mips_asm_h a=mips_asm_create(0x1000);
+        mips_asm_word(a, mips_asm_encode_i(0x09, 0, 8, 10));    // addiu $8, $0, 10
+        mips_asm_label(a, "loop");
+        ...
+        mips_asm_branch(a, mips_asm_encode_i(0x05, 8, 0, 0), "loop");  // bne $8, $0, loop
+        ...
+        mips_asm_write(a, mem);
+        mips_asm_free(a);
+*/
+
+/*! Encodes an R-type instruction. */
+static inline uint32_t mips_asm_encode_r(unsigned opcode, unsigned rs, unsigned rt, unsigned rd, unsigned shift, unsigned funct)
+{
+    return ((opcode&0x3Fu)<<26) | ((rs&0x1Fu)<<21) | ((rt&0x1Fu)<<16) | ((rd&0x1Fu)<<11) | ((shift&0x1Fu)<<6) | (funct&0x3Fu);
+}
+
+/*! Encodes an I-type instruction. Only the bottom 16 bits of imm are used. */
+static inline uint32_t mips_asm_encode_i(unsigned opcode, unsigned rs, unsigned rt, uint32_t imm)
+{
+    return ((opcode&0x3Fu)<<26) | ((rs&0x1Fu)<<21) | ((rt&0x1Fu)<<16) | (imm&0xFFFFu);
+}
+
+/*! Encodes a J-type instruction. The target is a byte address, and only
+    bits 27..2 are used. */
+static inline uint32_t mips_asm_encode_j(unsigned opcode, uint32_t target)
+{
+    return ((opcode&0x3Fu)<<26) | ((target>>2)&0x03FFFFFFu);
+}
+
+/*! Represents a program being assembled. \struct mips_asm_impl */
+struct mips_asm_impl;
+
+/*! Opaque handle to a program being assembled. */
+typedef struct mips_asm_impl *mips_asm_h;
+
+/*! Creates an empty program, which will be placed at origin (which must be
+    a multiple of four). */
+mips_asm_h mips_asm_create(uint32_t origin);
+
+/*! Releases the program. Passing an empty handle is legal. */
+void mips_asm_free(mips_asm_h a);
+
+/*! Returns the address the next instruction will be placed at. */
+uint32_t mips_asm_here(mips_asm_h a);
+
+/*! Appends an already encoded instruction (or data word). */
+mips_error mips_asm_word(mips_asm_h a, uint32_t encoding);
+
+/*! Defines a label at the current address.
+    \retval mips_ErrorInvalidArgument The label already exists.
+*/
+mips_error mips_asm_label(mips_asm_h a, const char *name);
+
+/*! Appends a branch, with the 16-bit offset field filled in
+    from the label when the program is written. The label can be defined
+    before or after the branch. */
+mips_error mips_asm_branch(mips_asm_h a, uint32_t encoding, const char *label);
+
+/*! Appends a J or JAL, with the target filled in from the label when the
+    program is written. */
+mips_error mips_asm_jump(mips_asm_h a, uint32_t encoding, const char *label);
+
+/*! Returns the address of a label.
+    \retval mips_ErrorInvalidArgument The label has not been defined.
+*/
+mips_error mips_asm_get_label(mips_asm_h a, const char *name, uint32_t *address);
+
+/*! Resolves all labels, and copies the encoded program to a buffer.
+
+    \param a Valid (non-empty) handle.
+
+    \param dst Receives the program as big-endian bytes, ready to be written
+        to memory at the origin. May be NULL, to just find out the length.
+
+    \param length Receives the number of bytes in the program.
+
+    \retval mips_ErrorInvalidArgument A label was not defined, or a branch
+        target is too far away.
+*/
+mips_error mips_asm_assemble(mips_asm_h a, uint8_t *dst, uint32_t *length);
+
+/*! Resolves all labels, and writes the program to memory at the
+    origin, using a single mips_mem_write. */
+mips_error mips_asm_write(mips_asm_h a, mips_mem_h mem);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+
+/*! Fluent C++ interface to \ref mips_asm.
+
+    Errors (such as duplicate labels) are remembered, and
+    returned from write. The class owns the underlying handle,
+    so it cannot be copied.
+
+    \ingroup mips_asm
+*/
+class mips_asm
+{
+private:
+    mips_asm_h m_h;
+    mips_error m_err;
+
+    mips_asm(const mips_asm &);             // Not copyable
+    mips_asm &operator=(const mips_asm &);
+
+    mips_asm &check(mips_error err)
+    {
+        if(err && !m_err)
+            m_err=err;
+        return *this;
+    }
+
+    mips_asm &r(unsigned funct, unsigned rd, unsigned rs, unsigned rt, unsigned shift=0)
+    { return word(mips_asm_encode_r(0, rs, rt, rd, shift, funct)); }
+
+    mips_asm &i(unsigned opcode, unsigned rt, unsigned rs, uint32_t imm)
+    { return word(mips_asm_encode_i(opcode, rs, rt, imm)); }
+
+    mips_asm &b(unsigned opcode, unsigned rs, unsigned rt, const char *label)
+    { return check(mips_asm_branch(m_h, mips_asm_encode_i(opcode, rs, rt, 0), label)); }
+
+    mips_asm &b(unsigned opcode, unsigned rs, unsigned rt, int offset)
+    { return i(opcode, rt, rs, (uint32_t)offset); }
+
+public:
+    /*! Starts a program which will be placed at origin */
+    explicit mips_asm(uint32_t origin=0)
+        : m_h(mips_asm_create(origin))
+        , m_err(m_h ? mips_Success : mips_ErrorInvalidArgument)
+    {}
+
+    ~mips_asm()
+    { mips_asm_free(m_h); }
+
+    mips_asm_h handle() const
+    { return m_h; }
+
+    uint32_t here() const
+    { return mips_asm_here(m_h); }
+
+    /*! Returns the address of a label, or 0xFFFFFFFF if not defined */
+    uint32_t address_of(const char *name) const
+    {
+        uint32_t address;
+        return mips_asm_get_label(m_h, name, &address) ? 0xFFFFFFFFu : address;
+    }
+
+    /*! Writes the program into memory, returning the first error seen */
+    mips_error write(mips_mem_h mem)
+    { return m_err ? m_err : mips_asm_write(m_h, mem); }
+
+    mips_asm &word(uint32_t encoding)
+    { return check(mips_asm_word(m_h, encoding)); }
+
+    mips_asm &label(const char *name)
+    { return check(mips_asm_label(m_h, name)); }
+
+    // Arithmetic and logic
+    mips_asm &add(unsigned rd, unsigned rs, unsigned rt)    { return r(0x20, rd, rs, rt); }
+    mips_asm &addu(unsigned rd, unsigned rs, unsigned rt)   { return r(0x21, rd, rs, rt); }
+    mips_asm &sub(unsigned rd, unsigned rs, unsigned rt)    { return r(0x22, rd, rs, rt); }
+    mips_asm &subu(unsigned rd, unsigned rs, unsigned rt)   { return r(0x23, rd, rs, rt); }
+    mips_asm &and_(unsigned rd, unsigned rs, unsigned rt)   { return r(0x24, rd, rs, rt); }
+    mips_asm &or_(unsigned rd, unsigned rs, unsigned rt)    { return r(0x25, rd, rs, rt); }
+    mips_asm &xor_(unsigned rd, unsigned rs, unsigned rt)   { return r(0x26, rd, rs, rt); }
+    mips_asm &nor_(unsigned rd, unsigned rs, unsigned rt)   { return r(0x27, rd, rs, rt); }
+    mips_asm &slt(unsigned rd, unsigned rs, unsigned rt)    { return r(0x2A, rd, rs, rt); }
+    mips_asm &sltu(unsigned rd, unsigned rs, unsigned rt)   { return r(0x2B, rd, rs, rt); }
+
+    mips_asm &sll(unsigned rd, unsigned rt, unsigned sa)    { return r(0x00, rd, 0, rt, sa); }
+    mips_asm &srl(unsigned rd, unsigned rt, unsigned sa)    { return r(0x02, rd, 0, rt, sa); }
+    mips_asm &sra(unsigned rd, unsigned rt, unsigned sa)    { return r(0x03, rd, 0, rt, sa); }
+    mips_asm &sllv(unsigned rd, unsigned rt, unsigned rs)   { return r(0x04, rd, rs, rt); }
+    mips_asm &srlv(unsigned rd, unsigned rt, unsigned rs)   { return r(0x06, rd, rs, rt); }
+    mips_asm &srav(unsigned rd, unsigned rt, unsigned rs)   { return r(0x07, rd, rs, rt); }
+
+    mips_asm &mult(unsigned rs, unsigned rt)    { return r(0x18, 0, rs, rt); }
+    mips_asm &multu(unsigned rs, unsigned rt)   { return r(0x19, 0, rs, rt); }
+    mips_asm &div(unsigned rs, unsigned rt)     { return r(0x1A, 0, rs, rt); }
+    mips_asm &divu(unsigned rs, unsigned rt)    { return r(0x1B, 0, rs, rt); }
+    mips_asm &mfhi(unsigned rd)                 { return r(0x10, rd, 0, 0); }
+    mips_asm &mthi(unsigned rs)                 { return r(0x11, 0, rs, 0); }
+    mips_asm &mflo(unsigned rd)                 { return r(0x12, rd, 0, 0); }
+    mips_asm &mtlo(unsigned rs)                 { return r(0x13, 0, rs, 0); }
+
+    mips_asm &addi(unsigned rt, unsigned rs, int16_t imm)   { return i(0x08, rt, rs, (uint16_t)imm); }
+    mips_asm &addiu(unsigned rt, unsigned rs, int16_t imm)  { return i(0x09, rt, rs, (uint16_t)imm); }
+    mips_asm &slti(unsigned rt, unsigned rs, int16_t imm)   { return i(0x0A, rt, rs, (uint16_t)imm); }
+    mips_asm &sltiu(unsigned rt, unsigned rs, int16_t imm)  { return i(0x0B, rt, rs, (uint16_t)imm); }
+    mips_asm &andi(unsigned rt, unsigned rs, uint16_t imm)  { return i(0x0C, rt, rs, imm); }
+    mips_asm &ori(unsigned rt, unsigned rs, uint16_t imm)   { return i(0x0D, rt, rs, imm); }
+    mips_asm &xori(unsigned rt, unsigned rs, uint16_t imm)  { return i(0x0E, rt, rs, imm); }
+    mips_asm &lui(unsigned rt, uint16_t imm)                { return i(0x0F, rt, 0, imm); }
+
+    // Memory, with operands in the order "lw rt, offset(base)"
+    mips_asm &lb(unsigned rt, int16_t offset, unsigned base)    { return i(0x20, rt, base, (uint16_t)offset); }
+    mips_asm &lh(unsigned rt, int16_t offset, unsigned base)    { return i(0x21, rt, base, (uint16_t)offset); }
+    mips_asm &lwl(unsigned rt, int16_t offset, unsigned base)   { return i(0x22, rt, base, (uint16_t)offset); }
+    mips_asm &lw(unsigned rt, int16_t offset, unsigned base)    { return i(0x23, rt, base, (uint16_t)offset); }
+    mips_asm &lbu(unsigned rt, int16_t offset, unsigned base)   { return i(0x24, rt, base, (uint16_t)offset); }
+    mips_asm &lhu(unsigned rt, int16_t offset, unsigned base)   { return i(0x25, rt, base, (uint16_t)offset); }
+    mips_asm &lwr(unsigned rt, int16_t offset, unsigned base)   { return i(0x26, rt, base, (uint16_t)offset); }
+    mips_asm &sb(unsigned rt, int16_t offset, unsigned base)    { return i(0x28, rt, base, (uint16_t)offset); }
+    mips_asm &sh(unsigned rt, int16_t offset, unsigned base)    { return i(0x29, rt, base, (uint16_t)offset); }
+    mips_asm &swl(unsigned rt, int16_t offset, unsigned base)   { return i(0x2A, rt, base, (uint16_t)offset); }
+    mips_asm &sw(unsigned rt, int16_t offset, unsigned base)    { return i(0x2B, rt, base, (uint16_t)offset); }
+    mips_asm &swr(unsigned rt, int16_t offset, unsigned base)   { return i(0x2E, rt, base, (uint16_t)offset); }
+
+    // Branches, either to a label or with an explicit offset in instructions
+    mips_asm &beq(unsigned rs, unsigned rt, const char *label)  { return b(0x04, rs, rt, label); }
+    mips_asm &beq(unsigned rs, unsigned rt, int offset)         { return b(0x04, rs, rt, offset); }
+    mips_asm &bne(unsigned rs, unsigned rt, const char *label)  { return b(0x05, rs, rt, label); }
+    mips_asm &bne(unsigned rs, unsigned rt, int offset)         { return b(0x05, rs, rt, offset); }
+    mips_asm &blez(unsigned rs, const char *label)              { return b(0x06, rs, 0, label); }
+    mips_asm &blez(unsigned rs, int offset)                     { return b(0x06, rs, 0, offset); }
+    mips_asm &bgtz(unsigned rs, const char *label)              { return b(0x07, rs, 0, label); }
+    mips_asm &bgtz(unsigned rs, int offset)                     { return b(0x07, rs, 0, offset); }
+    mips_asm &bltz(unsigned rs, const char *label)              { return b(0x01, rs, 0x00, label); }
+    mips_asm &bltz(unsigned rs, int offset)                     { return b(0x01, rs, 0x00, offset); }
+    mips_asm &bgez(unsigned rs, const char *label)              { return b(0x01, rs, 0x01, label); }
+    mips_asm &bgez(unsigned rs, int offset)                     { return b(0x01, rs, 0x01, offset); }
+    mips_asm &bltzal(unsigned rs, const char *label)            { return b(0x01, rs, 0x10, label); }
+    mips_asm &bltzal(unsigned rs, int offset)                   { return b(0x01, rs, 0x10, offset); }
+    mips_asm &bgezal(unsigned rs, const char *label)            { return b(0x01, rs, 0x11, label); }
+    mips_asm &bgezal(unsigned rs, int offset)                   { return b(0x01, rs, 0x11, offset); }
+
+    // Jumps, either to a label or an absolute address. The address is an
+    // int like the branch offsets, so that j(0) is not ambiguous.
+    mips_asm &j(const char *label)      { return check(mips_asm_jump(m_h, mips_asm_encode_j(0x02, 0), label)); }
+    mips_asm &j(int target)             { return word(mips_asm_encode_j(0x02, (uint32_t)target)); }
+    mips_asm &jal(const char *label)    { return check(mips_asm_jump(m_h, mips_asm_encode_j(0x03, 0), label)); }
+    mips_asm &jal(int target)           { return word(mips_asm_encode_j(0x03, (uint32_t)target)); }
+    mips_asm &jr(unsigned rs)                   { return r(0x08, 0, rs, 0); }
+    mips_asm &jalr(unsigned rd, unsigned rs)    { return r(0x09, rd, rs, 0); }
+
+    mips_asm &syscall(uint32_t code=0)  { return word(((code&0xFFFFFu)<<6) | 0x0C); }
+    mips_asm &break_(uint32_t code=0)   { return word(((code&0xFFFFFu)<<6) | 0x0D); }
+    mips_asm &nop()                     { return word(0); }
+
+    /*! Loads a 32-bit constant using lui/ori (always two instructions) */
+    mips_asm &li(unsigned rt, uint32_t value)
+    { return lui(rt, (uint16_t)(value>>16)).ori(rt, rt, (uint16_t)value); }
+
+    /*! Copies a register (addu rd, rs, $0) */
+    mips_asm &move(unsigned rd, unsigned rs)
+    { return addu(rd, rs, 0); }
+};
+
+#endif
+
+#endif
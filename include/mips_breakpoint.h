@@ -0,0 +1,128 @@
+/*! \file mips_breakpoint.h
+    Stopping \ref mips_cpu_run at particular instructions or memory accesses.
+*/
+#ifndef mips_breakpoint_header
+#define mips_breakpoint_header
+
+#include "mips_cpu_run.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_breakpoint Breakpoints and Watchpoints
+    \ingroup mips_cpu
+    \addtogroup mips_breakpoint
+    @{
+
+    A breakpoint stops execution just before the instruction at a
+    given address executes, and a watchpoint stops execution just before
+    an instruction reads or writes a given range of memory. In both
+    cases \ref mips_cpu_run returns without executing the instruction, so the
+    pc still points at it, and the returned error says why it stopped:
+
+        mips_cpu_set_breakpoint(cpu, 0x44);
+        mips_cpu_add_watchpoint(cpu, 0x1000, 4, mips_watch_Write);
+
+        mips_error err=mips_cpu_run(cpu, UINT64_MAX, 0);
+        if(err==mips_StopBreakpoint){
+            // pc==0x44
+        }else if(err==mips_StopWatchpoint){
+            uint32_t addr;
+            unsigned flags;
+            mips_cpu_get_watch_hit(cpu, &addr, &flags);
+        }
+
+    After mips_cpu_run stops at a breakpoint or watchpoint, the next call
+    to mips_cpu_run lets that instruction through, so calling it again
+    continues past the stop. Otherwise breakpoints are checked before every
+    instruction, including the first one of each call, so a program can be
+    run in fixed size chunks without missing any. Changing the pc or
+    resetting the CPU cancels the pending continue. \ref mips_cpu_step
+    ignores breakpoints and watchpoints completely.
+
+    Breakpoints are kept as one bit per instruction, in bitmaps which are
+    only allocated for the 4KB pages that contain a breakpoint. Watchpoints
+    mark each 4KB page they overlap as armed, and only accesses to armed
+    pages look at the watchpoints themselves. When there are no breakpoints
+    or watchpoints, mips_cpu_run uses a loop which does not look for
+    them at all.
+
+    Host call handlers, plugins and device events may add or remove
+    breakpoints and watchpoints while mips_cpu_run is active. Removing
+    them takes effect straight away. Adding them takes effect straight
+    away if there were already some when the run started, and otherwise
+    from the next call to mips_cpu_run.
+
+    A watchpoint only stops an access which would succeed. A misaligned
+    or invalid load or store, or one the memory would reject, raises its
+    exception as it would without the watchpoint.
+*/
+
+/*! Which kinds of memory access a watchpoint responds to. */
+typedef enum _mips_watch_flags{
+    mips_watch_Read=1,
+    mips_watch_Write=2
+}mips_watch_flags;
+
+/*! Stops mips_cpu_run before the instruction at the given address.
+    Setting a breakpoint that already exists has no effect.
+    \retval mips_ExceptionInvalidAlignment The address is not a multiple of four.
+*/
+mips_error mips_cpu_set_breakpoint(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint32_t pc         //!< Address of instruction
+);
+
+/*! Removes a breakpoint. Clearing a breakpoint that does not exist has no effect. */
+mips_error mips_cpu_clear_breakpoint(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint32_t pc         //!< Address of instruction
+);
+
+/*! Stops mips_cpu_run before any load or store which touches a byte in
+    the range [address,address+length). Unaligned accesses (LWL, LWR,
+    SWL, SWR) are treated as touching the whole containing word.
+*/
+mips_error mips_cpu_add_watchpoint(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint32_t address,   //!< First byte to watch
+    uint32_t length,    //!< Number of bytes to watch (non-zero)
+    unsigned flags      //!< mips_watch_Read and/or mips_watch_Write
+);
+
+/*! Removes a watchpoint with exactly the given address and length.
+    \retval mips_ErrorInvalidArgument No such watchpoint exists.
+*/
+mips_error mips_cpu_remove_watchpoint(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint32_t address,
+    uint32_t length
+);
+
+/*! Removes all breakpoints and watchpoints. */
+mips_error mips_cpu_clear_all_breakpoints(mips_cpu_h state);
+
+/*! Describes the access which caused the last mips_StopWatchpoint.
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param address Receives the address of the access.
+
+    \param flags Receives mips_watch_Read or mips_watch_Write.
+
+    \retval mips_ErrorInvalidArgument No watchpoint has been hit.
+*/
+mips_error mips_cpu_get_watch_hit(
+    mips_cpu_h state,
+    uint32_t *address,
+    unsigned *flags
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/*! \file mips_checkpoint.h
+    Saving and restoring a complete simulation (CPU plus RAM) to a file.
+*/
+#ifndef mips_checkpoint_header
+#define mips_checkpoint_header
+
+#include "mips_cpu_state.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_checkpoint Checkpoints
+    \addtogroup mips_checkpoint
+    @{
+
+    A checkpoint captures everything needed to carry on a simulation
+    later: the \ref mips_cpu_arch_state "architectural state" of the
+    CPU, plus the contents of a RAM created with \ref mips_mem_create_ram.
+    The main use is to run a program up to some interesting point
+    once (e.g. past all the initialisation), then start many
+    different experiments from that point without repeating the
+    work:
+
+        mips_checkpoint_save(cpu, mem, "warm.ckpt", 0);
+        ...
+        for(int i=0; i<n; i++){
+            mips_cpu_h c;
+            mips_mem_h m;
+            if(mips_checkpoint_load("warm.ckpt", &c, &m))
+                exit(1);
+            run_experiment(i, c, m);
+            mips_cpu_free(c);
+            mips_mem_free(m);
+        }
+
+    The file format is:
+
+    - A fixed header, containing a magic number, the RAM size and block
+      size, and the CPU state.
+    - A page table, with one entry for each 4096 byte page of RAM which
+      is not entirely zero. Zero pages are not stored at all.
+    - The page data. Uncompressed pages are stored in ascending order, aligned
+      to 4096 bytes within the file.
+
+    All fields are stored in the byte order of the machine which wrote the
+    file, and loading on a machine with a different byte order fails with
+    mips_ErrorFileReadError.
+
+    On platforms with mmap (linux, cygwin, OS X), loading does not copy
+    the uncompressed pages, it maps them privately from the file. So
+    loading is close to free however big the RAM is, and any pages
+    which the restored program never touches are never read from disk.
+    Pages are only copied when they are first written, and that copy
+    is private to the RAM being written. On other platforms
+    the pages are read into a buffer in the normal way.
+*/
+
+/*! Options for mips_checkpoint_save. */
+typedef enum _mips_checkpoint_flags{
+    /*! Try to compress each page, and store the compressed form
+        when it is much smaller. Compressed pages have to be decoded
+        during load, so this trades load time for file size. */
+    mips_checkpoint_Compress=1
+}mips_checkpoint_flags;
+
+/*! Writes the state of the cpu and mem to the named file.
+
+    \param cpu The CPU to save.
+
+    \param mem The memory the CPU is attached to. This must be a RAM
+        created with \ref mips_mem_create_ram or \ref mips_mem_create_ram_ex
+        (or loaded by mips_checkpoint_load).
+
+    \param fileName File to create or overwrite.
+
+    \param flags Either zero, or values from mips_checkpoint_flags or-ed together.
+
+    The checkpoint is written to a temporary file which is then
+    renamed, so RAMs loaded from a previous version of the same
+    file are not affected.
+
+    \retval mips_ErrorInvalidArgument If mem is not a RAM.
+
+    \retval mips_ErrorFileWriteError If the file could not be created or written.
+*/
+mips_error mips_checkpoint_save(
+    mips_cpu_h cpu,
+    mips_mem_h mem,
+    const char *fileName,
+    unsigned flags
+);
+
+/*! Creates a new RAM and CPU from the contents of a checkpoint.
+
+    The RAM has the same size, block size and flags as the one which was saved,
+    and the CPU is attached to it. Both are owned by the caller,
+    and should be released with \ref mips_cpu_free and \ref mips_mem_free
+    as normal. The file can be deleted, or replaced by another call to
+    mips_checkpoint_save, once this returns. However, it must not be
+    modified in place while the RAM is still in use, as pages which
+    have not yet been written are still backed by the file.
+
+    On failure both *cpu and *mem are set to zero.
+
+    \retval mips_ErrorFileReadError The file could not be opened, is not a
+        valid checkpoint, or is shorter than its page table says.
+*/
+mips_error mips_checkpoint_load(
+    const char *fileName,
+    mips_cpu_h *cpu,    //!< Receives the new CPU
+    mips_mem_h *mem     //!< Receives the new RAM
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -41,6 +41,7 @@ typedef enum _mips_error{
     mips_ErrorInvalidHandle=0x1002,
     mips_ErrorFileReadError=0x1003,
     mips_ErrorFileWriteError=0x1004,
+    mips_ErrorOutOfMemory=0x1005,
     ///@}
     
     //! Error or exception from the simulated processor or program.
@@ -51,13 +52,24 @@ typedef enum _mips_error{
     mips_ExceptionAccessViolation=0x2003,
     mips_ExceptionInvalidInstruction=0x2004,
     mips_ExceptionArithmeticOverflow=0x2005,
+    mips_ExceptionFloatingPoint=0x2006,
+    mips_ExceptionUninitialisedRead=0x2007,
     ///@}
     
     /*! This is an extension point for implementations. Codes
         at this number and above are available for the
         implementation, but are not generally understood.
         They shouldn't be exposed over public APIs. */
-    mips_InternalError=0x3000
+    mips_InternalError=0x3000,
+    
+    //! Reasons for stopping that are specific to the extension APIs.
+    ///@{
+    mips_StopExit=0x3001,         //!< The guest asked to exit, see \ref mips_hostcall
+    mips_StopBreakpoint=0x3002,   //!< Reached a breakpoint, see \ref mips_breakpoint
+    mips_StopWatchpoint=0x3003,   //!< Accessed a watched address, see \ref mips_breakpoint
+    mips_StopHistoryStart=0x3004, //!< Reversed to the oldest point recorded, see \ref mips_reverse
+    mips_StopInterrupt=0x3005     //!< An enabled interrupt line is raised, see \ref mips_event
+    ///@}
 }mips_error;
 
 #ifdef __cplusplus
@@ -0,0 +1,81 @@
+/*! \file mips_coverage.h
+    Recording which instructions and paths a CPU has actually executed.
+*/
+#ifndef mips_coverage_header
+#define mips_coverage_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_coverage Coverage
+    \ingroup mips_cpu
+    \addtogroup mips_coverage
+    @{
+
+    A test which says it is testing an instruction may not actually
+    execute it, and the interesting cases of an instruction (a branch
+    being taken and not taken, or an instruction in a delay slot) are
+    easy to miss. When coverage is enabled the CPU sets a bit for each
+    of these as it executes, so the cost is a few OR instructions per
+    instruction. The test framework enables it for the CPU given to
+    \ref mips_test_set_cpu, and includes it in the summary.
+
+    Instructions are identified by their encoding: primary opcodes
+    are bits of opcodes, SPECIAL instructions (opcode 0) are bits of
+    special indexed by the function field, and REGIMM instructions
+    (opcode 1) are bits of regimm indexed by the rt field. Only
+    instructions which complete are recorded, apart from the
+    exceptions fields.
+
+    The same things are also recorded by instruction, as bits indexed
+    by \ref mips_isa_op, which tells apart instructions that share an
+    opcode without a function field, such as all the COP1 instructions.
+    Bit n of ops is bit n%64 of ops[n/64].
+*/
+
+/*! Bitmaps of what has been executed. */
+typedef struct _mips_cpu_coverage{
+    uint64_t opcodes;               //!< Bit n: an instruction with primary opcode n completed
+    uint64_t special;               //!< Bit n: SPECIAL with function n completed
+    uint32_t regimm;                //!< Bit n: REGIMM with rt n completed
+
+    uint64_t taken;                 //!< Branches (by opcode) which were taken
+    uint64_t notTaken;              //!< Branches (by opcode) which were not taken
+    uint32_t regimmTaken;           //!< REGIMM branches (by rt) which were taken
+    uint32_t regimmNotTaken;        //!< REGIMM branches (by rt) which were not taken
+
+    uint64_t delaySlotOpcodes;      //!< Instructions (by opcode) completed in a delay slot
+    uint64_t delaySlotSpecial;      //!< SPECIAL instructions (by function) completed in a delay slot
+
+    uint32_t exceptions;            //!< Bit n: exception 0x2000+n was raised
+    uint64_t exceptionOpcodes;      //!< Instructions (by opcode) which raised an exception
+    uint64_t exceptionSpecial;      //!< SPECIAL instructions (by function) which raised an exception
+
+    uint64_t ops[4];                //!< Instructions (by mips_isa_op) which completed
+    uint64_t opsTaken[4];           //!< Branches (by mips_isa_op) which were taken
+    uint64_t opsNotTaken[4];        //!< Branches (by mips_isa_op) which were not taken
+    uint64_t opsInDelaySlot[4];     //!< Instructions (by mips_isa_op) completed in a delay slot
+    uint64_t opsRaised[4];          //!< Instructions (by mips_isa_op) which raised an exception
+}mips_cpu_coverage;
+
+/*! Turns coverage recording on or off. Turning it on clears it. */
+mips_error mips_cpu_set_coverage(mips_cpu_h state, int enable);
+
+/*! Gets everything recorded since coverage was enabled or cleared.
+    \retval mips_ErrorInvalidArgument Coverage is not enabled.
+*/
+mips_error mips_cpu_get_coverage(mips_cpu_h state, mips_cpu_coverage *coverage);
+
+/*! Clears the coverage, if it is enabled. */
+mips_error mips_cpu_clear_coverage(mips_cpu_h state);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
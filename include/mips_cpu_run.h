@@ -0,0 +1,137 @@
+/*! \file mips_cpu_run.h
+    Running many instructions with one call.
+*/
+#ifndef mips_cpu_run_header
+#define mips_cpu_run_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_cpu_run Running
+    \ingroup mips_cpu
+    \addtogroup mips_cpu_run
+    @{
+
+    \ref mips_cpu_step is the right interface for testing, as the
+    caller can look at the state after every instruction. But for long
+    programs the cost of calling it once per instruction (and checking
+    the pc after every call) is significant, so mips_cpu_run executes
+    instructions in a loop inside the CPU until something interesting
+    happens.
+*/
+
+/*! Executes instructions until one fails, or maxSteps have completed.
+
+    Each instruction has exactly the same effect as it would through
+    \ref mips_cpu_step, and if an instruction fails the state is left
+    as mips_cpu_step would leave it (i.e. at the failing instruction).
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param maxSteps Maximum number of instructions to complete. Use
+        UINT64_MAX to run until something stops the CPU.
+
+    \param stepsDone If not NULL, receives the number of instructions
+        which completed.
+
+    \retval mips_Success All maxSteps instructions completed.
+
+    \retval other The error returned by the instruction which failed, or
+        a stop code such as \ref mips_StopExit or \ref mips_StopBreakpoint.
+*/
+mips_error mips_cpu_run(
+    mips_cpu_h state,
+    uint64_t maxSteps,
+    uint64_t *stepsDone
+);
+
+/*! Turns journaled execution on or off. It is off when the CPU is created.
+
+    Normally each instruction is precise on its own: if it fails, nothing
+    it did is visible, but the instructions before it have all completed.
+    That includes a branch whose delay slot then fails, which leaves the pc
+    pointing at the delay slot, even though the branch has already
+    redirected execution and the CPU cannot sensibly be restarted there.
+
+    With journaling on, the old value of each register or memory word an
+    instruction changes is recorded in a small undo journal. A branch and
+    its delay slot share one journal, so if the delay slot raises an
+    exception (any mips_Exception* code) both are undone, and the CPU is
+    left at the branch, with the instruction count reduced to match.
+    Otherwise the journal is simply discarded.
+
+    Journaling is about where the CPU stops, not about speed, and it is
+    slower than running without it by one record per instruction. The
+    interpreter finds every exception before an instruction changes
+    anything, using the same tests that decide there is an exception
+    (overflow, alignment, the memory's own range and permission checks),
+    so there is no separate pre-check that a journal could replace.
+
+    Stops such as \ref mips_StopBreakpoint happen before the instruction
+    does anything, so they are never rolled back. Host call handlers
+    (\ref mips_hostcall) are not journaled, apart from the result
+    registers of the built-in SPIM services. Setting the pc
+    or arch state, or resetting the CPU, discards the journal.
+
+    This affects both \ref mips_cpu_step and \ref mips_cpu_run.
+
+    \retval mips_ErrorOutOfMemory The journal could not be allocated.
+*/
+mips_error mips_cpu_set_journaled(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    int enable          //!< Non-zero to turn journaling on
+);
+
+/*! Turns fast-forwarding of idle loops on or off. It is on when the
+    CPU is created.
+
+    Programs often wait in tiny loops which have no effect apart from
+    counting down a register or using up time. When \ref mips_cpu_run
+    takes a backward branch it looks at the loop, and if it is one of
+    these forms (with a NOP in the delay slot, unless shown):
+
+    - A loop which branches to itself, such as "b ." or "j .".
+    - A countdown: "addiu r,r,-1; bne r,$0,loop", or
+      "bne r,$0,loop" with "addiu r,r,-1" in the delay slot.
+    - Polling memory: "lw r,off(base); beq r,$0,loop" (or bne), with
+      r different from base.
+
+    then it works out where the loop would be after as many whole
+    iterations as possible, and jumps straight there. A countdown stops
+    just before its final iteration, which is then executed normally.
+    The other loops can only be left when something changes memory or
+    raises an interrupt, which in this simulator means a device event
+    (see \ref mips_event), so they skip up to the next event.
+    Either way the skip never goes past maxSteps, and the registers,
+    pc and instruction count are exactly as if every instruction had
+    been executed.
+
+    Fast-forwarding is not used while anything could see the individual
+    instructions: breakpoints, watchpoints, instrumentation, coverage,
+    journaling, reverse execution, or debug output. It only applies to
+    mips_cpu_run, not mips_cpu_step.
+*/
+mips_error mips_cpu_set_fast_forward(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    int enable          //!< Non-zero to turn fast-forwarding on
+);
+
+/*! Returns the number of instructions completed since the CPU was
+    created or reset, whether by mips_cpu_step or mips_cpu_run.
+    Instructions which fail are not counted.
+*/
+mips_error mips_cpu_get_instruction_count(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint64_t *count     //!< Receives the count
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+/*! \file mips_cpu_state.h
+    Allows the complete architectural state of a CPU to be copied in and out.
+*/
+#ifndef mips_cpu_state_header
+#define mips_cpu_state_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_cpu_state Architectural State
+    \ingroup mips_cpu
+    \addtogroup mips_cpu_state
+    @{
+
+    The functions in \ref mips_cpu only let the client see the
+    general purpose registers and the pc. That is enough for
+    testing, but things like checkpointing need to capture
+    everything that affects future execution, which includes
+    the delay-slot pc (pcN), the HI/LO registers, and the
+    floating-point registers and FCSR of COP1.
+
+    This is a snapshot of the state as a plain struct, so it
+    says nothing about how the CPU stores it internally.
+*/
+
+/*! Everything that determines what a CPU will do next, apart from memory. */
+typedef struct _mips_cpu_arch_state{
+    uint32_t pc;        //!< Address of the next instruction to execute
+    uint32_t pcN;       //!< Address of the instruction after that (differs from pc+4 in a delay slot)
+    uint32_t regs[32];  //!< General purpose registers, with regs[0]==0
+    uint32_t hi;        //!< HI register from MULT/DIV
+    uint32_t lo;        //!< LO register from MULT/DIV
+    uint32_t fpr[32];   //!< COP1 registers $f0..$f31, with doubles in even/odd pairs (low word in the even one)
+    uint32_t fcsr;      //!< COP1 control and status register
+}mips_cpu_arch_state;
+
+/*! Copies the current architectural state out of the CPU. */
+mips_error mips_cpu_get_arch_state(
+    mips_cpu_h state,               //!< Valid (non-empty) handle to a CPU
+    mips_cpu_arch_state *arch       //!< Receives the state
+);
+
+/*! Overwrites the architectural state of the CPU.
+
+    This does not cause any execution to happen, and does not
+    touch memory. If arch->regs[0] is not zero then it is ignored.
+*/
+mips_error mips_cpu_set_arch_state(
+    mips_cpu_h state,               //!< Valid (non-empty) handle to a CPU
+    const mips_cpu_arch_state *arch //!< State to load
+);
+
+/*! Overwrites every register apart from pc and pcN, which are ignored.
+
+    This is what a debugger needs when it changes registers at a stop.
+    It is like setting registers one at a time with
+    \ref mips_cpu_set_register rather than like mips_cpu_set_arch_state,
+    so the history (see \ref mips_reverse) is kept, and a CPU which
+    stopped at a breakpoint still steps over it when resumed.
+*/
+mips_error mips_cpu_set_registers(
+    mips_cpu_h state,               //!< Valid (non-empty) handle to a CPU
+    const mips_cpu_arch_state *arch //!< Registers to load
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,357 @@
+/*! \file mips_cxx.h
+    Header-only C++ wrappers for CPUs and memories.
+*/
+#ifndef mips_cxx_header
+#define mips_cxx_header
+
+#include "mips.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <utility>
+
+/*! \defgroup mips_cxx C++ Interface
+    \addtogroup mips_cxx
+    @{
+
+    \ref mips::Memory and \ref mips::Cpu own a handle each, free it when
+    they are destroyed, and can be moved but not copied. They only use
+    the C API, so the C functions can still be used on handle() for
+    anything the classes don't cover:
+
+        mips::Memory mem=mips::Memory::ram(1<<20);
+        mips::Cpu cpu(mem);
+
+        uint32_t prog[]={ ... };
+        mem.write(0, mips::span<const uint8_t>((const uint8_t*)prog, sizeof(prog)));
+
+        cpu.set_reg(4, 10);
+        cpu.run(1000);
+        uint32_t regs[32];
+        cpu.read_registers(regs);
+
+    Tests which look at registers a lot (for example comparing the
+    whole register file after each step) spend much of their time in
+    the checks done by mips_cpu_get_register. If MIPS_CXX_DIRECT_STATE
+    is defined, and the implementation's private mips_cpu_impl.h is
+    included first, then reg, pc, hi, lo, instructions and
+    read_registers read the CPU's fields directly, and inline to a
+    single load. Writes always go through mips_cpu_set_register, so
+    that reverse execution sees them. This only works when linking
+    against that same implementation, so it is off by default. The
+    direct Cpu has different symbol names, so files compiled with and
+    without it can be linked together. In both cases reg returns zero
+    for an index of 32 or more, and writes to $0 are ignored.
+*/
+
+namespace mips
+{
+
+/*! A pointer and a length, in the style of std::span (which needs C++20).
+    Arrays, and containers with data() and size() such as std::vector,
+    convert to it automatically. */
+template<class T>
+class span
+{
+private:
+    T *m_data;
+    size_t m_size;
+
+public:
+    span()
+        : m_data(0), m_size(0)
+    {}
+
+    span(T *data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    template<class U, size_t N>
+    span(U (&a)[N])
+        : m_data(a), m_size(N)
+    {}
+
+    template<class C>
+    span(C &c)
+        : m_data(c.data()), m_size(c.size())
+    {}
+
+    T *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    size_t size_bytes() const { return m_size*sizeof(T); }
+    bool empty() const { return m_size==0; }
+
+    T *begin() const { return m_data; }
+    T *end() const { return m_data+m_size; }
+    T &operator[](size_t i) const { return m_data[i]; }
+
+    span subspan(size_t offset, size_t count) const
+    { return span(m_data+offset, count); }
+};
+
+/*! Owns a \ref mips_mem_h. */
+class Memory
+{
+private:
+    mips_mem_h m_h;
+
+    Memory(const Memory &);                 // Not copyable
+    Memory &operator=(const Memory &);
+
+public:
+    Memory()
+        : m_h(0)
+    {}
+
+    /*! Takes ownership of an existing memory */
+    explicit Memory(mips_mem_h h)
+        : m_h(h)
+    {}
+
+    Memory(Memory &&o)
+        : m_h(o.m_h)
+    { o.m_h=0; }
+
+    Memory &operator=(Memory &&o)
+    {
+        std::swap(m_h, o.m_h);
+        return *this;
+    }
+
+    ~Memory()
+    { mips_mem_free(m_h); }
+
+    /*! Creates a RAM, see \ref mips_mem_create_ram_ex */
+    static Memory ram(uint32_t cbMem, uint32_t blockSize=4, unsigned flags=0)
+    { return Memory(mips_mem_create_ram_ex(cbMem, blockSize, flags)); }
+
+    mips_mem_h handle() const
+    { return m_h; }
+
+    /*! Gives up ownership, returning the handle */
+    mips_mem_h release()
+    {
+        mips_mem_h h=m_h;
+        m_h=0;
+        return h;
+    }
+
+    explicit operator bool() const
+    { return m_h!=0; }
+
+    mips_error read(uint32_t address, span<uint8_t> dst) const
+    { return mips_mem_read(m_h, address, (uint32_t)dst.size(), dst.data()); }
+
+    mips_error write(uint32_t address, span<const uint8_t> src)
+    { return mips_mem_write(m_h, address, (uint32_t)src.size(), src.data()); }
+
+    mips_error read_word(uint32_t address, uint32_t &value) const
+    { return mips_mem_read_word(m_h, address, &value); }
+
+    mips_error write_word(uint32_t address, uint32_t value)
+    { return mips_mem_write_word(m_h, address, value); }
+
+    /*! Reads consecutive aligned words, as numbers */
+    mips_error read_words(uint32_t address, span<uint32_t> dst) const
+    {
+        for(size_t i=0; i<dst.size(); i++){
+            mips_error err=mips_mem_read_word(m_h, address+4*(uint32_t)i, &dst[i]);
+            if(err)
+                return err;
+        }
+        return mips_Success;
+    }
+
+    /*! Writes consecutive aligned words, given as numbers */
+    mips_error write_words(uint32_t address, span<const uint32_t> src)
+    {
+        for(size_t i=0; i<src.size(); i++){
+            mips_error err=mips_mem_write_word(m_h, address+4*(uint32_t)i, src[i]);
+            if(err)
+                return err;
+        }
+        return mips_Success;
+    }
+};
+
+#ifdef MIPS_CXX_DIRECT_STATE
+inline namespace direct_state
+{
+#endif
+
+/*! Owns a \ref mips_cpu_h. The Memory it is attached to must outlive it. */
+class Cpu
+{
+private:
+    mips_cpu_h m_h;
+
+    Cpu(const Cpu &);                       // Not copyable
+    Cpu &operator=(const Cpu &);
+
+#ifndef MIPS_CXX_DIRECT_STATE
+    mips_cpu_arch_state arch() const
+    {
+        mips_cpu_arch_state s;
+        if(mips_cpu_get_arch_state(m_h, &s))
+            memset(&s, 0, sizeof(s));
+        return s;
+    }
+#endif
+
+public:
+    Cpu()
+        : m_h(0)
+    {}
+
+    /*! Creates a CPU attached to mem */
+    explicit Cpu(const Memory &mem)
+        : m_h(mips_cpu_create(mem.handle()))
+    {}
+
+    /*! Takes ownership of an existing CPU */
+    explicit Cpu(mips_cpu_h h)
+        : m_h(h)
+    {}
+
+    Cpu(Cpu &&o)
+        : m_h(o.m_h)
+    { o.m_h=0; }
+
+    Cpu &operator=(Cpu &&o)
+    {
+        std::swap(m_h, o.m_h);
+        return *this;
+    }
+
+    ~Cpu()
+    { mips_cpu_free(m_h); }
+
+    mips_cpu_h handle() const
+    { return m_h; }
+
+    /*! Gives up ownership, returning the handle */
+    mips_cpu_h release()
+    {
+        mips_cpu_h h=m_h;
+        m_h=0;
+        return h;
+    }
+
+    explicit operator bool() const
+    { return m_h!=0; }
+
+    mips_error reset()
+    { return mips_cpu_reset(m_h); }
+
+    mips_error step()
+    { return mips_cpu_step(m_h); }
+
+    /*! See \ref mips_cpu_run */
+    mips_error run(uint64_t maxSteps, uint64_t *stepsDone=0)
+    { return mips_cpu_run(m_h, maxSteps, stepsDone); }
+
+    mips_error set_pc(uint32_t pc)
+    { return mips_cpu_set_pc(m_h, pc); }
+
+    mips_error get_state(mips_cpu_arch_state &state) const
+    { return mips_cpu_get_arch_state(m_h, &state); }
+
+    mips_error set_state(const mips_cpu_arch_state &state)
+    { return mips_cpu_set_arch_state(m_h, &state); }
+
+    /*! Sets a register. Like all writes, this uses the C API even with
+        MIPS_CXX_DIRECT_STATE, as the CPU may need to know about it. */
+    void set_reg(unsigned index, uint32_t value)
+    { mips_cpu_set_register(m_h, index, value); }
+
+    /*! Writes registers first, first+1, ... from src */
+    mips_error write_registers(span<const uint32_t> src, unsigned first=0)
+    {
+        if(first>32 || src.size()>32-first)
+            return mips_ErrorInvalidArgument;
+        for(size_t i=0; i<src.size(); i++){
+            set_reg(first+(unsigned)i, src[i]);
+        }
+        return mips_Success;
+    }
+
+#ifdef MIPS_CXX_DIRECT_STATE
+#ifndef mips_cpu_impl_header
+#error "MIPS_CXX_DIRECT_STATE needs the implementation's mips_cpu_impl.h to be included first"
+#endif
+    uint32_t reg(unsigned index) const
+    { return index<32 ? m_h->regs[index] : 0; }
+
+    uint32_t pc() const
+    { return m_h->pc; }
+
+    uint32_t hi() const
+    { return m_h->hi; }
+
+    uint32_t lo() const
+    { return m_h->lo; }
+
+    uint64_t instructions() const
+    { return m_h->instructions; }
+
+    /*! Reads registers first, first+1, ... into dst */
+    mips_error read_registers(span<uint32_t> dst, unsigned first=0) const
+    {
+        if(first>32 || dst.size()>32-first)
+            return mips_ErrorInvalidArgument;
+        memcpy(dst.data(), m_h->regs+first, dst.size_bytes());
+        return mips_Success;
+    }
+#else
+    uint32_t reg(unsigned index) const
+    {
+        uint32_t value=0;
+        mips_cpu_get_register(m_h, index, &value);
+        return value;
+    }
+
+    uint32_t pc() const
+    {
+        uint32_t value=0;
+        mips_cpu_get_pc(m_h, &value);
+        return value;
+    }
+
+    uint32_t hi() const
+    { return arch().hi; }
+
+    uint32_t lo() const
+    { return arch().lo; }
+
+    uint64_t instructions() const
+    {
+        uint64_t count=0;
+        mips_cpu_get_instruction_count(m_h, &count);
+        return count;
+    }
+
+    /*! Reads registers first, first+1, ... into dst */
+    mips_error read_registers(span<uint32_t> dst, unsigned first=0) const
+    {
+        if(first>32 || dst.size()>32-first)
+            return mips_ErrorInvalidArgument;
+        mips_cpu_arch_state s;
+        mips_error err=mips_cpu_get_arch_state(m_h, &s);
+        if(err)
+            return err;
+        memcpy(dst.data(), s.regs+first, dst.size_bytes());
+        return mips_Success;
+    }
+#endif
+};
+
+#ifdef MIPS_CXX_DIRECT_STATE
+} // namespace direct_state
+#endif
+
+} // namespace mips
+
+/*! @} */
+
+#endif
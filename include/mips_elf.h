@@ -0,0 +1,163 @@
+/*! \file mips_elf.h
+    Loading programs and symbols from ELF files.
+*/
+#ifndef mips_elf_header
+#define mips_elf_header
+
+#include "mips_mem.h"
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_elf ELF Loader
+    \addtogroup mips_elf
+    @{
+
+    The binaries in fragments are raw dumps of the .text section of
+    a big-endian MIPS ELF object (elf32-tradbigmips), which only work
+    if they are loaded at address zero. Loading the ELF file itself
+    puts each part of the program at the address it was linked for,
+    starts the CPU at the proper entry point, and keeps the symbol
+    table so that addresses can be turned back into names:
+
+        mips_elf_h elf;
+        if(mips_elf_open("f_fibonacci-mips.o", &elf))
+            exit(1);
+        mips_elf_load(elf, mem, cpu);
+
+        ...
+
+        uint32_t offset;
+        const mips_elf_symbol *sym=mips_elf_find_symbol(elf, pc, &offset);
+        if(sym)
+            printf("%s+0x%x\n", sym->name, offset);
+
+        mips_elf_free(elf);
+
+    Only 32-bit big-endian files with machine type EM_MIPS are accepted.
+    If the file has program headers then every PT_LOAD segment is loaded,
+    otherwise (as for relocatable objects) every section with SHF_ALLOC
+    is loaded at its sh_addr. Either way, anything in memory but not in
+    the file (such as .bss) is cleared to zero.
+
+    On platforms with mmap (linux, cygwin, OS X) the file is mapped rather
+    than read, and stays mapped until mips_elf_free, so segments are
+    copied straight from the file into memory, and symbol names point
+    into the mapping. The file should not be modified while it is open.
+*/
+
+/*! One entry in the symbol table. */
+typedef struct _mips_elf_symbol{
+    const char *name;   //!< Valid until mips_elf_free
+    uint32_t address;   //!< st_value
+    uint32_t size;      //!< st_size, which may be zero for labels
+}mips_elf_symbol;
+
+/*! Represents an open ELF file. \struct mips_elf_impl */
+struct mips_elf_impl;
+
+/*! Opaque handle to an ELF file. */
+typedef struct mips_elf_impl *mips_elf_h;
+
+/*! Opens an ELF file and reads its headers and symbol table.
+
+    \param fileName File to open.
+
+    \param elf Receives the handle, or zero on failure.
+
+    \retval mips_ErrorFileReadError The file could not be read, is not
+        a valid 32-bit big-endian MIPS ELF file, or has a segment which
+        goes past the end of the 32-bit address space.
+*/
+mips_error mips_elf_open(
+    const char *fileName,
+    mips_elf_h *elf
+);
+
+/*! Closes the file and releases the symbols. Passing an empty handle is legal. */
+void mips_elf_free(mips_elf_h elf);
+
+/*! Returns e_entry, the address execution should start at. */
+uint32_t mips_elf_get_entry(mips_elf_h elf);
+
+/*! Copies the program into memory, and optionally points a CPU at it.
+
+    Each segment is written with one \ref mips_mem_write, apart from any
+    partial words at either end, which use \ref mips_mem_write_masked.
+    This can be called any number of times, for example to reload a
+    program into a fresh RAM for each test.
+
+    \param elf Valid (non-empty) handle to an ELF file.
+
+    \param mem The memory to load into.
+
+    \param cpu If not zero, the pc of this CPU is set to the entry point
+        with \ref mips_cpu_set_pc.
+
+    \retval mips_ExceptionInvalidAddress A segment is outside the memory.
+*/
+mips_error mips_elf_load(
+    mips_elf_h elf,
+    mips_mem_h mem,
+    mips_cpu_h cpu
+);
+
+/*! Finds the address and size of a section, such as ".text".
+    \retval mips_ErrorInvalidArgument There is no section with that name.
+*/
+mips_error mips_elf_get_section(
+    mips_elf_h elf,
+    const char *name,
+    uint32_t *address,
+    uint32_t *size
+);
+
+/*! Number of symbols. File, section, and undefined symbols are not included. */
+unsigned mips_elf_get_symbol_count(mips_elf_h elf);
+
+/*! Returns one of the symbols. Symbols are sorted by address, so the
+    index can be used to walk through them in order.
+    \retval 0 The index is not less than mips_elf_get_symbol_count.
+*/
+const mips_elf_symbol *mips_elf_get_symbol(mips_elf_h elf, unsigned index);
+
+/*! Finds the symbol an address belongs to, using a binary search.
+
+    This is the symbol with the highest address not above the given
+    address, as long as the address is within its size. Symbols with a
+    size of zero (such as labels in assembly) are taken to extend up to
+    the next symbol. Where several symbols have the same address,
+    functions are preferred over objects, which are preferred over
+    anything else.
+
+    \param elf Valid (non-empty) handle to an ELF file.
+
+    \param address The address to look up.
+
+    \param offset If not zero, receives the distance from the start of the symbol.
+
+    \retval 0 No symbol contains the address.
+*/
+const mips_elf_symbol *mips_elf_find_symbol(
+    mips_elf_h elf,
+    uint32_t address,
+    uint32_t *offset
+);
+
+/*! Finds a symbol by name.
+    \retval 0 There is no symbol with that name.
+*/
+const mips_elf_symbol *mips_elf_lookup_symbol(
+    mips_elf_h elf,
+    const char *name
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+/*! \file mips_event.h
+    Scheduling device events, interrupts, and timers.
+*/
+#ifndef mips_event_header
+#define mips_event_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_event Events and Interrupts
+    \ingroup mips_cpu
+    \addtogroup mips_event
+    @{
+
+    Devices which change over time (timers, serial ports, disks and so
+    on) should not be polled after every instruction. Instead, a device
+    asks the CPU to call it back at some point in the future, and the
+    CPU keeps all the requests in a binary heap ordered by time. The run
+    loop only compares the instruction count with the time of the
+    earliest event, so any number of idle devices cost nothing.
+
+    Time is measured by the CPU's instruction count (see \ref
+    mips_cpu_get_instruction_count), as there is no separate cycle
+    model: an event for time t happens after t instructions have
+    completed, and before the next one starts. Events happen in
+    \ref mips_cpu_step and \ref mips_cpu_run (and anything built on
+    them), but not while reverse execution is replaying history, and
+    they are not undone by journal rollback. Reverse execution only
+    records history while no events are queued and no lines are
+    raised (see \ref mips_reverse), so it never goes back past one.
+
+    Devices signal the program by raising one of 32 interrupt lines.
+    There is no coprocessor 0 to take the interrupt inside the guest,
+    so it is handled by the host in the same way as a \ref mips_hostcall
+    "host call": while a line is raised and enabled, mips_cpu_step and
+    mips_cpu_run return \ref mips_StopInterrupt before the next instruction.
+    The lines are level-triggered, so the host must clear the line (or
+    mask it) before execution can carry on:
+
+        mips_timer_h t=mips_timer_create(cpu, 0);
+        mips_timer_start(t, 10000, 10000);      // Every 10000 instructions
+
+        while(1){
+            mips_error err=mips_cpu_run(cpu, UINT64_MAX, 0);
+            if(err!=mips_StopInterrupt)
+                break;
+            mips_cpu_clear_interrupt(cpu, 0);
+            service_timer_tick(cpu);
+        }
+
+    \ref mips_cpu_reset cancels every event (which stops any timers)
+    and clears all the interrupt lines.
+*/
+
+/*! Called when an event is due.
+
+    \param context The pointer given to mips_cpu_schedule_event.
+
+    \param state The CPU the event was scheduled on.
+
+    \param when The time the event was scheduled for. The current
+        instruction count may be later, if the event was scheduled
+        in the past.
+
+    \retval mips_Success Carry on. Anything else stops mips_cpu_step
+        or mips_cpu_run, which return the same error.
+*/
+typedef mips_error (*mips_event_callback)(void *context, mips_cpu_h state, uint64_t when);
+
+/*! Asks for callback to be called once the instruction count reaches
+    when. Events due at the same time happen in the order they were
+    scheduled. Callbacks may schedule and cancel events themselves.
+
+    \param eventId If not NULL, receives an identifier for use with
+        mips_cpu_cancel_event.
+
+    \retval mips_ErrorOutOfMemory The queue could not be grown.
+*/
+mips_error mips_cpu_schedule_event(
+    mips_cpu_h state,
+    uint64_t when,
+    mips_event_callback callback,
+    void *context,
+    unsigned *eventId
+);
+
+/*! Removes an event before it happens.
+    \retval mips_ErrorInvalidArgument The event has already happened, or
+        never existed.
+*/
+mips_error mips_cpu_cancel_event(mips_cpu_h state, unsigned eventId);
+
+/*! Gets the time of the earliest event, or UINT64_MAX if there are none. */
+mips_error mips_cpu_get_next_event(mips_cpu_h state, uint64_t *when);
+
+/*! Raises interrupt line (from 0 to 31). */
+mips_error mips_cpu_raise_interrupt(mips_cpu_h state, unsigned line);
+
+/*! Lowers interrupt line (from 0 to 31). */
+mips_error mips_cpu_clear_interrupt(mips_cpu_h state, unsigned line);
+
+/*! Chooses which lines stop the CPU: bit n enables line n. All lines
+    are enabled when the CPU is created or reset. Raised lines which
+    are masked stay raised, and stop the CPU once they are enabled. */
+mips_error mips_cpu_set_interrupt_mask(mips_cpu_h state, uint32_t mask);
+
+/*! Gets the lines which are raised (whether or not they are enabled). */
+mips_error mips_cpu_get_interrupts(mips_cpu_h state, uint32_t *pending);
+
+/*! Represents a programmable timer. \struct mips_timer_impl */
+struct mips_timer_impl;
+
+/*! Opaque handle to a timer. */
+typedef struct mips_timer_impl *mips_timer_h;
+
+/*! Creates a stopped timer which will raise the given interrupt line.
+    The CPU must outlive the timer.
+    \retval 0 The line is not valid.
+*/
+mips_timer_h mips_timer_create(mips_cpu_h cpu, unsigned line);
+
+/*! Starts (or restarts) the timer.
+
+    \param delay Number of instructions until the first expiry, which
+        must be at least one.
+
+    \param period Instructions between later expiries, or zero for a
+        timer which only expires once.
+*/
+mips_error mips_timer_start(mips_timer_h timer, uint64_t delay, uint64_t period);
+
+/*! Stops the timer. Any interrupt it has raised stays raised. */
+mips_error mips_timer_stop(mips_timer_h timer);
+
+/*! Returns how many times the timer has expired since it was created. */
+uint64_t mips_timer_get_expirations(mips_timer_h timer);
+
+/*! Stops and releases the timer. Passing an empty handle is legal. */
+void mips_timer_free(mips_timer_h timer);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
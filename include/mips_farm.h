@@ -0,0 +1,145 @@
+/*! \file mips_farm.h
+    Running large numbers of independent simulations in parallel.
+*/
+#ifndef mips_farm_header
+#define mips_farm_header
+
+#include "mips_cpu_state.h"
+#include "mips_cpu_run.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_farm Simulation Farm
+    \addtogroup mips_farm
+    @{
+
+    A farm runs many independent jobs, each of which is a binary image
+    loaded into its own RAM and executed by its own CPU, until it meets
+    a stop condition. Jobs are spread over a pool of threads:
+
+        mips_farm_h farm=mips_farm_create(0);      // One thread per core
+
+        for(i=0;i<n;i++){
+            mips_farm_job job;
+            mips_farm_job_init(&job, images[i], lengths[i]);
+            job.maxSteps=100000000;
+            mips_farm_submit(farm, &job, &ids[i]);
+        }
+        mips_farm_wait(farm);
+
+        for(i=0;i<n;i++){
+            mips_farm_result res;
+            mips_farm_get_result(farm, ids[i], &res);
+            ...
+        }
+        mips_farm_free(farm);
+
+    Each thread has its own queue of jobs, and takes work from the other
+    queues when its own is empty, so a few long jobs do not hold up the
+    others. A thread keeps a handful of jobs active at once, and
+    runs each for a fixed number of instructions (using \ref mips_cpu_run)
+    before moving on to the next.
+
+    When a job finishes, its CPU and RAM go back to a pool and are
+    reset for a later job with the same memory size, rather than being
+    freed. The RAM is cleared before each job, and jobs share nothing,
+    so a job's result only depends on the job, not on the thread it ran
+    on or on what else was running.
+
+    Every job gets the SPIM host calls (\ref mips_cpu_install_spim_hostcalls),
+    with no input, output thrown away, and a heap from the end of the image
+    to the end of memory, so programs can stop themselves with exit.
+*/
+
+/*! Describes one job. Use \ref mips_farm_job_init to fill in the defaults. */
+typedef struct _mips_farm_job{
+    const uint8_t *image;   //!< Bytes to load. Must stay valid until the job is complete.
+    uint32_t imageLength;   //!< Number of bytes in image
+    uint32_t loadAddress;   //!< Where to put the image (default 0)
+    uint32_t memSize;       //!< Size of the RAM (default 1MB)
+
+    /*! Registers and pc to start with. The default is all zero, with
+        the pc at the load address and $sp at the end of memory. */
+    mips_cpu_arch_state initial;
+
+    uint64_t maxSteps;      //!< Stop after this many instructions (default 1M)
+    int hasStopPc;          //!< If non-zero, also stop on reaching stopPc
+    uint32_t stopPc;        //!< Address to stop at, when hasStopPc is set
+}mips_farm_job;
+
+/*! The outcome of a completed job. */
+typedef struct _mips_farm_result{
+    /*! Why the job stopped: mips_Success if it ran for maxSteps,
+        \ref mips_StopExit if it exited, \ref mips_StopBreakpoint if it
+        reached stopPc, or the exception or error that stopped it. */
+    mips_error stop;
+    uint64_t instructions;      //!< Instructions completed
+    uint32_t exitCode;          //!< Only valid if stop is mips_StopExit
+    mips_cpu_arch_state final;  //!< Registers and pc at the end
+    uint64_t regDigest;         //!< 64-bit FNV-1a hash of final
+    uint64_t memDigest;         //!< 64-bit FNV-1a hash of the whole RAM, in address order
+}mips_farm_result;
+
+/*! Represents a pool of worker threads and the jobs given to them. \struct mips_farm_impl */
+struct mips_farm_impl;
+
+/*! Opaque handle to a farm. */
+typedef struct mips_farm_impl *mips_farm_h;
+
+/*! Fills in the defaults for a job running the given image. */
+void mips_farm_job_init(
+    mips_farm_job *job,
+    const uint8_t *image,
+    uint32_t imageLength
+);
+
+/*! Starts a farm.
+    \param threads Number of worker threads, or zero for one per core.
+    \retval 0 The threads could not be started.
+*/
+mips_farm_h mips_farm_create(unsigned threads);
+
+/*! Adds a job. The job description is copied, but not the image.
+    Jobs start running straight away.
+
+    \param farm Valid (non-empty) handle to a farm.
+
+    \param job The job to run.
+
+    \param jobId Receives an identifier for the job, to pass to
+        mips_farm_get_result. Identifiers count up from zero.
+
+    \retval mips_ErrorInvalidArgument The image does not fit in memory.
+*/
+mips_error mips_farm_submit(
+    mips_farm_h farm,
+    const mips_farm_job *job,
+    unsigned *jobId
+);
+
+/*! Waits until every job submitted so far is complete. */
+mips_error mips_farm_wait(mips_farm_h farm);
+
+/*! Gets the result of a job.
+    \retval mips_ErrorInvalidArgument There is no such job, or it
+        has not completed yet.
+*/
+mips_error mips_farm_get_result(
+    mips_farm_h farm,
+    unsigned jobId,
+    mips_farm_result *result
+);
+
+/*! Stops the threads and releases everything. Jobs which have not
+    finished are abandoned. Passing an empty handle is legal. */
+void mips_farm_free(mips_farm_h farm);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+/*! \file mips_gdb.h
+    Lets gdb attach to a simulated CPU using the gdb remote serial protocol.
+*/
+#ifndef mips_gdb_header
+#define mips_gdb_header
+
+#include "mips_breakpoint.h"
+#include "mips_cpu_state.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_gdb GDB Remote Stub
+    \addtogroup mips_gdb
+    @{
+
+    Rather than adding fprintf calls and turning up
+    \ref mips_cpu_set_debug_level, it is often easier to look at a
+    running program with a debugger. A stub listens on a local socket
+    and speaks the same protocol as gdbserver, so any gdb that knows
+    about big-endian MIPS can connect to it:
+
+        mips_gdb_h stub=mips_gdb_create(cpu, mem, "1234");
+        mips_error err=mips_gdb_run(stub, 1);   // wait for gdb, then run
+        mips_gdb_free(stub);
+
+    and then in another terminal:
+
+        $ gdb-multiarch f_fibonacci-mips.o
+        (gdb) set endian big
+        (gdb) target remote localhost:1234
+        (gdb) break f_fibonacci
+        (gdb) continue
+
+    The stub supports reading and writing registers and memory, single
+    stepping, continuing, interrupting with Ctrl-C, software and hardware
+    breakpoints (both map onto \ref mips_cpu_set_breakpoint), and
+    read/write/access watchpoints (mapped onto \ref mips_cpu_add_watchpoint).
+    If \ref mips_cpu_set_history has been turned on, reverse-step and
+    reverse-continue work as well.
+    Memory packets are turned into a single mips_mem_read or mips_mem_write
+    of the aligned range they cover, rather than a transaction per word.
+
+    Execution always happens through \ref mips_cpu_run. While gdb is
+    attached and the program is running, the socket is checked for
+    Ctrl-C between chunks of instructions. While no debugger is attached
+    the program runs in much larger chunks, and the only extra work is
+    checking for a new connection between them.
+
+    The stub needs BSD sockets, so on platforms without them mips_gdb_create
+    always fails.
+*/
+
+/*! Represents a listening stub. \struct mips_gdb_stub */
+struct mips_gdb_stub;
+
+/*! Opaque handle to a stub. */
+typedef struct mips_gdb_stub *mips_gdb_h;
+
+/*! Creates a stub for the given CPU and memory, and starts listening.
+
+    \param cpu The CPU to debug. It is not owned by the stub.
+
+    \param mem The memory the CPU is attached to. It is not owned by the stub.
+
+    \param address Where to listen. Either "port" or "host:port" for a TCP
+        socket (the host defaults to 127.0.0.1, so only local clients can
+        connect), or "unix:path" for a unix domain socket.
+
+    \retval 0 The socket could not be created.
+*/
+mips_gdb_h mips_gdb_create(mips_cpu_h cpu, mips_mem_h mem, const char *address);
+
+/*! Runs the CPU under the control of the stub.
+
+    This returns when the program stops while no debugger is attached
+    (for example because it exited, or hit an exception), or when the
+    debugger kills the program. If a debugger is attached when the
+    program stops, the debugger is told about it and decides what happens next.
+
+    \param stub Valid (non-empty) handle to a stub.
+
+    \param waitForClient If non-zero, do not start executing until a
+        debugger connects.
+
+    \retval mips_Success The debugger killed the program.
+
+    \retval other The error which stopped the program, e.g. \ref mips_StopExit.
+*/
+mips_error mips_gdb_run(mips_gdb_h stub, int waitForClient);
+
+/*! Disconnects any debugger and closes the socket. Breakpoints and
+    watchpoints which the debugger set are removed from the CPU.
+    Passing an empty handle is legal.
+*/
+void mips_gdb_free(mips_gdb_h stub);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/*! \file mips_hostcall.h
+    Lets SYSCALL and BREAK instructions in the guest call functions in the host.
+*/
+#ifndef mips_hostcall_header
+#define mips_hostcall_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_hostcall Host Calls
+    \ingroup mips_cpu
+    \addtogroup mips_hostcall
+    @{
+
+    On a real system SYSCALL and BREAK cause an exception, and the
+    operating system or debugger works out what to do. In the simulator
+    there is no operating system, so instead the simulator (the host)
+    can register functions which are called when the guest program executes
+    one of these instructions. The guest program can then print results,
+    read input, allocate memory, or exit cleanly, rather than the only
+    ways out being an error or jumping to a sentinel address.
+
+    Handlers are chosen by:
+
+    - SYSCALL : the value of register $2 ($v0) when the instruction executes.
+      This is the convention used by the SPIM and MARS simulators.
+
+    - BREAK : the 20-bit code field in the instruction itself.
+
+    If no handler matches, both instructions return \ref mips_ExceptionBreak,
+    and the CPU state is left unchanged.
+
+    The standard SPIM services can be installed with
+    \ref mips_cpu_install_spim_hostcalls:
+
+    $v0  | Service      | Arguments                        | Result
+    -----|--------------|----------------------------------|-------
+    1    | print_int    | $a0 = integer                    |
+    4    | print_string | $a0 = address of NUL terminated  |
+    5    | read_int     |                                  | $v0 = integer
+    8    | read_string  | $a0 = buffer, $a1 = length       |
+    9    | sbrk         | $a0 = number of bytes            | $v0 = address of block
+    10   | exit         |                                  |
+    11   | print_char   | $a0 = character                  |
+    12   | read_char    |                                  | $v0 = character
+    17   | exit2        | $a0 = exit code                  |
+
+    Output from the guest is collected in a buffer and written out
+    in large blocks, rather than making a host call per character.
+    The buffer is flushed when it fills, before any input service
+    reads (so prompts appear), when the program exits, when
+    \ref mips_cpu_flush_hostcall_output is called, and when the CPU is freed.
+*/
+
+/*! Distinguishes the instruction which caused a host call. */
+typedef enum _mips_hostcall_kind{
+    mips_hostcall_Syscall=0,
+    mips_hostcall_Break=1
+}mips_hostcall_kind;
+
+/*! Function called when a matching SYSCALL or BREAK executes.
+
+    \param cpu The CPU executing the instruction. The handler can
+        use the normal CPU functions to read arguments and write results.
+
+    \param mem The memory the CPU is attached to.
+
+    \param code The $v0 value (SYSCALL) or code field (BREAK) which selected
+        this handler.
+
+    \param context The pointer given when the handler was registered.
+
+    \retval mips_Success The instruction completes, and execution continues
+        with the next instruction.
+
+    \retval other The instruction does not complete, and the error is returned
+        from \ref mips_cpu_step. Handlers which fail should not modify the CPU
+        state or memory, so that the pc still points at the SYSCALL or BREAK.
+        The SPIM services check the whole of a buffer before writing to it:
+        read_string checks all $a1 bytes before reading any input, and
+        print_string reads up to the terminator before printing anything.
+*/
+typedef mips_error (*mips_hostcall_handler)(
+    mips_cpu_h cpu,
+    mips_mem_h mem,
+    uint32_t code,
+    void *context
+);
+
+/*! Registers a handler for SYSCALL or BREAK with the given code.
+
+    Registering a handler for a code which already has a handler replaces
+    the previous handler. Passing handler==NULL removes the handler.
+*/
+mips_error mips_cpu_register_hostcall(
+    mips_cpu_h state,           //!< Valid (non-empty) handle to a CPU
+    mips_hostcall_kind kind,    //!< Which instruction to respond to
+    uint32_t code,              //!< Which $v0 value or BREAK code to respond to
+    mips_hostcall_handler handler,
+    void *context               //!< Passed through to the handler
+);
+
+/*! Registers handlers for the SPIM services listed in \ref mips_hostcall.
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param in Where the read services get input from. If NULL, the read
+        services behave as if at end of file.
+
+    \param out Where the print services send output. If NULL, output
+        is discarded.
+
+    \param heapBase First address returned by sbrk.
+
+    \param heapLimit Address just beyond the end of the heap. Requests
+        which would go beyond this return 0xFFFFFFFF in $v0.
+*/
+mips_error mips_cpu_install_spim_hostcalls(
+    mips_cpu_h state,
+    FILE *in,
+    FILE *out,
+    uint32_t heapBase,
+    uint32_t heapLimit
+);
+
+/*! Writes any buffered guest output to the destination stream. */
+mips_error mips_cpu_flush_hostcall_output(mips_cpu_h state);
+
+/*! Returns the exit code passed to the exit services.
+
+    Once the guest has called exit or exit2, \ref mips_cpu_step returns
+    \ref mips_StopExit, with the pc still pointing at the SYSCALL.
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param code Receives the exit code (zero for exit).
+
+    \retval mips_ErrorInvalidArgument The guest has not exited.
+*/
+mips_error mips_cpu_get_exit_code(mips_cpu_h state, uint32_t *code);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
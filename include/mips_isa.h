@@ -0,0 +1,294 @@
+/*! \file mips_isa.h
+    A single description of the instruction set, which the decoder,
+    disassembler and test framework are all generated from.
+*/
+#ifndef mips_isa_header
+#define mips_isa_header
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_isa Instruction Set
+    \addtogroup mips_isa
+    @{
+
+    Every instruction is described once, by one line of the
+    MIPS_ISA_INSTRUCTIONS X-macro:
+
+        X(name, format, table, code, kind, operands, description)
+
+    - name: The mnemonic in upper case, which is also the name tests use.
+    - format: R, I or J.
+    - table: Which field selects it: Primary (the opcode), Special
+      (the function field, when the opcode is 0) or RegImm (the rt field,
+      when the opcode is 1). COP1 instructions (opcode 0x11) are selected
+      by the rs field (Cop1), then by the rt field for BC1 (Cop1Bc),
+      or by the function field for each format (Cop1S, Cop1D, Cop1W).
+    - code: The value of that field.
+    - kind: The semantics class, from \ref mips_isa_class.
+    - operands: How the disassembler prints the operands. Each letter
+      is replaced by a field, and anything else is copied:
+      d, s and t are the rd, rs and rt registers, h is the shift amount,
+      i and u are the immediate as signed and unsigned, b is a branch
+      target, j is a jump target, and c is the code field of BREAK.
+      D, S and T are the fd, fs and ft floating-point registers, which
+      are in the shift, rd and rt fields.
+    - description: A short description for reports.
+
+    Names can't contain dots, so they are written with underscores
+    instead: ADD_S is add.s. Tests can use either form.
+
+    The tables in mips_isa.c are expanded from it, so adding a line
+    here adds the instruction to the decoder, disassembler and the test
+    framework's list of known instructions together. A CPU only has to
+    add a case for mips_isa_NAME to its switch on \ref mips_isa_decode.
+*/
+
+#define MIPS_ISA_INSTRUCTIONS(X) \
+    X(ABS_D,     R, Cop1D,   0x05, Float,  "D,S",    "Floating-point absolute value (double)") \
+    X(ABS_S,     R, Cop1S,   0x05, Float,  "D,S",    "Floating-point absolute value (single)") \
+    X(ADD,       R, Special, 0x20, Alu,    "d,s,t",  "Add (with overflow)") \
+    X(ADDI,      I, Primary, 0x08, Alu,    "t,s,i",  "Add immediate (with overflow)") \
+    X(ADDIU,     I, Primary, 0x09, Alu,    "t,s,i",  "Add immediate unsigned (no overflow)") \
+    X(ADDU,      R, Special, 0x21, Alu,    "d,s,t",  "Add unsigned (no overflow)") \
+    X(ADD_D,     R, Cop1D,   0x00, Float,  "D,S,T",  "Floating-point add (double)") \
+    X(ADD_S,     R, Cop1S,   0x00, Float,  "D,S,T",  "Floating-point add (single)") \
+    X(AND,       R, Special, 0x24, Alu,    "d,s,t",  "Bitwise and") \
+    X(ANDI,      I, Primary, 0x0C, Alu,    "t,s,u",  "Bitwise and immediate") \
+    X(BC1F,      I, Cop1Bc,  0x00, Branch, "b",      "Branch on floating-point false") \
+    X(BC1T,      I, Cop1Bc,  0x01, Branch, "b",      "Branch on floating-point true") \
+    X(BEQ,       I, Primary, 0x04, Branch, "s,t,b",  "Branch on equal") \
+    X(BGEZ,      I, RegImm,  0x01, Branch, "s,b",    "Branch on greater than or equal to zero") \
+    X(BGEZAL,    I, RegImm,  0x11, Branch, "s,b",    "Branch on greater than or equal to zero and link") \
+    X(BGTZ,      I, Primary, 0x07, Branch, "s,b",    "Branch on greater than zero") \
+    X(BLEZ,      I, Primary, 0x06, Branch, "s,b",    "Branch on less than or equal to zero") \
+    X(BLTZ,      I, RegImm,  0x00, Branch, "s,b",    "Branch on less than zero") \
+    X(BLTZAL,    I, RegImm,  0x10, Branch, "s,b",    "Branch on less than zero and link") \
+    X(BNE,       I, Primary, 0x05, Branch, "s,t,b",  "Branch on not equal") \
+    X(BREAK,     R, Special, 0x0D, System, "c",      "Breakpoint (host call)") \
+    X(CEIL_W_D,  R, Cop1D,   0x0E, Float,  "D,S",    "Floating-point ceiling to word (double)") \
+    X(CEIL_W_S,  R, Cop1S,   0x0E, Float,  "D,S",    "Floating-point ceiling to word (single)") \
+    X(CFC1,      R, Cop1,    0x02, Float,  "t,d",    "Move control word from floating-point") \
+    X(CTC1,      R, Cop1,    0x06, Float,  "t,d",    "Move control word to floating-point") \
+    X(CVT_D_S,   R, Cop1S,   0x21, Float,  "D,S",    "Convert single to double") \
+    X(CVT_D_W,   R, Cop1W,   0x21, Float,  "D,S",    "Convert word to double") \
+    X(CVT_S_D,   R, Cop1D,   0x20, Float,  "D,S",    "Convert double to single") \
+    X(CVT_S_W,   R, Cop1W,   0x20, Float,  "D,S",    "Convert word to single") \
+    X(CVT_W_D,   R, Cop1D,   0x24, Float,  "D,S",    "Convert double to word") \
+    X(CVT_W_S,   R, Cop1S,   0x24, Float,  "D,S",    "Convert single to word") \
+    X(C_EQ_D,    R, Cop1D,   0x32, Float,  "S,T",    "Floating-point compare equal (double)") \
+    X(C_EQ_S,    R, Cop1S,   0x32, Float,  "S,T",    "Floating-point compare equal (single)") \
+    X(C_F_D,     R, Cop1D,   0x30, Float,  "S,T",    "Floating-point compare false (double)") \
+    X(C_F_S,     R, Cop1S,   0x30, Float,  "S,T",    "Floating-point compare false (single)") \
+    X(C_LE_D,    R, Cop1D,   0x3E, Float,  "S,T",    "Floating-point compare less than or equal (double)") \
+    X(C_LE_S,    R, Cop1S,   0x3E, Float,  "S,T",    "Floating-point compare less than or equal (single)") \
+    X(C_LT_D,    R, Cop1D,   0x3C, Float,  "S,T",    "Floating-point compare less than (double)") \
+    X(C_LT_S,    R, Cop1S,   0x3C, Float,  "S,T",    "Floating-point compare less than (single)") \
+    X(C_NGE_D,   R, Cop1D,   0x3D, Float,  "S,T",    "Floating-point compare not greater than or equal (double)") \
+    X(C_NGE_S,   R, Cop1S,   0x3D, Float,  "S,T",    "Floating-point compare not greater than or equal (single)") \
+    X(C_NGLE_D,  R, Cop1D,   0x39, Float,  "S,T",    "Floating-point compare not greater than or less than or equal (double)") \
+    X(C_NGLE_S,  R, Cop1S,   0x39, Float,  "S,T",    "Floating-point compare not greater than or less than or equal (single)") \
+    X(C_NGL_D,   R, Cop1D,   0x3B, Float,  "S,T",    "Floating-point compare not greater than or less than (double)") \
+    X(C_NGL_S,   R, Cop1S,   0x3B, Float,  "S,T",    "Floating-point compare not greater than or less than (single)") \
+    X(C_NGT_D,   R, Cop1D,   0x3F, Float,  "S,T",    "Floating-point compare not greater than (double)") \
+    X(C_NGT_S,   R, Cop1S,   0x3F, Float,  "S,T",    "Floating-point compare not greater than (single)") \
+    X(C_OLE_D,   R, Cop1D,   0x36, Float,  "S,T",    "Floating-point compare ordered less than or equal (double)") \
+    X(C_OLE_S,   R, Cop1S,   0x36, Float,  "S,T",    "Floating-point compare ordered less than or equal (single)") \
+    X(C_OLT_D,   R, Cop1D,   0x34, Float,  "S,T",    "Floating-point compare ordered less than (double)") \
+    X(C_OLT_S,   R, Cop1S,   0x34, Float,  "S,T",    "Floating-point compare ordered less than (single)") \
+    X(C_SEQ_D,   R, Cop1D,   0x3A, Float,  "S,T",    "Floating-point compare signaling equal (double)") \
+    X(C_SEQ_S,   R, Cop1S,   0x3A, Float,  "S,T",    "Floating-point compare signaling equal (single)") \
+    X(C_SF_D,    R, Cop1D,   0x38, Float,  "S,T",    "Floating-point compare signaling false (double)") \
+    X(C_SF_S,    R, Cop1S,   0x38, Float,  "S,T",    "Floating-point compare signaling false (single)") \
+    X(C_UEQ_D,   R, Cop1D,   0x33, Float,  "S,T",    "Floating-point compare unordered or equal (double)") \
+    X(C_UEQ_S,   R, Cop1S,   0x33, Float,  "S,T",    "Floating-point compare unordered or equal (single)") \
+    X(C_ULE_D,   R, Cop1D,   0x37, Float,  "S,T",    "Floating-point compare unordered or less than or equal (double)") \
+    X(C_ULE_S,   R, Cop1S,   0x37, Float,  "S,T",    "Floating-point compare unordered or less than or equal (single)") \
+    X(C_ULT_D,   R, Cop1D,   0x35, Float,  "S,T",    "Floating-point compare unordered or less than (double)") \
+    X(C_ULT_S,   R, Cop1S,   0x35, Float,  "S,T",    "Floating-point compare unordered or less than (single)") \
+    X(C_UN_D,    R, Cop1D,   0x31, Float,  "S,T",    "Floating-point compare unordered (double)") \
+    X(C_UN_S,    R, Cop1S,   0x31, Float,  "S,T",    "Floating-point compare unordered (single)") \
+    X(DIV,       R, Special, 0x1A, MulDiv, "s,t",    "Divide") \
+    X(DIVU,      R, Special, 0x1B, MulDiv, "s,t",    "Divide unsigned") \
+    X(DIV_D,     R, Cop1D,   0x03, Float,  "D,S,T",  "Floating-point divide (double)") \
+    X(DIV_S,     R, Cop1S,   0x03, Float,  "D,S,T",  "Floating-point divide (single)") \
+    X(FLOOR_W_D, R, Cop1D,   0x0F, Float,  "D,S",    "Floating-point floor to word (double)") \
+    X(FLOOR_W_S, R, Cop1S,   0x0F, Float,  "D,S",    "Floating-point floor to word (single)") \
+    X(J,         J, Primary, 0x02, Jump,   "j",      "Jump") \
+    X(JAL,       J, Primary, 0x03, Jump,   "j",      "Jump and link") \
+    X(JALR,      R, Special, 0x09, Jump,   "d,s",    "Jump and link register") \
+    X(JR,        R, Special, 0x08, Jump,   "s",      "Jump register") \
+    X(LB,        I, Primary, 0x20, Load,   "t,i(s)", "Load byte") \
+    X(LBU,       I, Primary, 0x24, Load,   "t,i(s)", "Load byte unsigned") \
+    X(LDC1,      I, Primary, 0x35, Load,   "T,i(s)", "Load doubleword to floating-point") \
+    X(LH,        I, Primary, 0x21, Load,   "t,i(s)", "Load half-word") \
+    X(LHU,       I, Primary, 0x25, Load,   "t,i(s)", "Load half-word unsigned") \
+    X(LUI,       I, Primary, 0x0F, Alu,    "t,u",    "Load upper immediate") \
+    X(LW,        I, Primary, 0x23, Load,   "t,i(s)", "Load word") \
+    X(LWC1,      I, Primary, 0x31, Load,   "T,i(s)", "Load word to floating-point") \
+    X(LWL,       I, Primary, 0x22, Load,   "t,i(s)", "Load word left") \
+    X(LWR,       I, Primary, 0x26, Load,   "t,i(s)", "Load word right") \
+    X(MFC1,      R, Cop1,    0x00, Float,  "t,S",    "Move word from floating-point") \
+    X(MFHI,      R, Special, 0x10, MulDiv, "d",      "Move from HI") \
+    X(MFLO,      R, Special, 0x12, MulDiv, "d",      "Move from LO") \
+    X(MOV_D,     R, Cop1D,   0x06, Float,  "D,S",    "Floating-point move (double)") \
+    X(MOV_S,     R, Cop1S,   0x06, Float,  "D,S",    "Floating-point move (single)") \
+    X(MTC1,      R, Cop1,    0x04, Float,  "t,S",    "Move word to floating-point") \
+    X(MTHI,      R, Special, 0x11, MulDiv, "s",      "Move to HI") \
+    X(MTLO,      R, Special, 0x13, MulDiv, "s",      "Move to LO") \
+    X(MULT,      R, Special, 0x18, MulDiv, "s,t",    "Multiply") \
+    X(MULTU,     R, Special, 0x19, MulDiv, "s,t",    "Multiply unsigned") \
+    X(MUL_D,     R, Cop1D,   0x02, Float,  "D,S,T",  "Floating-point multiply (double)") \
+    X(MUL_S,     R, Cop1S,   0x02, Float,  "D,S,T",  "Floating-point multiply (single)") \
+    X(NEG_D,     R, Cop1D,   0x07, Float,  "D,S",    "Floating-point negate (double)") \
+    X(NEG_S,     R, Cop1S,   0x07, Float,  "D,S",    "Floating-point negate (single)") \
+    X(NOR,       R, Special, 0x27, Alu,    "d,s,t",  "Bitwise nor") \
+    X(OR,        R, Special, 0x25, Alu,    "d,s,t",  "Bitwise or") \
+    X(ORI,       I, Primary, 0x0D, Alu,    "t,s,u",  "Bitwise or immediate") \
+    X(ROUND_W_D, R, Cop1D,   0x0C, Float,  "D,S",    "Floating-point round to word (double)") \
+    X(ROUND_W_S, R, Cop1S,   0x0C, Float,  "D,S",    "Floating-point round to word (single)") \
+    X(SB,        I, Primary, 0x28, Store,  "t,i(s)", "Store byte") \
+    X(SDC1,      I, Primary, 0x3D, Store,  "T,i(s)", "Store doubleword from floating-point") \
+    X(SH,        I, Primary, 0x29, Store,  "t,i(s)", "Store half-word") \
+    X(SLL,       R, Special, 0x00, Shift,  "d,t,h",  "Shift left logical") \
+    X(SLLV,      R, Special, 0x04, Shift,  "d,t,s",  "Shift left logical variable") \
+    X(SLT,       R, Special, 0x2A, Alu,    "d,s,t",  "Set on less than (signed)") \
+    X(SLTI,      I, Primary, 0x0A, Alu,    "t,s,i",  "Set on less than immediate (signed)") \
+    X(SLTIU,     I, Primary, 0x0B, Alu,    "t,s,i",  "Set on less than immediate unsigned") \
+    X(SLTU,      R, Special, 0x2B, Alu,    "d,s,t",  "Set on less than unsigned") \
+    X(SQRT_D,    R, Cop1D,   0x04, Float,  "D,S",    "Floating-point square root (double)") \
+    X(SQRT_S,    R, Cop1S,   0x04, Float,  "D,S",    "Floating-point square root (single)") \
+    X(SRA,       R, Special, 0x03, Shift,  "d,t,h",  "Shift right arithmetic") \
+    X(SRAV,      R, Special, 0x07, Shift,  "d,t,s",  "Shift right arithmetic variable") \
+    X(SRL,       R, Special, 0x02, Shift,  "d,t,h",  "Shift right logical") \
+    X(SRLV,      R, Special, 0x06, Shift,  "d,t,s",  "Shift right logical variable") \
+    X(SUB,       R, Special, 0x22, Alu,    "d,s,t",  "Subtract") \
+    X(SUBU,      R, Special, 0x23, Alu,    "d,s,t",  "Subtract unsigned") \
+    X(SUB_D,     R, Cop1D,   0x01, Float,  "D,S,T",  "Floating-point subtract (double)") \
+    X(SUB_S,     R, Cop1S,   0x01, Float,  "D,S,T",  "Floating-point subtract (single)") \
+    X(SW,        I, Primary, 0x2B, Store,  "t,i(s)", "Store word") \
+    X(SWC1,      I, Primary, 0x39, Store,  "T,i(s)", "Store word from floating-point") \
+    X(SWL,       I, Primary, 0x2A, Store,  "t,i(s)", "Store word left") \
+    X(SWR,       I, Primary, 0x2E, Store,  "t,i(s)", "Store word right") \
+    X(SYSCALL,   R, Special, 0x0C, System, "",       "System call (host call)") \
+    X(TRUNC_W_D, R, Cop1D,   0x0D, Float,  "D,S",    "Floating-point truncate to word (double)") \
+    X(TRUNC_W_S, R, Cop1S,   0x0D, Float,  "D,S",    "Floating-point truncate to word (single)") \
+    X(XOR,       R, Special, 0x26, Alu,    "d,s,t",  "Bitwise exclusive or") \
+    X(XORI,      I, Primary, 0x0E, Alu,    "t,s,u",  "Bitwise exclusive or immediate")
+
+/*! One value per instruction, in the same order as MIPS_ISA_INSTRUCTIONS,
+    so they can be used as case labels. Encodings which are not in the
+    table decode to mips_isa_Invalid. */
+typedef enum _mips_isa_op{
+    mips_isa_Invalid=0,
+#define MIPS_ISA_ENUM(name, format, table, code, kind, operands, description) mips_isa_##name,
+    MIPS_ISA_INSTRUCTIONS(MIPS_ISA_ENUM)
+#undef MIPS_ISA_ENUM
+    mips_isa_Count          //!< One more than the last instruction
+}mips_isa_op;
+
+typedef enum _mips_isa_format{
+    mips_isa_format_R,
+    mips_isa_format_I,
+    mips_isa_format_J
+}mips_isa_format;
+
+/*! What an instruction does, in broad terms. */
+typedef enum _mips_isa_class{
+    mips_isa_class_Alu,     //!< Arithmetic, logic and comparisons into a register
+    mips_isa_class_Shift,
+    mips_isa_class_MulDiv,  //!< Anything involving HI and LO
+    mips_isa_class_Branch,  //!< Conditional and PC-relative, with a delay slot
+    mips_isa_class_Jump,    //!< Unconditional (including JR and JALR), with a delay slot
+    mips_isa_class_Load,
+    mips_isa_class_Store,
+    mips_isa_class_System,  //!< Traps to the host
+    mips_isa_class_Float    //!< COP1 arithmetic, comparisons, conversions and moves
+}mips_isa_class;
+
+/*! Everything known about one instruction. */
+typedef struct _mips_isa_info{
+    const char *name;           //!< Upper-case mnemonic, e.g. "ADDU"
+    mips_isa_format format;
+    mips_isa_class kind;
+    int opcode;                 //!< Primary opcode
+    int sub;                    //!< Function (opcode 0) or rt (opcode 1), otherwise -1
+    const char *operands;       //!< Disassembly template, see above
+    const char *description;
+}mips_isa_info;
+
+/*! Indexed by mips_isa_op. Entry 0 (mips_isa_Invalid) has the name
+    "<INVALID>" and an opcode of -1. */
+extern const mips_isa_info mips_isa_instructions[mips_isa_Count];
+
+/* The decode table holds the primary opcodes, then the SPECIAL
+   function codes, then the REGIMM rt codes, so all the integer
+   instructions fit in the first 160 bytes (three cache lines). The
+   COP1 tables come after them. */
+#define MIPS_ISA_DISPATCH_Primary 0
+#define MIPS_ISA_DISPATCH_Special 64
+#define MIPS_ISA_DISPATCH_RegImm 128
+#define MIPS_ISA_DISPATCH_Cop1 160
+#define MIPS_ISA_DISPATCH_Cop1Bc 192
+#define MIPS_ISA_DISPATCH_Cop1S 224
+#define MIPS_ISA_DISPATCH_Cop1D 288
+#define MIPS_ISA_DISPATCH_Cop1W 352
+#define MIPS_ISA_DISPATCH_SIZE 416
+
+extern const uint8_t mips_isa_dispatch[MIPS_ISA_DISPATCH_SIZE];
+
+/*! Decodes COP1 (opcode 0x11) instructions, by the rs field and then
+    the rt or function fields. */
+static inline mips_isa_op mips_isa_decode_cop1(uint32_t instr)
+{
+    switch((instr>>21)&0x1F){
+    case 8:  return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Cop1Bc+((instr>>16)&0x1F)];
+    case 16: return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Cop1S+(instr&0x3F)];
+    case 17: return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Cop1D+(instr&0x3F)];
+    case 20: return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Cop1W+(instr&0x3F)];
+    default: return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Cop1+((instr>>21)&0x1F)];
+    }
+}
+
+/*! Works out which instruction an encoding is, with one or two loads. */
+static inline mips_isa_op mips_isa_decode(uint32_t instr)
+{
+    uint32_t opcode=instr>>26;
+    if(opcode==0)
+        return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_Special+(instr&0x3F)];
+    if(opcode==1)
+        return (mips_isa_op)mips_isa_dispatch[MIPS_ISA_DISPATCH_RegImm+((instr>>16)&0x1F)];
+    if(opcode==0x11)
+        return mips_isa_decode_cop1(instr);
+    return (mips_isa_op)mips_isa_dispatch[opcode];
+}
+
+/*! Finds an instruction by name, ignoring case, and treating dots
+    and underscores as the same.
+    \retval mips_isa_Invalid There is no such instruction.
+*/
+mips_isa_op mips_isa_find(const char *name);
+
+/*! Writes the assembly language for instr into dst, for example
+    "addu $3, $1, $2" or "add.d $f0, $f2, $f4", using register numbers. Branch and jump targets
+    are worked out assuming instr is at address pc. SLL $0,$0,0 is shown
+    as "nop", and encodings which are not in the table as ".word".
+
+    \param size Size of dst. The result is always terminated, and
+        truncated if necessary.
+
+    \retval The length of the whole string (like snprintf), which is
+        never more than 40 characters.
+*/
+unsigned mips_isa_disassemble(uint32_t instr, uint32_t pc, char *dst, unsigned size);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
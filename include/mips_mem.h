@@ -142,6 +142,139 @@ mips_error mips_mem_write(
     const uint8_t *dataIn	//!< Receives the target bytes
 );
 
+/*! Reads one aligned 32-bit word, and returns it as a number.
+
+    This has the same effect as reading four bytes with mips_mem_read
+    and combining them in big-endian order, but lets the memory skip the
+    conversion if it keeps words in a form closer to the host's (see
+    \ref mips_mem_ram_HostOrder). CPUs should use it for instruction fetch,
+    LW, and SW, which are the bulk of all memory traffic.
+
+    \retval mips_ExceptionInvalidAlignment The address is not a multiple of 4,
+        or a 4-byte transaction is not allowed by the block size.
+*/
+mips_error mips_mem_read_word(
+    mips_mem_h mem,     //!< Handle to target memory
+    uint32_t address,   //!< Byte address of the word
+    uint32_t *value     //!< Receives the value
+);
+
+/*! Writes one aligned 32-bit word, given as a number. See \ref mips_mem_read_word. */
+mips_error mips_mem_write_word(
+    mips_mem_h mem,     //!< Handle to target memory
+    uint32_t address,   //!< Byte address of the word
+    uint32_t value      //!< Value to write
+);
+
+/*! Perform a write transaction which only changes some of the bytes.
+
+    This is the same as mips_mem_write, except that byte i of the
+    transaction is only written if bit i of byteMask is set, like
+    the byte-enable signals on a real data bus. The transaction still
+    has to follow the alignment and block size rules. For example, SB
+    to address 13 of a RAM with blockSize=4 can be done as:
+
+        uint8_t xa[4]={0, value, 0, 0};
+        mips_error err=mips_mem_write_masked(mem, 12, 4, xa, 1<<1);
+
+    Memories which have byte-enables do this in one step. For others
+    it is turned into a read followed by a write.
+
+    \retval mips_ErrorInvalidArgument length is more than 32.
+*/
+mips_error mips_mem_write_masked(
+    mips_mem_h mem,         //!< Handle to target memory
+    uint32_t address,       //!< Byte address to start transaction at
+    uint32_t length,        //!< Number of bytes in the transaction (at most 32)
+    const uint8_t *dataIn,  //!< Bytes to write, including ones which are masked off
+    uint32_t byteMask       //!< Bit i enables byte i
+);
+
+/*! Perform a read transaction which only returns some of the bytes.
+
+    Byte i of dataOut is only written if bit i of byteMask is set, and the
+    others are left alone. This matters for devices where reading has
+    side effects, and lets an unaligned load (such as LWL) merge straight
+    into the bytes it already has.
+
+    \retval mips_ErrorInvalidArgument length is more than 32.
+*/
+mips_error mips_mem_read_masked(
+    mips_mem_h mem,         //!< Handle to target memory
+    uint32_t address,       //!< Byte address to start transaction at
+    uint32_t length,        //!< Number of bytes in the transaction (at most 32)
+    uint8_t *dataOut,       //!< Receives the enabled bytes
+    uint32_t byteMask       //!< Bit i enables byte i
+);
+
+/*! Reads an instruction. This is the same as \ref mips_mem_read_word,
+    except that the page must be executable rather than readable (see
+    \ref mips_mem_set_permissions). CPUs should use it for instruction
+    fetch, and mips_mem_read_word for loads.
+*/
+mips_error mips_mem_fetch_word(
+    mips_mem_h mem,     //!< Handle to target memory
+    uint32_t address,   //!< Byte address of the word
+    uint32_t *value     //!< Receives the value
+);
+
+/*! Size of the pages that permissions apply to. */
+#define MIPS_MEM_PAGE_SIZE 4096
+
+/*! Access permissions for a page. */
+typedef enum _mips_mem_permission{
+    mips_mem_perm_Read=1,       //!< Loads, and every other kind of read
+    mips_mem_perm_Write=2,      //!< Stores, and every other kind of write
+    mips_mem_perm_Execute=4,    //!< Instruction fetch with mips_mem_fetch_word
+    mips_mem_perm_All=7
+}mips_mem_permission;
+
+/*! Changes the permissions of a range of pages. All memories start
+    with every page allowing everything.
+
+    Any transaction which touches a page without the right permission
+    fails with \ref mips_ExceptionAccessViolation, and has no effect.
+    For example, to catch stray stores into a program, and attempts to
+    run data:
+
+        mips_mem_set_permissions(mem, 0, textSize, mips_mem_perm_Read|mips_mem_perm_Execute);
+        mips_mem_set_permissions(mem, textSize, memSize-textSize, mips_mem_perm_Read|mips_mem_perm_Write);
+
+    Permissions are kept in a table with one byte per page, which is
+    looked at in the same test that checks the address is in range,
+    so a permitted transaction costs one extra load and no extra
+    branches. Until this is first called the table is a shared one
+    allowing everything, and allowing everything over the whole memory
+    goes back to the shared table. The table is not part of a
+    \ref mips_checkpoint "checkpoint".
+
+    \param mem Handle to target memory.
+
+    \param address Start of the range. Must be a multiple of MIPS_MEM_PAGE_SIZE.
+
+    \param length Bytes in the range. Rounded up to a whole number of pages.
+
+    \param permissions Values from mips_mem_permission or-ed together.
+
+    \retval mips_ErrorInvalidArgument The address is not page aligned, the
+        range goes past the end of memory, or the permissions are not valid.
+    \retval mips_ErrorOutOfMemory The table could not be allocated.
+*/
+mips_error mips_mem_set_permissions(
+    mips_mem_h mem,
+    uint32_t address,
+    uint32_t length,
+    unsigned permissions
+);
+
+/*! Gets the permissions of the page containing address.
+    \retval mips_ExceptionInvalidAddress The address is past the end of memory.
+*/
+mips_error mips_mem_get_permissions(
+    mips_mem_h mem,
+    uint32_t address,
+    unsigned *permissions
+);
 
 /*! Release all resources associated with memory. The caller doesn't
     really know what is being released (it could be memory, it could
@@ -206,12 +339,131 @@ void mips_mem_free(mips_mem_h mem);
     actual MIPS implementation would have what are called "byte-enables",
     which are extra signals saying which bytes within the data bus are
     valid, but I didn't include them in the API as they complicate things.
+    They have since been added as \ref mips_mem_write_masked and
+    \ref mips_mem_read_masked, which the RAM supports directly.
 */
 mips_mem_h mips_mem_create_ram(
     uint32_t cbMem,	//!< Total number of bytes of ram
     uint32_t blockSize	//!< Granularity of transactions supported by RAM
 );
 
+/*! Options for \ref mips_mem_create_ram_ex. */
+typedef enum _mips_mem_ram_flags{
+    /*! Store each aligned word as a native host integer, rather than as
+        four bytes in big-endian order. On a little-endian host this means
+        mips_mem_read_word and mips_mem_write_word are plain loads and stores,
+        while byte addresses are converted by XOR-ing the bottom two bits
+        with 3 (so byte 0 of a word lives where the host keeps its most
+        significant byte). mips_mem_read and mips_mem_write still see
+        exactly the same bytes as with a normal RAM, so only the speed
+        is different. The size must be a multiple of 4. */
+    mips_mem_ram_HostOrder=1,
+
+    /*! Back the RAM with huge pages, so that a large memory needs far
+        fewer host TLB entries. Explicit huge pages (MAP_HUGETLB) are tried
+        first, then transparent huge pages (madvise(MADV_HUGEPAGE)) on
+        a 2MB aligned mapping. */
+    mips_mem_ram_HugePages=2,
+
+    /*! Touch every page when the RAM is created, so that the host does
+        not take page faults during the simulation. */
+    mips_mem_ram_Prefault=4,
+
+    /*! Prefer memory on the NUMA node of the thread which creates the
+        RAM, which should be the thread that will run the CPU. */
+    mips_mem_ram_NumaLocal=8,
+
+    /*! Start with every byte zero, so that a program which reads memory
+        it never wrote still behaves the same on every host. */
+    mips_mem_ram_Zero=16,
+
+    /*! Keep a bit for every byte saying whether it has ever been written,
+        and fail any read which includes a byte that hasn't with
+        mips_ExceptionUninitialisedRead. A CPU stops at the load (or
+        fetch) with its state unchanged, so its pc says which instruction
+        it was, and \ref mips_mem_get_uninitialised_read says which
+        address. Masked transactions only look at the enabled bytes.
+        Implies mips_mem_ram_Zero. Reads and writes become a small
+        constant factor slower, and the bits take an eighth of the size
+        of the RAM. Checkpoints do not include the bits, so a RAM loaded
+        from one does not have them. Undoing stores, by journal rollback
+        (\ref mips_cpu_set_journaled) or reverse execution, puts back
+        the old values but not the bits, so bytes first written by the
+        undone stores still count as written. */
+    mips_mem_ram_Shadow=32
+}mips_mem_ram_flags;
+
+/*! Initialise a new RAM, with options which change how it works
+    internally without changing what it does. Passing zero for flags is
+    the same as calling \ref mips_mem_create_ram.
+
+    HugePages, Prefault and NumaLocal are only hints. If the host (or
+    the platform) can't provide them, the RAM is created without them,
+    rather than failing. The RAM is zero-filled when any of them (or
+    Zero or Shadow) is given, whereas the normal RAM starts with
+    undefined contents.
+*/
+mips_mem_h mips_mem_create_ram_ex(
+    uint32_t cbMem,     //!< Total number of bytes of ram
+    uint32_t blockSize, //!< Granularity of transactions supported by RAM
+    unsigned flags      //!< Values from mips_mem_ram_flags or-ed together
+);
+
+/*! Gets the address of the first byte which had not been written, for
+    the most recent read which failed with mips_ExceptionUninitialisedRead.
+    \retval mips_ErrorInvalidArgument The RAM does not have
+        mips_mem_ram_Shadow, or no read has failed.
+*/
+mips_error mips_mem_get_uninitialised_read(
+    mips_mem_h mem,     //!< RAM created with mips_mem_ram_Shadow, or an overlay of one
+    uint32_t *address   //!< Receives the byte address
+);
+
+/*! Marks a range of bytes as written without changing them, for memory
+    which is meant to start as zero (such as .bss), or to carry on past
+    a reported read.
+    \retval mips_ErrorInvalidArgument The RAM does not have
+        mips_mem_ram_Shadow, or the range is outside it.
+*/
+mips_error mips_mem_set_initialised(
+    mips_mem_h mem,     //!< RAM created with mips_mem_ram_Shadow, or an overlay of one
+    uint32_t address,   //!< First byte
+    uint32_t length     //!< Number of bytes
+);
+
+/*! Creates a copy-on-write view of another memory, so that lots of
+    simulations can share one copy of a program image.
+
+    The overlay has the same length and blockSize as the base. Reads
+    go through to the base until a 4KB page is first written, when the
+    page is copied and the copy is used from then on, so each overlay
+    only needs memory for the pages it has written. The base is never
+    written by the overlay, so any number of overlays (on any number of
+    threads) can share it, as long as nothing else changes it and it
+    is not freed until all the overlays have been.
+
+    The overlay starts with every permission, like any other memory.
+    The permissions of the base are not used.
+
+    If the base is a RAM with mips_mem_ram_Shadow, or an overlay of
+    one, the overlay checks reads in the same way, using the base's
+    bits for bytes it has not written and its own for bytes it has. Failed reads are reported by
+    the overlay, and nothing in the base (including its bits) changes.
+
+    \retval 0 base is not valid, or there was not enough memory.
+*/
+mips_mem_h mips_mem_create_overlay(
+    mips_mem_h base     //!< Memory holding the initial contents
+);
+
+/*! Gets the number of pages an overlay has copied from its base.
+    \retval mips_ErrorInvalidHandle mem is not an overlay.
+*/
+mips_error mips_mem_overlay_pages(
+    mips_mem_h mem,     //!< Memory created by mips_mem_create_overlay
+    uint32_t *count     //!< Receives the number of pages
+);
+
 /*!
     @}
     @}
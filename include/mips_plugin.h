@@ -0,0 +1,150 @@
+/*! \file mips_plugin.h
+    Observing execution through callbacks, without changing the CPU.
+*/
+#ifndef mips_plugin_header
+#define mips_plugin_header
+
+#include "mips_cpu.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_plugin Instrumentation
+    \ingroup mips_cpu
+    \addtogroup mips_plugin
+    @{
+
+    Tools such as coverage, profilers, or cache models need to see what
+    the CPU is doing, but shouldn't need their own build of it. Instead
+    they register hooks, which are either a callback function or a
+    counter to increment, for one or more kinds of event:
+
+        static void on_read(void *context, mips_cpu_h cpu, const mips_plugin_event *e)
+        {
+            cache_access((cache_t*)context, e->address);
+        }
+
+        uint64_t loopCount=0;
+        mips_cpu_add_plugin_counter(cpu, mips_plugin_Execute, 0x400, 0x40c, &loopCount, 0);
+        mips_cpu_add_plugin_callback(cpu, mips_plugin_Read, 0, 0xFFFFFFFF, on_read, &cache, 0);
+
+    Each hook can be restricted to an inclusive range of addresses. For
+    memory accesses the range applies to the data address, and for all
+    other events it applies to the pc of the instruction.
+
+    When a hook is added or removed, the hooks are sorted into one list per
+    kind of event, so the CPU only looks at the hooks which want the event
+    it has. If no hooks want a kind of event, the CPU pays a single test
+    for it, and if there are no hooks at all nothing is done. Counters
+    are incremented directly, without a function call.
+
+    Events are not reported while reverse execution replays instructions
+    (see \ref mips_reverse), and callbacks must not add or remove hooks.
+*/
+
+/*! Kinds of event, which can be or-ed together when adding a hook. */
+typedef enum _mips_plugin_kind{
+    /*! An instruction is about to execute. It has been fetched and has
+        passed any watchpoint, but might still cause an exception. */
+    mips_plugin_Execute=1,
+    /*! A load has completed. */
+    mips_plugin_Read=2,
+    /*! A store has completed. */
+    mips_plugin_Write=4,
+    /*! A branch or jump has completed, and will transfer control after
+        its delay slot to somewhere other than the next instruction. */
+    mips_plugin_Branch=8,
+    /*! An instruction caused an exception, and the CPU has been left
+        as it was before the instruction. */
+    mips_plugin_Exception=16,
+    /*! JAL or JALR, or BGEZAL or BLTZAL which was taken, has completed.
+        Control goes to the callee after the delay slot. */
+    mips_plugin_Call=32,
+    /*! JR $31 has completed, so control goes back to the caller after
+        the delay slot. */
+    mips_plugin_Return=64
+}mips_plugin_kind;
+
+/*! Describes an event. Fields which do not apply to an event are zero. */
+typedef struct _mips_plugin_event{
+    mips_plugin_kind kind;
+    uint32_t pc;        //!< Address of the instruction
+    uint32_t instr;     //!< The instruction, if it could be fetched
+    uint32_t address;   //!< Read and Write: data address. Branch, Call and Return: the target.
+    uint32_t length;    //!< Read and Write: bytes accessed (1, 2, or 4)
+    /*! Read: the value written to the register. Write: the register
+        being stored. */
+    uint32_t value;
+    mips_error error;   //!< Exception: the exception
+}mips_plugin_event;
+
+/*! Called for each event a hook wants.
+    \param context The value given when the hook was added.
+    \param cpu The CPU which caused the event.
+    \param event The event, which is only valid during the call.
+*/
+typedef void (*mips_plugin_callback)(
+    void *context,
+    mips_cpu_h cpu,
+    const mips_plugin_event *event
+);
+
+/*! Adds a hook which calls a function.
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param kinds One or more values from mips_plugin_kind.
+
+    \param begin First address the hook responds to.
+
+    \param end Last address the hook responds to, so 0 and 0xFFFFFFFF
+        cover everything.
+
+    \param callback Function to call for each event.
+
+    \param context Passed to the callback.
+
+    \param hookId If non-NULL, receives an identifier for \ref mips_cpu_remove_plugin.
+
+    \retval mips_ErrorInvalidArgument There are no (or unknown) kinds,
+        begin is after end, or callback is NULL.
+*/
+mips_error mips_cpu_add_plugin_callback(
+    mips_cpu_h state,
+    unsigned kinds,
+    uint32_t begin,
+    uint32_t end,
+    mips_plugin_callback callback,
+    void *context,
+    unsigned *hookId
+);
+
+/*! Adds a hook which increments a counter for each event. The counter
+    is not cleared, and must stay valid until the hook is removed or
+    the CPU is freed. Otherwise this is the same as \ref mips_cpu_add_plugin_callback.
+*/
+mips_error mips_cpu_add_plugin_counter(
+    mips_cpu_h state,
+    unsigned kinds,
+    uint32_t begin,
+    uint32_t end,
+    uint64_t *counter,
+    unsigned *hookId
+);
+
+/*! Removes a hook.
+    \retval mips_ErrorInvalidArgument There is no such hook.
+*/
+mips_error mips_cpu_remove_plugin(mips_cpu_h state, unsigned hookId);
+
+/*! Removes every hook. */
+mips_error mips_cpu_clear_plugins(mips_cpu_h state);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+/*! \file mips_profile.h
+    Finding where a program spends its instructions, by function and by caller.
+*/
+#ifndef mips_profile_header
+#define mips_profile_header
+
+#include "mips_cpu.h"
+#include "mips_elf.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_profile Profiling
+    \ingroup mips_plugin
+    \addtogroup mips_profile
+    @{
+
+    A profiler hooks the \ref mips_plugin_Call and \ref mips_plugin_Return
+    events, and nothing else, so the CPU runs at full speed between calls.
+    It keeps its own copy of the call stack, and each time the stack
+    changes the instructions executed since the last change are charged
+    to the function on top of it:
+
+        mips_profile_h p=mips_profile_create(cpu);
+        mips_cpu_run(cpu, UINT64_MAX, 0);
+        mips_profile_write_collapsed(p, stdout, elf);
+        mips_profile_free(p);
+
+    Costs are kept for each distinct call stack (a calling-context tree),
+    so the same function called from two places is two entries until the
+    output merges them. The call instruction is charged to the caller,
+    and its delay slot to the callee. A JR $31 is matched against the
+    return addresses on the stack, so returns which skip frames (as
+    longjmp does) unwind all of them, and returns to addresses which are
+    not on the stack are ignored.
+
+    If the instruction count goes backwards (because the CPU was reset,
+    went back with \ref mips_reverse, or had a checkpoint loaded into it)
+    then the stack is thrown away, and counting carries on from the root
+    without removing anything already charged.
+
+    The function at the pc when the profile is created is the root of
+    every stack. Symbol names are taken from an ELF file if one is given
+    when writing, otherwise functions are named by their address.
+*/
+
+/*! Represents a profile being collected. \struct mips_profile_impl */
+struct mips_profile_impl;
+
+/*! Opaque handle to a profile. */
+typedef struct mips_profile_impl *mips_profile_h;
+
+/*! Totals for one function, summed over everywhere it was called from. */
+typedef struct _mips_profile_function{
+    uint64_t calls;     //!< Number of times it was called
+    uint64_t exclusive; //!< Instructions executed in the function itself
+    /*! Instructions executed in the function and everything it called.
+        Instructions in recursive calls are only counted once. */
+    uint64_t inclusive;
+}mips_profile_function;
+
+/*! Starts profiling a CPU by adding a plugin hook. The CPU must
+    outlive the profile.
+    \retval 0 The CPU is not valid, or the hook could not be added.
+*/
+mips_profile_h mips_profile_create(mips_cpu_h cpu);
+
+/*! Gets the totals for the function starting at an address, up to the
+    current instruction.
+    \retval mips_ErrorInvalidArgument The function has not been seen.
+*/
+mips_error mips_profile_get_function(
+    mips_profile_h profile,
+    uint32_t address,               //!< Entry point of the function
+    mips_profile_function *info     //!< Receives the totals
+);
+
+/*! Writes one line per call stack, with the functions from the root
+    down separated by semi-colons, then a space and the instructions
+    executed with exactly that stack. This is the "collapsed" format
+    read by flamegraph.pl and similar tools.
+    \param symbols ELF file to name functions from, or NULL.
+*/
+mips_error mips_profile_write_collapsed(mips_profile_h profile, FILE *dst, mips_elf_h symbols);
+
+/*! Writes the profile in callgrind format, for kcachegrind and
+    callgrind_annotate. Each function has its exclusive cost, plus the
+    number of calls to and inclusive cost of each function it called.
+    Positions are the entry points of functions.
+    \param symbols ELF file to name functions from, or NULL.
+*/
+mips_error mips_profile_write_callgrind(mips_profile_h profile, FILE *dst, mips_elf_h symbols);
+
+/*! Removes the hook and releases the profile. Passing an empty handle is legal. */
+void mips_profile_free(mips_profile_h profile);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+/*! \file mips_reverse.h
+    Stepping and continuing backwards through a program's execution.
+*/
+#ifndef mips_reverse_header
+#define mips_reverse_header
+
+#include "mips_breakpoint.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/*! \defgroup mips_reverse Reverse Execution
+    \ingroup mips_cpu
+    \addtogroup mips_reverse
+    @{
+
+    When a program goes wrong after millions of instructions, the
+    interesting thing is usually a little while before the point where
+    it was noticed. Rather than re-running from the beginning, the CPU
+    can keep a history which lets it go backwards:
+
+        mips_cpu_set_history(cpu, 1000000, 64<<20); // Snapshot every 1M instructions, 64MB max
+
+        err=mips_cpu_run(cpu, UINT64_MAX, 0);       // Runs until something goes wrong
+        mips_cpu_reverse_step(cpu, 10);             // Now 10 instructions before it
+        mips_cpu_reverse_continue(cpu);             // Back to the last breakpoint or watchpoint
+
+    The history consists of snapshots of the CPU registers taken every
+    interval instructions, plus a log with the old value of every memory word
+    the program writes. To go back, the log is undone as far as the nearest
+    snapshot before the target, and the program is then executed forwards
+    until it reaches the target. Execution is deterministic, so the state
+    is exactly the same as it was the first time. Going back N instructions
+    costs at most interval instructions of replay, plus undoing the writes
+    made since that snapshot.
+
+    When the history would use more than its byte limit, the oldest
+    snapshot is thrown away along with the part of the log which only it
+    needed, so the program can only go back as far as the oldest snapshot
+    left. The most recent interval is always kept, even if on its own it
+    exceeds the limit.
+
+    Host calls (\ref mips_hostcall) cannot be replayed, as they may read
+    input or produce output. A snapshot is taken just before and just after
+    each one, so replay never needs to execute them, and memory written by
+    the built-in SPIM services is logged. Memory written by other handlers,
+    or directly through mips_mem_write by the caller, is not logged and will
+    not be undone. Host side state, such as the sbrk heap pointer, is not
+    rewound either.
+
+    Device events and interrupts (\ref mips_event) cannot be replayed or
+    undone either, so nothing is recorded while any event is queued or
+    any interrupt line is raised. Queueing an event or raising a line
+    discards the history, and recording starts again (with a new
+    snapshot) once the queue is empty and every line has been cleared.
+    A periodic timer therefore means there is no history at all.
+
+    Setting the pc or arch state, or resetting the CPU, discards the
+    history, as the new state is not reachable by replay. Setting
+    registers (with \ref mips_cpu_set_register or mips_cpu_set_registers)
+    does not. Instead a snapshot is taken with the new values, so going
+    back past it gives the registers as they were before.
+*/
+
+/*! Turns the history on, changes its settings, or turns it off.
+
+    \param state Valid (non-empty) handle to a CPU.
+
+    \param interval Number of instructions between snapshots. Zero turns
+        the history off and releases it.
+
+    \param maxBytes Approximate limit on the memory used for snapshots
+        and logged writes.
+*/
+mips_error mips_cpu_set_history(
+    mips_cpu_h state,
+    uint64_t interval,
+    size_t maxBytes
+);
+
+/*! Moves the CPU back by the given number of instructions.
+
+    \retval mips_Success The CPU is now exactly steps instructions earlier.
+
+    \retval mips_StopHistoryStart The history does not go back that far,
+        so the CPU is at the oldest point available.
+
+    \retval mips_ExceptionAccessViolation A word written since then can't
+        be put back, as its page is no longer writable (see
+        \ref mips_mem_set_permissions). Nothing is changed.
+
+    \retval mips_ErrorInvalidArgument The history is not turned on.
+*/
+mips_error mips_cpu_reverse_step(
+    mips_cpu_h state,   //!< Valid (non-empty) handle to a CPU
+    uint64_t steps      //!< Number of instructions to go back
+);
+
+/*! Moves the CPU back to the most recent point before now where
+    \ref mips_cpu_run would have stopped at a breakpoint or watchpoint.
+
+    Afterwards the CPU is in the same state as if mips_cpu_run had just
+    stopped there, so calling mips_cpu_run continues forwards past it,
+    and \ref mips_cpu_get_watch_hit describes any watchpoint.
+
+    \retval mips_StopBreakpoint Stopped at a breakpoint.
+
+    \retval mips_StopWatchpoint Stopped before an access to a watched address.
+
+    \retval mips_StopHistoryStart Nothing was hit, so the CPU is at the
+        oldest point available.
+
+    \retval mips_ExceptionAccessViolation A word written since the point
+        it needed to go back to is no longer writable, as for
+        \ref mips_cpu_reverse_step. The CPU is left where it was.
+
+    \retval mips_ErrorInvalidArgument The history is not turned on.
+*/
+mips_error mips_cpu_reverse_continue(
+    mips_cpu_h state    //!< Valid (non-empty) handle to a CPU
+);
+
+/*! @} */
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
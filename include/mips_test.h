@@ -5,6 +5,7 @@
 #define mips_test_header
 
 #include "mips_cpu.h"
+#include "mips_cpu_run.h"
 
 /* This allows the header to be used from both C and C++, so
 programs can be written in either (or both) languages. */
@@ -140,6 +141,51 @@ void mips_test_end_test(int testId, int passed, const char *msg);
 */
 void mips_test_end_suite();
 
+/*! Formats for \ref mips_test_add_report. */
+typedef enum _mips_test_report_format{
+    /*! One JSON object per line, per test. For example:
+    
+            {"id":3,"instruction":"ADDU","passed":true,"message":"","seconds":0.000012,"instructions":2}
+    
+        The last line is a summary, with the total counts and the slowest tests. */
+    mips_test_report_JsonLines=0,
+    
+    /*! JUnit style XML, as understood by most continuous integration
+        systems. The number of instructions is a property of each testcase. */
+    mips_test_report_JUnit=1
+}mips_test_report_format;
+
+/*! Asks for a machine readable report to be written as the tests run.
+
+    Each test is written to the file (and flushed) as soon as
+    mips_test_end_test is called, so if the test program crashes
+    part way through, all the tests which completed are still recorded.
+    
+    This can be called more than once to produce several reports, but
+    must be called before mips_test_begin_suite. As an alternative that
+    doesn't need the test program to change, mips_test_begin_suite also
+    looks at the environment variables MIPS_TEST_JSONL and MIPS_TEST_JUNIT,
+    and if they are set uses them as file names for the two formats.
+    
+    \param format Which format to write.
+    
+    \param fileName The file to create, or "-" for stdout.
+*/
+void mips_test_add_report(mips_test_report_format format, const char *fileName);
+
+/*! Tells the test framework which CPU the tests are running on.
+
+    If set, the framework records how many instructions the CPU
+    completed during each test (using \ref mips_cpu_get_instruction_count),
+    which appears in the reports. This can be changed at any time, for
+    example if a test creates its own CPU.
+    
+    It also turns on coverage for the CPU (see \ref mips_coverage), so
+    the summary can show tests which never executed the instruction they
+    name, branch directions which were never tested, and so on.
+*/
+void mips_test_set_cpu(mips_cpu_h cpu);
+
 /*! @} */    
     
 
@@ -1,36 +1,127 @@
 #include "mips.h"
+#include "mips_cpu_impl.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-struct mips_cpu_impl{
+#if defined(__unix__) || defined(__APPLE__)
+#define MIPS_CPU_POOL 1
+#include <pthread.h>
+#endif
 
-	uint32_t pc;
-	uint32_t pcN;
-	uint32_t regs[32];
+/* Freed CPUs are kept for re-use, as lots of short simulations
+   otherwise spend a surprising amount of time in malloc. Only the
+   state itself is kept, and anything it points at is freed as usual. */
+#ifdef MIPS_CPU_POOL
+#define MIPS_CPU_POOL_MAX 64
 
-	mips_mem_h mem;
-};
+static pthread_mutex_t sg_poolLock=PTHREAD_MUTEX_INITIALIZER;
+static mips_cpu_h sg_pool[MIPS_CPU_POOL_MAX];
+static unsigned sg_poolCount=0;
+#endif
+
+static mips_cpu_h mips_cpu_alloc(void)
+{
+	mips_cpu_h res=0;
+#ifdef MIPS_CPU_POOL
+	pthread_mutex_lock(&sg_poolLock);
+	if(sg_poolCount>0){
+		res=sg_pool[--sg_poolCount];
+	}
+	pthread_mutex_unlock(&sg_poolLock);
+	if(res)
+		return res;
+#endif
+	return (mips_cpu_h)malloc(sizeof(struct mips_cpu_impl));
+}
+
+static void mips_cpu_release(mips_cpu_h state)
+{
+#ifdef MIPS_CPU_POOL
+	pthread_mutex_lock(&sg_poolLock);
+	if(sg_poolCount<MIPS_CPU_POOL_MAX){
+		sg_pool[sg_poolCount++]=state;
+		state=0;
+	}
+	pthread_mutex_unlock(&sg_poolLock);
+#endif
+	free(state);
+}
 
 mips_cpu_h mips_cpu_create(mips_mem_h mem)
 {
-	unsigned i;
-	mips_cpu_h res=(mips_cpu_h)malloc(sizeof(struct mips_cpu_impl));
+	mips_cpu_h res=mips_cpu_alloc();
+	if(res==0)
+		return 0;
 
 	res->mem=mem;
 
-	res->pc=0;
-	res->pcN=4;	// NOTE: why does this make sense?
+	res->debugLevel=0;
+	res->debugDest=0;
 
+	res->hostcalls=0;
+
+	res->breakpoints=0;
+	res->watchPages=0;
+
+	res->journal=0;
+	res->history=0;
+	res->plugins=0;
+	res->coverage=0;
+	res->events=0;
+
+	res->fastForward=1;
+
+	mips_cpu_reset(res);
+
+	return res;
+}
+
+mips_error mips_cpu_reset(mips_cpu_h state)
+{
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	state->pc=0;
+	state->pcN=4;	// NOTE: why does this make sense?
+
+	for( i=0;i<32;i++){
+		state->regs[i]=0;
+	}
+	state->hi=0;
+	state->lo=0;
 	for( i=0;i<32;i++){
-		res->regs[i]=0;
+		state->fpr[i]=0;
 	}
+	state->fcsr=0;
 
-	return res;
+	state->instructions=0;
+	state->resumeFromStop=0;
+	state->notIdleLoop=1;	// Not a valid instruction address
+	state->delaySlot=1;
+	mips_cpu_journal_close(state);
+	if(state->history){
+		mips_cpu_history_clear(state);
+	}
+	mips_cpu_events_reset(state);
+
+	return mips_Success;
 }
 
 void mips_cpu_free(mips_cpu_h state)
 {
-	free(state);
+	if(state){
+		mips_cpu_hostcall_free(state);
+		mips_cpu_breakpoints_free(state);
+		mips_cpu_history_free(state);
+		mips_cpu_plugins_free(state);
+		mips_cpu_events_free(state);
+		free(state->coverage);
+		free(state->journal);
+		mips_cpu_release(state);
+	}
 }
 
 mips_error mips_cpu_get_register(
@@ -62,24 +153,1076 @@ mips_error mips_cpu_set_register(
 	if(index>=32)
 		return mips_ErrorInvalidArgument;
 
-	// TODO : What about register zero?
-	state->regs[index]=value;
+	// Register zero is hard-wired, so writes to it are lost
+	if(index!=0){
+		state->regs[index]=value;
+		if(mips_cpu_history_recording(state)){
+			mips_cpu_history_edited(state);
+		}
+	}
 
 	return mips_Success;
 }
 
-mips_error mips_cpu_step(mips_cpu_h state)
+mips_error mips_cpu_set_pc(
+	mips_cpu_h state,	//!< Valid (non-empty) handle to a CPU
+	uint32_t pc			//!< Address of the next instruction to exectute.
+)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	// The only sensible choice is that we are not in a delay slot
+	state->pc=pc;
+	state->pcN=pc+4;
+	state->resumeFromStop=0;
+	mips_cpu_journal_close(state);
+	if(state->history){
+		mips_cpu_history_clear(state);
+	}
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_pc(
+	mips_cpu_h state,	//!< Valid (non-empty) handle to a CPU
+	uint32_t *pc		//!< Where to write the byte address too
+)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(pc==0)
+		return mips_ErrorInvalidArgument;
+
+	*pc=state->pc;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_arch_state(mips_cpu_h state, mips_cpu_arch_state *arch)
+{
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(arch==0)
+		return mips_ErrorInvalidArgument;
+
+	arch->pc=state->pc;
+	arch->pcN=state->pcN;
+	for(i=0;i<32;i++){
+		arch->regs[i]=state->regs[i];
+	}
+	arch->hi=state->hi;
+	arch->lo=state->lo;
+	for(i=0;i<32;i++){
+		arch->fpr[i]=state->fpr[i];
+	}
+	arch->fcsr=state->fcsr;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_registers(mips_cpu_h state, const mips_cpu_arch_state *arch)
+{
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(arch==0)
+		return mips_ErrorInvalidArgument;
+
+	for(i=1;i<32;i++){
+		state->regs[i]=arch->regs[i];
+	}
+	state->hi=arch->hi;
+	state->lo=arch->lo;
+	for(i=0;i<32;i++){
+		state->fpr[i]=arch->fpr[i];
+	}
+	state->fcsr=arch->fcsr;
+	if(mips_cpu_history_recording(state)){
+		mips_cpu_history_edited(state);
+	}
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_arch_state(mips_cpu_h state, const mips_cpu_arch_state *arch)
+{
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(arch==0)
+		return mips_ErrorInvalidArgument;
+
+	state->pc=arch->pc;
+	state->pcN=arch->pcN;
+	state->regs[0]=0;
+	for(i=1;i<32;i++){
+		state->regs[i]=arch->regs[i];
+	}
+	state->hi=arch->hi;
+	state->lo=arch->lo;
+	for(i=0;i<32;i++){
+		state->fpr[i]=arch->fpr[i];
+	}
+	state->fcsr=arch->fcsr;
+	state->resumeFromStop=0;
+	mips_cpu_journal_close(state);
+	if(state->history){
+		mips_cpu_history_clear(state);
+	}
+
+	return mips_Success;
+}
+
+/* Transfers are whole aligned words, so all accesses go through
+   these, and anything narrower than a word is extracted from (or
+   merged into) the containing word. The memory does the conversion
+   from big-endian, as it may be able to avoid it altogether. */
+
+static mips_error mips_cpu_read_word(mips_cpu_h state, uint32_t address, uint32_t *value)
+{
+	return mips_mem_read_word(state->mem, address, value);
+}
+
+/* Instruction fetch, which needs execute rather than read permission */
+static mips_error mips_cpu_fetch_word(mips_cpu_h state, uint32_t address, uint32_t *value)
+{
+	return mips_mem_fetch_word(state->mem, address, value);
+}
+
+static mips_error mips_cpu_store_word(mips_cpu_h state, uint32_t address, uint32_t value)
+{
+	return mips_mem_write_word(state->mem, address, value);
+}
+
+/* Converts a mask of bits within a word into byte-enables, where
+   byte 0 is at the lowest address (i.e. the most significant). */
+static uint32_t mips_cpu_byte_enables(uint32_t mask)
+{
+	return ((mask>>24)&1) | ((mask>>15)&2) | ((mask>>6)&4) | ((mask<<3)&8);
+}
+
+/* Reads just the bytes selected by mask from the word at address.
+   The other bytes of value are zero. */
+static mips_error mips_cpu_read_masked(mips_cpu_h state, uint32_t address, uint32_t mask, uint32_t *value)
+{
+	uint8_t b[4]={0, 0, 0, 0};
+	mips_error err=mips_mem_read_masked(state->mem, address, 4, b, mips_cpu_byte_enables(mask));
+	if(err)
+		return err;
+	*value=((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+	return mips_Success;
+}
+
+mips_error mips_cpu_read_old_word(mips_mem_h mem, uint32_t address, uint32_t *value)
+{
+	uint8_t b[4]={0, 0, 0, 0};
+	unsigned i;
+	mips_error err=mips_mem_read_word(mem, address, value);
+
+	if(err!=mips_ExceptionUninitialisedRead)
+		return err;
+	// The unwritten bytes are zero, and the others have to be read one by one
+	for(i=0;i<4;i++){
+		err=mips_mem_read_masked(mem, address, 4, b, 1u<<i);
+		if(err && err!=mips_ExceptionUninitialisedRead)
+			return err;
+	}
+	*value=((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+	return mips_Success;
+}
+
+/* Records the old value of a word which has just been written. Only
+   writes which succeeded are logged, so undoing the log never has to
+   write anywhere the program didn't. */
+static void mips_cpu_log_write(mips_cpu_h state, uint32_t address, uint32_t old)
+{
+	if(state->journal){
+		mips_cpu_journal_record(state->journal, 1, address, old);
+	}
+	if(mips_cpu_history_recording(state)){
+		mips_cpu_history_record(state, address, old);
+	}
+}
+
+static mips_error mips_cpu_write_word(mips_cpu_h state, uint32_t address, uint32_t value)
+{
+	uint32_t old;
+	mips_error err;
+
+	if(state->journal || state->history){
+		err=mips_cpu_read_old_word(state->mem, address, &old);
+		if(!err)
+			err=mips_cpu_store_word(state, address, value);
+		if(!err)
+			mips_cpu_log_write(state, address, old);
+		return err;
+	}
+	return mips_cpu_store_word(state, address, value);
+}
+
+/* Replaces the bytes selected by mask in the word at address, as
+   a single transaction with byte-enables. */
+static mips_error mips_cpu_write_masked(mips_cpu_h state, uint32_t address, uint32_t value, uint32_t mask)
+{
+	uint8_t b[4];
+	uint32_t old=0;
+	int logged=state->journal || state->history;
+	mips_error err;
+
+	if(logged){
+		err=mips_cpu_read_old_word(state->mem, address, &old);
+		if(err)
+			return err;
+	}
+	b[0]=(uint8_t)(value>>24);
+	b[1]=(uint8_t)(value>>16);
+	b[2]=(uint8_t)(value>>8);
+	b[3]=(uint8_t)value;
+	err=mips_mem_write_masked(state->mem, address, 4, b, mips_cpu_byte_enables(mask));
+	if(!err && logged)
+		mips_cpu_log_write(state, address, old);
+	return err;
+}
+
+/* Stores a doubleword as a single transaction, so that if any of it
+   fails then none of it is written. first goes at the lower address. */
+static mips_error mips_cpu_write_double(mips_cpu_h state, uint32_t address, uint32_t first, uint32_t second)
+{
+	uint8_t b[8];
+	uint32_t old[2]={0, 0};
+	int logged=state->journal || state->history;
+	unsigned i;
+	mips_error err;
+
+	if(logged){
+		err=mips_cpu_read_old_word(state->mem, address, old);
+		if(!err)
+			err=mips_cpu_read_old_word(state->mem, address+4, old+1);
+		if(err)
+			return err;
+	}
+	for(i=0;i<4;i++){
+		b[i]=(uint8_t)(first>>(24-8*i));
+		b[4+i]=(uint8_t)(second>>(24-8*i));
+	}
+	err=mips_mem_write(state->mem, address, 8, b);
+	if(!err && logged){
+		mips_cpu_log_write(state, address, old[0]);
+		mips_cpu_log_write(state, address+4, old[1]);
+	}
+	return err;
+}
+
+static void mips_cpu_trace(mips_cpu_h state, uint32_t instr)
+{
+	unsigned i;
+	char text[48];
+
+	mips_isa_disassemble(instr, state->pc, text, sizeof(text));
+	fprintf(state->debugDest, "pc=0x%08x, instr=0x%08x  %s\n", state->pc, instr, text);
+	if(state->debugLevel>1){
+		for(i=0;i<32;i++){
+			fprintf(state->debugDest, "  r%-2u=0x%08x%s", i, state->regs[i], (i%4)==3 ? "\n" : "");
+		}
+		fprintf(state->debugDest, "  hi =0x%08x  lo =0x%08x  pcN=0x%08x\n", state->hi, state->lo, state->pcN);
+	}
+}
+
+/* Sets the bits for an instruction which has completed. */
+static void mips_cpu_record_coverage(mips_cpu_coverage *c, mips_isa_op op, uint32_t instr, int inDelaySlot, int taken)
+{
+	uint32_t opcode=instr>>26, funct=instr&0x3F, rt=(instr>>16)&0x1F;
+	uint64_t opBit=1ull<<(op%64);
+
+	c->ops[op/64] |= opBit;
+	if(taken==1){
+		c->opsTaken[op/64] |= opBit;
+	}else if(taken==0){
+		c->opsNotTaken[op/64] |= opBit;
+	}
+	if(inDelaySlot){
+		c->opsInDelaySlot[op/64] |= opBit;
+	}
+
+	c->opcodes |= 1ull<<opcode;
+	if(opcode==0){
+		c->special |= 1ull<<funct;
+	}else if(opcode==1){
+		c->regimm |= 1u<<rt;
+	}
+
+	if(taken==1){
+		if(opcode==1){
+			c->regimmTaken |= 1u<<rt;
+		}else{
+			c->taken |= 1ull<<opcode;
+		}
+	}else if(taken==0){
+		if(opcode==1){
+			c->regimmNotTaken |= 1u<<rt;
+		}else{
+			c->notTaken |= 1ull<<opcode;
+		}
+	}
+
+	if(inDelaySlot){
+		c->delaySlotOpcodes |= 1ull<<opcode;
+		if(opcode==0){
+			c->delaySlotSpecial |= 1ull<<funct;
+		}
+	}
+}
+
+static void mips_cpu_plugin_notify(
+	mips_cpu_h state,
+	mips_plugin_kind kind,
+	uint32_t instr,
+	uint32_t address,
+	uint32_t length,
+	uint32_t value
+){
+	mips_plugin_event e;
+	e.kind=kind;
+	e.pc=state->pc;
+	e.instr=instr;
+	e.address=address;
+	e.length=length;
+	e.value=value;
+	e.error=mips_Success;
+	mips_cpu_plugin_deliver(state, &e);
+}
+
+/* Checks a load or store on a page with watchpoints. Instructions
+   which are invalid, misaligned, or would fail in the memory are let
+   through, so that they raise their exception rather than stopping
+   first and raising it when resumed. */
+static mips_error mips_cpu_watch_access(mips_cpu_h state, mips_isa_op op, uint32_t rt, uint32_t addr)
+{
+	uint32_t length, first, last;
+	unsigned perms, need;
+
+	switch(op){
+	case mips_isa_LB: case mips_isa_LBU: case mips_isa_SB:
+		length=1;
+		break;
+	case mips_isa_LH: case mips_isa_LHU: case mips_isa_SH:
+		length=2;
+		break;
+	case mips_isa_LW: case mips_isa_SW: case mips_isa_LWC1: case mips_isa_SWC1:
+		length=4;
+		break;
+	case mips_isa_LWL: case mips_isa_LWR: case mips_isa_SWL: case mips_isa_SWR:
+		// These touch part of the word, and are never misaligned
+		addr&=~3u;
+		length=4;
+		break;
+	case mips_isa_LDC1: case mips_isa_SDC1:
+		if(rt&1)
+			return mips_Success;
+		length=8;
+		break;
+	default:
+		return mips_Success;
+	}
+	if(addr&(length-1))
+		return mips_Success;
+
+	// The access is within one page, as it is aligned
+	need = mips_isa_instructions[op].kind==mips_isa_class_Store ? mips_mem_perm_Write : mips_mem_perm_Read;
+	first=addr&~3u;
+	last=(addr+length-1)&~3u;
+	if(mips_mem_get_permissions(state->mem, first, &perms) || !(perms&need)
+		|| mips_mem_get_permissions(state->mem, last+3, &perms))
+		return mips_Success;
+
+	return mips_cpu_watch_check(state, addr, length, need==mips_mem_perm_Write);
+}
+
+/* Executes one instruction, with the same semantics as mips_cpu_step */
+static mips_error mips_cpu_execute_one(mips_cpu_h state)
+{
+	uint32_t instr, opcode, rs, rt, rd, shift, uimm, simm, target;
+	mips_isa_op op;
+	uint32_t a, b, addr=0, length=0, word, res=0;
+	unsigned dst=0;			// Register to write res to, or zero for none
+	uint32_t pcNN;			// Value that pcN will take afterwards
+	int taken=-1;			// Whether a branch was taken
+	int isBranch;
+	mips_error err;
+
+	// Fetch
+	err=mips_cpu_fetch_word(state, state->pc, &instr);
+	if(err)
+		return err;
+
+	// Decode. The instruction comes from the table in mips_isa.h, and
+	// then everything gets pulled out, even though only some of the
+	// fields make sense for any given instruction.
+	op=mips_isa_decode(instr);
+	opcode=instr>>26;
+	rs=(instr>>21)&0x1F;
+	rt=(instr>>16)&0x1F;
+	rd=(instr>>11)&0x1F;
+	shift=(instr>>6)&0x1F;
+	uimm=instr&0xFFFF;
+	simm=(uint32_t)(int32_t)(int16_t)uimm;
+	target=(state->pcN&0xF0000000) | ((instr&0x03FFFFFF)<<2);
+
+	a=state->regs[rs];
+	b=state->regs[rt];
+
+	// Branch targets are relative to the delay slot
+	pcNN=state->pcN+4;
+
+	// Everything from 0x20 up is a load or store, and from 0x30 up
+	// they are to or from COP1
+	if(opcode>=0x20){
+		addr=a+simm;
+		if(opcode>=0x30){
+			length = (opcode&4) ? 8 : 4;
+		}else{
+			length = (opcode&3)==0 ? 1 : (opcode&3)==1 ? 2 : 4;
+		}
+		if(state->watchPages && mips_cpu_watch_armed(state->watchPages, addr)){
+			err=mips_cpu_watch_access(state, op, rt, addr);
+			if(err)
+				return err;
+		}
+	}
+
+	// Only once a watchpoint can't stop it first, so that an instruction
+	// is never traced or reported twice when the run resumes
+	if(state->debugLevel>0){
+		mips_cpu_trace(state, instr);
+	}
+	if(mips_cpu_plugin_wants(state, mips_plugin_Execute)){
+		mips_cpu_plugin_notify(state, mips_plugin_Execute, instr, 0, 0, 0);
+	}
+
+	// Execute. Anything which could fail has to happen before any state
+	// is modified, so that an exception leaves the CPU unchanged.
+	switch(op){
+	case mips_isa_SLL: dst=rd; res=b<<shift; break;
+	case mips_isa_SRL: dst=rd; res=b>>shift; break;
+	case mips_isa_SRA: dst=rd; res=(uint32_t)((int32_t)b>>shift); break;
+	case mips_isa_SLLV: dst=rd; res=b<<(a&0x1F); break;
+	case mips_isa_SRLV: dst=rd; res=b>>(a&0x1F); break;
+	case mips_isa_SRAV: dst=rd; res=(uint32_t)((int32_t)b>>(a&0x1F)); break;
+	case mips_isa_JR:
+		pcNN=a;
+		break;
+	case mips_isa_JALR:
+		dst=rd;
+		res=state->pc+8;
+		pcNN=a;
+		break;
+	case mips_isa_SYSCALL:
+		err=mips_cpu_hostcall(state, mips_hostcall_Syscall, state->regs[2]);
+		if(err)
+			return err;
+		break;
+	case mips_isa_BREAK:
+		err=mips_cpu_hostcall(state, mips_hostcall_Break, (instr>>6)&0xFFFFF);
+		if(err)
+			return err;
+		break;
+	case mips_isa_MFHI: dst=rd; res=state->hi; break;
+	case mips_isa_MTHI: state->hi=a; break;
+	case mips_isa_MFLO: dst=rd; res=state->lo; break;
+	case mips_isa_MTLO: state->lo=a; break;
+	case mips_isa_MULT:
+	{
+		int64_t p=(int64_t)(int32_t)a * (int64_t)(int32_t)b;
+		state->hi=(uint32_t)((uint64_t)p>>32);
+		state->lo=(uint32_t)p;
+		break;
+	}
+	case mips_isa_MULTU:
+	{
+		uint64_t p=(uint64_t)a * (uint64_t)b;
+		state->hi=(uint32_t)(p>>32);
+		state->lo=(uint32_t)p;
+		break;
+	}
+	case mips_isa_DIV:
+		// Division by zero is UNPREDICTABLE, so HI/LO are left alone
+		if(b!=0){
+			if(a==0x80000000u && b==0xFFFFFFFFu){
+				state->lo=0x80000000u;
+				state->hi=0;
+			}else{
+				state->lo=(uint32_t)((int32_t)a / (int32_t)b);
+				state->hi=(uint32_t)((int32_t)a % (int32_t)b);
+			}
+		}
+		break;
+	case mips_isa_DIVU:
+		if(b!=0){
+			state->lo=a/b;
+			state->hi=a%b;
+		}
+		break;
+	case mips_isa_ADD:
+		dst=rd;
+		res=a+b;
+		if( ((a^res)&(b^res)) >> 31 )
+			return mips_ExceptionArithmeticOverflow;
+		break;
+	case mips_isa_ADDU: dst=rd; res=a+b; break;
+	case mips_isa_SUB:
+		dst=rd;
+		res=a-b;
+		if( ((a^b)&(a^res)) >> 31 )
+			return mips_ExceptionArithmeticOverflow;
+		break;
+	case mips_isa_SUBU: dst=rd; res=a-b; break;
+	case mips_isa_AND: dst=rd; res=a&b; break;
+	case mips_isa_OR: dst=rd; res=a|b; break;
+	case mips_isa_XOR: dst=rd; res=a^b; break;
+	case mips_isa_NOR: dst=rd; res=~(a|b); break;
+	case mips_isa_SLT: dst=rd; res=(int32_t)a < (int32_t)b; break;
+	case mips_isa_SLTU: dst=rd; res=a < b; break;
+
+	case mips_isa_BLTZ:
+	case mips_isa_BGEZ:
+	case mips_isa_BLTZAL:
+	case mips_isa_BGEZAL:
+		taken=(rt&1) ? ((int32_t)a>=0) : ((int32_t)a<0);
+		if(rt&0x10){
+			// The link happens whether or not the branch is taken
+			dst=31;
+			res=state->pc+8;
+		}
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+
+	case mips_isa_J:
+		pcNN=target;
+		break;
+	case mips_isa_JAL:
+		dst=31;
+		res=state->pc+8;
+		pcNN=target;
+		break;
+
+	case mips_isa_BEQ:
+		taken = a==b;
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+	case mips_isa_BNE:
+		taken = a!=b;
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+	case mips_isa_BLEZ:
+		taken = (int32_t)a<=0;
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+	case mips_isa_BGTZ:
+		taken = (int32_t)a>0;
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+
+	case mips_isa_ADDI:
+		dst=rt;
+		res=a+simm;
+		if( ((a^res)&(simm^res)) >> 31 )
+			return mips_ExceptionArithmeticOverflow;
+		break;
+	case mips_isa_ADDIU: dst=rt; res=a+simm; break;
+	case mips_isa_SLTI: dst=rt; res=(int32_t)a < (int32_t)simm; break;
+	case mips_isa_SLTIU: dst=rt; res=a < simm; break;
+	case mips_isa_ANDI: dst=rt; res=a&uimm; break;
+	case mips_isa_ORI: dst=rt; res=a|uimm; break;
+	case mips_isa_XORI: dst=rt; res=a^uimm; break;
+	case mips_isa_LUI: dst=rt; res=uimm<<16; break;
+
+	case mips_isa_LB:
+	case mips_isa_LBU:
+		shift=8*(3-(addr&3));
+		err=mips_cpu_read_masked(state, addr&~3u, 0xFFu<<shift, &word);
+		if(err)
+			return err;
+		res=(word>>shift)&0xFF;
+		if(op==mips_isa_LB)
+			res=(uint32_t)(int32_t)(int8_t)res;
+		dst=rt;
+		break;
+	case mips_isa_LH:
+	case mips_isa_LHU:
+		if(addr&1)
+			return mips_ExceptionInvalidAlignment;
+		shift=8*(2-(addr&2));
+		err=mips_cpu_read_masked(state, addr&~3u, 0xFFFFu<<shift, &word);
+		if(err)
+			return err;
+		res=(word>>shift)&0xFFFF;
+		if(op==mips_isa_LH)
+			res=(uint32_t)(int32_t)(int16_t)res;
+		dst=rt;
+		break;
+	case mips_isa_LW:
+		if(addr&3)
+			return mips_ExceptionInvalidAlignment;
+		err=mips_cpu_read_word(state, addr, &res);
+		if(err)
+			return err;
+		dst=rt;
+		break;
+	case mips_isa_LWL:
+		// The addressed byte and those after it go into the top of rt
+		shift=8*(addr&3);
+		err=mips_cpu_read_masked(state, addr&~3u, 0xFFFFFFFFu>>shift, &word);
+		if(err)
+			return err;
+		res=(word<<shift) | (b & ~(0xFFFFFFFFu<<shift));
+		dst=rt;
+		break;
+	case mips_isa_LWR:
+		// The addressed byte and those before it go into the bottom of rt
+		shift=8*(3-(addr&3));
+		err=mips_cpu_read_masked(state, addr&~3u, 0xFFFFFFFFu<<shift, &word);
+		if(err)
+			return err;
+		res=(word>>shift) | (b & ~(0xFFFFFFFFu>>shift));
+		dst=rt;
+		break;
+
+	case mips_isa_SB:
+		shift=8*(3-(addr&3));
+		err=mips_cpu_write_masked(state, addr&~3u, b<<shift, 0xFFu<<shift);
+		if(err)
+			return err;
+		break;
+	case mips_isa_SH:
+		if(addr&1)
+			return mips_ExceptionInvalidAlignment;
+		shift=8*(2-(addr&2));
+		err=mips_cpu_write_masked(state, addr&~3u, b<<shift, 0xFFFFu<<shift);
+		if(err)
+			return err;
+		break;
+	case mips_isa_SW:
+		if(addr&3)
+			return mips_ExceptionInvalidAlignment;
+		err=mips_cpu_write_word(state, addr, b);
+		if(err)
+			return err;
+		break;
+	case mips_isa_SWL:
+		shift=8*(addr&3);
+		err=mips_cpu_write_masked(state, addr&~3u, b>>shift, 0xFFFFFFFFu>>shift);
+		if(err)
+			return err;
+		break;
+	case mips_isa_SWR:
+		shift=8*(3-(addr&3));
+		err=mips_cpu_write_masked(state, addr&~3u, b<<shift, 0xFFFFFFFFu<<shift);
+		if(err)
+			return err;
+		break;
+
+	case mips_isa_MFC1: dst=rt; res=state->fpr[rd]; break;
+	case mips_isa_MTC1: mips_cpu_write_fpr(state, rd, b); break;
+	case mips_isa_CFC1:
+		// Only FIR and FCSR
+		if(rd==0){
+			res=0x00130000u;	// W, D and S
+		}else if(rd==31){
+			res=state->fcsr;
+		}else{
+			return mips_ExceptionInvalidInstruction;
+		}
+		dst=rt;
+		break;
+	case mips_isa_CTC1:
+		if(rd!=31)
+			return mips_ExceptionInvalidInstruction;
+		state->fcsr=b&0xFE83FFFFu;	// FS and bits 22..18 read as zero
+		break;
+	case mips_isa_BC1F:
+	case mips_isa_BC1T:
+		taken = ((state->fcsr>>23)&1)==(rt&1);
+		if(taken)
+			pcNN=state->pcN+(simm<<2);
+		break;
+
+	case mips_isa_LWC1:
+		if(addr&3)
+			return mips_ExceptionInvalidAlignment;
+		err=mips_cpu_read_word(state, addr, &res);
+		if(err)
+			return err;
+		mips_cpu_write_fpr(state, rt, res);
+		break;
+	case mips_isa_LDC1:
+		// The most significant word is first in memory, and goes in the odd register
+		if(addr&7)
+			return mips_ExceptionInvalidAlignment;
+		if(rt&1)
+			return mips_ExceptionInvalidInstruction;
+		err=mips_cpu_read_word(state, addr, &word);
+		if(!err)
+			err=mips_cpu_read_word(state, addr+4, &res);
+		if(err)
+			return err;
+		mips_cpu_write_fpr(state, rt+1, word);
+		mips_cpu_write_fpr(state, rt, res);
+		break;
+	case mips_isa_SWC1:
+		if(addr&3)
+			return mips_ExceptionInvalidAlignment;
+		err=mips_cpu_write_word(state, addr, state->fpr[rt]);
+		if(err)
+			return err;
+		break;
+	case mips_isa_SDC1:
+		if(addr&7)
+			return mips_ExceptionInvalidAlignment;
+		if(rt&1)
+			return mips_ExceptionInvalidInstruction;
+		err=mips_cpu_write_double(state, addr, state->fpr[rt+1], state->fpr[rt]);
+		if(err)
+			return err;
+		break;
+
+	default:
+		if(mips_isa_instructions[op].kind!=mips_isa_class_Float)
+			return mips_ExceptionInvalidInstruction;
+		err=mips_cpu_fpu_execute(state, op, instr);
+		if(err)
+			return err;
+		break;
+	}
+
+	// Writeback
+	isBranch = mips_isa_instructions[op].kind==mips_isa_class_Branch
+		|| mips_isa_instructions[op].kind==mips_isa_class_Jump;
+	if(state->journal){
+		if(dst!=0){
+			mips_cpu_journal_record(state->journal, 0, dst, state->regs[dst]);
+		}
+		// Branches and jumps keep the group open for their delay slot
+		state->journal->inDelaySlot=isBranch;
+	}
+	if(dst!=0){
+		state->regs[dst]=res;
+	}
+	if(state->coverage){
+		// Not-taken branches, and branches to pc+8, still have a delay slot
+		mips_cpu_record_coverage(state->coverage, op, instr, state->pc==state->delaySlot, taken);
+		state->delaySlot = isBranch ? state->pc+4 : 1;
+	}
+	if(state->plugins){
+		if(opcode>=0x20){
+			mips_plugin_kind kind = (opcode&0x08) ? mips_plugin_Write : mips_plugin_Read;
+			if(mips_cpu_plugin_wants(state, kind)){
+				uint32_t value = opcode>=0x30 ? state->fpr[rt+(length==8)] : (opcode&0x08) ? b : res;
+				mips_cpu_plugin_notify(state, kind, instr, length>=4 ? addr&~3u : addr, length, value);
+			}
+		}else if(pcNN!=state->pcN+4 && mips_cpu_plugin_wants(state, mips_plugin_Branch)){
+			mips_cpu_plugin_notify(state, mips_plugin_Branch, instr, pcNN, 0, 0);
+		}
+		if(state->plugins->kinds & (mips_plugin_Call|mips_plugin_Return)){
+			if(op==mips_isa_JAL || op==mips_isa_JALR
+				|| ((op==mips_isa_BGEZAL || op==mips_isa_BLTZAL) && taken)){
+				if(mips_cpu_plugin_wants(state, mips_plugin_Call)){
+					mips_cpu_plugin_notify(state, mips_plugin_Call, instr, pcNN, 0, 0);
+				}
+			}else if(op==mips_isa_JR && rs==31 && mips_cpu_plugin_wants(state, mips_plugin_Return)){
+				mips_cpu_plugin_notify(state, mips_plugin_Return, instr, pcNN, 0, 0);
+			}
+		}
+	}
+	state->pc=state->pcN;
+	state->pcN=pcNN;
+	state->instructions++;
+
+	return mips_Success;
+}
+
+/* Starts a new journal group, unless the next instruction is in the
+   delay slot of the last one. */
+static void mips_cpu_journal_begin(mips_cpu_h state)
+{
+	struct mips_journal *j=state->journal;
+
+	// Branches in delay slots are UNPREDICTABLE, so a chain of
+	// them only needs to be rolled back to the last one
+	if(j->inDelaySlot && j->count+2<=MIPS_JOURNAL_MAX)
+		return;
+
+	j->pc=state->pc;
+	j->pcN=state->pcN;
+	j->hi=state->hi;
+	j->lo=state->lo;
+	j->fcsr=state->fcsr;
+	j->instructions=state->instructions;
+	j->inDelaySlot=0;
+	j->count=0;
+}
+
+/* Undoes everything since the start of the group. */
+static void mips_cpu_journal_rollback(mips_cpu_h state)
+{
+	struct mips_journal *j=state->journal;
+
+	while(j->count>0){
+		const struct mips_journal_entry *e=j->entries+(--j->count);
+		if(e->isMem){
+			// Only writes which succeeded are logged, so this can't fail
+			mips_cpu_store_word(state, e->where, e->old);
+		}else if(e->where<32){
+			state->regs[e->where]=e->old;
+		}else{
+			state->fpr[e->where-32]=e->old;
+		}
+	}
+	state->pc=j->pc;
+	state->pcN=j->pcN;
+	state->hi=j->hi;
+	state->lo=j->lo;
+	state->fcsr=j->fcsr;
+	state->instructions=j->instructions;
+	j->inDelaySlot=0;
+}
+
+void mips_cpu_journal_close(mips_cpu_h state)
+{
+	if(state->journal){
+		state->journal->inDelaySlot=0;
+		state->journal->count=0;
+	}
+}
+
+/* Reports an exception from the instruction at pc, once the
+   CPU is back in the state from before it. */
+static void mips_cpu_plugin_exception(mips_cpu_h state, uint32_t pc, mips_error err)
+{
+	mips_plugin_event e;
+	uint32_t instr=0;
+
+	mips_cpu_fetch_word(state, pc, &instr);
+	e.kind=mips_plugin_Exception;
+	e.pc=pc;
+	e.instr=instr;
+	e.address=0;
+	e.length=0;
+	e.value=0;
+	e.error=err;
+	mips_cpu_plugin_deliver(state, &e);
+}
+
+mips_error mips_cpu_execute(mips_cpu_h state)
 {
+	mips_error err;
 	uint32_t pc=state->pc;
 
+	if(mips_cpu_history_recording(state) && (state->history->forceSnapshot || state->instructions>=state->history->nextSnapshot)){
+		mips_cpu_history_snapshot(state);
+	}
+
+	if(state->journal==0){
+		err=mips_cpu_execute_one(state);
+	}else{
+		mips_cpu_journal_begin(state);
+		err=mips_cpu_execute_one(state);
+		// Only exceptions are rolled back. Stops (breakpoints, exit, ...)
+		// happen before the instruction has any effect, and it will be
+		// tried again, so the group stays open.
+		if((err&0xF000)==0x2000){
+			mips_cpu_journal_rollback(state);
+		}
+	}
+
+	if((err&0xF000)==0x2000){
+		if(state->coverage){
+			uint32_t instr;
+			state->coverage->exceptions |= 1u<<(err&0x1F);
+			if(mips_cpu_fetch_word(state, pc, &instr)==mips_Success){
+				mips_isa_op op=mips_isa_decode(instr);
+				state->coverage->opsRaised[op/64] |= 1ull<<(op%64);
+				state->coverage->exceptionOpcodes |= 1ull<<(instr>>26);
+				if((instr>>26)==0){
+					state->coverage->exceptionSpecial |= 1ull<<(instr&0x3F);
+				}
+			}
+		}
+		if(mips_cpu_plugin_wants(state, mips_plugin_Exception)){
+			mips_cpu_plugin_exception(state, pc, err);
+		}
+	}
+	return err;
+}
+
+mips_error mips_cpu_step(mips_cpu_h state)
+{
 	if(state==0)
 		return mips_ErrorInvalidHandle;
 
-	//TODO: Here is where the magic happens
-	// - Fetch the instruction from memory (mips_mem_read)
-	// - Decode the instruction (is it R, I, J)?
-	// - Execute the instruction (do maths, access memory, ...)
-	// - Writeback the results (update registers, advance pc)
+	state->resumeFromStop=0;
+	if(state->instructions>=state->nextEvent){
+		mips_error err=mips_cpu_dispatch_events(state);
+		if(err)
+			return err;
+	}
+	return mips_cpu_execute(state);
+}
+
+mips_error mips_cpu_run(mips_cpu_h state, uint64_t maxSteps, uint64_t *stepsDone)
+{
+	uint64_t start, end;
+	const struct mips_breakpoints *bp;
+	int skipFirst;
+	mips_error err=mips_Success;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
 
-	return mips_ErrorNotImplemented;
+	start=state->instructions;
+	end = maxSteps > UINT64_MAX-start ? UINT64_MAX : start+maxSteps;
+
+	// If the last run stopped at a breakpoint or watchpoint, then the
+	// instruction it stopped at goes through, so that we can continue
+	skipFirst=state->resumeFromStop;
+	state->resumeFromStop=0;
+
+	bp=state->breakpoints;
+	if(bp && (bp->pcCount>0 || bp->watchCount>0)){
+		state->breakpoints->hit=0;
+		if(skipFirst && state->instructions<end){
+			err=mips_cpu_execute(state);
+		}
+		while(!err && state->instructions<end){
+			if(state->instructions>=state->nextEvent){
+				err=mips_cpu_dispatch_events(state);
+				if(err)
+					break;
+			}
+			// Host calls, plugins and events can change or free the
+			// breakpoints, so they are looked up again every time
+			bp=state->breakpoints;
+			state->watchPages = bp && bp->watchCount>0 ? bp->watchPages : 0;
+			if(bp && bp->pcCount>0 && mips_cpu_breakpoint_test(bp, state->pc)){
+				err=mips_StopBreakpoint;
+				break;
+			}
+			err=mips_cpu_execute(state);
+		}
+		state->watchPages=0;
+		if(err==mips_StopBreakpoint || err==mips_StopWatchpoint){
+			state->resumeFromStop=1;
+		}
+	}else{
+		while(!err && state->instructions<end){
+			// The only check needed for any number of devices
+			if(state->instructions>=state->nextEvent){
+				err=mips_cpu_dispatch_events(state);
+				if(err)
+					break;
+			}
+			err=mips_cpu_execute(state);
+			// A backward branch was just taken, so this may be an idle loop
+			if(!err && state->pcN<=state->pc){
+				err=mips_cpu_fast_forward(state, end);
+			}
+		}
+	}
+
+	if(stepsDone){
+		// A rollback can go back past the start of this run
+		*stepsDone = state->instructions>start ? state->instructions-start : 0;
+	}
+	return err;
+}
+
+mips_error mips_cpu_set_journaled(mips_cpu_h state, int enable)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	if(enable && state->journal==0){
+		state->journal=(struct mips_journal*)calloc(1, sizeof(struct mips_journal));
+		if(state->journal==0)
+			return mips_ErrorOutOfMemory;
+	}else if(!enable){
+		free(state->journal);
+		state->journal=0;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_coverage(mips_cpu_h state, int enable)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	if(enable){
+		if(state->coverage==0){
+			state->coverage=(mips_cpu_coverage*)malloc(sizeof(mips_cpu_coverage));
+			if(state->coverage==0)
+				return mips_ErrorInvalidArgument;
+		}
+		memset(state->coverage, 0, sizeof(mips_cpu_coverage));
+		state->delaySlot=1;
+	}else{
+		free(state->coverage);
+		state->coverage=0;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_coverage(mips_cpu_h state, mips_cpu_coverage *coverage)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(coverage==0 || state->coverage==0)
+		return mips_ErrorInvalidArgument;
+
+	*coverage=*state->coverage;
+	return mips_Success;
+}
+
+mips_error mips_cpu_clear_coverage(mips_cpu_h state)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	if(state->coverage){
+		memset(state->coverage, 0, sizeof(mips_cpu_coverage));
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_instruction_count(mips_cpu_h state, uint64_t *count)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(count==0)
+		return mips_ErrorInvalidArgument;
+
+	*count=state->instructions;
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_debug_level(mips_cpu_h state, unsigned level, FILE *dest)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(level>0 && dest==0)
+		return mips_ErrorInvalidArgument;
+
+	state->debugLevel=level;
+	state->debugDest=dest;
+
+	return mips_Success;
 }
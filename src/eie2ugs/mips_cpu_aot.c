@@ -0,0 +1,153 @@
+/* Implementation of mips_cpu_run_translated from mips_aot.h.
+   The translated code runs on a copy of the registers, and
+   anything it hands back is done by the interpreter.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+/* True if any breakpoint is set in [begin,end). */
+static int mips_cpu_breakpoints_between(const struct mips_breakpoints *bp, uint32_t begin, uint32_t end)
+{
+	uint32_t pc;
+
+	if(bp==0 || bp->pcCount==0)
+		return 0;
+
+	for(pc=begin&~3u; pc<end && pc>=(begin&~3u); ){
+		const struct mips_breakpoint_dir *d=bp->dirs[pc>>22];
+		if(d==0){
+			pc=(pc|0x3FFFFF)+1;		// Skip the whole directory
+			continue;
+		}
+		if(d->pages[(pc>>12)&0x3FF]==0){
+			pc=(pc|0xFFF)+1;
+			continue;
+		}
+		if(mips_cpu_breakpoint_test(bp, pc))
+			return 1;
+		pc+=4;
+	}
+	return 0;
+}
+
+/* True if any page of the image can't be executed, as translated
+   code doesn't fetch its instructions. */
+static int mips_cpu_image_protected(mips_mem_h mem, uint32_t begin, uint32_t end)
+{
+	uint32_t page;
+	unsigned perms;
+
+	for(page=begin&~(MIPS_MEM_PAGE_SIZE-1); page<end && page>=(begin&~(MIPS_MEM_PAGE_SIZE-1)); page+=MIPS_MEM_PAGE_SIZE){
+		if(mips_mem_get_permissions(mem, page, &perms) || !(perms & mips_mem_perm_Execute))
+			return 1;
+	}
+	return 0;
+}
+
+/* True if something is watching the CPU in a way that translated
+   code would not notice. */
+static int mips_cpu_translation_blocked(mips_cpu_h state, const mips_aot_module *module)
+{
+	if(state->journal || state->history || state->coverage || state->debugLevel>0)
+		return 1;
+	if(state->plugins && state->plugins->kinds)
+		return 1;
+	if(mips_cpu_image_protected(state->mem, module->base, module->base+module->length))
+		return 1;
+	if(state->breakpoints){
+		if(state->breakpoints->watchCount>0)
+			return 1;
+		if(mips_cpu_breakpoints_between(state->breakpoints, module->base, module->base+module->length))
+			return 1;
+	}
+	return 0;
+}
+
+mips_error mips_cpu_run_translated(
+	mips_cpu_h state,
+	const mips_aot_module *module,
+	uint64_t maxSteps,
+	uint64_t *stepsDone
+){
+	uint64_t start, end;
+	int skipFirst;
+	unsigned i;
+	mips_aot_context ctx;
+	const struct mips_breakpoints *bp;
+	mips_error err=mips_Success;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(module==0 || module->version!=MIPS_AOT_VERSION)
+		return mips_ErrorInvalidArgument;
+
+	if(mips_cpu_translation_blocked(state, module))
+		return mips_cpu_run(state, maxSteps, stepsDone);
+
+	start=state->instructions;
+	end = maxSteps > UINT64_MAX-start ? UINT64_MAX : start+maxSteps;
+
+	skipFirst=state->resumeFromStop;
+	state->resumeFromStop=0;
+	bp = (state->breakpoints && state->breakpoints->pcCount>0) ? state->breakpoints : 0;
+	if(bp){
+		state->breakpoints->hit=0;
+	}
+
+	ctx.mem=state->mem;
+	ctx.read_word=mips_mem_read_word;
+	ctx.write_word=mips_mem_write_word;
+	ctx.read_masked=mips_mem_read_masked;
+	ctx.write_masked=mips_mem_write_masked;
+
+	while(!err && state->instructions<end){
+		if(state->instructions>=state->nextEvent){
+			err=mips_cpu_dispatch_events(state);
+			if(err)
+				break;
+		}
+		if(!skipFirst){
+			uint64_t limit = state->nextEvent<end ? state->nextEvent : end;
+
+			ctx.arch.pc=state->pc;
+			ctx.arch.pcN=state->pcN;
+			for(i=0;i<32;i++){
+				ctx.arch.regs[i]=state->regs[i];
+			}
+			ctx.arch.hi=state->hi;
+			ctx.arch.lo=state->lo;
+			ctx.limit=limit-state->instructions;
+			ctx.count=0;
+
+			module->run(&ctx);
+
+			state->pc=ctx.arch.pc;
+			state->pcN=ctx.arch.pcN;
+			for(i=1;i<32;i++){
+				state->regs[i]=ctx.arch.regs[i];
+			}
+			state->hi=ctx.arch.hi;
+			state->lo=ctx.arch.lo;
+			state->instructions+=ctx.count;
+
+			if(state->instructions>=limit)
+				continue;	// Finished, or an event is due
+			// There are no breakpoints inside the image, but it may
+			// have stopped outside it
+			if(bp && mips_cpu_breakpoint_test(bp, state->pc)){
+				err=mips_StopBreakpoint;
+				state->resumeFromStop=1;
+				break;
+			}
+		}
+		skipFirst=0;
+
+		// Whatever stopped the translated code
+		err=mips_cpu_execute(state);
+	}
+
+	if(stepsDone){
+		*stepsDone = state->instructions-start;
+	}
+	return err;
+}
@@ -0,0 +1,217 @@
+/* Implementation of the breakpoint and watchpoint functions
+   from mips_breakpoint.h. The checks themselves are inline
+   in mips_cpu_impl.h, so that the run loop can use them directly.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <stdlib.h>
+
+static struct mips_breakpoints *mips_cpu_get_breakpoints(mips_cpu_h state)
+{
+	if(state->breakpoints==0){
+		state->breakpoints=(struct mips_breakpoints*)calloc(1, sizeof(struct mips_breakpoints));
+	}
+	return state->breakpoints;
+}
+
+void mips_cpu_breakpoints_free(mips_cpu_h state)
+{
+	unsigned i, j;
+	struct mips_breakpoints *bp=state->breakpoints;
+
+	if(bp){
+		for(i=0;i<1024;i++){
+			if(bp->dirs[i]){
+				for(j=0;j<1024;j++){
+					free(bp->dirs[i]->pages[j]);
+				}
+				free(bp->dirs[i]);
+			}
+		}
+		free(bp->watches);
+		free(bp);
+		state->breakpoints=0;
+	}
+}
+
+mips_error mips_cpu_set_breakpoint(mips_cpu_h state, uint32_t pc)
+{
+	struct mips_breakpoints *bp;
+	struct mips_breakpoint_dir *d;
+	struct mips_breakpoint_page *p;
+	uint32_t *word, bit;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(pc&3)
+		return mips_ExceptionInvalidAlignment;
+
+	bp=mips_cpu_get_breakpoints(state);
+	if(bp==0)
+		return mips_ErrorInvalidArgument;
+
+	d=bp->dirs[pc>>22];
+	if(d==0){
+		d=(struct mips_breakpoint_dir*)calloc(1, sizeof(struct mips_breakpoint_dir));
+		if(d==0)
+			return mips_ErrorInvalidArgument;
+		bp->dirs[pc>>22]=d;
+	}
+	p=d->pages[(pc>>12)&0x3FF];
+	if(p==0){
+		p=(struct mips_breakpoint_page*)calloc(1, sizeof(struct mips_breakpoint_page));
+		if(p==0)
+			return mips_ErrorInvalidArgument;
+		d->pages[(pc>>12)&0x3FF]=p;
+	}
+
+	word=&p->bits[(pc>>7)&0x1F];
+	bit=1u<<((pc>>2)&0x1F);
+	if(!(*word & bit)){
+		*word |= bit;
+		bp->pcCount++;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_clear_breakpoint(mips_cpu_h state, uint32_t pc)
+{
+	struct mips_breakpoints *bp;
+	struct mips_breakpoint_page *p;
+	uint32_t *word, bit;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	bp=state->breakpoints;
+	if(bp==0 || (pc&3) || !mips_cpu_breakpoint_test(bp, pc))
+		return mips_Success;
+
+	// Pages are kept once allocated, as breakpoints tend to move around within them
+	p=bp->dirs[pc>>22]->pages[(pc>>12)&0x3FF];
+	word=&p->bits[(pc>>7)&0x1F];
+	bit=1u<<((pc>>2)&0x1F);
+	*word &= ~bit;
+	bp->pcCount--;
+
+	return mips_Success;
+}
+
+/* Sets the armed bit for every page touched by any watchpoint. */
+static void mips_cpu_rebuild_watch_pages(struct mips_breakpoints *bp)
+{
+	unsigned i;
+	uint32_t page, last;
+
+	for(i=0;i<(1u<<15);i++){
+		bp->watchPages[i]=0;
+	}
+	for(i=0;i<bp->watchCount;i++){
+		page=bp->watches[i].address>>12;
+		last=(bp->watches[i].address+bp->watches[i].length-1)>>12;
+		while(1){
+			bp->watchPages[page>>5] |= 1u<<(page&0x1F);
+			if(page==last)
+				break;
+			page=(page+1)&0xFFFFF;
+		}
+	}
+}
+
+mips_error mips_cpu_add_watchpoint(mips_cpu_h state, uint32_t address, uint32_t length, unsigned flags)
+{
+	struct mips_breakpoints *bp;
+	struct mips_watchpoint *w;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(length==0 || (flags&~(unsigned)(mips_watch_Read|mips_watch_Write)) || flags==0)
+		return mips_ErrorInvalidArgument;
+
+	bp=mips_cpu_get_breakpoints(state);
+	if(bp==0)
+		return mips_ErrorInvalidArgument;
+
+	if(bp->watchCount==bp->watchCapacity){
+		unsigned capacity=bp->watchCapacity ? 2*bp->watchCapacity : 8;
+		w=(struct mips_watchpoint*)realloc(bp->watches, capacity*sizeof(struct mips_watchpoint));
+		if(w==0)
+			return mips_ErrorInvalidArgument;
+		bp->watches=w;
+		bp->watchCapacity=capacity;
+	}
+
+	w=bp->watches+bp->watchCount;
+	w->address=address;
+	w->length=length;
+	w->flags=flags;
+	bp->watchCount++;
+
+	mips_cpu_rebuild_watch_pages(bp);
+	return mips_Success;
+}
+
+mips_error mips_cpu_remove_watchpoint(mips_cpu_h state, uint32_t address, uint32_t length)
+{
+	unsigned i;
+	struct mips_breakpoints *bp;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	bp=state->breakpoints;
+	if(bp){
+		for(i=0;i<bp->watchCount;i++){
+			if(bp->watches[i].address==address && bp->watches[i].length==length){
+				bp->watches[i]=bp->watches[bp->watchCount-1];
+				bp->watchCount--;
+				mips_cpu_rebuild_watch_pages(bp);
+				return mips_Success;
+			}
+		}
+	}
+	return mips_ErrorInvalidArgument;
+}
+
+mips_error mips_cpu_clear_all_breakpoints(mips_cpu_h state)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	mips_cpu_breakpoints_free(state);
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_watch_hit(mips_cpu_h state, uint32_t *address, unsigned *flags)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(address==0 || flags==0)
+		return mips_ErrorInvalidArgument;
+	if(state->breakpoints==0 || !state->breakpoints->hit)
+		return mips_ErrorInvalidArgument;
+
+	*address=state->breakpoints->hitAddress;
+	*flags=state->breakpoints->hitFlags;
+	return mips_Success;
+}
+
+mips_error mips_cpu_watch_check(mips_cpu_h state, uint32_t address, uint32_t length, int write)
+{
+	unsigned i;
+	struct mips_breakpoints *bp=state->breakpoints;
+	unsigned flags = write ? mips_watch_Write : mips_watch_Read;
+
+	for(i=0;i<bp->watchCount;i++){
+		const struct mips_watchpoint *w=bp->watches+i;
+		// Ranges overlap, taking care that either may wrap around
+		if((w->flags&flags) && (address-w->address < w->length || w->address-address < length)){
+			bp->hit=1;
+			bp->hitAddress=address;
+			bp->hitFlags=flags;
+			return mips_StopWatchpoint;
+		}
+	}
+	return mips_Success;
+}
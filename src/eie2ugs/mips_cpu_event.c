@@ -0,0 +1,234 @@
+/* Implementation of the event queue and interrupt lines from
+   mips_event.h. The run loop only looks at state->nextEvent, so
+   this has to keep it up to date whenever anything changes.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <stdlib.h>
+
+static int mips_event_before(const struct mips_event *a, const struct mips_event *b)
+{
+	return a->when<b->when || (a->when==b->when && a->seq<b->seq);
+}
+
+static void mips_event_sift_up(struct mips_events *ev, unsigned i)
+{
+	struct mips_event e=ev->heap[i];
+	while(i>0){
+		unsigned parent=(i-1)/2;
+		if(!mips_event_before(&e, ev->heap+parent))
+			break;
+		ev->heap[i]=ev->heap[parent];
+		i=parent;
+	}
+	ev->heap[i]=e;
+}
+
+static void mips_event_sift_down(struct mips_events *ev, unsigned i)
+{
+	struct mips_event e=ev->heap[i];
+	while(1){
+		unsigned child=2*i+1;
+		if(child>=ev->count)
+			break;
+		if(child+1<ev->count && mips_event_before(ev->heap+child+1, ev->heap+child)){
+			child++;
+		}
+		if(!mips_event_before(ev->heap+child, &e))
+			break;
+		ev->heap[i]=ev->heap[child];
+		i=child;
+	}
+	ev->heap[i]=e;
+}
+
+/* Removes the entry at index i */
+static void mips_event_remove(struct mips_events *ev, unsigned i)
+{
+	ev->count--;
+	if(i<ev->count){
+		ev->heap[i]=ev->heap[ev->count];
+		mips_event_sift_down(ev, i);
+		mips_event_sift_up(ev, i);
+	}
+}
+
+static void mips_cpu_update_next_event(mips_cpu_h state)
+{
+	if(state->interruptsPending & state->interruptMask){
+		state->nextEvent=0;
+	}else if(state->events && state->events->count>0){
+		state->nextEvent=state->events->heap[0].when;
+	}else{
+		state->nextEvent=UINT64_MAX;
+	}
+}
+
+mips_error mips_cpu_dispatch_events(mips_cpu_h state)
+{
+	struct mips_events *ev=state->events;
+	mips_error err=mips_Success;
+
+	while(!err && ev && ev->count>0 && ev->heap[0].when<=state->instructions){
+		// Take it off first, as the callback may change the queue
+		struct mips_event e=ev->heap[0];
+		mips_event_remove(ev, 0);
+		err=e.callback(e.context, state, e.when);
+	}
+
+	mips_cpu_update_next_event(state);
+	if(!err && (state->interruptsPending & state->interruptMask)){
+		err=mips_StopInterrupt;
+	}
+	return err;
+}
+
+void mips_cpu_events_reset(mips_cpu_h state)
+{
+	if(state->events){
+		state->events->count=0;
+	}
+	state->interruptsPending=0;
+	state->interruptMask=0xFFFFFFFFu;
+	state->nextEvent=UINT64_MAX;
+}
+
+void mips_cpu_events_free(mips_cpu_h state)
+{
+	if(state->events){
+		free(state->events->heap);
+		free(state->events);
+		state->events=0;
+	}
+}
+
+mips_error mips_cpu_schedule_event(
+	mips_cpu_h state,
+	uint64_t when,
+	mips_event_callback callback,
+	void *context,
+	unsigned *eventId
+){
+	struct mips_events *ev;
+	struct mips_event *e;
+	unsigned id;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(callback==0)
+		return mips_ErrorInvalidArgument;
+
+	if(state->events==0){
+		state->events=(struct mips_events*)calloc(1, sizeof(struct mips_events));
+		if(state->events==0)
+			return mips_ErrorOutOfMemory;
+	}
+	ev=state->events;
+
+	if(ev->count==ev->capacity){
+		unsigned capacity = ev->capacity ? 2*ev->capacity : 16;
+		struct mips_event *heap=(struct mips_event*)realloc(ev->heap, capacity*sizeof(struct mips_event));
+		if(heap==0)
+			return mips_ErrorOutOfMemory;
+		ev->heap=heap;
+		ev->capacity=capacity;
+	}
+
+	if(state->history){
+		mips_cpu_history_clear(state);
+	}
+
+	e=ev->heap+ev->count;
+	e->when=when;
+	e->seq=ev->nextSeq++;
+	e->id=id=ev->nextId++;
+	e->callback=callback;
+	e->context=context;
+	ev->count++;
+	mips_event_sift_up(ev, ev->count-1);
+
+	if(eventId){
+		*eventId=id;
+	}
+	mips_cpu_update_next_event(state);
+	return mips_Success;
+}
+
+mips_error mips_cpu_cancel_event(mips_cpu_h state, unsigned eventId)
+{
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	if(state->events){
+		for(i=0;i<state->events->count;i++){
+			if(state->events->heap[i].id==eventId){
+				mips_event_remove(state->events, i);
+				mips_cpu_update_next_event(state);
+				return mips_Success;
+			}
+		}
+	}
+	return mips_ErrorInvalidArgument;
+}
+
+mips_error mips_cpu_get_next_event(mips_cpu_h state, uint64_t *when)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(when==0)
+		return mips_ErrorInvalidArgument;
+
+	*when = (state->events && state->events->count>0) ? state->events->heap[0].when : UINT64_MAX;
+	return mips_Success;
+}
+
+mips_error mips_cpu_raise_interrupt(mips_cpu_h state, unsigned line)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(line>=32)
+		return mips_ErrorInvalidArgument;
+
+	if(state->history){
+		mips_cpu_history_clear(state);
+	}
+	state->interruptsPending |= 1u<<line;
+	mips_cpu_update_next_event(state);
+	return mips_Success;
+}
+
+mips_error mips_cpu_clear_interrupt(mips_cpu_h state, unsigned line)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(line>=32)
+		return mips_ErrorInvalidArgument;
+
+	state->interruptsPending &= ~(1u<<line);
+	mips_cpu_update_next_event(state);
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_interrupt_mask(mips_cpu_h state, uint32_t mask)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	state->interruptMask=mask;
+	mips_cpu_update_next_event(state);
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_interrupts(mips_cpu_h state, uint32_t *pending)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(pending==0)
+		return mips_ErrorInvalidArgument;
+
+	*pending=state->interruptsPending;
+	return mips_Success;
+}
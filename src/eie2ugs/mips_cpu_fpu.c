@@ -0,0 +1,375 @@
+/* COP1 arithmetic, comparisons and conversions, for the instructions
+   in mips_isa.h with kind Float. The moves, BC1 and the loads and
+   stores are in mips_cpu.c along with their integer equivalents.
+
+   Registers are 32 bits wide (FR=0), so a double lives in an even/odd
+   pair with the low word in the even register. The FCSR layout is
+
+	31..25  FCC7..FCC1 (unused, only cc0 is supported)
+	24      FS (not supported, reads as zero)
+	23      FCC0
+	17..12  Cause  E V Z O U I
+	11..7   Enables  V Z O U I
+	6..2    Flags    V Z O U I
+	1..0    RM  (nearest, zero, +inf, -inf)
+
+   Arithmetic is done by the host (SSE2 where available), which is
+   IEEE 754 in exactly the same way, so the only work is in getting
+   the flags out and in the things MIPS does differently. For non-NaN
+   operands the host result is the answer, computed in the MIPS
+   rounding mode, and the host flags are the cause bits. NaN operands
+   are dealt with here instead, as MIPS uses the legacy encoding where
+   the top fraction bit is set for a signalling NaN, and any NaN
+   result becomes the MIPS default NaN.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <string.h>
+
+#if defined(__SSE2_MATH__) || defined(_M_X64)
+#define MIPS_FPU_SSE 1
+#include <emmintrin.h>
+#else
+#include <fenv.h>
+#include <math.h>
+#endif
+
+#define MIPS_FCSR_FCC0 0x00800000u
+#define MIPS_FCSR_CAUSE 0x0003F000u
+#define MIPS_FCSR_ENABLES 0x00000F80u
+#define MIPS_FCSR_RM 0x00000003u
+
+/* Exception bits, as they appear in the cause/enables/flags fields */
+#define MIPS_FPU_V 0x10u
+#define MIPS_FPU_Z 0x08u
+#define MIPS_FPU_O 0x04u
+#define MIPS_FPU_U 0x02u
+#define MIPS_FPU_I 0x01u
+
+#define MIPS_FPU_NAN_S 0x7FBFFFFFu
+#define MIPS_FPU_NAN_D 0x7FF7FFFFFFFFFFFFull
+
+/* Clears the host exception flags and sets the host rounding mode to
+   the MIPS one, returning whatever is needed to put the host back. */
+#ifdef MIPS_FPU_SSE
+static unsigned mips_fpu_host_begin(unsigned rm)
+{
+	static const unsigned rc[4]={ 0, 3, 2, 1 };
+	unsigned old=_mm_getcsr();
+	// Clear the flags, DAZ and FTZ, and set RC
+	_mm_setcsr((old & ~0xE07Fu) | (rc[rm]<<13));
+	return old;
+}
+
+/* Reads the host flags as MIPS exception bits, and restores the host. */
+static unsigned mips_fpu_host_end(unsigned old)
+{
+	unsigned f=_mm_getcsr();
+	unsigned res=0;
+	_mm_setcsr(old);
+	if(f&0x01) res|=MIPS_FPU_V;
+	if(f&0x04) res|=MIPS_FPU_Z;
+	if(f&0x08) res|=MIPS_FPU_O;
+	if(f&0x10) res|=MIPS_FPU_U;
+	if(f&0x20) res|=MIPS_FPU_I;
+	return res;
+}
+#else
+static unsigned mips_fpu_host_begin(unsigned rm)
+{
+	static const int modes[4]={ FE_TONEAREST, FE_TOWARDZERO, FE_UPWARD, FE_DOWNWARD };
+	int old=fegetround();
+	fesetround(modes[rm]);
+	feclearexcept(FE_ALL_EXCEPT);
+	return (unsigned)old;
+}
+
+static unsigned mips_fpu_host_end(unsigned old)
+{
+	int f=fetestexcept(FE_ALL_EXCEPT);
+	unsigned res=0;
+	feclearexcept(FE_ALL_EXCEPT);
+	fesetround((int)old);
+	if(f&FE_INVALID) res|=MIPS_FPU_V;
+	if(f&FE_DIVBYZERO) res|=MIPS_FPU_Z;
+	if(f&FE_OVERFLOW) res|=MIPS_FPU_O;
+	if(f&FE_UNDERFLOW) res|=MIPS_FPU_U;
+	if(f&FE_INEXACT) res|=MIPS_FPU_I;
+	return res;
+}
+#endif
+
+static float mips_fpu_to_s(uint32_t bits)
+{
+	float res;
+	memcpy(&res, &bits, 4);
+	return res;
+}
+
+static uint32_t mips_fpu_from_s(float value)
+{
+	uint32_t res;
+	memcpy(&res, &value, 4);
+	return res;
+}
+
+static double mips_fpu_to_d(uint64_t bits)
+{
+	double res;
+	memcpy(&res, &bits, 8);
+	return res;
+}
+
+static uint64_t mips_fpu_from_d(double value)
+{
+	uint64_t res;
+	memcpy(&res, &value, 8);
+	return res;
+}
+
+static int mips_fpu_is_nan_s(uint32_t x) { return (x&0x7FFFFFFFu)>0x7F800000u; }
+static int mips_fpu_is_snan_s(uint32_t x) { return mips_fpu_is_nan_s(x) && (x&0x00400000u); }
+static int mips_fpu_is_nan_d(uint64_t x) { return (x&0x7FFFFFFFFFFFFFFFull)>0x7FF0000000000000ull; }
+static int mips_fpu_is_snan_d(uint64_t x) { return mips_fpu_is_nan_d(x) && (x&0x0008000000000000ull); }
+
+static uint64_t mips_fpu_read_d(mips_cpu_h state, unsigned index)
+{
+	return ((uint64_t)state->fpr[index+1]<<32) | state->fpr[index];
+}
+
+/* Rounds to a word in the given MIPS rounding mode. Anything out of
+   range, including NaN and infinity, is invalid and gives 2^31-1. */
+static uint32_t mips_fpu_to_word(double v, unsigned rm, unsigned *cause)
+{
+	int64_t t;
+	double frac;
+
+	if(!(v > -2147483649.0 && v < 2147483648.0)){
+		*cause=MIPS_FPU_V;
+		return 0x7FFFFFFFu;
+	}
+	t=(int64_t)v;		// Towards zero, and exact as |v| < 2^32
+	frac=v-(double)t;
+	switch(rm){
+	case 0:
+		if(frac>0.5 || (frac==0.5 && (t&1)))
+			t++;
+		else if(frac<-0.5 || (frac==-0.5 && (t&1)))
+			t--;
+		break;
+	case 2: if(frac>0) t++; break;
+	case 3: if(frac<0) t--; break;
+	default: break;
+	}
+	if(t<-2147483647-1 || t>2147483647){
+		*cause=MIPS_FPU_V;
+		return 0x7FFFFFFFu;
+	}
+	*cause = frac!=0 ? MIPS_FPU_I : 0;
+	return (uint32_t)(int32_t)t;
+}
+
+/* c.cond.fmt. The low three bits of the condition select unordered,
+   equal and less than, and the fourth makes quiet NaNs signal too. */
+static mips_error mips_fpu_compare(mips_cpu_h state, unsigned cond, int isDouble, unsigned fs, unsigned ft)
+{
+	int unordered, equal=0, less=0, signal;
+	unsigned cause=0;
+	uint32_t fcsr=state->fcsr;
+
+	if(isDouble){
+		uint64_t a=mips_fpu_read_d(state, fs), b=mips_fpu_read_d(state, ft);
+		unordered=mips_fpu_is_nan_d(a) || mips_fpu_is_nan_d(b);
+		signal=mips_fpu_is_snan_d(a) || mips_fpu_is_snan_d(b);
+		if(!unordered){
+			equal = mips_fpu_to_d(a)==mips_fpu_to_d(b);
+			less = mips_fpu_to_d(a)<mips_fpu_to_d(b);
+		}
+	}else{
+		uint32_t a=state->fpr[fs], b=state->fpr[ft];
+		unordered=mips_fpu_is_nan_s(a) || mips_fpu_is_nan_s(b);
+		signal=mips_fpu_is_snan_s(a) || mips_fpu_is_snan_s(b);
+		if(!unordered){
+			equal = mips_fpu_to_s(a)==mips_fpu_to_s(b);
+			less = mips_fpu_to_s(a)<mips_fpu_to_s(b);
+		}
+	}
+	if(unordered && (signal || (cond&8))){
+		cause=MIPS_FPU_V;
+		if(fcsr & MIPS_FCSR_ENABLES & (cause<<7))
+			return mips_ExceptionFloatingPoint;
+	}
+
+	fcsr=(fcsr & ~MIPS_FCSR_CAUSE) | (cause<<12) | (cause<<2);
+	if(((cond&4) && less) || ((cond&2) && equal) || ((cond&1) && unordered)){
+		fcsr|=MIPS_FCSR_FCC0;
+	}else{
+		fcsr&=~MIPS_FCSR_FCC0;
+	}
+	state->fcsr=fcsr;
+	return mips_Success;
+}
+
+mips_error mips_cpu_fpu_execute(mips_cpu_h state, mips_isa_op op, uint32_t instr)
+{
+	unsigned fmt=(instr>>21)&0x1F, ft=(instr>>16)&0x1F, fs=(instr>>11)&0x1F, fd=(instr>>6)&0x1F;
+	unsigned funct=instr&0x3F;
+	unsigned rm=state->fcsr&MIPS_FCSR_RM;
+	int srcDouble=(fmt==17), dstDouble;
+	unsigned cause=0, host;
+	uint64_t res=0;
+
+	// Which side of a conversion is double
+	switch(op){
+	case mips_isa_CVT_D_S: case mips_isa_CVT_D_W: dstDouble=1; break;
+	case mips_isa_CVT_S_D: case mips_isa_CVT_S_W:
+	case mips_isa_CVT_W_S: case mips_isa_CVT_W_D:
+	case mips_isa_ROUND_W_S: case mips_isa_ROUND_W_D:
+	case mips_isa_TRUNC_W_S: case mips_isa_TRUNC_W_D:
+	case mips_isa_CEIL_W_S: case mips_isa_CEIL_W_D:
+	case mips_isa_FLOOR_W_S: case mips_isa_FLOOR_W_D:
+		dstDouble=0;
+		break;
+	default:
+		dstDouble=srcDouble;
+		break;
+	}
+
+	// Doubles are register pairs, and comparisons only set cc0
+	if(srcDouble && ((fs|ft)&1))
+		return mips_ExceptionInvalidInstruction;
+	if(funct>=0x30)
+		return fd!=0 ? mips_ExceptionInvalidInstruction : mips_fpu_compare(state, funct&0xF, srcDouble, fs, ft);
+	if(dstDouble && (fd&1))
+		return mips_ExceptionInvalidInstruction;
+
+	switch(op){
+	case mips_isa_MOV_S: mips_cpu_write_fpr(state, fd, state->fpr[fs]); return mips_Success;
+	case mips_isa_ABS_S: mips_cpu_write_fpr(state, fd, state->fpr[fs]&0x7FFFFFFFu); return mips_Success;
+	case mips_isa_NEG_S: mips_cpu_write_fpr(state, fd, state->fpr[fs]^0x80000000u); return mips_Success;
+	case mips_isa_MOV_D:
+		mips_cpu_write_fpr(state, fd, state->fpr[fs]);
+		mips_cpu_write_fpr(state, fd+1, state->fpr[fs+1]);
+		return mips_Success;
+	case mips_isa_ABS_D:
+		mips_cpu_write_fpr(state, fd, state->fpr[fs]);
+		mips_cpu_write_fpr(state, fd+1, state->fpr[fs+1]&0x7FFFFFFFu);
+		return mips_Success;
+	case mips_isa_NEG_D:
+		mips_cpu_write_fpr(state, fd, state->fpr[fs]);
+		mips_cpu_write_fpr(state, fd+1, state->fpr[fs+1]^0x80000000u);
+		return mips_Success;
+	default:
+		break;
+	}
+
+	if(fmt==20){
+		// Words are exact as doubles, and only CVT.S.W can be inexact
+		volatile int32_t w=(int32_t)state->fpr[fs];
+		host=mips_fpu_host_begin(rm);
+		if(dstDouble){
+			res=mips_fpu_from_d((double)w);
+		}else{
+			volatile float r=(float)w;
+			res=mips_fpu_from_s(r);
+		}
+		cause=mips_fpu_host_end(host);
+	}else if(srcDouble){
+		uint64_t a=mips_fpu_read_d(state, fs), b=mips_fpu_read_d(state, ft);
+		int binary = funct<4;
+
+		if(mips_fpu_is_nan_d(a) || (binary && mips_fpu_is_nan_d(b))){
+			if(mips_fpu_is_snan_d(a) || (binary && mips_fpu_is_snan_d(b)))
+				cause=MIPS_FPU_V;
+			if(dstDouble){
+				res=MIPS_FPU_NAN_D;
+			}else if(op==mips_isa_CVT_S_D){
+				res=MIPS_FPU_NAN_S;
+			}else{
+				res=0x7FFFFFFFu;
+				cause=MIPS_FPU_V;
+			}
+		}else if(funct>=0x0C && funct!=0x20){
+			// To word, either with a fixed mode or the current one
+			res=mips_fpu_to_word(mips_fpu_to_d(a), funct>=0x20 ? rm : funct==0x0C ? 0 : funct-0x0C, &cause);
+		}else{
+			volatile double x=mips_fpu_to_d(a), y=mips_fpu_to_d(b), r;
+			host=mips_fpu_host_begin(rm);
+			switch(op){
+			case mips_isa_ADD_D: r=x+y; break;
+			case mips_isa_SUB_D: r=x-y; break;
+			case mips_isa_MUL_D: r=x*y; break;
+			case mips_isa_DIV_D: r=x/y; break;
+#ifdef MIPS_FPU_SSE
+			case mips_isa_SQRT_D: r=_mm_cvtsd_f64(_mm_sqrt_pd(_mm_set_sd(x))); break;
+#else
+			case mips_isa_SQRT_D: r=sqrt(x); break;
+#endif
+			case mips_isa_CVT_S_D: { volatile float f=(float)x; r=f; break; }
+			default:
+				mips_fpu_host_end(host);
+				return mips_ExceptionInvalidInstruction;
+			}
+			cause=mips_fpu_host_end(host);
+			res = dstDouble ? mips_fpu_from_d(r) : mips_fpu_from_s((float)r);
+			if(dstDouble && mips_fpu_is_nan_d(res)){
+				res=MIPS_FPU_NAN_D;
+			}
+		}
+	}else{
+		uint32_t a=state->fpr[fs], b=state->fpr[ft];
+		int binary = funct<4;
+
+		if(mips_fpu_is_nan_s(a) || (binary && mips_fpu_is_nan_s(b))){
+			if(mips_fpu_is_snan_s(a) || (binary && mips_fpu_is_snan_s(b)))
+				cause=MIPS_FPU_V;
+			if(!dstDouble){
+				res = funct>=0x0C ? 0x7FFFFFFFu : MIPS_FPU_NAN_S;
+				if(funct>=0x0C)
+					cause=MIPS_FPU_V;
+			}else{
+				res=MIPS_FPU_NAN_D;
+			}
+		}else if(funct>=0x0C && funct!=0x21){
+			res=mips_fpu_to_word(mips_fpu_to_s(a), funct>=0x20 ? rm : funct==0x0C ? 0 : funct-0x0C, &cause);
+		}else{
+			volatile float x=mips_fpu_to_s(a), y=mips_fpu_to_s(b), r=0;
+			host=mips_fpu_host_begin(rm);
+			switch(op){
+			case mips_isa_ADD_S: r=x+y; break;
+			case mips_isa_SUB_S: r=x-y; break;
+			case mips_isa_MUL_S: r=x*y; break;
+			case mips_isa_DIV_S: r=x/y; break;
+#ifdef MIPS_FPU_SSE
+			case mips_isa_SQRT_S: r=_mm_cvtss_f32(_mm_sqrt_ps(_mm_set_ss(x))); break;
+#else
+			case mips_isa_SQRT_S: r=sqrtf(x); break;
+#endif
+			case mips_isa_CVT_D_S: res=mips_fpu_from_d((double)x); break;
+			default:
+				mips_fpu_host_end(host);
+				return mips_ExceptionInvalidInstruction;
+			}
+			cause=mips_fpu_host_end(host);
+			if(!dstDouble){
+				res=mips_fpu_from_s(r);
+				if(mips_fpu_is_nan_s((uint32_t)res))
+					res=MIPS_FPU_NAN_S;
+			}
+		}
+	}
+
+	// Traps leave everything as it was, including the cause bits
+	if(state->fcsr & MIPS_FCSR_ENABLES & (cause<<7))
+		return mips_ExceptionFloatingPoint;
+
+	state->fcsr=(state->fcsr & ~MIPS_FCSR_CAUSE) | (cause<<12) | (cause<<2);
+	if(dstDouble){
+		mips_cpu_write_fpr(state, fd, (uint32_t)res);
+		mips_cpu_write_fpr(state, fd+1, (uint32_t)(res>>32));
+	}else{
+		mips_cpu_write_fpr(state, fd, (uint32_t)res);
+	}
+	return mips_Success;
+}
@@ -0,0 +1,367 @@
+/* Implementation of reverse execution from mips_reverse.h. Snapshots
+   are taken by mips_cpu_execute, and memory writes are logged by the
+   store path in mips_cpu.c.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t mips_cpu_history_bytes(const struct mips_history *h)
+{
+	return h->snapCount*sizeof(struct mips_history_snapshot) + h->logCount*sizeof(struct mips_history_write);
+}
+
+/* Throws away the oldest snapshots, and the parts of the log only
+   they needed, until the history fits. */
+static void mips_cpu_history_trim(struct mips_history *h)
+{
+	unsigned i;
+	size_t drop;
+
+	while(h->snapCount>1 && mips_cpu_history_bytes(h)>h->maxBytes){
+		drop=h->snaps[1].logPosition;
+		memmove(h->log, h->log+drop, (h->logCount-drop)*sizeof(struct mips_history_write));
+		h->logCount-=drop;
+
+		memmove(h->snaps, h->snaps+1, (h->snapCount-1)*sizeof(struct mips_history_snapshot));
+		h->snapCount--;
+		for(i=0;i<h->snapCount;i++){
+			h->snaps[i].logPosition-=drop;
+		}
+	}
+}
+
+void mips_cpu_history_clear(mips_cpu_h state)
+{
+	struct mips_history *h=state->history;
+
+	h->snapCount=0;
+	h->logCount=0;
+	h->forceSnapshot=1;
+}
+
+void mips_cpu_history_free(mips_cpu_h state)
+{
+	if(state->history){
+		free(state->history->snaps);
+		free(state->history->log);
+		free(state->history);
+		state->history=0;
+	}
+}
+
+void mips_cpu_history_snapshot(mips_cpu_h state)
+{
+	struct mips_history *h=state->history;
+	struct mips_history_snapshot *s;
+
+	h->forceSnapshot=0;
+	h->nextSnapshot=state->instructions+h->interval;
+
+	// A journal rollback can move the count backwards. Later snapshots
+	// are still valid, but keeping them in order is simpler.
+	while(h->snapCount>0 && h->snaps[h->snapCount-1].instructions>state->instructions){
+		h->snapCount--;
+	}
+	if(h->snapCount>0 && h->snaps[h->snapCount-1].instructions==state->instructions)
+		return;
+
+	if(h->snapCount==h->snapCapacity){
+		unsigned capacity=h->snapCapacity ? 2*h->snapCapacity : 16;
+		s=(struct mips_history_snapshot*)realloc(h->snaps, capacity*sizeof(struct mips_history_snapshot));
+		if(s==0)
+			return;
+		h->snaps=s;
+		h->snapCapacity=capacity;
+	}
+
+	s=h->snaps+h->snapCount;
+	mips_cpu_get_arch_state(state, &s->arch);
+	s->instructions=state->instructions;
+	s->logPosition=h->logCount;
+	h->snapCount++;
+
+	mips_cpu_history_trim(h);
+}
+
+void mips_cpu_history_edited(mips_cpu_h state)
+{
+	struct mips_history *h=state->history;
+
+	if(h->inHostcall)
+		return;
+
+	// A snapshot at this count has the old registers, so replace it
+	if(h->snapCount>0 && h->snaps[h->snapCount-1].instructions==state->instructions){
+		h->snapCount--;
+	}
+	mips_cpu_history_snapshot(state);
+}
+
+void mips_cpu_history_record(mips_cpu_h state, uint32_t address, uint32_t old)
+{
+	struct mips_history *h=state->history;
+	struct mips_history_write *w;
+
+	if(h->logCount==h->logCapacity){
+		size_t capacity=h->logCapacity ? 2*h->logCapacity : 1024;
+		mips_cpu_history_trim(h);
+		if(h->logCount<h->logCapacity){
+			capacity=h->logCapacity;	// Trimming made space
+		}
+		w=(struct mips_history_write*)realloc(h->log, capacity*sizeof(struct mips_history_write));
+		if(w==0){
+			// The log can't be kept complete, so start again from here
+			mips_cpu_history_clear(state);
+			return;
+		}
+		h->log=w;
+		h->logCapacity=capacity;
+	}
+
+	w=h->log+h->logCount;
+	w->address=address;
+	w->old=old;
+	h->logCount++;
+}
+
+/* Puts the CPU and memory back to snapshot index, and forgets
+   everything after it. Every word written since then was writable at
+   the time, but its permissions may have changed since, so they are all
+   checked before any is put back, and if one fails nothing changes. */
+static mips_error mips_cpu_history_restore(mips_cpu_h state, unsigned index)
+{
+	unsigned i, perms;
+	size_t n;
+	mips_error err;
+	struct mips_history *h=state->history;
+	const struct mips_history_snapshot *s=h->snaps+index;
+
+	for(n=s->logPosition; n<h->logCount; n++){
+		err=mips_mem_get_permissions(state->mem, h->log[n].address, &perms);
+		if(err)
+			return err;
+		if(!(perms&mips_mem_perm_Write))
+			return mips_ExceptionAccessViolation;
+	}
+	while(h->logCount>s->logPosition){
+		const struct mips_history_write *w=h->log+(h->logCount-1);
+		err=mips_mem_write_word(state->mem, w->address, w->old);
+		if(err)
+			return err;
+		h->logCount--;
+	}
+
+	state->pc=s->arch.pc;
+	state->pcN=s->arch.pcN;
+	for(i=1;i<32;i++){
+		state->regs[i]=s->arch.regs[i];
+	}
+	state->hi=s->arch.hi;
+	state->lo=s->arch.lo;
+	for(i=0;i<32;i++){
+		state->fpr[i]=s->arch.fpr[i];
+	}
+	state->fcsr=s->arch.fcsr;
+	state->instructions=s->instructions;
+	state->resumeFromStop=0;
+	mips_cpu_journal_close(state);
+
+	h->snapCount=index+1;
+	h->nextSnapshot=s->instructions+h->interval;
+	h->forceSnapshot=0;
+	return mips_Success;
+}
+
+/* Index of the most recent snapshot at or before count. Snapshot
+   zero is returned if they are all later. */
+static unsigned mips_cpu_history_find(const struct mips_history *h, uint64_t count)
+{
+	unsigned i=h->snapCount-1;
+	while(i>0 && h->snaps[i].instructions>count){
+		i--;
+	}
+	return i;
+}
+
+/* Executes forwards until the count reaches target. */
+static mips_error mips_cpu_history_replay(mips_cpu_h state, uint64_t target)
+{
+	mips_error err=mips_Success;
+
+	state->history->replaying=1;
+	while(!err && state->instructions<target){
+		err=mips_cpu_execute(state);
+	}
+	state->history->replaying=0;
+	return err;
+}
+
+/* Restores snapshot index for reverse_continue, which may already have
+   moved back while scanning. If the restore fails the CPU goes forwards
+   again, so that it is left where the search started. */
+static mips_error mips_cpu_history_restore_search(mips_cpu_h state, unsigned index, uint64_t start)
+{
+	mips_error err=mips_cpu_history_restore(state, index);
+	if(err && state->instructions<start){
+		mips_cpu_history_replay(state, start);
+	}
+	return err;
+}
+
+/* Executes forwards until the count reaches end, and returns the count
+   of the last instruction that mips_cpu_run would have stopped at, or
+   UINT64_MAX if none. */
+static uint64_t mips_cpu_history_scan(mips_cpu_h state, uint64_t end, mips_error *reason)
+{
+	const struct mips_breakpoints *bp=state->breakpoints;
+	uint64_t last=UINT64_MAX;
+	mips_error err=mips_Success;
+
+	state->history->replaying=1;
+	while(!err && state->instructions<end){
+		if(bp->pcCount>0 && mips_cpu_breakpoint_test(bp, state->pc)){
+			last=state->instructions;
+			*reason=mips_StopBreakpoint;
+		}
+		if(bp->watchCount>0){
+			state->watchPages=bp->watchPages;
+			err=mips_cpu_execute(state);
+			state->watchPages=0;
+			if(err==mips_StopWatchpoint){
+				last=state->instructions;
+				*reason=mips_StopWatchpoint;
+				err=mips_cpu_execute(state);
+			}
+		}else{
+			// A host call stops the scan, but only happens as the last
+			// instruction before a snapshot
+			err=mips_cpu_execute(state);
+		}
+	}
+	state->history->replaying=0;
+	return last;
+}
+
+/* Makes sure there is a snapshot to go back to. */
+static void mips_cpu_history_prepare(mips_cpu_h state)
+{
+	if(!mips_cpu_history_recording(state))
+		return;
+	if(state->history->forceSnapshot || state->history->snapCount==0){
+		mips_cpu_history_snapshot(state);
+	}
+}
+
+mips_error mips_cpu_set_history(mips_cpu_h state, uint64_t interval, size_t maxBytes)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	if(interval==0){
+		mips_cpu_history_free(state);
+		return mips_Success;
+	}
+
+	if(state->history==0){
+		state->history=(struct mips_history*)calloc(1, sizeof(struct mips_history));
+		if(state->history==0)
+			return mips_ErrorInvalidArgument;
+		state->history->forceSnapshot=1;
+	}
+	state->history->interval=interval;
+	state->history->maxBytes=maxBytes;
+	if(state->history->snapCount>0){
+		state->history->nextSnapshot=state->history->snaps[state->history->snapCount-1].instructions+interval;
+	}
+	mips_cpu_history_trim(state->history);
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_reverse_step(mips_cpu_h state, uint64_t steps)
+{
+	struct mips_history *h;
+	uint64_t first, target;
+	int clamped;
+	mips_error err;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	h=state->history;
+	if(h==0)
+		return mips_ErrorInvalidArgument;
+
+	mips_cpu_history_prepare(state);
+	if(h->snapCount==0)
+		return mips_StopHistoryStart;	// Couldn't allocate a snapshot
+
+	first=h->snaps[0].instructions;
+	clamped = state->instructions<first || state->instructions-first<steps;
+	target = clamped ? first : state->instructions-steps;
+
+	err=mips_cpu_history_restore(state, mips_cpu_history_find(h, target));
+	if(err)
+		return err;
+	err=mips_cpu_history_replay(state, target);
+	if(err)
+		return err;
+
+	return clamped ? mips_StopHistoryStart : mips_Success;
+}
+
+mips_error mips_cpu_reverse_continue(mips_cpu_h state)
+{
+	struct mips_history *h;
+	uint64_t start, end, hit;
+	unsigned index;
+	mips_error err, reason=mips_Success;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	h=state->history;
+	if(h==0)
+		return mips_ErrorInvalidArgument;
+
+	mips_cpu_history_prepare(state);
+	if(h->snapCount==0)
+		return mips_StopHistoryStart;
+
+	start=end=state->instructions;
+	if(state->breakpoints && (state->breakpoints->pcCount>0 || state->breakpoints->watchCount>0)){
+		// Work backwards one interval at a time, replaying each to find
+		// the last stop within it
+		index=mips_cpu_history_find(h, end);
+		while(1){
+			if(h->snaps[index].instructions<end){
+				err=mips_cpu_history_restore_search(state, index, start);
+				if(err)
+					return err;
+				hit=mips_cpu_history_scan(state, end, &reason);
+				if(hit!=UINT64_MAX){
+					err=mips_cpu_history_restore_search(state, index, start);
+					if(err)
+						return err;
+					mips_cpu_history_replay(state, hit);
+					if(reason==mips_StopWatchpoint){
+						// Run the check again so the hit is recorded
+						state->watchPages=state->breakpoints->watchPages;
+						mips_cpu_execute(state);
+						state->watchPages=0;
+					}
+					state->resumeFromStop=1;
+					return reason;
+				}
+			}
+			if(index==0)
+				break;
+			end=h->snaps[index].instructions;
+			index--;
+		}
+	}
+
+	err=mips_cpu_history_restore_search(state, 0, start);
+	return err ? err : mips_StopHistoryStart;
+}
@@ -0,0 +1,481 @@
+/* Implementation of the host call functions from mips_hostcall.h,
+   including the standard SPIM services.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIPS_HOSTCALL_BUFFER_SIZE 4096
+
+struct mips_hostcall_entry{
+	mips_hostcall_kind kind;
+	uint32_t code;
+	mips_hostcall_handler handler;
+	void *context;
+};
+
+struct mips_hostcall_table{
+	unsigned count;
+	unsigned capacity;
+	struct mips_hostcall_entry *entries;
+
+	// State for the SPIM services
+	FILE *in;
+	FILE *out;
+	uint32_t heapNext;
+	uint32_t heapLimit;
+
+	int exited;
+	uint32_t exitCode;
+
+	unsigned outLength;
+	char outBuffer[MIPS_HOSTCALL_BUFFER_SIZE];
+};
+
+static struct mips_hostcall_table *mips_hostcall_get_table(mips_cpu_h state)
+{
+	if(state->hostcalls==0){
+		state->hostcalls=(struct mips_hostcall_table*)calloc(1, sizeof(struct mips_hostcall_table));
+	}
+	return state->hostcalls;
+}
+
+mips_error mips_cpu_hostcall(mips_cpu_h state, mips_hostcall_kind kind, uint32_t code)
+{
+	unsigned i;
+	struct mips_hostcall_table *table=state->hostcalls;
+	mips_error err;
+
+	// Nothing has changed yet, so the state is still as it was before
+	// this instruction. Snapshots either side mean replay never has to
+	// repeat the call.
+	if(state->history && state->history->replaying)
+		return mips_InternalError;
+	if(mips_cpu_history_recording(state)){
+		mips_cpu_history_snapshot(state);
+		state->history->forceSnapshot=1;
+	}
+
+	if(table){
+		for(i=0;i<table->count;i++){
+			struct mips_hostcall_entry *e=table->entries+i;
+			if(e->kind==kind && e->code==code){
+				if(state->history)
+					state->history->inHostcall=1;
+				err=e->handler(state, state->mem, code, e->context);
+				if(state->history)
+					state->history->inHostcall=0;
+				return err;
+			}
+		}
+	}
+	return mips_ExceptionBreak;
+}
+
+void mips_cpu_hostcall_free(mips_cpu_h state)
+{
+	if(state->hostcalls){
+		mips_cpu_flush_hostcall_output(state);
+		free(state->hostcalls->entries);
+		free(state->hostcalls);
+		state->hostcalls=0;
+	}
+}
+
+mips_error mips_cpu_register_hostcall(
+	mips_cpu_h state,
+	mips_hostcall_kind kind,
+	uint32_t code,
+	mips_hostcall_handler handler,
+	void *context
+)
+{
+	unsigned i;
+	struct mips_hostcall_table *table;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(kind!=mips_hostcall_Syscall && kind!=mips_hostcall_Break)
+		return mips_ErrorInvalidArgument;
+
+	table=mips_hostcall_get_table(state);
+	if(table==0)
+		return mips_ErrorInvalidArgument;
+
+	for(i=0;i<table->count;i++){
+		if(table->entries[i].kind==kind && table->entries[i].code==code){
+			if(handler){
+				table->entries[i].handler=handler;
+				table->entries[i].context=context;
+			}else{
+				table->entries[i]=table->entries[table->count-1];
+				table->count--;
+			}
+			return mips_Success;
+		}
+	}
+
+	if(handler==0)
+		return mips_Success;
+
+	if(table->count==table->capacity){
+		unsigned capacity=table->capacity ? 2*table->capacity : 16;
+		struct mips_hostcall_entry *entries=(struct mips_hostcall_entry*)realloc(table->entries, capacity*sizeof(struct mips_hostcall_entry));
+		if(entries==0)
+			return mips_ErrorInvalidArgument;
+		table->entries=entries;
+		table->capacity=capacity;
+	}
+	table->entries[table->count].kind=kind;
+	table->entries[table->count].code=code;
+	table->entries[table->count].handler=handler;
+	table->entries[table->count].context=context;
+	table->count++;
+
+	return mips_Success;
+}
+
+mips_error mips_cpu_flush_hostcall_output(mips_cpu_h state)
+{
+	struct mips_hostcall_table *table;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	table=state->hostcalls;
+	if(table && table->outLength>0){
+		if(table->out){
+			if(table->outLength!=fwrite(table->outBuffer, 1, table->outLength, table->out)){
+				return mips_ErrorFileWriteError;
+			}
+			fflush(table->out);
+		}
+		table->outLength=0;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_get_exit_code(mips_cpu_h state, uint32_t *code)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(code==0)
+		return mips_ErrorInvalidArgument;
+	if(state->hostcalls==0 || !state->hostcalls->exited)
+		return mips_ErrorInvalidArgument;
+
+	*code=state->hostcalls->exitCode;
+	return mips_Success;
+}
+
+/////////////////////////////////////////////////////////////////////
+// SPIM services
+
+static mips_error mips_hostcall_put(mips_cpu_h state, const char *data, unsigned length)
+{
+	struct mips_hostcall_table *table=state->hostcalls;
+	mips_error err;
+
+	while(length>0){
+		unsigned todo=MIPS_HOSTCALL_BUFFER_SIZE-table->outLength;
+		if(todo>length)
+			todo=length;
+		memcpy(table->outBuffer+table->outLength, data, todo);
+		table->outLength+=todo;
+		data+=todo;
+		length-=todo;
+
+		if(table->outLength==MIPS_HOSTCALL_BUFFER_SIZE){
+			err=mips_cpu_flush_hostcall_output(state);
+			if(err)
+				return err;
+		}
+	}
+	return mips_Success;
+}
+
+/* Copies bytes into guest memory, merging partial words at either end. */
+static mips_error mips_hostcall_write_bytes(mips_cpu_h cpu, mips_mem_h mem, uint32_t address, const uint8_t *data, uint32_t length)
+{
+	uint8_t word[4];
+	uint32_t old=0;
+	int recording=mips_cpu_history_recording(cpu);
+	mips_error err;
+
+	while(length>0){
+		uint32_t base=address&~3u;
+		uint32_t offset=address&3;
+		uint32_t todo=4-offset;
+		if(todo>length)
+			todo=length;
+
+		if(recording){
+			err=mips_cpu_read_old_word(mem, base, &old);
+			if(err)
+				return err;
+		}
+		// Partial words only write their own bytes
+		memcpy(word+offset, data, todo);
+		err=mips_mem_write_masked(mem, base, 4, word, ((1u<<todo)-1)<<offset);
+		if(err)
+			return err;
+		// Only once it has been written, as the history is undone by writing
+		if(recording){
+			mips_cpu_history_record(cpu, base, old);
+		}
+
+		address+=todo;
+		data+=todo;
+		length-=todo;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_hostcall_print_int(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	char tmp[16];
+	int n=sprintf(tmp, "%d", (int)(int32_t)cpu->regs[4]);
+	(void)mem; (void)code; (void)context;
+	return mips_hostcall_put(cpu, tmp, (unsigned)n);
+}
+
+static mips_error mips_hostcall_print_char(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	char c=(char)cpu->regs[4];
+	(void)mem; (void)code; (void)context;
+	return mips_hostcall_put(cpu, &c, 1);
+}
+
+/* Reads the bytes of the word containing address, from address up to
+   the terminator, one at a time. Only needed for memories which fail
+   reads of bytes that were never written (mips_mem_ram_Shadow), as
+   the rest of the word may not have been. */
+static mips_error mips_hostcall_read_string_bytes(mips_mem_h mem, uint32_t address, uint8_t *word)
+{
+	unsigned i;
+	mips_error err;
+
+	for(i=address&3; i<4; i++){
+		err=mips_mem_read_masked(mem, address&~3u, 4, word, 1u<<i);
+		if(err)
+			return err;
+		if(word[i]==0)
+			break;
+	}
+	return mips_Success;
+}
+
+/* Reads the word containing address, for a string starting there. */
+static mips_error mips_hostcall_read_string_word(mips_mem_h mem, uint32_t address, uint8_t *word)
+{
+	mips_error err=mips_mem_read(mem, address&~3u, 4, word);
+	if(err==mips_ExceptionUninitialisedRead){
+		err=mips_hostcall_read_string_bytes(mem, address, word);
+	}
+	return err;
+}
+
+static mips_error mips_hostcall_print_string(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	uint32_t address=cpu->regs[4], last;
+	uint8_t word[4];
+	unsigned start, end;
+	mips_error err;
+	(void)code; (void)context;
+
+	// Find the terminator before printing anything, as output which
+	// has been flushed can't be taken back if the string can't be read
+	for(last=address; ; last=(last&~3u)+4){
+		err=mips_hostcall_read_string_word(mem, last, word);
+		if(err)
+			return err;
+		end=last&3;
+		while(end<4 && word[end]!=0){
+			end++;
+		}
+		if(end<4)
+			break;
+	}
+
+	// Then read whole words again, and copy up to the terminator
+	while(1){
+		mips_hostcall_read_string_word(mem, address, word);
+		start=address&3;
+		end=start;
+		while(end<4 && word[end]!=0){
+			end++;
+		}
+		err=mips_hostcall_put(cpu, (const char*)word+start, end-start);
+		if(err || end<4)
+			return err;
+		address=(address&~3u)+4;
+	}
+}
+
+static mips_error mips_hostcall_read_int(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	int value=0;
+	(void)mem; (void)code; (void)context;
+
+	mips_cpu_flush_hostcall_output(cpu);
+	if(cpu->hostcalls->in){
+		if(1!=fscanf(cpu->hostcalls->in, "%d", &value))
+			value=0;
+	}
+	mips_cpu_write_gpr(cpu, 2, (uint32_t)value);
+	return mips_Success;
+}
+
+static mips_error mips_hostcall_read_char(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	int c=EOF;
+	(void)mem; (void)code; (void)context;
+
+	mips_cpu_flush_hostcall_output(cpu);
+	if(cpu->hostcalls->in){
+		c=fgetc(cpu->hostcalls->in);
+	}
+	mips_cpu_write_gpr(cpu, 2, (c==EOF) ? 0xFFFFFFFFu : (uint32_t)c);
+	return mips_Success;
+}
+
+/* Checks that every byte in [address, address+length) can be written,
+   so that a service can fail before changing anything. */
+static mips_error mips_hostcall_check_writable(mips_mem_h mem, uint32_t address, uint32_t length)
+{
+	uint32_t page;
+	unsigned permissions;
+	mips_error err;
+
+	if(length==0)
+		return mips_Success;
+	if(address+length-1 < address)
+		return mips_ExceptionInvalidAddress;
+
+	for(page=address&~0xFFFu; ; page+=0x1000){
+		err=mips_mem_get_permissions(mem, page, &permissions);
+		if(err)
+			return err;
+		if(!(permissions & mips_mem_perm_Write))
+			return mips_ExceptionAccessViolation;
+		if(page>=((address+length-1)&~0xFFFu))
+			break;
+	}
+	// The last byte may be past the end of memory within the last page
+	return mips_mem_get_permissions(mem, address+length-1, &permissions);
+}
+
+/* Same semantics as fgets: reads up to length-1 characters, stopping
+   after a newline, and always NUL terminates if length>0. The whole
+   buffer is checked before any input is read, so a buffer which can't
+   be written raises the exception with the input and guest memory
+   unchanged. */
+static mips_error mips_hostcall_read_string(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	uint32_t address=cpu->regs[4];
+	uint32_t length=cpu->regs[5];
+	uint32_t got=0, capacity=256;
+	char *buffer, *grown;
+	mips_error err;
+	(void)code; (void)context;
+
+	if(length==0)
+		return mips_Success;
+	err=mips_hostcall_check_writable(mem, address, length);
+	if(err)
+		return err;
+	mips_cpu_flush_hostcall_output(cpu);
+
+	buffer=(char*)malloc(capacity);
+	if(buffer==0)
+		return mips_ErrorOutOfMemory;
+	while(got+1<length){
+		int c=cpu->hostcalls->in ? fgetc(cpu->hostcalls->in) : EOF;
+		if(c==EOF)
+			break;
+		if(got+1==capacity){
+			grown=(char*)realloc(buffer, 2*capacity);
+			if(grown==0){
+				free(buffer);
+				return mips_ErrorOutOfMemory;
+			}
+			buffer=grown;
+			capacity*=2;
+		}
+		buffer[got++]=(char)c;
+		if(c=='\n')
+			break;
+	}
+	buffer[got]=0;
+
+	err=mips_hostcall_write_bytes(cpu, mem, address, (const uint8_t*)buffer, got+1);
+	free(buffer);
+	return err;
+}
+
+static mips_error mips_hostcall_sbrk(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	struct mips_hostcall_table *table=cpu->hostcalls;
+	uint32_t size=(cpu->regs[4]+3)&~3u;
+	(void)mem; (void)code; (void)context;
+
+	if(size > table->heapLimit-table->heapNext){
+		mips_cpu_write_gpr(cpu, 2, 0xFFFFFFFFu);
+	}else{
+		mips_cpu_write_gpr(cpu, 2, table->heapNext);
+		table->heapNext+=size;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_hostcall_exit(mips_cpu_h cpu, mips_mem_h mem, uint32_t code, void *context)
+{
+	(void)mem; (void)context;
+
+	cpu->hostcalls->exited=1;
+	cpu->hostcalls->exitCode = (code==17) ? cpu->regs[4] : 0;
+	mips_cpu_flush_hostcall_output(cpu);
+	return mips_StopExit;
+}
+
+mips_error mips_cpu_install_spim_hostcalls(
+	mips_cpu_h state,
+	FILE *in,
+	FILE *out,
+	uint32_t heapBase,
+	uint32_t heapLimit
+)
+{
+	struct mips_hostcall_table *table;
+	mips_error err=mips_Success;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(heapLimit<heapBase)
+		return mips_ErrorInvalidArgument;
+
+	table=mips_hostcall_get_table(state);
+	if(table==0)
+		return mips_ErrorInvalidArgument;
+
+	mips_cpu_flush_hostcall_output(state);
+	table->in=in;
+	table->out=out;
+	table->heapNext=(heapBase+3)&~3u;
+	table->heapLimit=heapLimit;
+	table->exited=0;
+
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 1, mips_hostcall_print_int, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 4, mips_hostcall_print_string, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 5, mips_hostcall_read_int, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 8, mips_hostcall_read_string, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 9, mips_hostcall_sbrk, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 10, mips_hostcall_exit, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 11, mips_hostcall_print_char, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 12, mips_hostcall_read_char, 0);
+	if(!err) err=mips_cpu_register_hostcall(state, mips_hostcall_Syscall, 17, mips_hostcall_exit, 0);
+
+	return err;
+}
@@ -0,0 +1,140 @@
+/* Fast-forwarding of idle loops, as described for
+   mips_cpu_set_fast_forward in mips_cpu_run.h.
+
+   mips_cpu_run calls mips_cpu_fast_forward whenever it has just taken
+   a branch backwards, so we are in the delay slot and pcN is the loop
+   head. The loop is only skipped if it exactly matches one of the
+   patterns below, which means every register and memory effect of an
+   iteration is known without executing it. Only whole iterations
+   which come back to the loop head are skipped, so the interpreter
+   still executes the iteration which leaves the loop, and any
+   remainder when the budget runs out.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#define MIPS_NOP 0x00000000u
+
+static int mips_idle_is_addiu_dec(uint32_t instr, unsigned *r)
+{
+	unsigned rs=(instr>>21)&0x1F, rt=(instr>>16)&0x1F;
+	if((instr>>26)!=0x09 || (instr&0xFFFF)!=0xFFFF || rs!=rt || rt==0)
+		return 0;
+	*r=rt;
+	return 1;
+}
+
+/* bne r,$0,offset or bne $0,r,offset */
+static int mips_idle_is_bnez(uint32_t instr, uint32_t offset, unsigned *r)
+{
+	unsigned rs=(instr>>21)&0x1F, rt=(instr>>16)&0x1F;
+	if((instr>>26)!=0x05 || (instr&0xFFFF)!=offset || (rs!=0)==(rt!=0))
+		return 0;
+	*r = rs ? rs : rt;
+	return 1;
+}
+
+mips_error mips_cpu_fast_forward(mips_cpu_h state, uint64_t end)
+{
+	uint32_t head=state->pcN, body=state->pc-head;
+	uint32_t i0, i1, i2=MIPS_NOP, value;
+	uint64_t limit, budget, k;
+	unsigned r, rb;
+	mips_error err;
+
+	// Anything which looks at individual instructions has to see them all
+	if(!state->fastForward || state->journal || state->history || state->coverage
+		|| state->debugLevel>0 || (state->plugins && state->plugins->kinds)){
+		return mips_Success;
+	}
+	if(head==state->notIdleLoop || (body!=4 && body!=8))
+		return mips_Success;
+
+	if(mips_mem_fetch_word(state->mem, head, &i0) || mips_mem_fetch_word(state->mem, head+4, &i1))
+		return mips_Success;
+	if(body==8 && mips_mem_fetch_word(state->mem, head+8, &i2))
+		return mips_Success;
+
+	// Classify before executing anything
+	if(body==8){
+		if(i2!=MIPS_NOP){
+			state->notIdleLoop=head;
+			return mips_Success;
+		}
+		if(mips_idle_is_addiu_dec(i0, &r) && mips_idle_is_bnez(i1, 0xFFFE, &rb) && rb==r){
+			// addiu r,r,-1 ; bne r,$0,head ; nop
+		}else if((i0>>26)==0x23 && ((i1>>26)==0x04 || (i1>>26)==0x05)
+			&& (i1&0x001FFFFF)==0xFFFE && ((i1>>21)&0x1F)==((i0>>16)&0x1F)
+			&& ((i0>>16)&0x1F)!=0 && ((i0>>16)&0x1F)!=((i0>>21)&0x1F)){
+			// lw r,off(base) ; beq/bne r,$0,head ; nop
+		}else{
+			state->notIdleLoop=head;
+			return mips_Success;
+		}
+	}else{
+		if(mips_idle_is_bnez(i0, 0xFFFF, &r) && mips_idle_is_addiu_dec(i1, &rb) && rb==r){
+			// bne r,$0,head ; addiu r,r,-1
+		}else if(i1==MIPS_NOP && ((i0>>26)==0x02
+			|| ((i0>>26)==0x04 && ((i0>>21)&0x1F)==((i0>>16)&0x1F) && (i0&0xFFFF)==0xFFFF))){
+			// j head ; nop  or  beq r,r,head ; nop
+		}else{
+			state->notIdleLoop=head;
+			return mips_Success;
+		}
+	}
+
+	// Finish the current iteration normally, so we are at the head
+	limit = end < state->nextEvent ? end : state->nextEvent;
+	if(state->instructions>=limit)
+		return mips_Success;
+	err=mips_cpu_execute(state);
+	if(err || state->pc!=head || state->pcN!=head+4)
+		return err;
+	budget=limit-state->instructions;
+
+	if(body==8 && (i0>>26)==0x09){
+		// Iteration j leaves r=v-j, and comes back while that is non-zero
+		k=(uint32_t)(state->regs[r]-1);
+		if(k>budget/3)
+			k=budget/3;
+		state->regs[r]-=(uint32_t)k;
+		state->instructions+=3*k;
+	}else if(body==8){
+		// Nothing but an event (or the host) can change memory while
+		// the loop runs, so one read decides every iteration
+		uint32_t base=(i0>>21)&0x1F;
+		uint32_t address=state->regs[base]+(uint32_t)(int32_t)(int16_t)(i0&0xFFFF);
+		int loops;
+		r=(i0>>16)&0x1F;
+		if(mips_mem_read_word(state->mem, address, &value))
+			return mips_Success;		// Let the interpreter raise it
+		loops = (i1>>26)==0x04 ? value==0 : value!=0;
+		if(!loops)
+			return mips_Success;
+		k=budget/3;
+		if(k>0){
+			state->regs[r]=value;
+			state->instructions+=3*k;
+		}
+	}else if((i0>>26)==0x05){
+		// The branch sees v-j and the delay slot decrements it
+		k=state->regs[r];
+		if(k>budget/2)
+			k=budget/2;
+		state->regs[r]-=(uint32_t)k;
+		state->instructions+=2*k;
+	}else{
+		k=budget/2;
+		state->instructions+=2*k;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_set_fast_forward(mips_cpu_h state, int enable)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	state->fastForward = enable!=0;
+	return mips_Success;
+}
@@ -0,0 +1,375 @@
+/* Private definition of the CPU state. This is shared between
+   the mips_cpu*.c files which make up this implementation,
+   but is not visible to clients of the API.
+*/
+#ifndef mips_cpu_impl_header
+#define mips_cpu_impl_header
+
+#include "mips.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+struct mips_hostcall_table;
+struct mips_breakpoints;
+struct mips_journal;
+struct mips_history;
+struct mips_plugins;
+struct mips_events;
+
+struct mips_cpu_impl{
+
+	uint32_t pc;
+	uint32_t pcN;
+	uint32_t regs[32];
+	uint32_t hi;
+	uint32_t lo;
+	uint32_t fpr[32];
+	uint32_t fcsr;
+
+	mips_mem_h mem;
+
+	/* Instructions completed since create or reset */
+	uint64_t instructions;
+
+	unsigned debugLevel;
+	FILE *debugDest;
+
+	/* Only allocated once a host call is registered */
+	struct mips_hostcall_table *hostcalls;
+
+	/* Only allocated once a breakpoint or watchpoint is added */
+	struct mips_breakpoints *breakpoints;
+	/* Bitmap of 4KB pages with watchpoints. Only non-NULL while
+	   mips_cpu_run is active and there are watchpoints, so that
+	   it is the only thing the memory path has to look at. */
+	const uint32_t *watchPages;
+	/* Set when mips_cpu_run stops at a breakpoint or watchpoint, so
+	   the next run lets that instruction through */
+	int resumeFromStop;
+
+	/* Only allocated while journaling is enabled */
+	struct mips_journal *journal;
+
+	/* Only allocated while reverse execution is enabled */
+	struct mips_history *history;
+
+	/* Only allocated while there are instrumentation hooks */
+	struct mips_plugins *plugins;
+
+	/* Only allocated while coverage is enabled */
+	mips_cpu_coverage *coverage;
+	/* Address of the delay slot of the last instruction, if it was a
+	   branch or jump, otherwise 1. Only kept up to date for coverage. */
+	uint32_t delaySlot;
+
+	/* Only allocated once an event is scheduled */
+	struct mips_events *events;
+	/* The run loop calls mips_cpu_dispatch_events once the instruction
+	   count reaches this. It is the time of the earliest event, zero
+	   while an enabled interrupt is raised, or UINT64_MAX otherwise. */
+	uint64_t nextEvent;
+	uint32_t interruptsPending;
+	uint32_t interruptMask;
+
+	/* See mips_cpu_set_fast_forward */
+	int fastForward;
+	/* The last loop head which wasn't an idle loop, so it doesn't
+	   have to be decoded again every iteration */
+	uint32_t notIdleLoop;
+};
+
+/* Undo log for the instruction being executed, or for a branch and
+   its delay slot. Every instruction changes at most two registers or
+   memory words (two for doubles), and hi/lo/fcsr are saved when the
+   group starts, so the entries only need to cover the instructions
+   in one group. */
+#define MIPS_JOURNAL_MAX 4
+
+struct mips_journal_entry{
+	int isMem;		/* Memory word at where, otherwise register where, with 32+n for $fn */
+	uint32_t where;
+	uint32_t old;
+};
+
+struct mips_journal{
+	uint32_t pc;
+	uint32_t pcN;
+	uint32_t hi;
+	uint32_t lo;
+	uint32_t fcsr;
+	uint64_t instructions;
+
+	int inDelaySlot;	/* Last instruction was a branch, so the group is still open */
+	unsigned count;
+	struct mips_journal_entry entries[MIPS_JOURNAL_MAX];
+};
+
+static inline void mips_cpu_journal_record(struct mips_journal *j, int isMem, uint32_t where, uint32_t old)
+{
+	j->entries[j->count].isMem=isMem;
+	j->entries[j->count].where=where;
+	j->entries[j->count].old=old;
+	j->count++;
+}
+
+/* Writes a floating-point register, so that it can be rolled back. */
+static inline void mips_cpu_write_fpr(mips_cpu_h state, unsigned index, uint32_t value)
+{
+	if(state->journal){
+		mips_cpu_journal_record(state->journal, 0, 32+index, state->fpr[index]);
+	}
+	state->fpr[index]=value;
+}
+
+/* Writes a general purpose register from outside writeback, such as
+   in a host call, so that it can be rolled back. */
+static inline void mips_cpu_write_gpr(mips_cpu_h state, unsigned index, uint32_t value)
+{
+	if(index==0)
+		return;
+	if(state->journal){
+		mips_cpu_journal_record(state->journal, 0, index, state->regs[index]);
+	}
+	state->regs[index]=value;
+}
+
+/* Discards the current journal group, after the state has been changed
+   from outside. (mips_cpu.c) */
+void mips_cpu_journal_close(mips_cpu_h state);
+
+/* Executes one instruction, with the same semantics as mips_cpu_step
+   apart from not resetting the pending continue. (mips_cpu.c) */
+mips_error mips_cpu_execute(mips_cpu_h state);
+
+/* Reads the value of a word before it is overwritten, so it can be put
+   back later. Unlike mips_mem_read_word this works for words which have
+   not been written yet in a RAM with mips_mem_ram_Shadow, which start
+   as zero. Putting the value back marks them as written. (mips_cpu.c) */
+mips_error mips_cpu_read_old_word(mips_mem_h mem, uint32_t address, uint32_t *value);
+
+/* History for reverse execution. Snapshots are in order of
+   instruction count, and each remembers how long the write log was
+   when it was taken, so undoing the log back to that length puts
+   memory back as it was. */
+struct mips_history_snapshot{
+	mips_cpu_arch_state arch;
+	uint64_t instructions;
+	size_t logPosition;
+};
+
+struct mips_history_write{
+	uint32_t address;	/* Aligned word address */
+	uint32_t old;
+};
+
+struct mips_history{
+	uint64_t interval;
+	size_t maxBytes;
+
+	uint64_t nextSnapshot;
+	int forceSnapshot;	/* Take one before the next instruction, e.g. after a host call */
+	int replaying;		/* Host calls must not happen */
+	int inHostcall;		/* The snapshot after the call will hold any edits */
+
+	unsigned snapCount;
+	unsigned snapCapacity;
+	struct mips_history_snapshot *snaps;
+
+	size_t logCount;
+	size_t logCapacity;
+	struct mips_history_write *log;
+};
+
+/* Takes a snapshot of the current state, if there isn't one already
+   for this instruction count. (mips_cpu_history.c) */
+void mips_cpu_history_snapshot(mips_cpu_h state);
+
+/* Records the old value of a memory word before it is written. */
+void mips_cpu_history_record(mips_cpu_h state, uint32_t address, uint32_t old);
+
+/* Discards all snapshots and the log, keeping the settings. */
+void mips_cpu_history_clear(mips_cpu_h state);
+
+/* Registers were changed from outside, so replay from an earlier
+   snapshot would not reach the current state. Starts a snapshot here. */
+void mips_cpu_history_edited(mips_cpu_h state);
+
+/* Releases the history. */
+void mips_cpu_history_free(mips_cpu_h state);
+
+/* Breakpoints are one bit per instruction, with the bitmaps for 4KB
+   pages held in a two-level table. Pages and directories are only
+   allocated when they contain a breakpoint. */
+struct mips_breakpoint_page{
+	uint32_t bits[32];
+};
+struct mips_breakpoint_dir{
+	struct mips_breakpoint_page *pages[1024];
+};
+
+struct mips_watchpoint{
+	uint32_t address;
+	uint32_t length;
+	unsigned flags;
+};
+
+struct mips_breakpoints{
+	unsigned pcCount;
+	struct mips_breakpoint_dir *dirs[1024];
+
+	unsigned watchCount;
+	unsigned watchCapacity;
+	struct mips_watchpoint *watches;
+	uint32_t watchPages[1<<15];	// One bit per 4KB page
+
+	int hit;
+	uint32_t hitAddress;
+	unsigned hitFlags;
+};
+
+static inline int mips_cpu_breakpoint_test(const struct mips_breakpoints *bp, uint32_t pc)
+{
+	const struct mips_breakpoint_dir *d=bp->dirs[pc>>22];
+	const struct mips_breakpoint_page *p= d ? d->pages[(pc>>12)&0x3FF] : 0;
+	return p && ((p->bits[(pc>>7)&0x1F]>>((pc>>2)&0x1F))&1);
+}
+
+static inline int mips_cpu_watch_armed(const uint32_t *watchPages, uint32_t address)
+{
+	return (watchPages[address>>17]>>((address>>12)&0x1F))&1;
+}
+
+/* Checks whether the load or store at address should be stopped.
+   Only called for addresses in pages which are armed.
+   (mips_cpu_breakpoint.c) */
+mips_error mips_cpu_watch_check(mips_cpu_h state, uint32_t address, uint32_t length, int write);
+
+/* Releases all breakpoints. (mips_cpu_breakpoint.c) */
+void mips_cpu_breakpoints_free(mips_cpu_h state);
+
+/* Instrumentation hooks. Each hook is copied into the list for every
+   kind of event it wants, so that delivering an event only looks at
+   the hooks for that kind. */
+#define MIPS_PLUGIN_KINDS 7
+
+struct mips_plugin_hook{
+	unsigned id;
+	uint32_t begin;
+	uint32_t end;
+	mips_plugin_callback callback;	/* Either this is called, */
+	void *context;
+	uint64_t *counter;				/* or this is incremented */
+};
+
+struct mips_plugin_list{
+	unsigned count;
+	unsigned capacity;
+	struct mips_plugin_hook *hooks;
+};
+
+struct mips_plugins{
+	unsigned kinds;		/* Kinds with at least one hook */
+	unsigned nextId;
+	struct mips_plugin_list lists[MIPS_PLUGIN_KINDS];
+};
+
+static inline int mips_cpu_plugin_wants(mips_cpu_h state, unsigned kind)
+{
+	return state->plugins && (state->plugins->kinds & kind);
+}
+
+/* Delivers an event to every hook in range. Only called if
+   mips_cpu_plugin_wants is true for the kind. */
+static inline void mips_cpu_plugin_deliver(mips_cpu_h state, const mips_plugin_event *e)
+{
+	unsigned i, index=0;
+	uint32_t where = (e->kind & (mips_plugin_Read|mips_plugin_Write)) ? e->address : e->pc;
+	const struct mips_plugin_list *list;
+
+	if(state->history && state->history->replaying)
+		return;
+
+	while((1u<<index)!=(unsigned)e->kind){
+		index++;
+	}
+	list=state->plugins->lists+index;
+	for(i=0;i<list->count;i++){
+		const struct mips_plugin_hook *h=list->hooks+i;
+		if(where<h->begin || where>h->end)
+			continue;
+		if(h->counter){
+			++*h->counter;
+		}else{
+			h->callback(h->context, state, e);
+		}
+	}
+}
+
+/* Releases all hooks. (mips_cpu_plugin.c) */
+void mips_cpu_plugins_free(mips_cpu_h state);
+
+/* Called by mips_cpu_step when it executes SYSCALL or BREAK. Returns
+   mips_Success if a handler dealt with it, in which case the
+   instruction should complete. (mips_cpu_hostcall.c) */
+mips_error mips_cpu_hostcall(mips_cpu_h state, mips_hostcall_kind kind, uint32_t code);
+
+/* Flushes output and releases the table. (mips_cpu_hostcall.c) */
+void mips_cpu_hostcall_free(mips_cpu_h state);
+
+/* Pending device events, as a binary heap ordered by (when, seq),
+   so events at the same time keep the order they were scheduled in. */
+struct mips_event{
+	uint64_t when;
+	uint64_t seq;
+	unsigned id;
+	mips_event_callback callback;
+	void *context;
+};
+
+struct mips_events{
+	unsigned count;
+	unsigned capacity;
+	struct mips_event *heap;
+	unsigned nextId;
+	uint64_t nextSeq;
+};
+
+/* Calls every event which is due, then returns mips_StopInterrupt if
+   an enabled interrupt is raised. Only needs calling once the
+   instruction count reaches nextEvent. (mips_cpu_event.c) */
+mips_error mips_cpu_dispatch_events(mips_cpu_h state);
+
+/* The history is only recorded while no events are queued and no
+   interrupts are raised, as replay can't repeat what devices do.
+   Queueing an event or raising an interrupt discards the history,
+   and recording starts again once both are clear. */
+static inline int mips_cpu_history_recording(mips_cpu_h state)
+{
+	return state->history && state->interruptsPending==0
+		&& (state->events==0 || state->events->count==0);
+}
+
+/* Cancels all events and lowers all interrupts. (mips_cpu_event.c) */
+void mips_cpu_events_reset(mips_cpu_h state);
+
+/* Releases the queue. (mips_cpu_event.c) */
+void mips_cpu_events_free(mips_cpu_h state);
+
+/* Executes a COP1 instruction of kind mips_isa_class_Float, apart from
+   the moves to and from the integer registers. Like the rest of the
+   instructions, an exception leaves the state unchanged. (mips_cpu_fpu.c) */
+mips_error mips_cpu_fpu_execute(mips_cpu_h state, mips_isa_op op, uint32_t instr);
+
+/* Called by mips_cpu_run when it has just taken a backward branch,
+   so the pc is at the delay slot. If the loop is one that can be
+   skipped, executes the delay slot and then jumps ahead by whole
+   iterations, never past end or the next event. (mips_cpu_idle.c) */
+mips_error mips_cpu_fast_forward(mips_cpu_h state, uint64_t end);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+/* Implementation of the instrumentation functions from
+   mips_plugin.h. Delivery is inline in mips_cpu_impl.h, so
+   that counters don't need a function call.
+*/
+#include "mips.h"
+#include "mips_cpu_impl.h"
+
+#include <stdlib.h>
+
+static const unsigned sg_allKinds=mips_plugin_Execute | mips_plugin_Read
+	| mips_plugin_Write | mips_plugin_Branch | mips_plugin_Exception
+	| mips_plugin_Call | mips_plugin_Return;
+
+void mips_cpu_plugins_free(mips_cpu_h state)
+{
+	unsigned i;
+	struct mips_plugins *p=state->plugins;
+
+	if(p){
+		for(i=0;i<MIPS_PLUGIN_KINDS;i++){
+			free(p->lists[i].hooks);
+		}
+		free(p);
+		state->plugins=0;
+	}
+}
+
+static int mips_cpu_plugin_append(struct mips_plugin_list *list, const struct mips_plugin_hook *h)
+{
+	if(list->count==list->capacity){
+		unsigned capacity = list->capacity ? 2*list->capacity : 4;
+		struct mips_plugin_hook *hooks=(struct mips_plugin_hook*)realloc(list->hooks, capacity*sizeof(struct mips_plugin_hook));
+		if(hooks==0)
+			return 0;
+		list->hooks=hooks;
+		list->capacity=capacity;
+	}
+	list->hooks[list->count++]=*h;
+	return 1;
+}
+
+/* Removes every copy of a hook, returning non-zero if there were any. */
+static int mips_cpu_plugin_remove_id(struct mips_plugins *p, unsigned id)
+{
+	unsigned i, j, k;
+	int found=0;
+
+	for(i=0;i<MIPS_PLUGIN_KINDS;i++){
+		struct mips_plugin_list *list=p->lists+i;
+		for(j=0,k=0;j<list->count;j++){
+			if(list->hooks[j].id==id){
+				found=1;
+			}else{
+				list->hooks[k++]=list->hooks[j];
+			}
+		}
+		list->count=k;
+		if(k==0){
+			p->kinds &= ~(1u<<i);
+		}
+	}
+	return found;
+}
+
+static mips_error mips_cpu_plugin_add(
+	mips_cpu_h state,
+	unsigned kinds,
+	const struct mips_plugin_hook *hook,
+	unsigned *hookId
+){
+	struct mips_plugin_hook h=*hook;
+	unsigned i;
+
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(kinds==0 || (kinds & ~sg_allKinds) || h.begin>h.end)
+		return mips_ErrorInvalidArgument;
+
+	if(state->plugins==0){
+		state->plugins=(struct mips_plugins*)calloc(1, sizeof(struct mips_plugins));
+		if(state->plugins==0)
+			return mips_ErrorInvalidArgument;
+	}
+
+	h.id=state->plugins->nextId++;
+	for(i=0;i<MIPS_PLUGIN_KINDS;i++){
+		if(kinds & (1u<<i)){
+			if(!mips_cpu_plugin_append(state->plugins->lists+i, &h)){
+				mips_cpu_plugin_remove_id(state->plugins, h.id);
+				return mips_ErrorInvalidArgument;
+			}
+			state->plugins->kinds |= 1u<<i;
+		}
+	}
+
+	if(hookId){
+		*hookId=h.id;
+	}
+	return mips_Success;
+}
+
+mips_error mips_cpu_add_plugin_callback(
+	mips_cpu_h state,
+	unsigned kinds,
+	uint32_t begin,
+	uint32_t end,
+	mips_plugin_callback callback,
+	void *context,
+	unsigned *hookId
+){
+	struct mips_plugin_hook h;
+
+	if(callback==0)
+		return state ? mips_ErrorInvalidArgument : mips_ErrorInvalidHandle;
+
+	h.id=0;
+	h.begin=begin;
+	h.end=end;
+	h.callback=callback;
+	h.context=context;
+	h.counter=0;
+	return mips_cpu_plugin_add(state, kinds, &h, hookId);
+}
+
+mips_error mips_cpu_add_plugin_counter(
+	mips_cpu_h state,
+	unsigned kinds,
+	uint32_t begin,
+	uint32_t end,
+	uint64_t *counter,
+	unsigned *hookId
+){
+	struct mips_plugin_hook h;
+
+	if(counter==0)
+		return state ? mips_ErrorInvalidArgument : mips_ErrorInvalidHandle;
+
+	h.id=0;
+	h.begin=begin;
+	h.end=end;
+	h.callback=0;
+	h.context=0;
+	h.counter=counter;
+	return mips_cpu_plugin_add(state, kinds, &h, hookId);
+}
+
+mips_error mips_cpu_remove_plugin(mips_cpu_h state, unsigned hookId)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+	if(state->plugins==0 || !mips_cpu_plugin_remove_id(state->plugins, hookId))
+		return mips_ErrorInvalidArgument;
+	return mips_Success;
+}
+
+mips_error mips_cpu_clear_plugins(mips_cpu_h state)
+{
+	if(state==0)
+		return mips_ErrorInvalidHandle;
+
+	mips_cpu_plugins_free(state);
+	return mips_Success;
+}
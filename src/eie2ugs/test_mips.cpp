@@ -1,4 +1,1904 @@
-#include "mips_test.h"
+#include "mips.h"
+#include "test_mips_cxx.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <map>
+#include <thread>
+#endif
+
+/* Runs from the current pc until the program exits through syscall 10,
+   which every test program ends with. */
+static mips_error run_to_exit(mips_cpu_h cpu, uint64_t maxSteps=1<<20)
+{
+	mips_error err=mips_cpu_run(cpu, maxSteps, 0);
+	if(err==mips_StopExit)
+		return mips_Success;
+	return err ? err : mips_ErrorInvalidArgument;
+}
+
+static uint32_t get_register(mips_cpu_h cpu, unsigned index)
+{
+	uint32_t value=0;
+	mips_cpu_get_register(cpu, index, &value);
+	return value;
+}
+
+/* Writes a program into memory, and starts a freshly reset CPU at it */
+static mips_error load_program(mips_cpu_h cpu, mips_mem_h mem, mips_asm &a, uint32_t origin)
+{
+	mips_error err=a.write(mem);
+	if(err==0)
+		err=mips_cpu_reset(cpu);
+	if(err==0)
+		err=mips_cpu_set_pc(cpu, origin);
+	return err;
+}
+
+/* Sums 1..100 into $9, storing each partial sum at 0x4000+4*i */
+static void assemble_sum(mips_asm &a)
+{
+	a.addiu(8, 0, 0)
+	 .addiu(9, 0, 0)
+	 .label("loop")
+	 .addiu(8, 8, 1)
+	 .addu(9, 9, 8)
+	 .sll(10, 8, 2)
+	 .sw(9, 0x4000, 10)
+	 .slti(11, 8, 100)
+	 .bne(11, 0, "loop")
+	 .nop()
+	 .li(2, 10)
+	 .syscall();
+}
+
+static void test_jumps(mips_cpu_h cpu, mips_mem_h mem)
+{
+	mips_cpu_reset(cpu);
+	int testId=mips_test_begin_test("jal");
+
+	// Out to a subroutine by label, back with jr, then on to the
+	// absolute address zero
+	mips_asm a(0x1000);
+	a.jal("sub")
+	 .nop()
+	 .j(0)
+	 .nop()
+	 .label("sub")
+	 .addiu(9, 0, 5)
+	 .jr(31)
+	 .nop();
+	mips_asm z(0);
+	z.addiu(10, 9, 1)
+	 .li(2, 10)
+	 .syscall();
+
+	mips_error err=a.write(mem);
+	if(err==0)
+		err=z.write(mem);
+	if(err==0)
+		err=mips_cpu_set_pc(cpu, 0x1000);
+	if(err==0)
+		err=run_to_exit(cpu);
+
+	mips_test_end_test(testId, err==mips_Success && get_register(cpu, 10)==6
+		&& get_register(cpu, 31)==0x1008, "jal to a label, then j to address zero");
+}
+
+static void test_checkpoint(mips_cpu_h cpu, mips_mem_h mem)
+{
+	const char *fileName="test_mips_checkpoint.tmp";
+	mips_asm a(0x1000);
+	assemble_sum(a);
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+
+	// Stop half way through the loop, save, then finish both copies
+	int testId=mips_test_begin_test("<internal>");
+	if(err==0)
+		err=mips_cpu_run(cpu, 200, 0);
+	if(err==0)
+		err=mips_checkpoint_save(cpu, mem, fileName, mips_checkpoint_Compress);
+
+	mips_cpu_h copy=0;
+	mips_mem_h copyMem=0;
+	if(err==0)
+		err=mips_checkpoint_load(fileName, &copy, &copyMem);
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(copy, 0, stdout, 0x80000, 0x100000);
+	if(err==0)
+		err=run_to_exit(cpu);
+	if(err==0)
+		err=run_to_exit(copy);
+
+	uint32_t pc=0, copyPc=1;
+	uint8_t word[4]={0}, copyWord[4]={1};
+	if(err==0){
+		mips_cpu_get_pc(cpu, &pc);
+		mips_cpu_get_pc(copy, &copyPc);
+		err=mips_mem_read(mem, 0x4000+4*50, 4, word);
+	}
+	if(err==0)
+		err=mips_mem_read(copyMem, 0x4000+4*50, 4, copyWord);
+	int passed = err==mips_Success && get_register(copy, 9)==5050 && pc==copyPc
+		&& memcmp(word, copyWord, 4)==0 && word[3]==(1275&0xFF);
+	mips_cpu_free(copy);
+	mips_mem_free(copyMem);
+	mips_test_end_test(testId, passed, "checkpoint restored part way through runs to the same result");
+
+	// A file cut short must be refused, rather than mapped past its end
+	testId=mips_test_begin_test("<internal>");
+	passed=0;
+	FILE *f=fopen(fileName, "rb");
+	if(f){
+		std::vector<char> data;
+		char buffer[4096];
+		size_t got;
+		while((got=fread(buffer, 1, sizeof(buffer), f))>0){
+			data.insert(data.end(), buffer, buffer+got);
+		}
+		fclose(f);
+
+		f=fopen(fileName, "wb");
+		if(f){
+			fwrite(&data[0], 1, data.size()-data.size()/4, f);
+			fclose(f);
+			err=mips_checkpoint_load(fileName, &copy, &copyMem);
+			passed = err==mips_ErrorFileReadError && copy==0 && copyMem==0;
+		}
+	}
+	remove(fileName);
+	mips_test_end_test(testId, passed, "truncated checkpoint is rejected");
+}
+
+/* Runs a program on a CPU of its own, attached to mem */
+static mips_error run_on(mips_mem_h mem, uint32_t pc, mips_cpu_h *cpu)
+{
+	mips_error err;
+	*cpu=mips_cpu_create(mem);
+	if(*cpu==0)
+		return mips_ErrorInvalidArgument;
+	err=mips_cpu_install_spim_hostcalls(*cpu, 0, stdout, 0x80000, 0x100000);
+	if(err==0)
+		err=mips_cpu_set_pc(*cpu, pc);
+	if(err==0)
+		err=run_to_exit(*cpu);
+	return err;
+}
+
+static void test_overlay(mips_mem_h mem)
+{
+	int testId=mips_test_begin_test("<internal>");
+
+	// Two overlays share the program in the base, and only one runs it
+	mips_asm a(0x1000);
+	assemble_sum(a);
+	mips_error err=a.write(mem);
+	uint8_t zero[4]={0, 0, 0, 0};
+	if(err==0)
+		err=mips_mem_write(mem, 0x4000+4*100, 4, zero);
+
+	mips_mem_h ran=mips_mem_create_overlay(mem);
+	mips_mem_h idle=mips_mem_create_overlay(mem);
+	mips_cpu_h other=0;
+	if(ran==0 || idle==0)
+		err=mips_ErrorInvalidArgument;
+	if(err==0)
+		err=run_on(ran, 0x1000, &other);
+
+	uint8_t inRan[4]={0}, inIdle[4]={1}, inBase[4]={1};
+	uint32_t pages=0, idlePages=1;
+	if(err==0)
+		err=mips_mem_read(ran, 0x4000+4*100, 4, inRan);
+	if(err==0)
+		err=mips_mem_read(idle, 0x4000+4*100, 4, inIdle);
+	if(err==0)
+		err=mips_mem_read(mem, 0x4000+4*100, 4, inBase);
+	if(err==0)
+		err=mips_mem_overlay_pages(ran, &pages);
+	if(err==0)
+		err=mips_mem_overlay_pages(idle, &idlePages);
+
+	int passed = err==mips_Success && get_register(other, 9)==5050
+		&& inRan[2]==(5050>>8) && inRan[3]==(5050&0xFF)
+		&& memcmp(inIdle, zero, 4)==0 && memcmp(inBase, zero, 4)==0
+		&& pages==1 && idlePages==0;
+	mips_cpu_free(other);
+	mips_mem_free(idle);
+	mips_mem_free(ran);
+	mips_test_end_test(testId, passed, "writes through an overlay stay in that overlay");
+
+	// Faults on a shadow base are reported by the overlay, not the base
+	testId=mips_test_begin_test("<internal>");
+	passed=0;
+	mips_mem_h base=mips_mem_create_ram_ex(1<<16, 4, mips_mem_ram_Shadow);
+	mips_mem_h over=base ? mips_mem_create_overlay(base) : 0;
+	if(over){
+		uint8_t b[4];
+		uint32_t where=0;
+		err=mips_mem_write(base, 0x100, 4, zero);
+		if(err==0)
+			err=mips_mem_write(over, 0x104, 4, zero);
+		passed = err==mips_Success
+			&& mips_mem_read(over, 0x100, 4, b)==mips_Success
+			&& mips_mem_read(over, 0x104, 4, b)==mips_Success
+			&& mips_mem_read(over, 0x108, 4, b)==mips_ExceptionUninitialisedRead
+			&& mips_mem_get_uninitialised_read(over, &where)==mips_Success && where==0x108
+			&& mips_mem_get_uninitialised_read(base, &where)==mips_ErrorInvalidArgument
+			&& mips_mem_read(base, 0x104, 4, b)==mips_ExceptionUninitialisedRead;
+	}
+	mips_test_end_test(testId, passed, "shadow bits of a base are checked through an overlay");
+
+	// An overlay of that overlay sees the bits of both
+	testId=mips_test_begin_test("<internal>");
+	passed=0;
+	mips_mem_h top=over ? mips_mem_create_overlay(over) : 0;
+	if(top){
+		uint8_t b[8]={0};
+		uint32_t where=0;
+		err=mips_mem_write(over, 0x2004, 4, zero);
+		if(err==0)
+			err=mips_mem_write(top, 0x10C, 4, zero);
+		passed = err==mips_Success
+			&& mips_mem_read(top, 0x100, 4, b)==mips_Success
+			&& mips_mem_read(top, 0x104, 4, b)==mips_Success
+			&& mips_mem_read(top, 0x10C, 4, b)==mips_Success
+			&& mips_mem_read(top, 0x108, 4, b)==mips_ExceptionUninitialisedRead
+			&& mips_mem_get_uninitialised_read(top, &where)==mips_Success && where==0x108
+			&& mips_mem_read_word(top, 0x2004, &where)==mips_Success && where==0
+			&& mips_mem_read_masked(top, 0x2000, 8, b, 0xF0)==mips_Success
+			&& mips_mem_read_masked(top, 0x2000, 8, b, 0x01)==mips_ExceptionUninitialisedRead
+			&& mips_mem_get_uninitialised_read(top, &where)==mips_Success && where==0x2000
+			&& mips_mem_read(over, 0x10C, 4, b)==mips_ExceptionUninitialisedRead;
+	}
+	mips_mem_free(top);
+	mips_mem_free(over);
+	mips_mem_free(base);
+	mips_test_end_test(testId, passed, "shadow bits are checked through a chain of overlays");
+}
+
+static void test_shadow(mips_cpu_h suiteCpu)
+{
+	int passed=0;
+
+	// The byte after the one stored has never been written
+	mips_mem_h mem=mips_mem_create_ram_ex(1<<20, 4, mips_mem_ram_Shadow);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	mips_asm a(0x1000);
+	a.addiu(8, 0, 0x55)
+	 .sb(8, 0x3000, 0)
+	 .lbu(9, 0x3000, 0)
+	 .label("bad")
+	 .lbu(10, 0x3001, 0)
+	 .li(2, 10)
+	 .syscall();
+
+	mips_error err = cpu ? load_program(cpu, mem, a, 0x1000) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, 0, stdout, 0x80000, 0x100000);
+
+	mips_test_set_cpu(cpu);
+	int testId=mips_test_begin_test("lbu");
+	if(err==0){
+		uint32_t pc=0, where=0;
+		err=mips_cpu_run(cpu, 100, 0);
+		mips_cpu_get_pc(cpu, &pc);
+		passed = err==mips_ExceptionUninitialisedRead && pc==a.address_of("bad")
+			&& get_register(cpu, 9)==0x55 && get_register(cpu, 10)==0
+			&& mips_mem_get_uninitialised_read(mem, &where)==mips_Success && where==0x3001;
+
+		// Once it is marked as written the load goes through
+		err=mips_mem_set_initialised(mem, 0x3001, 1);
+		if(err==0)
+			err=run_to_exit(cpu);
+		passed = passed && err==mips_Success;
+	}
+	mips_test_end_test(testId, passed, "load of an unwritten byte stops at the load");
+	mips_test_set_cpu(suiteCpu);
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+/* Snapshot of what the summing program has done so far */
+struct sum_state
+{
+	uint32_t pc;
+	uint32_t i;
+	uint32_t sum;
+	uint8_t last[4];
+	uint64_t count;
+};
+
+static mips_error get_sum_state(mips_cpu_h cpu, mips_mem_h mem, sum_state &st)
+{
+	mips_error err=mips_cpu_get_pc(cpu, &st.pc);
+	if(err==0)
+		err=mips_cpu_get_instruction_count(cpu, &st.count);
+	if(err==0)
+		err=mips_mem_read(mem, 0x4000+4*99, 4, st.last);
+	st.i=get_register(cpu, 8);
+	st.sum=get_register(cpu, 9);
+	return err;
+}
+
+static void test_reverse(mips_cpu_h cpu, mips_mem_h mem)
+{
+	// The table starts clear, so undoing the writes can be seen
+	std::vector<uint8_t> zero(4*101, 0);
+	mips_asm a(0x1000);
+	assemble_sum(a);
+	mips_error err=mips_mem_write(mem, 0x4000, zero.size(), &zero[0]);
+	if(err==0)
+		err=load_program(cpu, mem, a, 0x1000);
+	if(err==0)
+		err=mips_cpu_set_history(cpu, 16, 1<<20);
+
+	int testId=mips_test_begin_test("<internal>");
+	sum_state part, end, back;
+	if(err==0)
+		err=mips_cpu_run(cpu, 300, 0);
+	if(err==0)
+		err=get_sum_state(cpu, mem, part);
+	if(err==0)
+		err=run_to_exit(cpu);
+	if(err==0)
+		err=get_sum_state(cpu, mem, end);
+	if(err==0)
+		err=mips_cpu_reverse_step(cpu, end.count-part.count);
+	if(err==0)
+		err=get_sum_state(cpu, mem, back);
+	mips_test_end_test(testId, err==mips_Success && end.last[3]!=0
+		&& back.pc==part.pc && back.i==part.i && back.sum==part.sum
+		&& back.count==part.count && memcmp(back.last, part.last, 4)==0 && back.last[3]==0,
+		"reverse step from the exit gives the state part way through");
+
+	// The loop head is at 2+7*k instructions, and the last visit before
+	// 300 is the 43rd
+	testId=mips_test_begin_test("<internal>");
+	int passed=0;
+	if(err==0)
+		err=mips_cpu_set_breakpoint(cpu, a.address_of("loop"));
+	if(err==0){
+		passed = mips_cpu_reverse_continue(cpu)==mips_StopBreakpoint
+			&& get_sum_state(cpu, mem, back)==mips_Success
+			&& back.pc==a.address_of("loop") && back.count==2+7*42 && back.i==42
+			&& mips_cpu_run(cpu, 1, 0)==mips_Success
+			&& mips_cpu_get_pc(cpu, &back.pc)==mips_Success && back.pc==a.address_of("loop")+4;
+	}
+	mips_cpu_clear_all_breakpoints(cpu);
+	mips_cpu_set_history(cpu, 0, 0);
+	mips_test_end_test(testId, passed, "reverse continue stops at the previous breakpoint");
+}
+
+/* Runs a CPU with and without fast-forwarding for the same number of
+   instructions, and checks they end up in exactly the same place */
+static int same_with_fast_forward(mips_cpu_h fast, mips_cpu_h slow, uint32_t pc, uint64_t maxSteps)
+{
+	mips_error errFast=mips_cpu_set_pc(fast, pc);
+	mips_error errSlow=mips_cpu_set_pc(slow, pc);
+	if(errFast || errSlow)
+		return 0;
+	errFast=mips_cpu_run(fast, maxSteps, 0);
+	errSlow=mips_cpu_run(slow, maxSteps, 0);
+
+	uint64_t countFast=0, countSlow=1;
+	uint32_t pcFast=0, pcSlow=1;
+	mips_cpu_get_instruction_count(fast, &countFast);
+	mips_cpu_get_instruction_count(slow, &countSlow);
+	mips_cpu_get_pc(fast, &pcFast);
+	mips_cpu_get_pc(slow, &pcSlow);
+	for(unsigned i=0; i<32; i++){
+		if(get_register(fast, i)!=get_register(slow, i))
+			return 0;
+	}
+	return errFast==errSlow && countFast==countSlow && pcFast==pcSlow;
+}
+
+static void test_fast_forward(void)
+{
+	// Coverage turns fast-forwarding off, so these CPUs are not given
+	// to the test framework
+	mips_mem_h mem=mips_mem_create_ram(1<<16, 4);
+	mips_cpu_h fast=mips_cpu_create(mem);
+	mips_cpu_h slow=mips_cpu_create(mem);
+	mips_asm a(0x1000);
+	a.li(8, 1000000)
+	 .label("countdown")
+	 .addiu(8, 8, -1)
+	 .bne(8, 0, "countdown")
+	 .nop()
+	 .addiu(9, 0, 7)
+	 .li(2, 10)
+	 .syscall()
+	 .label("spin")
+	 .j("spin")
+	 .nop();
+	mips_error err = fast && slow ? a.write(mem) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(fast, 0, stdout, 0x8000, 0x10000);
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(slow, 0, stdout, 0x8000, 0x10000);
+	if(err==0)
+		err=mips_cpu_set_fast_forward(slow, 0);
+
+	int testId=mips_test_begin_test("<internal>");
+	int passed = err==mips_Success
+		&& same_with_fast_forward(fast, slow, 0x1000, UINT64_MAX)
+		&& get_register(fast, 9)==7;
+	mips_test_end_test(testId, passed, "countdown skipped to exit matches stepping every iteration");
+
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success
+		&& mips_cpu_reset(fast)==mips_Success && mips_cpu_reset(slow)==mips_Success
+		&& same_with_fast_forward(fast, slow, 0x1000, 1234567)
+		&& get_register(fast, 8)!=0;
+	mips_test_end_test(testId, passed, "countdown stopped part way by maxSteps matches stepping");
+
+	testId=mips_test_begin_test("<internal>");
+	uint64_t count=0;
+	passed = err==mips_Success
+		&& mips_cpu_reset(fast)==mips_Success && mips_cpu_reset(slow)==mips_Success
+		&& same_with_fast_forward(fast, slow, a.address_of("spin"), 100001)
+		&& mips_cpu_get_instruction_count(fast, &count)==mips_Success && count==100001;
+	mips_test_end_test(testId, passed, "jump to self runs exactly maxSteps");
+
+	mips_cpu_free(fast);
+	mips_cpu_free(slow);
+	mips_mem_free(mem);
+}
+
+/* The assembler has no COP1 methods, so these are encoded here.
+   Arithmetic puts fmt in rs, ft in rt, fs in rd and fd in shift. */
+enum{ fmt_S=0x10, fmt_D=0x11, fmt_W=0x14 };
+enum{ cop1_MFC1=0x00, cop1_CFC1=0x02, cop1_MTC1=0x04, cop1_CTC1=0x06 };
+
+static uint32_t cop1(unsigned fmt, unsigned fd, unsigned fs, unsigned ft, unsigned funct)
+{
+	return mips_asm_encode_r(0x11, fmt, ft, fs, fd, funct);
+}
+
+static uint32_t cop1_move(unsigned op, unsigned rt, unsigned fs)
+{
+	return mips_asm_encode_r(0x11, op, rt, fs, 0, 0);
+}
+
+static void test_fpu_program(mips_cpu_h cpu, mips_mem_h mem, const char *name,
+	mips_asm &a, uint32_t expected, const char *msg)
+{
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+	int testId=mips_test_begin_test(name);
+	if(err==0)
+		err=run_to_exit(cpu);
+	mips_test_end_test(testId, err==mips_Success && get_register(cpu, 10)==expected, msg);
+}
+
+static void test_fpu(mips_cpu_h cpu, mips_mem_h mem)
+{
+	// 1.5 + 2.25 == 3.75
+	mips_asm add(0x1000);
+	add.li(8, 0x3FC00000).word(cop1_move(cop1_MTC1, 8, 0))
+	 .li(8, 0x40100000).word(cop1_move(cop1_MTC1, 8, 2))
+	 .word(cop1(fmt_S, 4, 0, 2, 0x00))	// add.s $f4, $f0, $f2
+	 .word(cop1_move(cop1_MFC1, 10, 4))
+	 .li(2, 10)
+	 .syscall();
+	test_fpu_program(cpu, mem, "add.s", add, 0x40700000, "1.5+2.25 == 3.75");
+
+	// 1.0 < 2.0, so the branch on the condition is taken
+	mips_asm lt(0x1000);
+	lt.word(cop1_move(cop1_MTC1, 0, 0))
+	 .li(8, 0x3FF00000).word(cop1_move(cop1_MTC1, 8, 1))
+	 .word(cop1_move(cop1_MTC1, 0, 2))
+	 .li(8, 0x40000000).word(cop1_move(cop1_MTC1, 8, 3))
+	 .word(cop1(fmt_D, 0, 0, 2, 0x3C));	// c.lt.d $f0, $f2
+	mips_asm_branch(lt.handle(), mips_asm_encode_i(0x11, 0x08, 1, 0), "less");	// bc1t less
+	lt.nop()
+	 .addiu(10, 0, 1)
+	 .li(2, 10)
+	 .syscall()
+	 .label("less")
+	 .addiu(10, 0, 2)
+	 .li(2, 10)
+	 .syscall();
+	test_fpu_program(cpu, mem, "c.lt.d", lt, 2, "1.0 < 2.0 sets the condition");
+
+	// 2.5 converts to 3 rounding towards +inf, but round.w always goes to even
+	mips_asm rm(0x1000);
+	rm.addiu(8, 0, 2).word(cop1_move(cop1_CTC1, 8, 31))
+	 .li(8, 0x40200000).word(cop1_move(cop1_MTC1, 8, 0))
+	 .word(cop1(fmt_S, 2, 0, 0, 0x24))	// cvt.w.s $f2, $f0
+	 .word(cop1(fmt_S, 4, 0, 0, 0x0C))	// round.w.s $f4, $f0
+	 .word(cop1_move(cop1_MFC1, 10, 2))
+	 .word(cop1_move(cop1_MFC1, 11, 4))
+	 .sll(11, 11, 8)
+	 .or_(10, 10, 11)
+	 .li(2, 10)
+	 .syscall();
+	test_fpu_program(cpu, mem, "cvt.w.s", rm, 0x203, "2.5 converts to 3 towards +inf, and rounds to 2");
+
+	// Without the enable, 1/0 gives +inf and sets the Z cause and flag
+	mips_asm inf(0x1000);
+	inf.li(8, 0x3F800000).word(cop1_move(cop1_MTC1, 8, 0))
+	 .word(cop1_move(cop1_MTC1, 0, 2))
+	 .word(cop1(fmt_S, 4, 0, 2, 0x03))	// div.s $f4, $f0, $f2
+	 .word(cop1_move(cop1_MFC1, 10, 4))
+	 .word(cop1_move(cop1_CFC1, 11, 31))
+	 .li(2, 10)
+	 .syscall();
+	mips_error err=load_program(cpu, mem, inf, 0x1000);
+	int testId=mips_test_begin_test("div.s");
+	if(err==0)
+		err=run_to_exit(cpu);
+	mips_test_end_test(testId, err==mips_Success && get_register(cpu, 10)==0x7F800000
+		&& get_register(cpu, 11)==0x8020, "1/0 is +inf with divide-by-zero cause and flag");
+
+	// With it enabled, the divide traps and changes nothing
+	mips_asm trap(0x1000);
+	trap.li(8, 0x3F800000).word(cop1_move(cop1_MTC1, 8, 0))
+	 .word(cop1_move(cop1_MTC1, 0, 2))
+	 .word(cop1_move(cop1_MTC1, 8, 4))
+	 .addiu(9, 0, 0x400).word(cop1_move(cop1_CTC1, 9, 31))
+	 .label("div")
+	 .word(cop1(fmt_S, 4, 0, 2, 0x03))	// div.s $f4, $f0, $f2
+	 .li(2, 10)
+	 .syscall();
+	err=load_program(cpu, mem, trap, 0x1000);
+	testId=mips_test_begin_test("div.s");
+	mips_cpu_arch_state st;
+	int passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionFloatingPoint
+		&& mips_cpu_get_arch_state(cpu, &st)==mips_Success
+		&& st.pc==trap.address_of("div") && st.fpr[4]==0x3F800000 && st.fcsr==0x400;
+	mips_test_end_test(testId, passed, "enabled divide-by-zero traps with $f4 and fcsr unchanged");
+}
+
+/* A double store which starts in memory and ends past it must not
+   write the half that fits */
+static void test_sdc1_at_end(mips_cpu_h suiteCpu)
+{
+	mips_mem_h mem=mips_mem_create_ram(0x10004, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	uint8_t before[4]={0x12, 0x34, 0x56, 0x78}, after[4]={0};
+	mips_asm a(0x1000);
+	a.li(8, 0x3FF00000).word(cop1_move(cop1_MTC1, 8, 1))
+	 .word(cop1_move(cop1_MTC1, 8, 0))
+	 .li(9, 0x10000)
+	 .label("store")
+	 .word(mips_asm_encode_i(0x3D, 9, 0, 0))	// sdc1 $f0, 0($9)
+	 .li(2, 10)
+	 .syscall();
+	mips_error err = cpu ? load_program(cpu, mem, a, 0x1000) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_mem_write(mem, 0x10000, 4, before);
+
+	mips_test_set_cpu(cpu);
+	int testId=mips_test_begin_test("sdc1");
+	uint32_t pc=0;
+	int passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionInvalidAddress
+		&& mips_cpu_get_pc(cpu, &pc)==mips_Success && pc==a.address_of("store")
+		&& mips_mem_read(mem, 0x10000, 4, after)==mips_Success && memcmp(before, after, 4)==0;
+	mips_test_end_test(testId, passed, "sdc1 across the end of memory writes neither word");
+	mips_test_set_cpu(suiteCpu);
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+/* Big-endian fields, for building an ELF file */
+static void put16(std::vector<uint8_t> &v, uint32_t x)
+{
+	v.push_back((uint8_t)(x>>8));
+	v.push_back((uint8_t)x);
+}
+
+static void put32(std::vector<uint8_t> &v, uint32_t x)
+{
+	put16(v, x>>16);
+	put16(v, x&0xFFFF);
+}
+
+static void put_section(std::vector<uint8_t> &v, uint32_t name, uint32_t type, uint32_t flags,
+	uint32_t offset, uint32_t size, uint32_t link, uint32_t info, uint32_t align, uint32_t entsize)
+{
+	put32(v, name); put32(v, type); put32(v, flags); put32(v, 0);
+	put32(v, offset); put32(v, size); put32(v, link); put32(v, info);
+	put32(v, align); put32(v, entsize);
+}
+
+/* Wraps the code of a fragment in a relocatable object, laid out the
+   way the cross compiler does: .text with a function symbol covering
+   the code, and a 16 byte .bss with an object symbol called "table". */
+static std::vector<uint8_t> make_object(const std::vector<uint8_t> &code, const std::string &function)
+{
+	std::string strtab(1, '\0');
+	strtab+=function;
+	strtab+='\0';
+	strtab+="table";
+	strtab+='\0';
+	const char shstrtab[]="\0.text\0.bss\0.symtab\0.strtab\0.shstrtab";
+	uint32_t textOffset=52, symOffset=textOffset+((code.size()+3)&~3u);
+	uint32_t strOffset=symOffset+3*16, shstrOffset=strOffset+strtab.size();
+	uint32_t shOffset=(shstrOffset+sizeof(shstrtab)+3)&~3u;
+
+	std::vector<uint8_t> v;
+	const uint8_t ident[16]={ 0x7F, 'E', 'L', 'F', 1, 2, 1 };
+	v.insert(v.end(), ident, ident+16);
+	put16(v, 1); put16(v, 8); put32(v, 1);		// ET_REL, EM_MIPS, EV_CURRENT
+	put32(v, 0); put32(v, 0); put32(v, shOffset); put32(v, 0);
+	put16(v, 52); put16(v, 32); put16(v, 0); put16(v, 40); put16(v, 6); put16(v, 5);
+
+	v.insert(v.end(), code.begin(), code.end());
+	v.resize(symOffset, 0);
+	put32(v, 0); put32(v, 0); put32(v, 0); put32(v, 0);
+	put32(v, 1); put32(v, 0); put32(v, code.size()); put16(v, 0x1200); put16(v, 1);	// GLOBAL FUNC in .text
+	put32(v, 2+function.size()); put32(v, 0); put32(v, 16); put16(v, 0x1100); put16(v, 2);	// GLOBAL OBJECT in .bss
+	v.insert(v.end(), strtab.begin(), strtab.end());
+	v.insert(v.end(), shstrtab, shstrtab+sizeof(shstrtab));
+	v.resize(shOffset, 0);
+
+	put_section(v, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	put_section(v, 1, 1, 6, textOffset, code.size(), 0, 0, 16, 0);		// .text, PROGBITS, ALLOC|EXECINSTR
+	put_section(v, 7, 8, 3, symOffset, 16, 0, 0, 16, 0);				// .bss, NOBITS, WRITE|ALLOC
+	put_section(v, 12, 2, 0, symOffset, 3*16, 4, 1, 4, 16);				// .symtab
+	put_section(v, 20, 3, 0, strOffset, strtab.size(), 0, 0, 1, 0);		// .strtab
+	put_section(v, 28, 3, 0, shstrOffset, sizeof(shstrtab), 0, 0, 1, 0);	// .shstrtab
+	return v;
+}
+
+static bool read_file(const char *name, std::vector<uint8_t> &data)
+{
+	FILE *f=fopen(name, "rb");
+	if(f==0)
+		return false;
+	uint8_t buffer[4096];
+	size_t got;
+	while((got=fread(buffer, 1, sizeof(buffer), f))>0){
+		data.insert(data.end(), buffer, buffer+got);
+	}
+	fclose(f);
+	return true;
+}
+
+static void test_elf(mips_cpu_h cpu, mips_mem_h mem)
+{
+	const char *fileName="test_mips_elf.tmp";
+
+	// Run from the top of the tree, or from next to the test
+	std::vector<uint8_t> code;
+	if(!read_file("fragments/f_fibonacci-mips.bin", code))
+		read_file("../../fragments/f_fibonacci-mips.bin", code);
+
+	mips_elf_h elf=0;
+	mips_error err = code.empty() ? mips_ErrorFileReadError : mips_Success;
+	if(err==0){
+		std::vector<uint8_t> object=make_object(code, "f_fibonacci");
+		FILE *f=fopen(fileName, "wb");
+		if(f==0 || fwrite(&object[0], 1, object.size(), f)!=object.size())
+			err=mips_ErrorFileWriteError;
+		if(f)
+			fclose(f);
+	}
+	if(err==0)
+		err=mips_elf_open(fileName, &elf);
+
+	int testId=mips_test_begin_test("<internal>");
+	uint32_t textAddress=1, textSize=0, bssAddress=0, bssSize=0, offset=0;
+	const mips_elf_symbol *inside=0, *byName=0, *table=0;
+	if(err==0)
+		err=mips_elf_get_section(elf, ".text", &textAddress, &textSize);
+	if(err==0)
+		err=mips_elf_get_section(elf, ".bss", &bssAddress, &bssSize);
+	if(err==0){
+		inside=mips_elf_find_symbol(elf, 0x28, &offset);
+		byName=mips_elf_lookup_symbol(elf, "f_fibonacci");
+		table=mips_elf_lookup_symbol(elf, "table");
+	}
+	mips_test_end_test(testId, err==mips_Success && textAddress==0 && textSize==code.size()
+		&& bssAddress==((textSize+15)&~15u) && bssSize==16
+		&& inside && byName==inside && strcmp(inside->name, "f_fibonacci")==0 && offset==0x28
+		&& table && table->address==bssAddress && table->size==16,
+		"sections of an object are laid out in order, and symbols found by address and name");
+
+	// Load over a dirty .bss, then call f_fibonacci(12), returning to a
+	// stub which saves $v0 and exits
+	std::vector<uint8_t> dirty(16, 0xFF);
+	mips_asm stub(0x8000);
+	stub.move(10, 2)
+	 .li(2, 10)
+	 .syscall();
+	if(err==0)
+		err=mips_mem_write(mem, bssAddress, 16, &dirty[0]);
+	if(err==0)
+		err=stub.write(mem);
+	if(err==0)
+		err=mips_cpu_reset(cpu);
+	if(err==0)
+		err=mips_elf_load(elf, mem, cpu);
+	if(err==0)
+		err=mips_cpu_set_register(cpu, 4, 12);
+	if(err==0)
+		err=mips_cpu_set_register(cpu, 29, 0x80000);
+	if(err==0)
+		err=mips_cpu_set_register(cpu, 31, 0x8000);
+
+	testId=mips_test_begin_test("<internal>");
+	uint8_t bss[16]={1};
+	if(err==0)
+		err=mips_mem_read(mem, bssAddress, 16, bss);
+	if(err==0)
+		err=run_to_exit(cpu);
+	std::vector<uint8_t> zero(16, 0);
+	mips_test_end_test(testId, err==mips_Success && memcmp(bss, &zero[0], 16)==0
+		&& get_register(cpu, 10)==144, "loaded object clears .bss and computes fib(12)");
+
+	mips_elf_free(elf);
+	remove(fileName);
+}
+
+static void test_profile(mips_cpu_h cpu, mips_mem_h mem)
+{
+	// rec(3) calls itself down to rec(0), saving $ra on the stack
+	mips_asm a(0x1000);
+	a.li(4, 3)
+	 .jal("rec")
+	 .nop()
+	 .li(2, 10)
+	 .syscall()
+	 .label("rec")
+	 .beq(4, 0, "done")
+	 .nop()
+	 .addiu(29, 29, -8)
+	 .sw(31, 0, 29)
+	 .addiu(4, 4, -1)
+	 .jal("rec")
+	 .nop()
+	 .lw(31, 0, 29)
+	 .addiu(29, 29, 8)
+	 .label("done")
+	 .jr(31)
+	 .nop();
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+	if(err==0)
+		err=mips_cpu_set_register(cpu, 29, 0x80000);
+	mips_profile_h profile = err ? 0 : mips_profile_create(cpu);
+
+	int testId=mips_test_begin_test("<internal>");
+	mips_profile_function top, rec;
+	uint64_t count=0;
+	err = profile ? run_to_exit(cpu) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_profile_get_function(profile, 0x1000, &top);
+	if(err==0)
+		err=mips_profile_get_function(profile, a.address_of("rec"), &rec);
+	if(err==0)
+		err=mips_cpu_get_instruction_count(cpu, &count);
+
+	// Each of the three calls which recurse is 11 instructions, counting
+	// the delay slot of the jal into it and of the jr back from its callee,
+	// and rec(0) is 4. Recursion is only counted once in inclusive.
+	mips_test_end_test(testId, err==mips_Success
+		&& rec.calls==4 && rec.exclusive==3*11+4 && rec.inclusive==rec.exclusive
+		&& top.calls==0 && top.inclusive==count && top.exclusive+rec.exclusive==count,
+		"exclusive and inclusive counts of a recursive function");
+	mips_profile_free(profile);
+}
+
+/* Runs a farm job on a CPU and RAM of its own, in this thread */
+static mips_error run_serially(const mips_farm_job &job, mips_farm_result &res)
+{
+	mips_mem_h mem=mips_mem_create_ram_ex(job.memSize, 4, mips_mem_ram_Zero);
+	mips_cpu_h cpu = mem ? mips_cpu_create(mem) : 0;
+	mips_error err = cpu ? mips_mem_write(mem, job.loadAddress, job.imageLength, job.image) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_set_arch_state(cpu, &job.initial);
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, 0, 0, job.loadAddress+job.imageLength, job.memSize);
+	if(err==0){
+		res.stop=mips_cpu_run(cpu, job.maxSteps, 0);
+		mips_cpu_get_instruction_count(cpu, &res.instructions);
+		mips_cpu_get_exit_code(cpu, &res.exitCode);
+		mips_cpu_get_arch_state(cpu, &res.final);
+
+		// FNV-1a of the memory in address order, as the farm does
+		std::vector<uint8_t> data(job.memSize);
+		err=mips_mem_read(mem, 0, job.memSize, &data[0]);
+		res.memDigest=0xCBF29CE484222325ull;
+		for(size_t i=0; i<data.size(); i++){
+			res.memDigest=(res.memDigest^data[i])*0x100000001B3ull;
+		}
+	}
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+	return err;
+}
+
+static void test_farm(void)
+{
+	// Sums 1..$a0, storing each partial sum, and exits with the total
+	mips_asm a(0);
+	a.addiu(8, 0, 0)
+	 .addiu(9, 0, 0)
+	 .label("loop")
+	 .addiu(8, 8, 1)
+	 .addu(9, 9, 8)
+	 .sll(10, 8, 2)
+	 .sw(9, 0x4000, 10)
+	 .bne(8, 4, "loop")
+	 .nop()
+	 .move(4, 9)
+	 .li(2, 17)
+	 .syscall();
+	uint32_t length=0;
+	mips_error err=mips_asm_assemble(a.handle(), 0, &length);
+	std::vector<uint8_t> image(length);
+	if(err==0)
+		err=mips_asm_assemble(a.handle(), &image[0], &length);
+
+	// The last job runs out of steps part way through
+	const unsigned count=64;
+	std::vector<mips_farm_job> jobs(count);
+	std::vector<unsigned> ids(count);
+	mips_farm_h farm = err ? 0 : mips_farm_create(4);
+	for(unsigned i=0; i<count && farm; i++){
+		mips_farm_job_init(&jobs[i], &image[0], length);
+		jobs[i].memSize=1<<16;
+		jobs[i].initial.regs[29]=jobs[i].memSize;
+		jobs[i].initial.regs[4]=i+1;
+		if(i==count-1){
+			jobs[i].initial.regs[4]=1000;
+			jobs[i].maxSteps=500;
+		}
+		err=mips_farm_submit(farm, &jobs[i], &ids[i]);
+		if(err)
+			break;
+	}
+	if(farm && err==0)
+		err=mips_farm_wait(farm);
+
+	int testId=mips_test_begin_test("<internal>");
+	int passed = farm!=0 && err==mips_Success;
+	for(unsigned i=0; i<count && passed; i++){
+		mips_farm_result got, expected;
+		memset(&got, 0, sizeof(got));
+		memset(&expected, 0, sizeof(expected));
+		passed = mips_farm_get_result(farm, ids[i], &got)==mips_Success
+			&& run_serially(jobs[i], expected)==mips_Success
+			&& got.stop==expected.stop && got.instructions==expected.instructions
+			&& memcmp(&got.final, &expected.final, sizeof(got.final))==0
+			&& got.memDigest==expected.memDigest;
+		if(i<count-1){
+			passed = passed && got.stop==mips_StopExit && got.exitCode==(i+1)*(i+2)/2;
+		}else{
+			passed = passed && got.stop==mips_Success && got.instructions==500;
+		}
+	}
+	mips_farm_free(farm);
+	mips_test_end_test(testId, passed, "farm results match running each job on its own");
+}
+
+static void test_journal(mips_cpu_h cpu, mips_mem_h mem)
+{
+	// The delay slot of the jal is a misaligned load
+	mips_asm a(0x1000);
+	a.addiu(8, 0, 1)
+	 .label("call")
+	 .jal("target")
+	 .label("slot")
+	 .lw(9, 1, 0)
+	 .label("target")
+	 .li(2, 10)
+	 .syscall();
+
+	for(int journaled=0; journaled<2; journaled++){
+		mips_error err=load_program(cpu, mem, a, 0x1000);
+		if(err==0)
+			err=mips_cpu_set_journaled(cpu, journaled);
+
+		int testId=mips_test_begin_test("<internal>");
+		uint32_t pc=0;
+		uint64_t count=0;
+		int passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionInvalidAlignment
+			&& mips_cpu_get_pc(cpu, &pc)==mips_Success
+			&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success
+			&& get_register(cpu, 8)==1;
+		if(journaled){
+			// The jal is undone along with its delay slot
+			passed = passed && pc==a.address_of("call") && count==1 && get_register(cpu, 31)==0;
+		}else{
+			passed = passed && pc==a.address_of("slot") && count==2 && get_register(cpu, 31)==a.address_of("target");
+		}
+		mips_test_end_test(testId, passed, journaled ? "journaled jal is rolled back with its delay slot"
+			: "without journaling the jal stays done");
+	}
+	mips_cpu_set_journaled(cpu, 0);
+}
+
+/* Stands in for a compiled translation of assemble_sum at 0x1000. It
+   only knows the first two instructions, and hands everything else
+   back to the interpreter. */
+static void sum_prologue_run(mips_aot_context *ctx)
+{
+	if(ctx->arch.pc!=0x1000 || ctx->arch.pcN!=0x1004 || ctx->limit<2)
+		return;
+	ctx->arch.regs[8]=0;
+	ctx->arch.regs[9]=0;
+	ctx->arch.pc=0x1008;
+	ctx->arch.pcN=0x100C;
+	ctx->count=2;
+}
+
+static void test_aot(void)
+{
+	mips_asm a(0x1000);
+	assemble_sum(a);
+	std::vector<uint8_t> image;
+	uint32_t length=0;
+	mips_error err=mips_asm_assemble(a.handle(), 0, &length);
+	if(err==0){
+		image.resize(length);
+		err=mips_asm_assemble(a.handle(), &image[0], &length);
+	}
+
+	mips_aot_module module={ MIPS_AOT_VERSION, 0x1000, length, 0xCBF29CE484222325ull, sum_prologue_run };
+	for(size_t i=0; i<image.size(); i++){
+		module.digest=(module.digest^image[i])*0x100000001B3ull;
+	}
+
+	int testId=mips_test_begin_test("<internal>");
+	FILE *dst=tmpfile();
+	int passed = err==mips_Success && dst!=0
+		&& mips_aot_translate(&image[0], length, 0x1000, 0, 0, 0, dst)==mips_Success;
+	if(passed){
+		// The generated module carries the same digest that mips_aot_check uses
+		char expected[64];
+		sprintf(expected, "0x%016llxull", (unsigned long long)module.digest);
+		std::string source((size_t)ftell(dst), '\0');
+		rewind(dst);
+		passed = fread(&source[0], 1, source.size(), dst)==source.size()
+			&& source.find("const mips_aot_module mips_aot_image=")!=std::string::npos
+			&& source.find(expected)!=std::string::npos;
+	}
+	if(dst)
+		fclose(dst);
+	mips_test_end_test(testId, passed, "translation defines the default module with the image digest");
+
+	mips_mem_h mem[2];
+	mips_cpu_h cpu[2];
+	mips_error stop[2];
+	uint64_t count[2]={0, 0};
+	for(int i=0; i<2; i++){
+		mem[i]=mips_mem_create_ram(1<<20, 4);
+		cpu[i]=mips_cpu_create(mem[i]);
+		mips_cpu_install_spim_hostcalls(cpu[i], 0, stdout, 0x80000, 0x100000);
+		stop[i] = err ? err : load_program(cpu[i], mem[i], a, 0x1000);
+	}
+
+	testId=mips_test_begin_test("<internal>");
+	passed = stop[0]==mips_Success && mips_aot_check(&module, mem[0])==mips_Success;
+	if(passed){
+		stop[0]=mips_cpu_run_translated(cpu[0], &module, UINT64_MAX, 0);
+		stop[1]=mips_cpu_run(cpu[1], UINT64_MAX, 0);
+		mips_cpu_get_instruction_count(cpu[0], &count[0]);
+		mips_cpu_get_instruction_count(cpu[1], &count[1]);
+		passed = stop[0]==mips_StopExit && stop[1]==mips_StopExit && count[0]==count[1] && count[0]==2+7*100+2;
+		for(unsigned r=1; r<32 && passed; r++){
+			passed = get_register(cpu[0], r)==get_register(cpu[1], r);
+		}
+	}
+	mips_test_end_test(testId, passed, "translated run matches the interpreter");
+
+	// Changing the code invalidates the translation
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_mem_write_word(mem[0], 0x1004, 0)==mips_Success
+		&& mips_aot_check(&module, mem[0])==mips_ErrorInvalidArgument;
+	mips_test_end_test(testId, passed, "mips_aot_check rejects a modified image");
+
+	for(int i=0; i<2; i++){
+		mips_cpu_free(cpu[i]);
+		mips_mem_free(mem[i]);
+	}
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Sends a packet to a gdb stub and waits (for up to five seconds) for
+   the reply, skipping any acks. */
+static bool gdb_exchange(int fd, const std::string &payload, std::string &reply)
+{
+	unsigned sum=0;
+	for(size_t i=0; i<payload.size(); i++){
+		sum+=(uint8_t)payload[i];
+	}
+	char tail[4];
+	sprintf(tail, "#%02x", sum&0xFF);
+	std::string packet="$"+payload+tail;
+	if(write(fd, packet.data(), packet.size())!=(ssize_t)packet.size())
+		return false;
+
+	std::string in;
+	while(1){
+		size_t start=in.find('$');
+		size_t hash = start==std::string::npos ? start : in.find('#', start);
+		if(hash!=std::string::npos && hash+2<in.size()){
+			reply=in.substr(start+1, hash-start-1);
+			return true;
+		}
+		struct pollfd p={ fd, POLLIN, 0 };
+		char buffer[256];
+		ssize_t got = poll(&p, 1, 5000)==1 ? read(fd, buffer, sizeof(buffer)) : -1;
+		if(got<=0)
+			return false;
+		in.append(buffer, got);
+	}
+}
+
+static void test_gdb(void)
+{
+	const char *path="test_mips_gdb.sock";
+	mips_mem_h mem=mips_mem_create_ram(1<<20, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	mips_cpu_install_spim_hostcalls(cpu, 0, stdout, 0x80000, 0x100000);
+
+	mips_asm a(0x1000);
+	assemble_sum(a);
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+
+	int testId=mips_test_begin_test("<internal>");
+	mips_gdb_h stub = err ? 0 : mips_gdb_create(cpu, mem, (std::string("unix:")+path).c_str());
+	int fd = stub ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family=AF_UNIX;
+	strcpy(sa.sun_path, path);
+	int passed = fd>=0 && connect(fd, (struct sockaddr*)&sa, sizeof(sa))==0;
+
+	mips_error result=mips_ErrorInvalidArgument;
+	std::thread server;
+	if(passed){
+		server=std::thread([&](){ result=mips_gdb_run(stub, 1); });
+	}
+
+	// Stop at the top of the loop twice, then run to the end
+	char breakpoint[32], clear[32], pc[16];
+	sprintf(breakpoint, "Z0,%x,4", a.address_of("loop"));
+	sprintf(clear, "z0,%x,4", a.address_of("loop"));
+	sprintf(pc, "%08x", a.address_of("loop"));
+	std::string reply;
+	passed = passed
+		&& gdb_exchange(fd, "QStartNoAckMode", reply) && reply=="OK"
+		&& gdb_exchange(fd, breakpoint, reply) && reply=="OK"
+		&& gdb_exchange(fd, "c", reply) && reply=="S05"
+		&& gdb_exchange(fd, "p25", reply) && reply==pc
+		&& gdb_exchange(fd, "p8", reply) && reply=="00000000"
+		&& gdb_exchange(fd, "c", reply) && reply=="S05"
+		&& gdb_exchange(fd, "p8", reply) && reply=="00000001"
+		&& gdb_exchange(fd, "m4004,4", reply) && reply=="00000001"
+		&& gdb_exchange(fd, clear, reply) && reply=="OK"
+		&& gdb_exchange(fd, "c", reply) && reply=="W00"
+		&& gdb_exchange(fd, "p9", reply) && reply=="000013ba";
+
+	if(fd>=0){
+		// Killing the program ends mips_gdb_run, as does closing the socket
+		// if anything above went wrong
+		if(passed)
+			passed = write(fd, "$k#6b", 5)==5;
+		else
+			shutdown(fd, SHUT_RDWR);
+	}
+	if(server.joinable())
+		server.join();
+	passed = passed && result==mips_Success;
+	if(fd>=0)
+		close(fd);
+
+	mips_gdb_free(stub);
+	mips_test_end_test(testId, passed, "gdb stub stops at breakpoints and reads state");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+#endif
+
+static uint32_t get_pc(mips_cpu_h cpu)
+{
+	uint32_t pc=0;
+	mips_cpu_get_pc(cpu, &pc);
+	return pc;
+}
+
+/* True if the CPU stopped at a watchpoint on the instruction at label,
+   for an access at address of the given kind */
+static bool stopped_at_watch(mips_cpu_h cpu, mips_error err, mips_asm &a, const char *label, uint32_t address, unsigned flags)
+{
+	uint32_t hitAddress=0;
+	unsigned hitFlags=0;
+	return err==mips_StopWatchpoint && get_pc(cpu)==a.address_of(label)
+		&& mips_cpu_get_watch_hit(cpu, &hitAddress, &hitFlags)==mips_Success
+		&& hitAddress==address && hitFlags==flags;
+}
+
+static mips_error clear_breakpoints_hostcall(mips_cpu_h cpu, mips_mem_h, uint32_t, void *)
+{
+	return mips_cpu_clear_all_breakpoints(cpu);
+}
+
+static void test_watchpoints(mips_cpu_h cpu, mips_mem_h mem)
+{
+	mips_asm a(0x1000);
+	a.li(8, 0x2000)
+	 .li(9, 0x12345678)
+	 .label("store")
+	 .sw(9, 0, 8)
+	 .label("load")
+	 .lw(10, 4, 8)
+	 .label("byte")
+	 .lb(11, 7, 8)
+	 .li(2, 10)
+	 .syscall();
+
+	// A write, then resuming runs to the end
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+	int testId=mips_test_begin_test("sw");
+	uint32_t word=0;
+	int passed = err==mips_Success && mips_cpu_add_watchpoint(cpu, 0x2000, 4, mips_watch_Write)==mips_Success;
+	passed = passed && stopped_at_watch(cpu, mips_cpu_run(cpu, 100, 0), a, "store", 0x2000, mips_watch_Write)
+		&& mips_mem_read_word(mem, 0x2000, &word)==mips_Success && word!=0x12345678
+		&& mips_cpu_run(cpu, 100, 0)==mips_StopExit
+		&& mips_mem_read_word(mem, 0x2000, &word)==mips_Success && word==0x12345678;
+	mips_cpu_clear_all_breakpoints(cpu);
+	mips_test_end_test(testId, passed, "write watchpoint stops before the store, and resumes past it");
+
+	// Reads skip the store, and both the word and the byte inside it stop
+	err=load_program(cpu, mem, a, 0x1000);
+	testId=mips_test_begin_test("lw");
+	passed = err==mips_Success && mips_cpu_add_watchpoint(cpu, 0x2004, 4, mips_watch_Read)==mips_Success;
+	passed = passed && stopped_at_watch(cpu, mips_cpu_run(cpu, 100, 0), a, "load", 0x2004, mips_watch_Read)
+		&& stopped_at_watch(cpu, mips_cpu_run(cpu, 100, 0), a, "byte", 0x2007, mips_watch_Read)
+		&& mips_cpu_run(cpu, 100, 0)==mips_StopExit;
+	mips_cpu_clear_all_breakpoints(cpu);
+	mips_test_end_test(testId, passed, "read watchpoint stops at each load which overlaps it");
+
+	// Ranges which only just miss, or are for the other kind of access
+	err=load_program(cpu, mem, a, 0x1000);
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success
+		&& mips_cpu_add_watchpoint(cpu, 0x2008, 4, mips_watch_Read|mips_watch_Write)==mips_Success
+		&& mips_cpu_add_watchpoint(cpu, 0x1FFC, 4, mips_watch_Read|mips_watch_Write)==mips_Success
+		&& mips_cpu_add_watchpoint(cpu, 0x2000, 4, mips_watch_Read)==mips_Success
+		&& mips_cpu_run(cpu, 100, 0)==mips_StopExit;
+	mips_cpu_clear_all_breakpoints(cpu);
+	err=load_program(cpu, mem, a, 0x1000);
+	passed = passed && err==mips_Success
+		&& mips_cpu_add_watchpoint(cpu, 0x2003, 1, mips_watch_Write)==mips_Success
+		&& stopped_at_watch(cpu, mips_cpu_run(cpu, 100, 0), a, "store", 0x2000, mips_watch_Write);
+	mips_cpu_clear_all_breakpoints(cpu);
+	mips_test_end_test(testId, passed, "watchpoints only stop accesses which overlap them");
+
+	// Accesses which fail raise their exception, not a stop
+	struct{
+		uint32_t instr;
+		mips_error expected;
+	}faults[]={
+		{ 0x8D0A0002, mips_ExceptionInvalidAlignment },	// lw $10,2($8)
+		{ 0x9D0A0000, mips_ExceptionInvalidInstruction },	// Opcode 0x27
+		{ 0xB10A0000, mips_ExceptionInvalidInstruction },	// Opcode 0x2C
+		{ 0xC10A0000, mips_ExceptionInvalidInstruction },	// Opcode 0x30
+		{ 0xE10A0000, mips_ExceptionInvalidInstruction },	// Opcode 0x38
+		{ 0x8D2A0000, mips_ExceptionInvalidAddress }		// lw $10,0($9)
+	};
+	testId=mips_test_begin_test("<internal>");
+	passed=1;
+	for(unsigned i=0; i<sizeof(faults)/sizeof(faults[0]); i++){
+		mips_asm f(0x1000);
+		f.li(8, 0x2000)
+		 .li(9, 1<<20)
+		 .label("fault")
+		 .word(faults[i].instr);
+		err=load_program(cpu, mem, f, 0x1000);
+		passed = passed && err==mips_Success
+			&& mips_cpu_add_watchpoint(cpu, 0x2000, 0x1000, mips_watch_Read|mips_watch_Write)==mips_Success
+			&& mips_cpu_add_watchpoint(cpu, 1<<20, 4, mips_watch_Read|mips_watch_Write)==mips_Success
+			&& mips_cpu_run(cpu, 100, 0)==faults[i].expected && get_pc(cpu)==f.address_of("fault");
+		mips_cpu_clear_all_breakpoints(cpu);
+	}
+	mips_test_end_test(testId, passed, "faulting accesses to watched pages raise exceptions");
+
+	// A host call which removes everything doesn't leave the run
+	// looking at freed breakpoints
+	mips_asm c(0x1000);
+	c.li(8, 0x2000)
+	 .li(2, 100)
+	 .syscall()
+	 .sw(0, 0, 8)
+	 .li(2, 10)
+	 .syscall();
+	err=load_program(cpu, mem, c, 0x1000);
+	if(err==0)
+		err=mips_cpu_register_hostcall(cpu, mips_hostcall_Syscall, 100, clear_breakpoints_hostcall, 0);
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success
+		&& mips_cpu_add_watchpoint(cpu, 0x2000, 4, mips_watch_Write)==mips_Success
+		&& mips_cpu_set_breakpoint(cpu, 0x8000)==mips_Success
+		&& mips_cpu_run(cpu, 100, 0)==mips_StopExit;
+	mips_cpu_register_hostcall(cpu, mips_hostcall_Syscall, 100, 0, 0);
+	mips_test_end_test(testId, passed, "host call can clear breakpoints during a run");
+}
+
+static void test_permissions(void)
+{
+	mips_mem_h mem=mips_mem_create_ram(0x10000, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+
+	// Stores into the program itself
+	mips_asm a(0x1000);
+	a.li(8, 0x1000)
+	 .li(9, 0x5555)
+	 .label("store")
+	 .sw(9, 0, 8)
+	 .li(2, 10);
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+	if(err==0)
+		err=mips_mem_set_permissions(mem, 0, 0x2000, mips_mem_perm_Read|mips_mem_perm_Execute);
+	if(err==0)
+		err=mips_mem_set_permissions(mem, 0x2000, 0xE000, mips_mem_perm_Read|mips_mem_perm_Write);
+
+	int testId=mips_test_begin_test("<internal>");
+	uint32_t word=0, before=0;
+	uint64_t count=0;
+	int passed = err==mips_Success && mips_mem_read_word(mem, 0x1000, &before)==mips_Success
+		&& mips_cpu_run(cpu, 100, 0)==mips_ExceptionAccessViolation
+		&& get_pc(cpu)==a.address_of("store")
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success
+		&& count==(a.address_of("store")-0x1000)/4
+		&& mips_mem_read_word(mem, 0x1000, &word)==mips_Success && word==before;
+	mips_test_end_test(testId, passed, "store to read-only text faults and changes nothing");
+
+	// Jumping into data
+	uint64_t after=0;
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_cpu_set_pc(cpu, 0x2000)==mips_Success
+		&& mips_cpu_step(cpu)==mips_ExceptionAccessViolation && get_pc(cpu)==0x2000
+		&& mips_cpu_get_instruction_count(cpu, &after)==mips_Success && after==count;
+	mips_test_end_test(testId, passed, "fetch from non-executable data faults");
+
+	// A range which doesn't end on a page boundary covers the whole
+	// of its last page, and nothing more
+	unsigned perms[3]={0, 0, 0};
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_mem_set_permissions(mem, 0x3000, 0x1800, mips_mem_perm_Read)==mips_Success
+		&& mips_mem_get_permissions(mem, 0x3000, &perms[0])==mips_Success && perms[0]==mips_mem_perm_Read
+		&& mips_mem_get_permissions(mem, 0x4FFC, &perms[1])==mips_Success && perms[1]==mips_mem_perm_Read
+		&& mips_mem_get_permissions(mem, 0x5000, &perms[2])==mips_Success
+		&& perms[2]==(mips_mem_perm_Read|mips_mem_perm_Write)
+		&& mips_mem_write_word(mem, 0x4800, 1)==mips_ExceptionAccessViolation
+		&& mips_mem_write_word(mem, 0x5000, 1)==mips_Success
+		&& mips_mem_set_permissions(mem, 0x3004, 0x1000, mips_mem_perm_Read)==mips_ErrorInvalidArgument
+		&& mips_mem_set_permissions(mem, 0xF000, 0x2000, mips_mem_perm_Read)==mips_ErrorInvalidArgument;
+	mips_test_end_test(testId, passed, "permissions apply to every page a range touches");
+
+	// Allowing everything again, after which the store goes through
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_mem_set_permissions(mem, 0, 0x10000, mips_mem_perm_All)==mips_Success
+		&& mips_mem_get_permissions(mem, 0x1000, &perms[0])==mips_Success && perms[0]==mips_mem_perm_All
+		&& mips_mem_get_permissions(mem, 0x4000, &perms[1])==mips_Success && perms[1]==mips_mem_perm_All
+		&& mips_cpu_set_pc(cpu, a.address_of("store"))==mips_Success && mips_cpu_step(cpu)==mips_Success
+		&& mips_mem_read_word(mem, 0x1000, &word)==mips_Success && word==0x5555;
+	mips_test_end_test(testId, passed, "permissions can be cleared for the whole memory");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+struct event_log
+{
+	std::vector<unsigned> order;	// Context values of the events, as they happen
+	unsigned cancel[2];				// Events cancelled by the first one
+	int cancelled;
+};
+
+struct logged_event
+{
+	event_log *log;
+	unsigned tag;
+};
+
+static mips_error log_event(void *context, mips_cpu_h cpu, uint64_t)
+{
+	logged_event *e=(logged_event*)context;
+	e->log->order.push_back(e->tag);
+	if(e->tag==0){
+		e->log->cancelled = mips_cpu_cancel_event(cpu, e->log->cancel[0])==mips_Success
+			&& mips_cpu_cancel_event(cpu, e->log->cancel[1])==mips_Success;
+	}
+	return mips_Success;
+}
+
+static void test_events(void)
+{
+	mips_mem_h mem=mips_mem_create_ram(0x10000, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+
+	// Spins forever, so only events stop it
+	mips_asm a(0x1000);
+	a.label("spin")
+	 .beq(0, 0, "spin")
+	 .nop();
+	mips_error err=load_program(cpu, mem, a, 0x1000);
+
+	// Equal times happen in the order they were scheduled, whatever
+	// order the heap ends up in, and the first cancels two others
+	event_log log;
+	logged_event events[6];
+	const uint64_t times[6]={ 5, 5, 3, 5, 5, 8 };
+	unsigned ids[6];
+	for(unsigned i=0; i<6; i++){
+		events[i].log=&log;
+		events[i].tag=i;
+		if(err==0)
+			err=mips_cpu_schedule_event(cpu, times[i], log_event, events+i, ids+i);
+	}
+	log.cancel[0]=ids[3];
+	log.cancel[1]=ids[5];
+	log.cancelled=0;
+
+	int testId=mips_test_begin_test("<internal>");
+	uint64_t next=0;
+	int passed = err==mips_Success && mips_cpu_run(cpu, 20, 0)==mips_Success
+		&& log.order.size()==4 && log.order[0]==2 && log.order[1]==0 && log.order[2]==1 && log.order[3]==4
+		&& log.cancelled && mips_cpu_get_next_event(cpu, &next)==mips_Success && next==UINT64_MAX;
+	mips_test_end_test(testId, passed, "events at the same time happen in order, and can cancel others");
+
+	// A periodic timer stays on its schedule while its line is masked,
+	// and the raised line stops the CPU as soon as it is unmasked
+	mips_timer_h timer=mips_timer_create(cpu, 3);
+	uint32_t pending=0;
+	uint64_t count=0, after=0;
+	testId=mips_test_begin_test("<internal>");
+	passed = timer!=0 && mips_cpu_set_interrupt_mask(cpu, ~(1u<<3))==mips_Success
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success
+		&& mips_timer_start(timer, 7, 10)==mips_Success
+		&& mips_cpu_run(cpu, 1000, 0)==mips_Success
+		&& mips_timer_get_expirations(timer)==100
+		&& mips_cpu_get_next_event(cpu, &next)==mips_Success && next==count+1007
+		&& mips_cpu_get_interrupts(cpu, &pending)==mips_Success && pending==(1u<<3)
+		&& mips_cpu_set_interrupt_mask(cpu, 0xFFFFFFFFu)==mips_Success
+		&& mips_cpu_run(cpu, 1000, 0)==mips_StopInterrupt
+		&& mips_cpu_get_instruction_count(cpu, &after)==mips_Success && after==count+1000;
+	mips_test_end_test(testId, passed, "periodic timer does not drift, and masked lines stay raised");
+
+	// Reset cancels the timer and lowers the line
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_cpu_reset(cpu)==mips_Success && mips_cpu_set_pc(cpu, 0x1000)==mips_Success
+		&& mips_cpu_get_next_event(cpu, &next)==mips_Success && next==UINT64_MAX
+		&& mips_cpu_get_interrupts(cpu, &pending)==mips_Success && pending==0
+		&& mips_cpu_run(cpu, 100, 0)==mips_Success && mips_timer_get_expirations(timer)==100
+		&& mips_timer_stop(timer)==mips_Success;
+	mips_test_end_test(testId, passed, "reset cancels timers and clears interrupts");
+
+	// A period which would go past the end of time
+	testId=mips_test_begin_test("<internal>");
+	passed = mips_cpu_set_interrupt_mask(cpu, 0)==mips_Success
+		&& mips_timer_start(timer, 1, UINT64_MAX)==mips_Success
+		&& mips_cpu_run(cpu, 10, 0)==mips_Success && mips_timer_get_expirations(timer)==101
+		&& mips_cpu_get_next_event(cpu, &next)==mips_Success && next==UINT64_MAX;
+	mips_test_end_test(testId, passed, "timer period is clamped rather than wrapping");
+
+	mips_timer_free(timer);
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+static void test_journal_failed_store(mips_cpu_h suiteCpu)
+{
+	// The first word of the doubleword is in range and never written
+	mips_mem_h mem=mips_mem_create_ram_ex(0x10004, 4, mips_mem_ram_Shadow);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	mips_asm a(0x1000);
+	a.li(9, 0x10000)
+	 .label("store")
+	 .word(mips_asm_encode_i(0x3D, 9, 0, 0))	// sdc1 $f0, 0($9)
+	 .li(2, 10)
+	 .syscall();
+	mips_error err = cpu ? load_program(cpu, mem, a, 0x1000) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_set_journaled(cpu, 1);
+
+	mips_test_set_cpu(cpu);
+	int testId=mips_test_begin_test("sdc1");
+	uint32_t word;
+	int passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionInvalidAddress
+		&& get_pc(cpu)==a.address_of("store")
+		&& mips_mem_read_word(mem, 0x10000, &word)==mips_ExceptionUninitialisedRead;
+	mips_test_end_test(testId, passed, "journaled sdc1 which fails leaves nothing to undo");
+	mips_test_set_cpu(suiteCpu);
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+/* Stores early on to a page which is then made read-only, so going back
+   past them has to fail, while going back a little still works */
+static void test_reverse_read_only(void)
+{
+	mips_mem_h mem=mips_mem_create_ram_ex(1<<16, 4, mips_mem_ram_Zero);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	mips_asm a(0x1000);
+	a.li(8, 0x4000)
+	 .li(9, 0x5000)
+	 .label("early")
+	 .sw(8, 0, 8)
+	 .li(10, 40)
+	 .label("wait")
+	 .addiu(10, 10, -1)
+	 .bne(10, 0, "wait")
+	 .nop()
+	 .sw(9, 0, 9)
+	 .sw(9, 4, 9)
+	 .li(2, 10)
+	 .syscall();
+	mips_error err = cpu ? load_program(cpu, mem, a, 0x1000) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, 0, stdout, 0x8000, 0x10000);
+	if(err==0)
+		err=mips_cpu_set_history(cpu, 16, 1<<20);
+	if(err==0)
+		err=run_to_exit(cpu);
+	if(err==0)
+		err=mips_cpu_set_breakpoint(cpu, a.address_of("early"));
+	if(err==0)
+		err=mips_mem_set_permissions(mem, 0x4000, 0x1000, mips_mem_perm_Read);
+
+	int testId=mips_test_begin_test("<internal>");
+	uint64_t end=0, count=0;
+	uint32_t word=0;
+	int passed = err==mips_Success && mips_cpu_get_instruction_count(cpu, &end)==mips_Success
+		&& mips_cpu_reverse_step(cpu, end-4)==mips_ExceptionAccessViolation
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count==end
+		&& get_pc(cpu)==a.address_of("wait")+28
+		&& mips_cpu_reverse_continue(cpu)==mips_ExceptionAccessViolation
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count==end
+		&& get_pc(cpu)==a.address_of("wait")+28 && get_register(cpu, 10)==0
+		&& mips_mem_read_word(mem, 0x4000, &word)==mips_Success && word==0x4000
+		&& mips_mem_read_word(mem, 0x5004, &word)==mips_Success && word==0x5000;
+	mips_test_end_test(testId, passed, "reverse fails without moving when memory can't be put back");
+
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success
+		&& mips_cpu_reverse_step(cpu, 3)==mips_Success
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count==end-3
+		&& mips_mem_read_word(mem, 0x5004, &word)==mips_Success && word==0
+		&& mips_mem_set_permissions(mem, 0x4000, 0x1000, mips_mem_perm_All)==mips_Success
+		&& mips_cpu_reverse_continue(cpu)==mips_StopBreakpoint
+		&& get_pc(cpu)==a.address_of("early")
+		&& mips_mem_read_word(mem, 0x4000, &word)==mips_Success && word==0;
+	mips_test_end_test(testId, passed, "reverse only needs the words it puts back to be writable");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
+
+/* Everything written to a stream so far */
+static std::string stream_contents(FILE *f)
+{
+	std::string s;
+	long end;
+	fflush(f);
+	if(fseek(f, 0, SEEK_END)==0 && (end=ftell(f))>0){
+		s.resize((size_t)end);
+		rewind(f);
+		if(fread(&s[0], 1, s.size(), f)!=s.size())
+			s.clear();
+	}
+	return s;
+}
+
+static void test_spim_services(void)
+{
+	mips_mem_h mem=mips_mem_create_ram(1<<20, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	FILE *in=tmpfile(), *out=tmpfile();
+	if(in){
+		fputs("42hello\nline\n", in);
+		rewind(in);
+	}
+
+	mips_asm a(0x1000);
+	a.li(4, -17).li(2, 1).syscall()
+	 .li(4, 0x3000).li(2, 4).syscall()
+	 .label("before_read")
+	 .li(2, 5).syscall()
+	 .label("after_read")
+	 .move(16, 2)
+	 .li(4, 0x4000).li(5, 64).li(2, 8).syscall()
+	 .li(4, 10).li(2, 9).syscall().move(17, 2)
+	 .li(4, 5).li(2, 9).syscall().move(18, 2)
+	 .li(4, 0x7FFFFFFF).li(2, 9).syscall().move(19, 2)
+	 .li(4, 3).li(2, 17).syscall();
+	mips_error err = in && out ? load_program(cpu, mem, a, 0x1000) : mips_ErrorFileReadError;
+	if(err==0)
+		err=mips_mem_write(mem, 0x3000, 4, (const uint8_t*)"hi\n");
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, in, out, 0x80001, 0x100000);
+	if(err==0)
+		err=mips_cpu_set_breakpoint(cpu, a.address_of("before_read"));
+	if(err==0)
+		err=mips_cpu_set_breakpoint(cpu, a.address_of("after_read"));
+
+	// Output stays in the buffer until something reads input
+	int testId=mips_test_begin_test("<internal>");
+	int passed = err==mips_Success
+		&& mips_cpu_run(cpu, 1000, 0)==mips_StopBreakpoint && stream_contents(out).empty()
+		&& mips_cpu_run(cpu, 1000, 0)==mips_StopBreakpoint && stream_contents(out)=="-17hi\n";
+	mips_test_end_test(testId, passed, "output is buffered, and flushed before input is read");
+
+	testId=mips_test_begin_test("<internal>");
+	char line[8]={0};
+	uint32_t code=0;
+	passed = passed && mips_cpu_clear_all_breakpoints(cpu)==mips_Success
+		&& mips_cpu_run(cpu, 1000, 0)==mips_StopExit
+		&& mips_cpu_get_exit_code(cpu, &code)==mips_Success && code==3
+		&& get_register(cpu, 16)==42
+		&& mips_mem_read(mem, 0x4000, 8, (uint8_t*)line)==mips_Success && strcmp(line, "hello\n")==0
+		&& get_register(cpu, 17)==0x80004 && get_register(cpu, 18)==0x80010
+		&& get_register(cpu, 19)==0xFFFFFFFF
+		&& stream_contents(out)=="-17hi\n";
+	mips_test_end_test(testId, passed, "SPIM services read, print, allocate and exit");
+
+	// A buffer which runs into a read-only page is checked before any
+	// input is used
+	mips_asm r(0x1000);
+	r.li(4, 0x5FF8).li(5, 16).li(2, 8)
+	 .label("read")
+	 .syscall()
+	 .li(2, 10).syscall();
+	uint32_t before=0, after=0;
+	long position=in ? ftell(in) : 0;
+	err=load_program(cpu, mem, r, 0x1000);
+	if(err==0)
+		err=mips_mem_set_permissions(mem, 0x6000, 0x1000, mips_mem_perm_Read);
+	if(err==0)
+		err=mips_mem_read_word(mem, 0x5FF8, &before);
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionAccessViolation
+		&& get_pc(cpu)==r.address_of("read") && ftell(in)==position
+		&& mips_mem_read_word(mem, 0x5FF8, &after)==mips_Success && after==before;
+	// Then the input is still there for a buffer which fits
+	passed = passed && mips_cpu_set_register(cpu, 5, 8)==mips_Success
+		&& mips_cpu_run(cpu, 100, 0)==mips_StopExit
+		&& mips_mem_read(mem, 0x5FF8, 8, (uint8_t*)line)==mips_Success && strcmp(line, "line\n")==0
+		&& mips_cpu_get_exit_code(cpu, &code)==mips_Success && code==0;
+	mips_test_end_test(testId, passed, "read_string checks its buffer before reading input");
+
+	// A string which runs off the end of memory prints nothing, even
+	// when it would have filled the output buffer
+	std::string text(4000, 'a'), tail(200, 'b');
+	mips_asm p(0x1000);
+	p.li(4, 0x10000).li(2, 4).syscall()
+	 .li(4, (1<<20)-200).li(2, 4)
+	 .label("print")
+	 .syscall();
+	FILE *out2=tmpfile();
+	err = out2 ? load_program(cpu, mem, p, 0x1000) : mips_ErrorFileWriteError;
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, 0, out2, 0x80000, 0x100000);
+	if(err==0)
+		err=mips_mem_write(mem, 0x10000, 4004, (const uint8_t*)(text+std::string(4, '\0')).data());
+	if(err==0)
+		err=mips_mem_write(mem, (1<<20)-200, 200, (const uint8_t*)tail.data());
+	testId=mips_test_begin_test("<internal>");
+	passed = err==mips_Success && mips_cpu_run(cpu, 100, 0)==mips_ExceptionInvalidAddress
+		&& get_pc(cpu)==p.address_of("print")
+		&& mips_cpu_flush_hostcall_output(cpu)==mips_Success && stream_contents(out2)==text;
+	mips_test_end_test(testId, passed, "print_string of an unreadable string prints nothing");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+	if(in)
+		fclose(in);
+	if(out)
+		fclose(out);
+	if(out2)
+		fclose(out2);
+}
+
+/* Applies the same accesses to a plain RAM and to one created with flags,
+   checking after each that both memories return the same bytes. */
+static bool same_guest_view(mips_mem_h plain, mips_mem_h ram, uint32_t size)
+{
+	uint32_t seed=12345;
+	std::vector<uint8_t> fill(size);
+	for(uint32_t i=0; i<size; i++){
+		seed=seed*1103515245+12345;
+		fill[i]=(uint8_t)(seed>>16);
+	}
+	if(mips_mem_write(plain, 0, size, &fill[0]) || mips_mem_write(ram, 0, size, &fill[0]))
+		return false;
+
+	for(unsigned i=0; i<4000; i++){
+		seed=seed*1103515245+12345;
+		uint32_t r=seed>>8;
+		uint32_t address=(r>>4)%(size-8);
+		uint8_t data[8]={(uint8_t)i, (uint8_t)(i>>8), 0x5A, 0xA5, 0x12, 0x34, 0x56, (uint8_t)r};
+		uint8_t a[8]={0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE};
+		uint8_t b[8]={0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE, 0xEE};
+		uint32_t wa=0, wb=1;
+		bool ok=false;
+		switch(r%5){
+		case 0:	// byte
+			ok = mips_mem_write(plain, address, 1, data)==mips_Success
+				&& mips_mem_write(ram, address, 1, data)==mips_Success
+				&& mips_mem_read(plain, address, 1, a)==mips_Success
+				&& mips_mem_read(ram, address, 1, b)==mips_Success;
+			break;
+		case 1:	// half
+			address&=~1u;
+			ok = mips_mem_write(plain, address, 2, data)==mips_Success
+				&& mips_mem_write(ram, address, 2, data)==mips_Success
+				&& mips_mem_read(plain, address, 2, a)==mips_Success
+				&& mips_mem_read(ram, address, 2, b)==mips_Success;
+			break;
+		case 2:	// word, as a number and as bytes
+			address&=~3u;
+			wa=(uint32_t)r*2654435761u;
+			ok = mips_mem_write_word(plain, address, wa)==mips_Success
+				&& mips_mem_write_word(ram, address, wa)==mips_Success
+				&& mips_mem_read_word(ram, address, &wb)==mips_Success && wa==wb
+				&& mips_mem_read(plain, address, 4, a)==mips_Success
+				&& mips_mem_read(ram, address, 4, b)==mips_Success
+				&& wb==((uint32_t)b[0]<<24 | (uint32_t)b[1]<<16 | (uint32_t)b[2]<<8 | b[3]);
+			break;
+		case 3:	// masked write, read back through a different mask
+			address&=~3u;
+			ok = mips_mem_write_masked(plain, address, 8, data, r>>24)==mips_Success
+				&& mips_mem_write_masked(ram, address, 8, data, r>>24)==mips_Success
+				&& mips_mem_read_masked(plain, address, 8, a, r>>16)==mips_Success
+				&& mips_mem_read_masked(ram, address, 8, b, r>>16)==mips_Success;
+			break;
+		default:	// a word written as bytes, read back as a number
+			address&=~3u;
+			ok = mips_mem_write(plain, address, 4, data+4)==mips_Success
+				&& mips_mem_write(ram, address, 4, data+4)==mips_Success
+				&& mips_mem_read_word(plain, address, &wa)==mips_Success
+				&& mips_mem_read_word(ram, address, &wb)==mips_Success
+				&& wa==wb && wa==0x12345600u+(r&0xFF);
+			break;
+		}
+		if(!ok || memcmp(a, b, 8)!=0)
+			return false;
+	}
+
+	std::vector<uint8_t> inPlain(size), inRam(size);
+	return mips_mem_read(plain, 0, size, &inPlain[0])==mips_Success
+		&& mips_mem_read(ram, 0, size, &inRam[0])==mips_Success
+		&& inPlain==inRam;
+}
+
+static void test_ram_flags(void)
+{
+	const uint32_t size=1<<16;
+	int testId=mips_test_begin_test("<internal>");
+	std::string failed;
+	for(unsigned flags=1; flags<64; flags++){
+		// Blocks of one byte, so that halves and single bytes are allowed
+		mips_mem_h plain=mips_mem_create_ram(size, 1);
+		mips_mem_h ram=mips_mem_create_ram_ex(size, 1, flags);
+		if(plain==0 || ram==0 || !same_guest_view(plain, ram, size)){
+			failed += failed.empty() ? "RAM differs from a plain one with flags " : ", ";
+			failed += std::to_string(flags);
+		}
+		mips_mem_free(ram);
+		mips_mem_free(plain);
+	}
+	mips_test_end_test(testId, failed.empty(),
+		failed.empty() ? "HostOrder, placement and shadow RAMs look the same as a plain RAM" : failed.c_str());
+}
+
+/* The bits each table selects on, and the fields left for operands */
+#define ISA_BASE_Primary(code) ((uint32_t)(code)<<26)
+#define ISA_BASE_Special(code) ((uint32_t)(code))
+#define ISA_BASE_RegImm(code) (1u<<26 | (uint32_t)(code)<<16)
+#define ISA_BASE_Cop1(code) (0x11u<<26 | (uint32_t)(code)<<21)
+#define ISA_BASE_Cop1Bc(code) (0x11u<<26 | 8u<<21 | (uint32_t)(code)<<16)
+#define ISA_BASE_Cop1S(code) (0x11u<<26 | 16u<<21 | (uint32_t)(code))
+#define ISA_BASE_Cop1D(code) (0x11u<<26 | 17u<<21 | (uint32_t)(code))
+#define ISA_BASE_Cop1W(code) (0x11u<<26 | 20u<<21 | (uint32_t)(code))
+
+#define ISA_FREE_Primary 0x03FFFFFFu
+#define ISA_FREE_Special 0x03FFFFC0u
+#define ISA_FREE_RegImm 0x03E0FFFFu
+#define ISA_FREE_Cop1 0x001FFFFFu
+#define ISA_FREE_Cop1Bc 0x0000FFFFu
+#define ISA_FREE_Cop1S 0x001FFFC0u
+#define ISA_FREE_Cop1D 0x001FFFC0u
+#define ISA_FREE_Cop1W 0x001FFFC0u
+
+struct isa_encoding{
+	mips_isa_op op;
+	const char *name;
+	uint32_t base, free;
+};
+
+#define ISA_ENCODING(name, format, table, code, kind, operands, description) \
+	{ mips_isa_##name, #name, ISA_BASE_##table(code), ISA_FREE_##table },
+
+static const isa_encoding sg_isaEncodings[]={
+	MIPS_ISA_INSTRUCTIONS(ISA_ENCODING)
+};
+
+/* Every line of MIPS_ISA_INSTRUCTIONS is encoded with a few different
+   operand fields, and has to decode, disassemble and be found by the
+   disassembled name as the same instruction. */
+static void test_isa_tables(void)
+{
+	int testId=mips_test_begin_test("<internal>");
+	std::string failed;
+	const uint32_t operands[3]={0, 0x00221905u, 0xFFFFFFFFu};
+	unsigned count=sizeof(sg_isaEncodings)/sizeof(sg_isaEncodings[0]);
+	bool ok=count==mips_isa_Count-1;
+	for(unsigned i=0; i<count; i++){
+		const isa_encoding &e=sg_isaEncodings[i];
+		const mips_isa_info &info=mips_isa_instructions[e.op];
+		bool same = e.op==(mips_isa_op)(i+1) && mips_isa_find(e.name)==e.op
+			&& strcmp(info.name, e.name)==0 && info.opcode==(int)(e.base>>26);
+		for(unsigned j=0; same && j<3; j++){
+			uint32_t instr=e.base | (operands[j]&e.free);
+			char text[64], mnemonic[64];
+			unsigned length=mips_isa_disassemble(instr, 0x1000, text, sizeof(text));
+			size_t end=strcspn(text, " ");
+			memcpy(mnemonic, text, end);
+			mnemonic[end]=0;
+			same = mips_isa_decode(instr)==e.op
+				&& length==strlen(text) && length<=40
+				&& (instr==0 ? strcmp(text, "nop")==0 : mips_isa_find(mnemonic)==e.op);
+		}
+		if(!same){
+			failed += failed.empty() ? "table entries which don't round trip: " : ", ";
+			failed += e.name;
+		}
+	}
+	ok = ok && failed.empty();
+	mips_test_end_test(testId, ok, ok ? "every instruction decodes, disassembles and is found again" :
+		failed.empty() ? "instructions are missing from the table" : failed.c_str());
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Splits one line of a JSON lines report into its fields. Strings are
+   unescaped, and anything else (numbers, true, arrays) is kept as text. */
+static bool parse_json_line(const std::string &line, std::map<std::string,std::string> &fields)
+{
+	size_t i=0;
+	fields.clear();
+	if(line.empty() || line[i++]!='{')
+		return false;
+	while(i<line.size() && line[i]!='}'){
+		std::string value[2];
+		for(int part=0; part<2; part++){
+			if(i<line.size() && line[i]=='"'){
+				for(i++; i<line.size() && line[i]!='"'; i++){
+					char c=line[i];
+					if(c=='\\' && i+1<line.size()){
+						c=line[++i];
+						if(c=='u' && i+4<line.size()){
+							c=(char)strtoul(line.substr(i+1, 4).c_str(), 0, 16);
+							i+=4;
+						}
+					}
+					value[part]+=c;
+				}
+				i++;
+			}else{
+				while(i<line.size() && line[i]!=',' && line[i]!='}'){
+					value[part]+=line[i];
+					if(line[i++]=='['){
+						while(i<line.size() && line[i-1]!=']')
+							value[part]+=line[i++];
+					}
+				}
+			}
+			if(part==0 && (i>=line.size() || line[i++]!=':'))
+				return false;
+		}
+		fields[value[0]]=value[1];
+		if(i<line.size() && line[i]==',')
+			i++;
+	}
+	return i+1==line.size();
+}
+
+/* Runs a small suite in a child process, which can start the framework
+   afresh, with a JSON lines report named by MIPS_TEST_JSONL and a JUnit
+   one from mips_test_add_report. It has to happen before this suite
+   begins, so the result is only recorded by test_reports. */
+static std::string check_reports(void)
+{
+	const char *jsonlName="test_mips_report.jsonl.tmp";
+	const char *junitName="test_mips_report.xml.tmp";
+	const char *message="say \"hi\" \\ <a&b>\ttab\nline\x01" "end";
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid=fork();
+	if(pid==0){
+		if(freopen("/dev/null", "w", stderr)==0)
+			_exit(1);
+		setenv("MIPS_TEST_JSONL", jsonlName, 1);
+		unsetenv("MIPS_TEST_JUNIT");
+		mips_test_add_report(mips_test_report_JUnit, junitName);
+		mips_test_begin_suite();
+		int testId=mips_test_begin_test("addu");
+		mips_test_end_test(testId, 1, NULL);
+		testId=mips_test_begin_test("<internal>");
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		mips_test_end_test(testId, 0, message);
+		testId=mips_test_begin_test("addu");
+		mips_test_end_test(testId, 1, "");
+		mips_test_end_suite();
+		_exit(0);
+	}
+	int status=1;
+	if(pid<0 || waitpid(pid, &status, 0)!=pid || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+		return "the suite writing the reports failed";
+
+	std::vector<uint8_t> jsonl, junit;
+	bool found = read_file(jsonlName, jsonl) && read_file(junitName, junit);
+	remove(jsonlName);
+	remove(junitName);
+	if(!found)
+		return "the reports were not written";
+
+	std::vector<std::map<std::string,std::string> > lines;
+	std::string text(jsonl.begin(), jsonl.end());
+	for(size_t begin=0, end; (end=text.find('\n', begin))!=std::string::npos; begin=end+1){
+		lines.resize(lines.size()+1);
+		if(!parse_json_line(text.substr(begin, end-begin), lines.back()))
+			return "a JSON line could not be parsed";
+	}
+	if(lines.size()!=4)
+		return "the JSON lines report should have three tests and a summary";
+	for(int i=0; i<3; i++){
+		std::map<std::string,std::string> &l=lines[i];
+		if(l["id"]!=std::to_string(i) || l["instruction"]!=(i==1 ? "<INTERNAL>" : "ADDU")
+			|| l["passed"]!=(i==1 ? "false" : "true") || l["message"]!=(i==1 ? message : "")
+			|| l["instructions"]!="0" || l.count("seconds")!=1 || l.count("executed")!=0)
+			return "test "+std::to_string(i)+" is wrong in the JSON lines report";
+	}
+	std::map<std::string,std::string> &summary=lines[3];
+	const std::string &slowest=summary["slowest"];
+	if(summary["summary"]!="true" || summary["tests"]!="3" || summary["passed"]!="2"
+		|| slowest.size()!=7 || slowest.compare(0, 3, "[1,")!=0
+		|| (slowest!="[1,0,2]" && slowest!="[1,2,0]"))
+		return "the JSON lines summary is wrong";
+
+	std::string xml(junit.begin(), junit.end());
+	const char *failure="<failure message=\"say &quot;hi&quot; \\ &lt;a&amp;b&gt;&#9;tab&#10;line?end\"/>";
+	size_t cases=0;
+	for(size_t at=0; (at=xml.find("<testcase ", at))!=std::string::npos; at++)
+		cases++;
+	if(xml.compare(0, 5, "<?xml")!=0 || cases!=3 || xml.find(failure)==std::string::npos
+		|| xml.find("<failure", xml.find(failure)+1)!=std::string::npos
+		|| xml.find("classname=\"&lt;INTERNAL&gt;\" name=\"1\"")==std::string::npos
+		|| xml.size()<13 || xml.compare(xml.size()-13, 13, "</testsuite>\n")!=0)
+		return "the JUnit report is wrong";
+	return "";
+}
+
+static void test_reports(const std::string &problem)
+{
+	int testId=mips_test_begin_test("<internal>");
+	mips_test_end_test(testId, problem.empty(),
+		problem.empty() ? "reports escape messages and list the slowest tests" : problem.c_str());
+}
+#endif
+
+// In test_mips_direct.cpp
+void test_cxx_direct_state(void);
+// In test_mips_plugin.cpp
+void test_plugins(void);
 
 int main()
 {
@@ -9,6 +1909,11 @@ int main()
 
 	mips_cpu_h cpu=mips_cpu_create(mem);
 
+#if defined(__unix__) || defined(__APPLE__)
+	std::string reportProblem=check_reports();
+#endif
+
+	mips_test_set_cpu(cpu);
 	mips_test_begin_suite();
 
 	int testId=mips_test_begin_test("and");
@@ -20,12 +1925,13 @@ int main()
 		err = mips_cpu_set_register(cpu, 9, 0x00FFFF00ul);
 
 	// and $10, $8, $9
+	mips_asm a(0x1000);
+	a.and_(10, 8, 9);
+	if(err==0)
+		err=a.write(mem);
 
-	// TODO : work out the bit-wise encoding for the instruction.
-
-	// TODO : Write it into mempory at a known address
-
-	// TODO : Make sure the program-counter is at that address
+	if(err==0)
+		err=mips_cpu_set_pc(cpu, 0x1000);
 
 	if(err==0)
 		err=mips_cpu_step(cpu);
@@ -38,6 +1944,37 @@ int main()
 
 	mips_test_end_test(testId, passed, NULL);
 
+	mips_cpu_install_spim_hostcalls(cpu, 0, stdout, 0x80000, 0x100000);
+
+	test_jumps(cpu, mem);
+	test_checkpoint(cpu, mem);
+	test_overlay(mem);
+	test_shadow(cpu);
+	test_reverse(cpu, mem);
+	test_fast_forward();
+	test_fpu(cpu, mem);
+	test_sdc1_at_end(cpu);
+	test_elf(cpu, mem);
+	test_profile(cpu, mem);
+	test_farm();
+	test_journal(cpu, mem);
+	test_aot();
+	test_cxx_wrappers("C++ wrappers through the C API");
+	test_cxx_direct_state();
+	test_watchpoints(cpu, mem);
+	test_permissions();
+	test_events();
+	test_journal_failed_store(cpu);
+	test_spim_services();
+	test_ram_flags();
+	test_isa_tables();
+	test_plugins();
+	test_reverse_read_only();
+#if defined(__unix__) || defined(__APPLE__)
+	test_gdb();
+	test_reports(reportProblem);
+#endif
+
 	mips_test_end_suite();
 
 	mips_cpu_free(cpu);
@@ -0,0 +1,59 @@
+/* Test of the C++ wrappers in mips_cxx.h. It is included by
+   test_mips.cpp, and by test_mips_direct.cpp with MIPS_CXX_DIRECT_STATE,
+   so the same checks run against both kinds of mips::Cpu.
+*/
+#ifndef test_mips_cxx_header
+#define test_mips_cxx_header
+
+#include "mips_cxx.h"
+
+static void test_cxx_wrappers(const char *message)
+{
+	int testId=mips_test_begin_test("<internal>");
+
+	mips::Memory mem=mips::Memory::ram(1<<20);
+	mips::Cpu cpu(mem);
+
+	mips_asm a(0x1000);
+	a.addu(10, 8, 9)
+	 .addu(11, 10, 0)
+	 .addu(12, 10, 0);
+	int passed = mem && cpu && a.write(mem.handle())==mips_Success
+		&& cpu.set_pc(0x1000)==mips_Success
+		&& mips_cpu_set_history(cpu.handle(), 1000, 1<<20)==mips_Success;
+
+	cpu.set_reg(8, 5);
+	cpu.set_reg(9, 7);
+	cpu.set_reg(0, 1);
+	passed = passed && cpu.step()==mips_Success && cpu.step()==mips_Success
+		&& cpu.reg(10)==12 && cpu.reg(11)==12 && cpu.reg(0)==0 && cpu.reg(32)==0
+		&& cpu.pc()==0x1008 && cpu.instructions()==2;
+
+	// The write is seen by the history, so going back to just after
+	// it gives the new value rather than replaying the old one
+	cpu.set_reg(10, 99);
+	passed = passed && cpu.step()==mips_Success && cpu.reg(12)==99
+		&& mips_cpu_reverse_step(cpu.handle(), 1)==mips_Success
+		&& cpu.reg(10)==99 && cpu.reg(12)==0 && cpu.instructions()==2;
+
+	uint32_t regs[4];
+	passed = passed && cpu.read_registers(regs, 8)==mips_Success
+		&& regs[0]==5 && regs[1]==7 && regs[2]==99 && regs[3]==12
+		&& cpu.read_registers(regs, 30)==mips_ErrorInvalidArgument;
+
+	// Moving leaves the source empty, and the CPU still attached to the memory
+	mips::Memory movedMem(std::move(mem));
+	mips::Cpu moved(std::move(cpu));
+	passed = passed && !mem && !cpu && movedMem && moved && moved.reg(10)==99;
+
+	mips::Cpu assigned;
+	assigned=std::move(moved);
+	uint32_t word=0;
+	passed = passed && !moved && assigned && assigned.pc()==0x1008
+		&& assigned.step()==mips_Success && assigned.reg(12)==99
+		&& movedMem.read_word(0x1000, word)==mips_Success && word==0x01095021;
+
+	mips_test_end_test(testId, passed, message);
+}
+
+#endif
@@ -0,0 +1,11 @@
+/* Runs the mips_cxx.h test with the wrappers reading this CPU's
+   state directly. */
+#include "mips_cpu_impl.h"
+
+#define MIPS_CXX_DIRECT_STATE
+#include "test_mips_cxx.h"
+
+void test_cxx_direct_state(void)
+{
+	test_cxx_wrappers("C++ wrappers with direct state access");
+}
@@ -0,0 +1,143 @@
+/* Tests of the instrumentation hooks in mips_plugin.h. This looks at
+   the CPU's state directly, so that it can tell whether the fast
+   paths which hooks turn off are back once the hooks are removed.
+*/
+#include "mips_cpu_impl.h"
+
+#include <vector>
+
+static void log_plugin_event(void *context, mips_cpu_h, const mips_plugin_event *e)
+{
+	((std::vector<mips_plugin_event>*)context)->push_back(*e);
+}
+
+static bool is_event(const mips_plugin_event &e, mips_plugin_kind kind, uint32_t pc, uint32_t address, uint32_t length, uint32_t value)
+{
+	return e.kind==kind && e.pc==pc && e.address==address && e.length==length && e.value==value;
+}
+
+/* True if the hooks no longer stop the CPU from using its fast paths */
+static bool no_plugins(mips_cpu_h cpu)
+{
+	return cpu->plugins==0 || cpu->plugins->kinds==0;
+}
+
+void test_plugins(void)
+{
+	// Not given to the test framework, as coverage would turn
+	// fast-forwarding off
+	mips_mem_h mem=mips_mem_create_ram(1<<16, 4);
+	mips_cpu_h cpu=mips_cpu_create(mem);
+	mips_asm a(0x1000);
+	a.li(8, 0x2000)
+	 .li(9, 0x1234)
+	 .label("sw")
+	 .sw(9, 0, 8)
+	 .label("sb")
+	 .sb(9, 5, 8)
+	 .label("lw")
+	 .lw(10, 0, 8)
+	 .label("lbu")
+	 .lbu(11, 5, 8)
+	 .label("beq")
+	 .beq(0, 0, "target")
+	 .nop()
+	 .addiu(12, 0, 1)
+	 .label("target")
+	 .li(2, 10)
+	 .syscall();
+	mips_error err = cpu ? a.write(mem) : mips_ErrorInvalidArgument;
+	if(err==0)
+		err=mips_cpu_install_spim_hostcalls(cpu, 0, stdout, 0x8000, 0x10000);
+
+	// Everything, the instructions from the sw to the lbu, and only the
+	// bytes the sb and lbu touch
+	std::vector<mips_plugin_event> events, never;
+	uint64_t executed=0, touched=0;
+	unsigned ids[4]={0};
+	if(err==0)
+		err=mips_cpu_add_plugin_callback(cpu, mips_plugin_Execute|mips_plugin_Read|mips_plugin_Write|mips_plugin_Branch,
+			0, 0xFFFFFFFF, log_plugin_event, &events, &ids[0]);
+	if(err==0)
+		err=mips_cpu_add_plugin_counter(cpu, mips_plugin_Execute, a.address_of("sw"), a.address_of("lbu"), &executed, &ids[1]);
+	if(err==0)
+		err=mips_cpu_add_plugin_counter(cpu, mips_plugin_Read|mips_plugin_Write, 0x2004, 0x2007, &touched, &ids[2]);
+	if(err==0)
+		err=mips_cpu_add_plugin_callback(cpu, mips_plugin_Read|mips_plugin_Write, 0x3000, 0x3FFF, log_plugin_event, &never, &ids[3]);
+	if(err==0)
+		err=mips_cpu_set_pc(cpu, 0x1000);
+	if(err==0)
+		err=mips_cpu_run(cpu, 100, 0);
+
+	int testId=mips_test_begin_test("<internal>");
+	// Each instruction is executed, then has its memory or branch event
+	std::vector<mips_plugin_event> expected;
+	uint32_t pcs[]={0x1000, 0x1004, 0x1008, 0x100C};
+	for(unsigned i=0; i<4; i++){
+		mips_plugin_event e={mips_plugin_Execute, pcs[i], 0, 0, 0, 0, mips_Success};
+		expected.push_back(e);
+	}
+	mips_plugin_event e[]={
+		{mips_plugin_Execute, a.address_of("sw"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Write, a.address_of("sw"), 0, 0x2000, 4, 0x1234, mips_Success},
+		{mips_plugin_Execute, a.address_of("sb"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Write, a.address_of("sb"), 0, 0x2005, 1, 0x1234, mips_Success},
+		{mips_plugin_Execute, a.address_of("lw"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Read, a.address_of("lw"), 0, 0x2000, 4, 0x1234, mips_Success},
+		{mips_plugin_Execute, a.address_of("lbu"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Read, a.address_of("lbu"), 0, 0x2005, 1, 0x34, mips_Success},
+		{mips_plugin_Execute, a.address_of("beq"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Branch, a.address_of("beq"), 0, a.address_of("target"), 0, 0, mips_Success},
+		{mips_plugin_Execute, a.address_of("beq")+4, 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Execute, a.address_of("target"), 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Execute, a.address_of("target")+4, 0, 0, 0, 0, mips_Success},
+		{mips_plugin_Execute, a.address_of("target")+8, 0, 0, 0, 0, mips_Success}
+	};
+	expected.insert(expected.end(), e, e+sizeof(e)/sizeof(e[0]));
+	int passed = err==mips_StopExit && events.size()==expected.size() && never.empty()
+		&& executed==4 && touched==2;
+	for(unsigned i=0; passed && i<events.size(); i++){
+		uint32_t instr=0;
+		const mips_plugin_event &want=expected[i];
+		passed = is_event(events[i], want.kind, want.pc, want.address, want.length, want.value)
+			&& mips_mem_read_word(mem, want.pc, &instr)==mips_Success && events[i].instr==instr;
+	}
+	mips_test_end_test(testId, passed, "plugins see execution, memory and branches in their ranges");
+
+	// Once the hooks are gone nothing is delivered, and idle loops
+	// are skipped again
+	testId=mips_test_begin_test("<internal>");
+	mips_asm b(0x1000);
+	b.li(8, 1000000)
+	 .label("loop")
+	 .addiu(8, 8, -1)
+	 .bne(8, 0, "loop")
+	 .nop()
+	 .li(2, 10)
+	 .syscall();
+	passed = err==mips_StopExit && b.write(mem)==mips_Success && !no_plugins(cpu);
+	// The first time round the loop, just after the branch back
+	uint64_t count=0;
+	passed = passed && mips_cpu_reset(cpu)==mips_Success && mips_cpu_set_pc(cpu, 0x1000)==mips_Success;
+	for(unsigned i=0; passed && i<4; i++){
+		passed = mips_cpu_step(cpu)==mips_Success;
+	}
+	passed = passed && mips_cpu_fast_forward(cpu, UINT64_MAX)==mips_Success
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count==4;
+	for(unsigned i=0; passed && i<4; i++){
+		passed = mips_cpu_remove_plugin(cpu, ids[i])==mips_Success;
+	}
+	events.clear();
+	executed=touched=0;
+	passed = passed && no_plugins(cpu)
+		&& mips_cpu_remove_plugin(cpu, ids[0])==mips_ErrorInvalidArgument
+		&& mips_cpu_fast_forward(cpu, UINT64_MAX)==mips_Success
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count>1000000
+		&& mips_cpu_run(cpu, UINT64_MAX, 0)==mips_StopExit	// The syscall stops, so isn't counted
+		&& mips_cpu_get_instruction_count(cpu, &count)==mips_Success && count==2+3*1000000+2
+		&& events.empty() && executed==0 && touched==0;
+	mips_test_end_test(testId, passed, "removing every plugin lets idle loops be skipped again");
+
+	mips_cpu_free(cpu);
+	mips_mem_free(mem);
+}
@@ -0,0 +1,628 @@
+/* This file is an implementation of the translator and loader
+   defined in mips_aot.h. The other half, mips_cpu_run_translated,
+   is part of the CPU, as it needs to see inside the CPU state.
+
+   The generated code keeps the registers in a local array, and is
+   laid out in address order as one big switch on the pc. Each
+   basic block starts with a case label (so indirect jumps can find
+   it) and a check on the instruction budget, and static branches
+   jump straight to the label of their target.
+*/
+#include "mips.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MIPS_AOT_DLOPEN 1
+#include <dlfcn.h>
+#endif
+
+static const char *sg_defaultSymbol="mips_aot_image";
+
+static uint64_t fnv1a(const uint8_t *data, size_t length)
+{
+    uint64_t h=0xCBF29CE484222325ull;
+    for(size_t i=0; i<length; i++){
+        h ^= data[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+static std::string format(const char *fmt, ...)
+{
+    char buffer[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    return buffer;
+}
+
+/* How an instruction affects control flow. */
+enum aot_flow_t
+{
+    aot_flow_Normal,    // Goes on to the next instruction
+    aot_flow_Branch,    // Conditional branch, with a delay slot
+    aot_flow_Jump,      // J or JAL, with a delay slot
+    aot_flow_Indirect,  // JR or JALR, with a delay slot
+    aot_flow_Exit       // Always handed to the interpreter (SYSCALL, BREAK, COP1, invalid)
+};
+
+struct aot_translator_t
+{
+    const uint8_t *image;
+    uint32_t length;
+    uint32_t base;
+
+    std::set<uint32_t> decoded;     // Every instruction reached
+    std::set<uint32_t> leaders;     // Start of a basic block
+    std::set<uint32_t> labels;      // Leaders which are the target of a goto
+
+    std::string out;
+
+    bool contains(uint32_t pc) const
+    {
+        return (pc&3)==0 && pc>=base && pc-base<length;
+    }
+
+    uint32_t word(uint32_t pc) const
+    {
+        const uint8_t *p=image+(pc-base);
+        return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+    }
+
+    void emit(const std::string &s)
+    {
+        out+=s;
+    }
+
+    void analyse(const std::vector<uint32_t> &entries);
+    unsigned block_length(uint32_t leader) const;
+    std::string exit_to(const char *pc, const char *pcN, unsigned undo) const;
+    bool emit_simple(uint32_t pc, const std::string &bail);
+    void emit_transfer(uint32_t pc, unsigned index, unsigned len);
+    void generate(const char *symbol);
+};
+
+static aot_flow_t aot_flow(uint32_t instr)
+{
+    uint32_t opcode=instr>>26, funct=instr&0x3F, rt=(instr>>16)&0x1F;
+
+    switch(opcode){
+    case 0x00:
+        if(funct==0x08 || funct==0x09)
+            return aot_flow_Indirect;
+        if(funct==0x0C || funct==0x0D)
+            return aot_flow_Exit;
+        return aot_flow_Normal;     // Invalid functions are found by emit_simple
+    case 0x01:
+        if((rt&0x1E)!=0 && (rt&0x1E)!=0x10)
+            return aot_flow_Exit;
+        return aot_flow_Branch;
+    case 0x02:
+    case 0x03:
+        return aot_flow_Jump;
+    case 0x04: case 0x05: case 0x06: case 0x07:
+        return aot_flow_Branch;
+    case 0x11:
+        return aot_flow_Exit;       // Including BC1, so its delay slot is interpreted too
+    default:
+        return aot_flow_Normal;
+    }
+}
+
+static uint32_t aot_branch_target(uint32_t pc, uint32_t instr)
+{
+    return pc+4+((uint32_t)(int32_t)(int16_t)(instr&0xFFFF)<<2);
+}
+
+static uint32_t aot_jump_target(uint32_t pc, uint32_t instr)
+{
+    return ((pc+4)&0xF0000000) | ((instr&0x03FFFFFF)<<2);
+}
+
+/* Finds every instruction reachable from the entries. Each entry,
+   branch target, and return address starts a basic block. */
+void aot_translator_t::analyse(const std::vector<uint32_t> &entries)
+{
+    std::vector<uint32_t> work(entries);
+
+    while(!work.empty()){
+        uint32_t pc=work.back();
+        work.pop_back();
+        if(!contains(pc) || leaders.count(pc))
+            continue;
+        leaders.insert(pc);
+
+        while(contains(pc)){
+            uint32_t instr=word(pc);
+            aot_flow_t flow=aot_flow(instr);
+            decoded.insert(pc);
+
+            if(flow==aot_flow_Normal){
+                pc+=4;
+                if(leaders.count(pc))
+                    break;
+                continue;
+            }
+            if(flow==aot_flow_Exit){
+                // The interpreter deals with it, then comes back to the next one
+                work.push_back(pc+4);
+                if((instr>>26)==0x11 && ((instr>>21)&0x1F)==8){
+                    work.push_back(aot_branch_target(pc, instr));   // BC1F, BC1T
+                    work.push_back(pc+8);
+                }
+                break;
+            }
+
+            if(!contains(pc+4))
+                break;      // No delay slot, so the interpreter gets it
+            decoded.insert(pc+4);
+
+            uint32_t opcode=instr>>26;
+            if(flow==aot_flow_Branch){
+                work.push_back(aot_branch_target(pc, instr));
+                work.push_back(pc+8);
+            }else if(flow==aot_flow_Jump){
+                work.push_back(aot_jump_target(pc, instr));
+                if(opcode==0x03)
+                    work.push_back(pc+8);   // Where the call will return to
+            }else if((instr&0x3F)==0x09){
+                work.push_back(pc+8);       // JALR
+            }
+            break;
+        }
+    }
+}
+
+/* Number of instructions executed by falling through from a leader
+   until control is transferred, including any delay slot. */
+unsigned aot_translator_t::block_length(uint32_t leader) const
+{
+    unsigned len=0;
+    uint32_t pc=leader;
+    while(decoded.count(pc)){
+        aot_flow_t flow=aot_flow(word(pc));
+        if(flow==aot_flow_Exit)
+            return len+1;
+        if(flow!=aot_flow_Normal)
+            return decoded.count(pc+4) ? len+2 : len+1;
+        len++;
+        pc+=4;
+        if(leaders.count(pc))
+            break;
+    }
+    return len;
+}
+
+/* Code which leaves the translation with the given pc and pcN. undo is
+   the number of instructions in the block which have not been executed. */
+std::string aot_translator_t::exit_to(const char *pc, const char *pcN, unsigned undo) const
+{
+    std::string s=format("{ pc=%s; pcN=%s; ", pc, pcN);
+    if(undo)
+        s+=format("n-=%u; ", undo);
+    return s+"goto out; }";
+}
+
+/* Emits an instruction which doesn't affect control flow. Anything which
+   would cause an exception runs bail instead, before changing anything.
+   Returns false if the instruction always needs the interpreter. */
+bool aot_translator_t::emit_simple(uint32_t pc, const std::string &bail)
+{
+    uint32_t instr=word(pc);
+    uint32_t opcode=instr>>26, rs=(instr>>21)&0x1F, rt=(instr>>16)&0x1F, rd=(instr>>11)&0x1F;
+    uint32_t shift=(instr>>6)&0x1F, funct=instr&0x3F, uimm=instr&0xFFFF;
+    uint32_t simm=(uint32_t)(int32_t)(int16_t)uimm;
+
+    std::string a=format("r[%u]", rs), b=format("r[%u]", rt);
+    std::string expr;
+    unsigned dst=0;
+    const char *overflow=0;     // Condition on a, b, and t for ADD, ADDI, SUB
+
+    switch(opcode){
+    case 0x00:
+        dst=rd;
+        switch(funct){
+        case 0x00: expr=format("%s<<%u", b.c_str(), shift); break;
+        case 0x02: expr=format("%s>>%u", b.c_str(), shift); break;
+        case 0x03: expr=format("(uint32_t)((int32_t)%s>>%u)", b.c_str(), shift); break;
+        case 0x04: expr=format("%s<<(%s&0x1F)", b.c_str(), a.c_str()); break;
+        case 0x06: expr=format("%s>>(%s&0x1F)", b.c_str(), a.c_str()); break;
+        case 0x07: expr=format("(uint32_t)((int32_t)%s>>(%s&0x1F))", b.c_str(), a.c_str()); break;
+        case 0x10: expr="hi"; break;
+        case 0x11: emit(format("        hi=%s;\n", a.c_str())); return true;
+        case 0x12: expr="lo"; break;
+        case 0x13: emit(format("        lo=%s;\n", a.c_str())); return true;
+        case 0x18:
+            emit(format("        { int64_t p=(int64_t)(int32_t)%s*(int64_t)(int32_t)%s; hi=(uint32_t)((uint64_t)p>>32); lo=(uint32_t)p; }\n", a.c_str(), b.c_str()));
+            return true;
+        case 0x19:
+            emit(format("        { uint64_t p=(uint64_t)%s*(uint64_t)%s; hi=(uint32_t)(p>>32); lo=(uint32_t)p; }\n", a.c_str(), b.c_str()));
+            return true;
+        case 0x1A:
+            emit(format("        if(%s!=0){ if(%s==0x80000000u && %s==0xFFFFFFFFu){ lo=0x80000000u; hi=0; }else{ lo=(uint32_t)((int32_t)%s/(int32_t)%s); hi=(uint32_t)((int32_t)%s%%(int32_t)%s); } }\n",
+                b.c_str(), a.c_str(), b.c_str(), a.c_str(), b.c_str(), a.c_str(), b.c_str()));
+            return true;
+        case 0x1B:
+            emit(format("        if(%s!=0){ lo=%s/%s; hi=%s%%%s; }\n", b.c_str(), a.c_str(), b.c_str(), a.c_str(), b.c_str()));
+            return true;
+        case 0x20: expr=format("%s+%s", a.c_str(), b.c_str()); overflow="((a^t)&(b^t))>>31"; break;
+        case 0x21: expr=format("%s+%s", a.c_str(), b.c_str()); break;
+        case 0x22: expr=format("%s-%s", a.c_str(), b.c_str()); overflow="((a^b)&(a^t))>>31"; break;
+        case 0x23: expr=format("%s-%s", a.c_str(), b.c_str()); break;
+        case 0x24: expr=format("%s&%s", a.c_str(), b.c_str()); break;
+        case 0x25: expr=format("%s|%s", a.c_str(), b.c_str()); break;
+        case 0x26: expr=format("%s^%s", a.c_str(), b.c_str()); break;
+        case 0x27: expr=format("~(%s|%s)", a.c_str(), b.c_str()); break;
+        case 0x2A: expr=format("(int32_t)%s<(int32_t)%s", a.c_str(), b.c_str()); break;
+        case 0x2B: expr=format("%s<%s", a.c_str(), b.c_str()); break;
+        default:
+            return false;
+        }
+        break;
+
+    case 0x08:
+        dst=rt;
+        b=format("0x%08xu", simm);
+        expr=format("%s+%s", a.c_str(), b.c_str());
+        overflow="((a^t)&(b^t))>>31";
+        break;
+    case 0x09: dst=rt; expr=format("%s+0x%08xu", a.c_str(), simm); break;
+    case 0x0A: dst=rt; expr=format("(int32_t)%s<%d", a.c_str(), (int32_t)simm); break;
+    case 0x0B: dst=rt; expr=format("%s<0x%08xu", a.c_str(), simm); break;
+    case 0x0C: dst=rt; expr=format("%s&0x%04xu", a.c_str(), uimm); break;
+    case 0x0D: dst=rt; expr=format("%s|0x%04xu", a.c_str(), uimm); break;
+    case 0x0E: dst=rt; expr=format("%s^0x%04xu", a.c_str(), uimm); break;
+    case 0x0F: dst=rt; expr=format("0x%08xu", uimm<<16); break;
+
+    case 0x20: case 0x24:   // LB, LBU
+    case 0x21: case 0x25:   // LH, LHU
+    case 0x22: case 0x26:   // LWL, LWR
+    case 0x23:              // LW
+    {
+        std::string value;
+        emit(format("        { uint32_t addr=%s+0x%08xu, w;\n", a.c_str(), simm));
+        if(opcode==0x23){
+            emit(format("          if((addr&3) || ctx->read_word(mem, addr, &w)) %s\n", bail.c_str()));
+            value="w";
+        }else if(opcode==0x20 || opcode==0x24){
+            emit("          uint32_t s=8*(3-(addr&3));\n");
+            emit(format("          if(mips_aot_read_masked(ctx, addr&~3u, 0xFFu<<s, &w)) %s\n", bail.c_str()));
+            value= opcode==0x20 ? "(uint32_t)(int32_t)(int8_t)(w>>s)" : "(w>>s)&0xFF";
+        }else if(opcode==0x21 || opcode==0x25){
+            emit("          uint32_t s=8*(2-(addr&2));\n");
+            emit(format("          if((addr&1) || mips_aot_read_masked(ctx, addr&~3u, 0xFFFFu<<s, &w)) %s\n", bail.c_str()));
+            value= opcode==0x21 ? "(uint32_t)(int32_t)(int16_t)(w>>s)" : "(w>>s)&0xFFFF";
+        }else if(opcode==0x22){
+            emit("          uint32_t s=8*(addr&3);\n");
+            emit(format("          if(mips_aot_read_masked(ctx, addr&~3u, 0xFFFFFFFFu>>s, &w)) %s\n", bail.c_str()));
+            value=format("(w<<s) | (%s & ~(0xFFFFFFFFu<<s))", b.c_str());
+        }else{
+            emit("          uint32_t s=8*(3-(addr&3));\n");
+            emit(format("          if(mips_aot_read_masked(ctx, addr&~3u, 0xFFFFFFFFu<<s, &w)) %s\n", bail.c_str()));
+            value=format("(w>>s) | (%s & ~(0xFFFFFFFFu>>s))", b.c_str());
+        }
+        if(rt!=0)
+            emit(format("          r[%u]=%s;\n", rt, value.c_str()));
+        emit("        }\n");
+        return true;
+    }
+
+    case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2E:
+    {
+        emit(format("        { uint32_t addr=%s+0x%08xu;\n", a.c_str(), simm));
+        if(opcode==0x2B){
+            emit(format("          if((addr&3) || ctx->write_word(mem, addr, %s)) %s\n", b.c_str(), bail.c_str()));
+        }else{
+            const char *s, *value, *mask, *check="";
+            if(opcode==0x28){
+                s="8*(3-(addr&3))"; value="%s<<s"; mask="0xFFu<<s";
+            }else if(opcode==0x29){
+                s="8*(2-(addr&2))"; value="%s<<s"; mask="0xFFFFu<<s"; check="(addr&1) || ";
+            }else if(opcode==0x2A){
+                s="8*(addr&3)"; value="%s>>s"; mask="0xFFFFFFFFu>>s";
+            }else{
+                s="8*(3-(addr&3))"; value="%s<<s"; mask="0xFFFFFFFFu<<s";
+            }
+            emit(format("          uint32_t s=%s;\n", s));
+            emit(format("          if(%smips_aot_write_masked(ctx, addr&~3u, %s, %s)) %s\n",
+                check, format(value, b.c_str()).c_str(), mask, bail.c_str()));
+        }
+        emit("        }\n");
+        return true;
+    }
+
+    default:
+        return false;
+    }
+
+    if(overflow){
+        emit(format("        { uint32_t a=%s, b=%s, t=a+%sb;\n", a.c_str(), b.c_str(), (opcode==0 && funct==0x22) ? "-" : ""));
+        emit(format("          if(%s) %s\n", overflow, bail.c_str()));
+        if(dst!=0)
+            emit(format("          r[%u]=t;\n", dst));
+        emit("        }\n");
+    }else if(dst!=0){
+        emit(format("        r[%u]=%s;\n", dst, expr.c_str()));
+    }
+    return true;
+}
+
+/* Emits a branch or jump at index within a block of len instructions,
+   together with its delay slot. */
+void aot_translator_t::emit_transfer(uint32_t pc, unsigned index, unsigned len)
+{
+    uint32_t instr=word(pc);
+    uint32_t opcode=instr>>26, rs=(instr>>21)&0x1F, rt=(instr>>16)&0x1F, rd=(instr>>11)&0x1F;
+    aot_flow_t flow=aot_flow(instr);
+    std::string here=format("0x%08xu", pc), slot=format("0x%08xu", pc+4), next=format("0x%08xu", pc+8);
+    std::string target, pcN;
+    unsigned link=0;
+
+    if(!decoded.count(pc+4)){
+        emit(format("        %s\n", exit_to(here.c_str(), slot.c_str(), len-index).c_str()));
+        return;
+    }
+
+    emit("        {\n");
+    if(flow==aot_flow_Branch){
+        std::string cond;
+        const char *a=0;
+        std::string ra=format("r[%u]", rs), rb=format("r[%u]", rt);
+        a=ra.c_str();
+        switch(opcode){
+        case 0x01: cond=format((rt&1) ? "(int32_t)%s>=0" : "(int32_t)%s<0", a); link=(rt&0x10) ? 31 : 0; break;
+        case 0x04: cond=format("%s==%s", a, rb.c_str()); break;
+        case 0x05: cond=format("%s!=%s", a, rb.c_str()); break;
+        case 0x06: cond=format("(int32_t)%s<=0", a); break;
+        default:   cond=format("(int32_t)%s>0", a); break;
+        }
+        emit(format("          bool taken=%s;\n", cond.c_str()));
+        target=format("0x%08xu", aot_branch_target(pc, instr));
+        pcN=format("taken ? %s : %s", target.c_str(), next.c_str());
+    }else if(flow==aot_flow_Jump){
+        target=format("0x%08xu", aot_jump_target(pc, instr));
+        link= opcode==0x03 ? 31 : 0;
+        pcN=target;
+    }else{
+        emit(format("          uint32_t target=r[%u];\n", rs));
+        target="target";
+        link= (instr&0x3F)==0x09 ? rd : 0;
+        pcN="target";
+    }
+    if(link!=0)
+        emit(format("          r[%u]=%s;\n", link, next.c_str()));
+
+    // The delay slot. Branches in delay slots are UNPREDICTABLE, so
+    // they are left to the interpreter.
+    std::string bail=exit_to(slot.c_str(), pcN.c_str(), len-index-1);
+    size_t slotStart=out.size();
+    if(aot_flow(word(pc+4))!=aot_flow_Normal || !emit_simple(pc+4, bail)){
+        out.resize(slotStart);
+        emit(format("          %s\n", bail.c_str()));
+        emit("        }\n");
+        return;
+    }
+    for(size_t i=slotStart; i<out.size(); i=out.find('\n', i)+1){
+        out.insert(i, "  ");
+    }
+
+    if(flow==aot_flow_Indirect){
+        emit("          pc=target;\n");
+        emit("          goto dispatch;\n");
+    }else{
+        uint32_t dest= flow==aot_flow_Branch ? aot_branch_target(pc, instr) : aot_jump_target(pc, instr);
+        std::string go;
+        if(leaders.count(dest)){
+            go=format("goto L_%08x;", dest);
+            labels.insert(dest);
+        }else{
+            go=exit_to(target.c_str(), format("0x%08xu", dest+4).c_str(), 0);
+        }
+        if(flow==aot_flow_Branch){
+            emit(format("          if(taken) %s\n", go.c_str()));
+            if(leaders.count(pc+8)){
+                emit(format("          goto L_%08x;\n", pc+8));
+                labels.insert(pc+8);
+            }else{
+                emit(format("          %s\n", exit_to(next.c_str(), format("0x%08xu", pc+12).c_str(), 0).c_str()));
+            }
+        }else{
+            emit(format("          %s\n", go.c_str()));
+        }
+    }
+    emit("        }\n");
+}
+
+void aot_translator_t::generate(const char *symbol)
+{
+    std::string body;
+    unsigned index=0, len=0;
+    bool fallsThrough=false;
+    uint32_t last=0;
+
+    out.swap(body);
+    for(std::set<uint32_t>::const_iterator it=decoded.begin(); it!=decoded.end(); ++it){
+        uint32_t pc=*it;
+
+        if(fallsThrough && pc!=last+4){
+            // Ran off the end of the image, or into something not decoded
+            emit(format("        %s\n", exit_to(format("0x%08xu", last+4).c_str(), format("0x%08xu", last+8).c_str(), 0).c_str()));
+            fallsThrough=false;
+        }
+
+        if(leaders.count(pc)){
+            len=block_length(pc);
+            index=0;
+            if(fallsThrough)
+                emit("        // fall through\n");
+            emit(format("    case 0x%08xu:\n", pc));
+            emit(format("    L_%08x:\n", pc));
+            emit(format("        if(limit-n<%u) %s\n", len, exit_to(format("0x%08xu", pc).c_str(), format("0x%08xu", pc+4).c_str(), 0).c_str()));
+            emit(format("        n+=%u;\n", len));
+        }else if(!fallsThrough){
+            continue;   // A delay slot, which was emitted with its branch
+        }
+
+        uint32_t instr=word(pc);
+        aot_flow_t flow=aot_flow(instr);
+        emit(format("        // 0x%08x: 0x%08x\n", pc, instr));
+        std::string bail=exit_to(format("0x%08xu", pc).c_str(), format("0x%08xu", pc+4).c_str(), len-index);
+        if(flow==aot_flow_Normal && emit_simple(pc, bail)){
+            fallsThrough=true;
+            index++;
+        }else if(flow==aot_flow_Branch || flow==aot_flow_Jump || flow==aot_flow_Indirect){
+            emit_transfer(pc, index, len);
+            fallsThrough=false;
+        }else{
+            emit(format("        %s\n", bail.c_str()));
+            fallsThrough=false;
+        }
+        last=pc;
+    }
+    if(fallsThrough){
+        emit(format("        %s\n", exit_to(format("0x%08xu", last+4).c_str(), format("0x%08xu", last+8).c_str(), 0).c_str()));
+    }
+    out.swap(body);
+
+    // Labels which nothing jumps to would upset -Wall
+    std::string filtered;
+    size_t pos=0;
+    while(pos<body.size()){
+        size_t end=body.find('\n', pos);
+        std::string line=body.substr(pos, end-pos+1);
+        uint32_t addr;
+        if(line.compare(0, 6, "    L_")==0 && sscanf(line.c_str()+6, "%x", &addr)==1 && !labels.count(addr)){
+            line.clear();
+        }
+        filtered+=line;
+        pos=end+1;
+    }
+
+    emit(format("/* Translation of %u bytes at 0x%08x, generated by mips_aot_translate.\n", length, base));
+    emit("   Compile with something like:\n");
+    emit("       g++ -O2 -shared -fPIC -I include this_file.cpp -o this_file.so\n");
+    emit("*/\n");
+    emit("#include \"mips_aot.h\"\n\n");
+    emit("static void run(mips_aot_context *ctx)\n");
+    emit("{\n");
+    emit("    uint32_t r[32];\n");
+    emit("    for(unsigned i=0; i<32; i++){\n");
+    emit("        r[i]=ctx->arch.regs[i];\n");
+    emit("    }\n");
+    emit("    r[0]=0;\n");
+    emit("    uint32_t hi=ctx->arch.hi, lo=ctx->arch.lo;\n");
+    emit("    uint32_t pc=ctx->arch.pc, pcN=ctx->arch.pcN;\n");
+    emit("    uint64_t n=0, limit=ctx->limit;\n");
+    emit("    mips_mem_h mem=ctx->mem;\n");
+    emit("    (void)mem;\n\n");
+    emit("    if(pcN!=pc+4)\n");
+    emit("        goto out;     // In a delay slot\n\n");
+    emit("dispatch:\n");
+    emit("    switch(pc){\n");
+    emit(filtered);
+    emit("    default:\n");
+    emit("        pcN=pc+4;\n");
+    emit("        goto out;\n");
+    emit("    }\n\n");
+    emit("out:\n");
+    emit("    for(unsigned i=1; i<32; i++){\n");
+    emit("        ctx->arch.regs[i]=r[i];\n");
+    emit("    }\n");
+    emit("    ctx->arch.hi=hi;\n");
+    emit("    ctx->arch.lo=lo;\n");
+    emit("    ctx->arch.pc=pc;\n");
+    emit("    ctx->arch.pcN=pcN;\n");
+    emit("    ctx->count=n;\n");
+    emit("}\n\n");
+    emit(format("extern \"C\" const mips_aot_module %s={\n", symbol));
+    emit(format("    MIPS_AOT_VERSION, 0x%08xu, 0x%08xu, 0x%016llxull, run\n", base, length, (unsigned long long)fnv1a(image, length)));
+    emit("};\n");
+}
+
+mips_error mips_aot_translate(
+    const uint8_t *image,
+    uint32_t length,
+    uint32_t base,
+    const uint32_t *entries,
+    unsigned entryCount,
+    const char *symbol,
+    FILE *dst
+){
+    if(dst==0 || (length>0 && image==0) || (entryCount>0 && entries==0))
+        return mips_ErrorInvalidArgument;
+    if((length%4)!=0 || (base%4)!=0 || length>0xFFFFFFFFu-base)
+        return mips_ErrorInvalidArgument;
+
+    aot_translator_t t;
+    t.image=image;
+    t.length=length;
+    t.base=base;
+
+    std::vector<uint32_t> roots(1, base);
+    roots.insert(roots.end(), entries, entries+entryCount);
+    t.analyse(roots);
+    t.generate(symbol ? symbol : sg_defaultSymbol);
+
+    if(t.out.size()!=fwrite(t.out.data(), 1, t.out.size(), dst))
+        return mips_ErrorFileWriteError;
+    return mips_Success;
+}
+
+mips_error mips_aot_load(
+    const char *fileName,
+    const char *symbol,
+    const mips_aot_module **module
+){
+    if(fileName==0 || module==0)
+        return mips_ErrorInvalidArgument;
+
+#ifdef MIPS_AOT_DLOPEN
+    void *lib=dlopen(fileName, RTLD_NOW|RTLD_LOCAL);
+    if(lib==0)
+        return mips_ErrorFileReadError;
+
+    const mips_aot_module *m=(const mips_aot_module*)dlsym(lib, symbol ? symbol : sg_defaultSymbol);
+    if(m==0 || m->version!=MIPS_AOT_VERSION){
+        dlclose(lib);
+        return mips_ErrorInvalidArgument;
+    }
+    *module=m;
+    return mips_Success;
+#else
+    (void)symbol;
+    return mips_ErrorFileReadError;
+#endif
+}
+
+mips_error mips_aot_check(
+    const mips_aot_module *module,
+    mips_mem_h mem
+){
+    if(mem==0)
+        return mips_ErrorInvalidHandle;
+    if(module==0)
+        return mips_ErrorInvalidArgument;
+
+    std::vector<uint8_t> bytes(module->length);
+    for(uint32_t i=0; i<module->length; i+=4){
+        uint32_t w;
+        mips_error err=mips_mem_read_word(mem, module->base+i, &w);
+        if(err)
+            return err;
+        bytes[i]=(uint8_t)(w>>24);
+        bytes[i+1]=(uint8_t)(w>>16);
+        bytes[i+2]=(uint8_t)(w>>8);
+        bytes[i+3]=(uint8_t)w;
+    }
+    if(fnv1a(bytes.empty() ? 0 : &bytes[0], bytes.size())!=module->digest)
+        return mips_ErrorInvalidArgument;
+    return mips_Success;
+}
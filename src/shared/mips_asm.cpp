@@ -0,0 +1,173 @@
+/* This file is an implementation of the functions
+   defined in mips_asm.h. Instructions are kept as words
+   until the program is written, so that labels can be used
+   before they are defined.
+*/
+#include "mips.h"
+#include "mips_asm.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct fixup_t
+{
+    uint32_t index;     // Instruction which needs patching
+    bool jump;          // J-type target, otherwise a 16-bit branch offset
+    std::string label;
+};
+
+struct mips_asm_impl
+{
+    uint32_t origin;
+    std::vector<uint32_t> words;
+    std::map<std::string,uint32_t> labels;
+    std::vector<fixup_t> fixups;
+};
+
+static mips_error add_fixup(mips_asm_h a, uint32_t encoding, const char *label, bool jump)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+    if(label==0)
+        return mips_ErrorInvalidArgument;
+
+    fixup_t f;
+    f.index=(uint32_t)a->words.size();
+    f.jump=jump;
+    f.label=label;
+    a->fixups.push_back(f);
+    a->words.push_back(encoding);
+    return mips_Success;
+}
+
+extern "C" mips_asm_h mips_asm_create(uint32_t origin)
+{
+    if(origin&3)
+        return 0;
+
+    mips_asm_impl *a=new mips_asm_impl;
+    a->origin=origin;
+    return a;
+}
+
+extern "C" void mips_asm_free(mips_asm_h a)
+{
+    delete a;
+}
+
+extern "C" uint32_t mips_asm_here(mips_asm_h a)
+{
+    if(a==0)
+        return 0;
+    return a->origin+4*(uint32_t)a->words.size();
+}
+
+extern "C" mips_error mips_asm_word(mips_asm_h a, uint32_t encoding)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+
+    a->words.push_back(encoding);
+    return mips_Success;
+}
+
+extern "C" mips_error mips_asm_label(mips_asm_h a, const char *name)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+    if(name==0)
+        return mips_ErrorInvalidArgument;
+
+    if(!a->labels.insert(std::make_pair(std::string(name), mips_asm_here(a))).second)
+        return mips_ErrorInvalidArgument;
+    return mips_Success;
+}
+
+extern "C" mips_error mips_asm_branch(mips_asm_h a, uint32_t encoding, const char *label)
+{
+    return add_fixup(a, encoding, label, false);
+}
+
+extern "C" mips_error mips_asm_jump(mips_asm_h a, uint32_t encoding, const char *label)
+{
+    return add_fixup(a, encoding, label, true);
+}
+
+extern "C" mips_error mips_asm_get_label(mips_asm_h a, const char *name, uint32_t *address)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+    if(name==0 || address==0)
+        return mips_ErrorInvalidArgument;
+
+    std::map<std::string,uint32_t>::const_iterator it=a->labels.find(name);
+    if(it==a->labels.end())
+        return mips_ErrorInvalidArgument;
+    *address=it->second;
+    return mips_Success;
+}
+
+extern "C" mips_error mips_asm_assemble(mips_asm_h a, uint8_t *dst, uint32_t *length)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+    if(length==0)
+        return mips_ErrorInvalidArgument;
+
+    std::vector<uint32_t> words(a->words);
+
+    for(unsigned i=0;i<a->fixups.size();i++){
+        const fixup_t &f=a->fixups[i];
+
+        std::map<std::string,uint32_t>::const_iterator it=a->labels.find(f.label);
+        if(it==a->labels.end())
+            return mips_ErrorInvalidArgument;
+
+        uint32_t pc=a->origin+4*f.index;
+        uint32_t target=it->second;
+        if(f.jump){
+            // Target must be in the same 256MB region as the delay slot
+            if( ((pc+4)^target) & 0xF0000000u )
+                return mips_ErrorInvalidArgument;
+            words[f.index] = (words[f.index]&0xFC000000u) | ((target>>2)&0x03FFFFFFu);
+        }else{
+            // Offset is relative to the delay slot, in instructions
+            int32_t offset=((int32_t)(target-(pc+4)))>>2;
+            if(offset < -32768 || offset > 32767)
+                return mips_ErrorInvalidArgument;
+            words[f.index] = (words[f.index]&0xFFFF0000u) | ((uint32_t)offset&0xFFFFu);
+        }
+    }
+
+    *length=4*(uint32_t)words.size();
+    if(dst){
+        for(unsigned i=0;i<words.size();i++){
+            dst[4*i+0]=(uint8_t)(words[i]>>24);
+            dst[4*i+1]=(uint8_t)(words[i]>>16);
+            dst[4*i+2]=(uint8_t)(words[i]>>8);
+            dst[4*i+3]=(uint8_t)(words[i]);
+        }
+    }
+    return mips_Success;
+}
+
+extern "C" mips_error mips_asm_write(mips_asm_h a, mips_mem_h mem)
+{
+    if(a==0)
+        return mips_ErrorInvalidHandle;
+
+    uint32_t length=0;
+    mips_error err=mips_asm_assemble(a, 0, &length);
+    if(err)
+        return err;
+    if(length==0)
+        return mips_Success;
+
+    std::vector<uint8_t> bytes(length);
+    err=mips_asm_assemble(a, &bytes[0], &length);
+    if(err)
+        return err;
+
+    return mips_mem_write(mem, a->origin, length, &bytes[0]);
+}
@@ -0,0 +1,488 @@
+/* This file is an implementation of the functions
+   defined in mips_checkpoint.h. It needs to know about
+   the internals of the RAM provider, and relies on the
+   CPU implementing the functions from mips_cpu_state.h.
+*/
+#include "mips.h"
+#include "mips_mem_ram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MIPS_CHECKPOINT_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char sg_magic[8]={'M','I','P','S','C','K','P','T'};
+static const uint32_t sg_byteOrder=0x01020304;
+static const uint32_t sg_version=3;
+static const uint32_t sg_pageSize=4096;
+
+enum page_encoding_t
+{
+    page_encoding_raw=0,
+    page_encoding_packbits=1
+};
+
+struct checkpoint_header_t
+{
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t memLength;
+    uint32_t blockSize;
+    uint32_t pageCount;     // Number of entries in the page table
+    uint32_t ramFlags;      // Layout of the pages, from mips_mem_ram_flags
+    mips_cpu_arch_state cpu;
+};
+
+struct checkpoint_page_t
+{
+    uint32_t index;         // Page number within the RAM
+    uint32_t encoding;      // One of page_encoding_t
+    uint32_t storedLength;  // Bytes in the file
+    uint32_t reserved;
+    uint64_t offset;        // Byte offset within the file
+};
+
+static uint64_t round_up(uint64_t x, uint64_t align)
+{
+    return (x+align-1)/align*align;
+}
+
+static bool is_zero_page(const uint8_t *page)
+{
+    for(unsigned i=0; i<sg_pageSize; i++){
+        if(page[i])
+            return false;
+    }
+    return true;
+}
+
+/* PackBits, as used in TIFF and MacPaint. A control byte c<128 is followed
+   by c+1 literal bytes, while c>128 is followed by one byte to be
+   repeated 257-c times. */
+static void packbits_encode(const uint8_t *src, unsigned n, std::vector<uint8_t> &dst)
+{
+    unsigned i=0;
+    while(i<n){
+        unsigned run=1;
+        while(i+run<n && run<128 && src[i+run]==src[i]){
+            run++;
+        }
+        if(run>=3){
+            dst.push_back((uint8_t)(257-run));
+            dst.push_back(src[i]);
+            i+=run;
+        }else{
+            unsigned start=i;
+            unsigned len=0;
+            while(i<n && len<128){
+                if(i+2<n && src[i]==src[i+1] && src[i]==src[i+2])
+                    break;
+                i++;
+                len++;
+            }
+            dst.push_back((uint8_t)(len-1));
+            dst.insert(dst.end(), src+start, src+start+len);
+        }
+    }
+}
+
+static bool packbits_decode(const uint8_t *src, unsigned n, uint8_t *dst, unsigned cbDst)
+{
+    unsigned i=0, o=0;
+    while(i<n){
+        unsigned c=src[i++];
+        if(c<128){
+            unsigned len=c+1;
+            if(i+len>n || o+len>cbDst)
+                return false;
+            memcpy(dst+o, src+i, len);
+            i+=len;
+            o+=len;
+        }else if(c>128){
+            unsigned len=257-c;
+            if(i>=n || o+len>cbDst)
+                return false;
+            memset(dst+o, src[i], len);
+            i++;
+            o+=len;
+        }
+    }
+    return o==cbDst;
+}
+
+extern "C" mips_error mips_checkpoint_save(
+    mips_cpu_h cpu,
+    mips_mem_h mem,
+    const char *fileName,
+    unsigned flags
+){
+    if(cpu==0 || mem==0)
+        return mips_ErrorInvalidHandle;
+    if(!mips_mem_is_ram(mem))
+        return mips_ErrorInvalidArgument;
+    if(fileName==0)
+        return mips_ErrorInvalidArgument;
+
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sg_magic, sizeof(sg_magic));
+    header.byteOrder=sg_byteOrder;
+    header.version=sg_version;
+    header.pageSize=sg_pageSize;
+    header.memLength=mem->length;
+    header.blockSize=mem->blockSize;
+    header.ramFlags=mem->flags & mips_mem_ram_HostOrder;  // Pages are stored exactly as laid out in memory
+
+    mips_error err=mips_cpu_get_arch_state(cpu, &header.cpu);
+    if(err)
+        return err;
+
+    // Work out what will be stored for each page. The last page may
+    // be partial, in which case it is padded with zeros.
+    std::vector<checkpoint_page_t> rawPages, packedPages;
+    std::vector<uint8_t> packed;
+
+    uint32_t numPages=(uint32_t)round_up(mem->length, sg_pageSize)/sg_pageSize;
+    std::vector<uint8_t> page(sg_pageSize);
+    for(uint32_t i=0; i<numPages; i++){
+        uint32_t base=i*sg_pageSize;
+        uint32_t todo=mem->length-base < sg_pageSize ? mem->length-base : sg_pageSize;
+        memset(&page[0], 0, sg_pageSize);
+        memcpy(&page[0], mem->data+base, todo);
+
+        if(is_zero_page(&page[0]))
+            continue;
+
+        checkpoint_page_t info;
+        memset(&info, 0, sizeof(info));
+        info.index=i;
+
+        if(flags & mips_checkpoint_Compress){
+            size_t before=packed.size();
+            packbits_encode(&page[0], sg_pageSize, packed);
+            // Only worth losing the ability to map the page if it is much smaller
+            if(packed.size()-before < sg_pageSize/2){
+                info.encoding=page_encoding_packbits;
+                info.storedLength=(uint32_t)(packed.size()-before);
+                info.offset=before;    // relative for now
+                packedPages.push_back(info);
+                continue;
+            }
+            packed.resize(before);
+        }
+
+        info.encoding=page_encoding_raw;
+        info.storedLength=sg_pageSize;
+        rawPages.push_back(info);
+    }
+
+    // Lay out the file: header, table, packed data, then aligned raw pages
+    header.pageCount=(uint32_t)(rawPages.size()+packedPages.size());
+    uint64_t packedBase=sizeof(header)+header.pageCount*sizeof(checkpoint_page_t);
+    uint64_t rawBase=round_up(packedBase+packed.size(), sg_pageSize);
+
+    std::vector<checkpoint_page_t> table;
+    for(unsigned i=0; i<packedPages.size(); i++){
+        packedPages[i].offset+=packedBase;
+        table.push_back(packedPages[i]);
+    }
+    for(unsigned i=0; i<rawPages.size(); i++){
+        rawPages[i].offset=rawBase+i*(uint64_t)sg_pageSize;
+        table.push_back(rawPages[i]);
+    }
+
+    std::string tmpName=std::string(fileName)+".tmp";
+    FILE *dst=fopen(tmpName.c_str(), "wb");
+    if(!dst)
+        return mips_ErrorFileWriteError;
+
+    bool ok=true;
+    ok = ok && 1==fwrite(&header, sizeof(header), 1, dst);
+    if(table.size()>0)
+        ok = ok && table.size()==fwrite(&table[0], sizeof(checkpoint_page_t), table.size(), dst);
+    if(packed.size()>0)
+        ok = ok && packed.size()==fwrite(&packed[0], 1, packed.size(), dst);
+    if(rawPages.size()>0){
+        std::vector<uint8_t> zeros(rawBase-(packedBase+packed.size()), 0);
+        if(zeros.size()>0)
+            ok = ok && zeros.size()==fwrite(&zeros[0], 1, zeros.size(), dst);
+
+        for(unsigned i=0; ok && i<rawPages.size(); i++){
+            uint32_t base=rawPages[i].index*sg_pageSize;
+            uint32_t todo=mem->length-base < sg_pageSize ? mem->length-base : sg_pageSize;
+            memset(&page[0], 0, sg_pageSize);
+            memcpy(&page[0], mem->data+base, todo);
+            ok = ok && sg_pageSize==fwrite(&page[0], 1, sg_pageSize, dst);
+        }
+    }
+    ok = (0==fclose(dst)) && ok;
+
+    if(ok){
+#ifndef MIPS_CHECKPOINT_MMAP
+        remove(fileName);   // rename does not replace existing files on windows
+#endif
+        ok = 0==rename(tmpName.c_str(), fileName);
+    }
+    if(!ok){
+        remove(tmpName.c_str());
+        return mips_ErrorFileWriteError;
+    }
+    return mips_Success;
+}
+
+#ifdef MIPS_CHECKPOINT_MMAP
+
+static size_t mapped_length(uint32_t length)
+{
+    return (size_t)round_up(length ? length : 1, sg_pageSize);
+}
+
+static void free_mapped_data(uint8_t *data, uint32_t length)
+{
+    munmap(data, mapped_length(length));
+}
+
+/* The RAM starts as anonymous (zero) pages, and then the raw pages
+   in the file are mapped over the top of it. MAP_PRIVATE means that
+   writes go to private copies rather than back into the file. */
+static mips_error load_pages(
+    int fd,
+    const checkpoint_header_t &header,
+    const std::vector<checkpoint_page_t> &table,
+    uint8_t **pData
+){
+    size_t cbMapped=mapped_length(header.memLength);
+    void *base=mmap(0, cbMapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(base==MAP_FAILED)
+        return mips_ErrorFileReadError;
+    uint8_t *data=(uint8_t*)base;
+
+    // Mapping at 4K granularity only works if that is what the host uses
+    bool canMap = sysconf(_SC_PAGESIZE)==(long)sg_pageSize;
+
+    std::vector<uint8_t> buffer;
+    unsigned i=0;
+    while(i<table.size()){
+        const checkpoint_page_t &p=table[i];
+
+        if(p.encoding==page_encoding_raw){
+            // Find a run of pages which are contiguous in both RAM and file
+            unsigned n=1;
+            while(i+n<table.size()
+                && table[i+n].encoding==page_encoding_raw
+                && table[i+n].index==p.index+n
+                && table[i+n].offset==p.offset+n*(uint64_t)sg_pageSize
+            ){
+                n++;
+            }
+            size_t cb=n*(size_t)sg_pageSize;
+            bool done=false;
+            if(canMap){
+                void *got=mmap(data+p.index*(size_t)sg_pageSize, cb, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, (off_t)p.offset);
+                done = got!=MAP_FAILED;
+            }
+            if(!done){
+                if((ssize_t)cb!=pread(fd, data+p.index*(size_t)sg_pageSize, cb, (off_t)p.offset)){
+                    munmap(base, cbMapped);
+                    return mips_ErrorFileReadError;
+                }
+            }
+            i+=n;
+        }else{
+            buffer.resize(p.storedLength);
+            bool ok = (ssize_t)p.storedLength==pread(fd, &buffer[0], p.storedLength, (off_t)p.offset);
+            ok = ok && packbits_decode(&buffer[0], p.storedLength, data+p.index*(size_t)sg_pageSize, sg_pageSize);
+            if(!ok){
+                munmap(base, cbMapped);
+                return mips_ErrorFileReadError;
+            }
+            i++;
+        }
+    }
+
+    *pData=data;
+    return mips_Success;
+}
+
+#else
+
+static void free_mapped_data(uint8_t *data, uint32_t)
+{
+    free(data);
+}
+
+static mips_error load_pages(
+    FILE *src,
+    const checkpoint_header_t &header,
+    const std::vector<checkpoint_page_t> &table,
+    uint8_t **pData
+){
+    uint8_t *data=(uint8_t*)calloc(round_up(header.memLength ? header.memLength : 1, sg_pageSize), 1);
+    if(data==0)
+        return mips_ErrorFileReadError;
+
+    std::vector<uint8_t> buffer;
+    for(unsigned i=0; i<table.size(); i++){
+        const checkpoint_page_t &p=table[i];
+        buffer.resize(p.storedLength);
+        bool ok = 0==fseek(src, (long)p.offset, SEEK_SET);
+        ok = ok && p.storedLength==fread(&buffer[0], 1, p.storedLength, src);
+        if(ok){
+            if(p.encoding==page_encoding_raw){
+                memcpy(data+p.index*(size_t)sg_pageSize, &buffer[0], sg_pageSize);
+            }else{
+                ok=packbits_decode(&buffer[0], p.storedLength, data+p.index*(size_t)sg_pageSize, sg_pageSize);
+            }
+        }
+        if(!ok){
+            free(data);
+            return mips_ErrorFileReadError;
+        }
+    }
+
+    *pData=data;
+    return mips_Success;
+}
+
+#endif
+
+static bool check_header(const checkpoint_header_t &header)
+{
+    if(memcmp(header.magic, sg_magic, sizeof(sg_magic)))
+        return false;
+    if(header.byteOrder!=sg_byteOrder)
+        return false;
+    if(header.version!=sg_version)
+        return false;
+    if(header.pageSize!=sg_pageSize)
+        return false;
+    if(header.blockSize==0)
+        return false;
+    if(header.ramFlags & ~(uint32_t)mips_mem_ram_HostOrder)
+        return false;
+    return header.pageCount <= round_up(header.memLength, sg_pageSize)/sg_pageSize;
+}
+
+/* Every page must be within the file, as mapping a truncated file
+   would give SIGBUS when the missing part was touched. */
+static bool check_table(const checkpoint_header_t &header, const std::vector<checkpoint_page_t> &table, uint64_t fileSize)
+{
+    uint32_t numPages=(uint32_t)(round_up(header.memLength, sg_pageSize)/sg_pageSize);
+    for(unsigned i=0; i<table.size(); i++){
+        const checkpoint_page_t &p=table[i];
+        if(p.index>=numPages)
+            return false;
+        if(p.offset>fileSize || p.storedLength>fileSize-p.offset)
+            return false;
+        if(p.encoding==page_encoding_raw){
+            if(p.storedLength!=sg_pageSize || (p.offset%sg_pageSize))
+                return false;
+        }else if(p.encoding==page_encoding_packbits){
+            if(p.storedLength>2*sg_pageSize)
+                return false;
+        }else{
+            return false;
+        }
+    }
+    return true;
+}
+
+extern "C" mips_error mips_checkpoint_load(
+    const char *fileName,
+    mips_cpu_h *cpu,
+    mips_mem_h *mem
+){
+    if(fileName==0 || cpu==0 || mem==0)
+        return mips_ErrorInvalidArgument;
+    *cpu=0;
+    *mem=0;
+
+    checkpoint_header_t header;
+    std::vector<checkpoint_page_t> table;
+    uint8_t *data=0;
+    mips_error err=mips_Success;
+
+#ifdef MIPS_CHECKPOINT_MMAP
+    int fd=open(fileName, O_RDONLY);
+    if(fd<0)
+        return mips_ErrorFileReadError;
+
+    struct stat info;
+    bool ok = 0==fstat(fd, &info);
+    ok = ok && sizeof(header)==pread(fd, &header, sizeof(header), 0);
+    ok = ok && check_header(header);
+    if(ok){
+        table.resize(header.pageCount);
+        size_t cbTable=header.pageCount*sizeof(checkpoint_page_t);
+        ok = cbTable==0 || (ssize_t)cbTable==pread(fd, &table[0], cbTable, sizeof(header));
+    }
+    ok = ok && check_table(header, table, (uint64_t)info.st_size);
+
+    if(!ok){
+        err=mips_ErrorFileReadError;
+    }else{
+        err=load_pages(fd, header, table, &data);
+    }
+    close(fd);  // Any mappings stay valid after closing
+#else
+    FILE *src=fopen(fileName, "rb");
+    if(!src)
+        return mips_ErrorFileReadError;
+
+    bool ok = 1==fread(&header, sizeof(header), 1, src);
+    ok = ok && check_header(header);
+    if(ok){
+        table.resize(header.pageCount);
+        ok = header.pageCount==0 || header.pageCount==fread(&table[0], sizeof(checkpoint_page_t), header.pageCount, src);
+    }
+    long fileSize=-1;
+    if(ok && 0==fseek(src, 0, SEEK_END)){
+        fileSize=ftell(src);
+    }
+    ok = ok && fileSize>=0 && check_table(header, table, (uint64_t)fileSize);
+
+    if(!ok){
+        err=mips_ErrorFileReadError;
+    }else{
+        err=load_pages(src, header, table, &data);
+    }
+    fclose(src);
+#endif
+    if(err)
+        return err;
+
+    mips_mem_h m=mips_mem_create_ram_from(header.memLength, header.blockSize, header.ramFlags, data, free_mapped_data);
+    if(m==0){
+        free_mapped_data(data, header.memLength);
+        return mips_ErrorFileReadError;
+    }
+
+    mips_cpu_h c=mips_cpu_create(m);
+    if(c==0){
+        mips_mem_free(m);
+        return mips_ErrorFileReadError;
+    }
+
+    err=mips_cpu_set_arch_state(c, &header.cpu);
+    if(err){
+        mips_cpu_free(c);
+        mips_mem_free(m);
+        return err;
+    }
+
+    *cpu=c;
+    *mem=m;
+    return mips_Success;
+}
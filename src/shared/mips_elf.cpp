@@ -0,0 +1,525 @@
+/* This file is an implementation of the functions
+   defined in mips_elf.h. It only relies on the public
+   memory and CPU functions, so works with any memory.
+*/
+#include "mips.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MIPS_ELF_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Just the parts of elf.h that are needed, so this doesn't
+// depend on the host having it.
+static const uint8_t ELFCLASS32=1;
+static const uint8_t ELFDATA2MSB=2;
+static const uint16_t EM_MIPS=8;
+static const uint16_t ET_REL=1;
+static const uint32_t PT_LOAD=1;
+static const uint32_t SHT_SYMTAB=2;
+static const uint32_t SHT_NOBITS=8;
+static const uint32_t SHF_ALLOC=2;
+static const uint16_t SHN_UNDEF=0;
+static const uint16_t SHN_LORESERVE=0xFF00;
+static const uint8_t STT_OBJECT=1;
+static const uint8_t STT_FUNC=2;
+static const uint8_t STT_SECTION=3;
+static const uint8_t STT_FILE=4;
+
+static const uint32_t sg_ehdrSize=52;
+static const uint32_t sg_phdrSize=32;
+static const uint32_t sg_shdrSize=40;
+static const uint32_t sg_symSize=16;
+
+struct elf_segment_t
+{
+    uint32_t address;
+    uint32_t offset;        // Within the file
+    uint32_t fileSize;
+    uint32_t memSize;       // Anything past fileSize is zero
+};
+
+struct elf_section_t
+{
+    std::string name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t address;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t link;
+    uint32_t align;
+};
+
+struct mips_elf_impl
+{
+    const uint8_t *data;
+    size_t length;
+#ifdef MIPS_ELF_MMAP
+    void *mapped;
+    size_t mappedLength;
+#else
+    std::vector<uint8_t> buffer;
+#endif
+
+    uint32_t entry;
+    std::vector<elf_segment_t> segments;
+    std::vector<elf_section_t> sections;
+    std::vector<mips_elf_symbol> symbols;   // Sorted by address, preferred first
+};
+
+static uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0]<<8) | p[1]);
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+static bool in_file(const mips_elf_impl *elf, uint64_t offset, uint64_t length)
+{
+    return offset<=elf->length && length<=elf->length-offset;
+}
+
+/* Returns the string at offset within a string table section, or
+   0 if it isn't properly terminated within the section. */
+static const char *get_string(const mips_elf_impl *elf, const elf_section_t &strtab, uint32_t offset)
+{
+    if(offset>=strtab.size || !in_file(elf, strtab.offset, strtab.size))
+        return 0;
+    const char *begin=(const char*)elf->data+strtab.offset+offset;
+    if(memchr(begin, 0, strtab.size-offset)==0)
+        return 0;
+    return begin;
+}
+
+static bool read_sections(mips_elf_impl *elf, uint32_t shoff, uint16_t shentsize, uint16_t shnum, uint16_t shstrndx)
+{
+    if(shnum==0)
+        return true;
+    if(shentsize<sg_shdrSize || !in_file(elf, shoff, (uint64_t)shentsize*shnum))
+        return false;
+
+    elf->sections.resize(shnum);
+    for(unsigned i=0; i<shnum; i++){
+        const uint8_t *p=elf->data+shoff+i*shentsize;
+        elf_section_t &s=elf->sections[i];
+        s.type=be32(p+4);
+        s.flags=be32(p+8);
+        s.address=be32(p+12);
+        s.offset=be32(p+16);
+        s.size=be32(p+20);
+        s.link=be32(p+24);
+        s.align=be32(p+32);
+        if(s.type!=SHT_NOBITS && !in_file(elf, s.offset, s.size))
+            return false;
+    }
+
+    if(shstrndx!=SHN_UNDEF && shstrndx<shnum){
+        for(unsigned i=0; i<shnum; i++){
+            const char *name=get_string(elf, elf->sections[shstrndx], be32(elf->data+shoff+i*shentsize));
+            if(name){
+                elf->sections[i].name=name;
+            }
+        }
+    }
+    return true;
+}
+
+static bool read_segments(mips_elf_impl *elf, uint32_t phoff, uint16_t phentsize, uint16_t phnum)
+{
+    if(phentsize<sg_phdrSize || !in_file(elf, phoff, (uint64_t)phentsize*phnum))
+        return false;
+
+    for(unsigned i=0; i<phnum; i++){
+        const uint8_t *p=elf->data+phoff+i*phentsize;
+        if(be32(p)!=PT_LOAD)
+            continue;
+        elf_segment_t s;
+        s.offset=be32(p+4);
+        s.address=be32(p+8);    // p_vaddr, as there is no MMU
+        s.fileSize=be32(p+16);
+        s.memSize=be32(p+20);
+        if(s.fileSize>s.memSize || !in_file(elf, s.offset, s.fileSize))
+            return false;
+        // Otherwise the zero fill would wrap round to address zero
+        if((uint64_t)s.address+s.memSize>0x100000000ull)
+            return false;
+        if(s.memSize>0){
+            elf->segments.push_back(s);
+        }
+    }
+    return true;
+}
+
+/* Relocatable objects (like the ones in fragments) have no program
+   headers, and every section is at address zero. The allocated sections
+   are placed one after another instead, in file order, so .text ends up
+   at zero as it does in the .bin files. Relocations are not applied. */
+static void layout_sections(mips_elf_impl *elf, std::vector<uint32_t> &bases)
+{
+    uint64_t next=0;
+    bases.assign(elf->sections.size(), 0);
+    for(unsigned i=0; i<elf->sections.size(); i++){
+        elf_section_t &s=elf->sections[i];
+        if(!(s.flags & SHF_ALLOC) || s.size==0)
+            continue;
+        uint64_t align = s.align ? s.align : 1;
+        next=(next+align-1)/align*align;
+        if(next+s.size>0x100000000ull)
+            break;
+        s.address=(uint32_t)next;
+        bases[i]=s.address;
+        next+=s.size;
+
+        elf_segment_t seg;
+        seg.address=s.address;
+        seg.offset=s.offset;
+        seg.fileSize = s.type==SHT_NOBITS ? 0 : s.size;
+        seg.memSize=s.size;
+        elf->segments.push_back(seg);
+    }
+}
+
+/* Lower is better, for symbols at the same address */
+static int symbol_rank(uint8_t type)
+{
+    if(type==STT_FUNC)
+        return 0;
+    if(type==STT_OBJECT)
+        return 1;
+    return 2;
+}
+
+static void read_symbols(mips_elf_impl *elf, bool relocatable, const std::vector<uint32_t> &bases)
+{
+    std::vector<std::pair<std::pair<uint32_t,int>, mips_elf_symbol> > found;
+
+    for(unsigned i=0; i<elf->sections.size(); i++){
+        const elf_section_t &symtab=elf->sections[i];
+        if(symtab.type!=SHT_SYMTAB || symtab.link>=elf->sections.size())
+            continue;
+        const elf_section_t &strtab=elf->sections[symtab.link];
+
+        // Entry zero is always the null symbol
+        for(uint32_t j=1; j<symtab.size/sg_symSize; j++){
+            const uint8_t *p=elf->data+symtab.offset+j*sg_symSize;
+            uint8_t type=p[12]&0xF;
+            uint16_t shndx=be16(p+14);
+            if(type==STT_SECTION || type==STT_FILE || shndx==SHN_UNDEF)
+                continue;
+
+            mips_elf_symbol sym;
+            sym.name=get_string(elf, strtab, be32(p));
+            if(sym.name==0 || sym.name[0]==0)
+                continue;
+            sym.address=be32(p+4);
+            sym.size=be32(p+8);
+            if(relocatable && shndx<SHN_LORESERVE && shndx<bases.size()){
+                sym.address+=bases[shndx];
+            }
+            found.push_back(std::make_pair(std::make_pair(sym.address, symbol_rank(type)), sym));
+        }
+    }
+
+    std::stable_sort(found.begin(), found.end(),
+        [](const std::pair<std::pair<uint32_t,int>, mips_elf_symbol> &a, const std::pair<std::pair<uint32_t,int>, mips_elf_symbol> &b){
+            return a.first<b.first;
+        }
+    );
+    elf->symbols.reserve(found.size());
+    for(unsigned i=0; i<found.size(); i++){
+        elf->symbols.push_back(found[i].second);
+    }
+}
+
+static bool parse(mips_elf_impl *elf)
+{
+    const uint8_t *h=elf->data;
+    if(elf->length<sg_ehdrSize)
+        return false;
+    if(h[0]!=0x7F || h[1]!='E' || h[2]!='L' || h[3]!='F')
+        return false;
+    if(h[4]!=ELFCLASS32 || h[5]!=ELFDATA2MSB || be16(h+18)!=EM_MIPS)
+        return false;
+
+    uint16_t type=be16(h+16);
+    elf->entry=be32(h+24);
+    uint32_t phoff=be32(h+28);
+    uint32_t shoff=be32(h+32);
+    uint16_t phentsize=be16(h+42);
+    uint16_t phnum=be16(h+44);
+    uint16_t shentsize=be16(h+46);
+    uint16_t shnum=be16(h+48);
+    uint16_t shstrndx=be16(h+50);
+
+    if(!read_sections(elf, shoff, shentsize, shnum, shstrndx))
+        return false;
+
+    std::vector<uint32_t> bases;
+    if(phnum>0){
+        if(!read_segments(elf, phoff, phentsize, phnum))
+            return false;
+    }else{
+        layout_sections(elf, bases);
+    }
+
+    read_symbols(elf, type==ET_REL && phnum==0, bases);
+    return true;
+}
+
+extern "C" mips_error mips_elf_open(
+    const char *fileName,
+    mips_elf_h *elf
+){
+    if(fileName==0 || elf==0)
+        return mips_ErrorInvalidArgument;
+    *elf=0;
+
+    mips_elf_impl *res=new mips_elf_impl;
+    res->data=0;
+    res->length=0;
+    res->entry=0;
+
+#ifdef MIPS_ELF_MMAP
+    res->mapped=0;
+    res->mappedLength=0;
+
+    int fd=open(fileName, O_RDONLY);
+    if(fd<0){
+        delete res;
+        return mips_ErrorFileReadError;
+    }
+    struct stat st;
+    bool ok = 0==fstat(fd, &st) && st.st_size>0;
+    if(ok){
+        res->mappedLength=(size_t)st.st_size;
+        res->mapped=mmap(0, res->mappedLength, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = res->mapped!=MAP_FAILED;
+        if(!ok){
+            res->mapped=0;
+        }
+    }
+    close(fd);  // The mapping stays valid after closing
+    if(ok){
+        res->data=(const uint8_t*)res->mapped;
+        res->length=res->mappedLength;
+    }
+#else
+    FILE *src=fopen(fileName, "rb");
+    if(!src){
+        delete res;
+        return mips_ErrorFileReadError;
+    }
+    uint8_t tmp[4096];
+    size_t got;
+    while((got=fread(tmp, 1, sizeof(tmp), src))>0){
+        res->buffer.insert(res->buffer.end(), tmp, tmp+got);
+    }
+    bool ok = !ferror(src) && res->buffer.size()>0;
+    fclose(src);
+    if(ok){
+        res->data=&res->buffer[0];
+        res->length=res->buffer.size();
+    }
+#endif
+
+    if(!ok || !parse(res)){
+        mips_elf_free(res);
+        return mips_ErrorFileReadError;
+    }
+
+    *elf=res;
+    return mips_Success;
+}
+
+extern "C" void mips_elf_free(mips_elf_h elf)
+{
+    if(elf){
+#ifdef MIPS_ELF_MMAP
+        if(elf->mapped){
+            munmap(elf->mapped, elf->mappedLength);
+        }
+#endif
+        delete elf;
+    }
+}
+
+extern "C" uint32_t mips_elf_get_entry(mips_elf_h elf)
+{
+    return elf->entry;
+}
+
+/* Writes part of a word, using byte enables. */
+static mips_error write_partial(mips_mem_h mem, uint32_t address, const uint8_t *src, uint32_t length)
+{
+    uint8_t word[4]={0, 0, 0, 0};
+    uint32_t first=address&3, mask=0;
+    for(uint32_t i=0; i<length; i++){
+        word[first+i] = src ? src[i] : 0;
+        mask |= 1u<<(first+i);
+    }
+    return mips_mem_write_masked(mem, address-first, 4, word, mask);
+}
+
+/* Copies bytes into memory, or zeros if src is null. The aligned middle
+   goes in one transaction, and only the ends need byte enables. */
+static mips_error write_range(mips_mem_h mem, uint32_t address, const uint8_t *src, uint32_t length)
+{
+    static const uint8_t zeros[65536]={0};
+    mips_error err;
+
+    if(length==0)
+        return mips_Success;
+    if(length-1>0xFFFFFFFFu-address)
+        return mips_ExceptionInvalidAddress;
+
+    if(address&3){
+        uint32_t todo=std::min(4-(address&3), length);
+        if((err=write_partial(mem, address, src, todo)))
+            return err;
+        address+=todo;
+        src = src ? src+todo : 0;
+        length-=todo;
+    }
+
+    uint32_t aligned=length&~3u;
+    if(src){
+        if(aligned>0 && (err=mips_mem_write(mem, address, aligned, src)))
+            return err;
+    }else{
+        for(uint32_t done=0; done<aligned; ){
+            uint32_t todo=std::min(aligned-done, (uint32_t)sizeof(zeros));
+            if((err=mips_mem_write(mem, address+done, todo, zeros)))
+                return err;
+            done+=todo;
+        }
+    }
+    address+=aligned;
+    src = src ? src+aligned : 0;
+    length-=aligned;
+
+    if(length>0)
+        return write_partial(mem, address, src, length);
+    return mips_Success;
+}
+
+extern "C" mips_error mips_elf_load(
+    mips_elf_h elf,
+    mips_mem_h mem,
+    mips_cpu_h cpu
+){
+    if(elf==0 || mem==0)
+        return mips_ErrorInvalidHandle;
+
+    for(unsigned i=0; i<elf->segments.size(); i++){
+        const elf_segment_t &s=elf->segments[i];
+        if((uint64_t)s.address+s.memSize>0x100000000ull)
+            return mips_ExceptionInvalidAddress;
+        mips_error err=write_range(mem, s.address, elf->data+s.offset, s.fileSize);
+        if(!err){
+            err=write_range(mem, s.address+s.fileSize, 0, s.memSize-s.fileSize);
+        }
+        if(err)
+            return err;
+    }
+
+    if(cpu)
+        return mips_cpu_set_pc(cpu, elf->entry);
+    return mips_Success;
+}
+
+extern "C" mips_error mips_elf_get_section(
+    mips_elf_h elf,
+    const char *name,
+    uint32_t *address,
+    uint32_t *size
+){
+    if(elf==0)
+        return mips_ErrorInvalidHandle;
+    if(name==0)
+        return mips_ErrorInvalidArgument;
+
+    for(unsigned i=0; i<elf->sections.size(); i++){
+        const elf_section_t &s=elf->sections[i];
+        if(s.name==name){
+            if(address){
+                *address=s.address;
+            }
+            if(size){
+                *size=s.size;
+            }
+            return mips_Success;
+        }
+    }
+    return mips_ErrorInvalidArgument;
+}
+
+extern "C" unsigned mips_elf_get_symbol_count(mips_elf_h elf)
+{
+    return elf ? elf->symbols.size() : 0;
+}
+
+extern "C" const mips_elf_symbol *mips_elf_get_symbol(mips_elf_h elf, unsigned index)
+{
+    if(elf==0 || index>=elf->symbols.size())
+        return 0;
+    return &elf->symbols[index];
+}
+
+extern "C" const mips_elf_symbol *mips_elf_find_symbol(
+    mips_elf_h elf,
+    uint32_t address,
+    uint32_t *offset
+){
+    if(elf==0 || elf->symbols.size()==0)
+        return 0;
+
+    // First symbol above the address
+    std::vector<mips_elf_symbol>::const_iterator it=std::upper_bound(
+        elf->symbols.begin(), elf->symbols.end(), address,
+        [](uint32_t a, const mips_elf_symbol &s){ return a<s.address; }
+    );
+    if(it==elf->symbols.begin())
+        return 0;
+    --it;
+
+    // Back to the preferred one of any at the same address
+    while(it!=elf->symbols.begin() && (it-1)->address==it->address){
+        --it;
+    }
+
+    uint32_t delta=address-it->address;
+    if(it->size>0 && delta>=it->size)
+        return 0;
+    if(offset){
+        *offset=delta;
+    }
+    return &*it;
+}
+
+extern "C" const mips_elf_symbol *mips_elf_lookup_symbol(
+    mips_elf_h elf,
+    const char *name
+){
+    if(elf==0 || name==0)
+        return 0;
+    for(unsigned i=0; i<elf->symbols.size(); i++){
+        if(!strcmp(elf->symbols[i].name, name))
+            return &elf->symbols[i];
+    }
+    return 0;
+}
@@ -0,0 +1,367 @@
+/* This file is an implementation of the functions
+   defined in mips_farm.h. It reaches into the RAM provider
+   to load images and clear memory without going through
+   transactions.
+*/
+#include "mips.h"
+#include "mips_farm.h"
+#include "mips_mem_ram.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Instructions a job runs for before the thread moves to another one
+static const uint64_t sg_sliceSteps=1<<20;
+
+// Jobs a thread keeps in progress at once
+static const unsigned sg_activePerThread=4;
+
+struct farm_context_t
+{
+    mips_cpu_h cpu;
+    mips_mem_h mem;
+};
+
+struct farm_job_t
+{
+    mips_farm_job job;
+    farm_context_t ctxt;
+    bool done;
+    mips_farm_result result;
+};
+
+struct farm_worker_t
+{
+    std::mutex lock;
+    std::deque<unsigned> queue;     // Jobs not yet started
+    std::thread thread;
+};
+
+struct mips_farm_impl
+{
+    std::vector<std::unique_ptr<farm_worker_t> > workers;
+
+    // Set under the lock, but also polled by workers between slices
+    std::atomic<bool> stopping;
+
+    std::mutex lock;                // Protects everything below
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    std::deque<std::unique_ptr<farm_job_t> > jobs;  // Stable addresses as it grows
+    unsigned submitted;
+    unsigned completed;
+    unsigned nextWorker;
+
+    // Idle CPU and RAM pairs, by memory size
+    std::multimap<uint32_t,farm_context_t> pool;
+};
+
+static uint64_t fnv1a(uint64_t h, const uint8_t *data, size_t length)
+{
+    for(size_t i=0; i<length; i++){
+        h ^= data[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+static const uint64_t sg_fnvBasis=0xCBF29CE484222325ull;
+
+static bool get_context(mips_farm_impl *farm, uint32_t memSize, farm_context_t &ctxt)
+{
+    {
+        std::lock_guard<std::mutex> guard(farm->lock);
+        std::multimap<uint32_t,farm_context_t>::iterator it=farm->pool.find(memSize);
+        if(it!=farm->pool.end()){
+            ctxt=it->second;
+            farm->pool.erase(it);
+            return true;
+        }
+    }
+
+    ctxt.mem=mips_mem_create_ram(memSize, 4);
+    ctxt.cpu=ctxt.mem ? mips_cpu_create(ctxt.mem) : 0;
+    if(ctxt.cpu==0){
+        mips_mem_free(ctxt.mem);
+        return false;
+    }
+    return true;
+}
+
+static void put_context(mips_farm_impl *farm, const farm_context_t &ctxt)
+{
+    std::lock_guard<std::mutex> guard(farm->lock);
+    farm->pool.insert(std::make_pair(ctxt.mem->length, ctxt));
+}
+
+/* Sets up a context for a job, returning an error if it can't start. */
+static mips_error start_job(farm_job_t *j)
+{
+    const mips_farm_job &job=j->job;
+    mips_cpu_h cpu=j->ctxt.cpu;
+    mips_mem_h mem=j->ctxt.mem;
+
+    // Whatever the last job left behind has to go
+    memset(mem->data, 0, mem->length);
+    memcpy(mem->data+job.loadAddress, job.image, job.imageLength);
+
+    mips_error err=mips_cpu_reset(cpu);
+    if(!err) err=mips_cpu_clear_all_breakpoints(cpu);
+    if(!err) err=mips_cpu_set_arch_state(cpu, &job.initial);
+    if(!err) err=mips_cpu_install_spim_hostcalls(cpu, 0, 0, job.loadAddress+job.imageLength, job.memSize);
+    if(!err && job.hasStopPc) err=mips_cpu_set_breakpoint(cpu, job.stopPc);
+    return err;
+}
+
+static void finish_job(mips_farm_impl *farm, farm_job_t *j, mips_error stop)
+{
+    mips_farm_result &r=j->result;
+    memset(&r, 0, sizeof(r));
+    r.stop=stop;
+
+    if(j->ctxt.cpu){
+        mips_cpu_get_instruction_count(j->ctxt.cpu, &r.instructions);
+        if(stop==mips_StopExit)
+            mips_cpu_get_exit_code(j->ctxt.cpu, &r.exitCode);
+        mips_cpu_get_arch_state(j->ctxt.cpu, &r.final);
+        r.regDigest=fnv1a(sg_fnvBasis, (const uint8_t*)&r.final, sizeof(r.final));
+        r.memDigest=fnv1a(sg_fnvBasis, j->ctxt.mem->data, j->ctxt.mem->length);
+        put_context(farm, j->ctxt);
+        j->ctxt.cpu=0;
+        j->ctxt.mem=0;
+    }
+
+    std::lock_guard<std::mutex> guard(farm->lock);
+    j->done=true;
+    farm->completed++;
+    if(farm->completed==farm->submitted)
+        farm->allDone.notify_all();
+}
+
+/* Takes a job from our own queue (newest first), or from the oldest end
+   of someone else's. */
+static bool take_job(mips_farm_impl *farm, unsigned self, unsigned &id)
+{
+    unsigned n=(unsigned)farm->workers.size();
+    for(unsigned k=0; k<n; k++){
+        farm_worker_t *w=farm->workers[(self+k)%n].get();
+        std::lock_guard<std::mutex> guard(w->lock);
+        if(!w->queue.empty()){
+            if(k==0){
+                id=w->queue.back();
+                w->queue.pop_back();
+            }else{
+                id=w->queue.front();
+                w->queue.pop_front();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static farm_job_t *get_job(mips_farm_impl *farm, unsigned id)
+{
+    std::lock_guard<std::mutex> guard(farm->lock);
+    return farm->jobs[id].get();
+}
+
+static void worker_main(mips_farm_impl *farm, unsigned self)
+{
+    std::vector<farm_job_t*> active;
+    size_t next=0;
+
+    while(1){
+        // Top up the active set
+        unsigned id;
+        while(active.size()<sg_activePerThread && take_job(farm, self, id)){
+            farm_job_t *j=get_job(farm, id);
+            if(!get_context(farm, j->job.memSize, j->ctxt)){
+                j->ctxt.cpu=0;
+                finish_job(farm, j, mips_ErrorInvalidArgument);
+                continue;
+            }
+            mips_error err=start_job(j);
+            if(err){
+                finish_job(farm, j, err);
+                continue;
+            }
+            active.push_back(j);
+        }
+
+        if(active.empty()){
+            std::unique_lock<std::mutex> guard(farm->lock);
+            if(farm->stopping)
+                return;
+            // Queues are checked again under the farm lock, which submit
+            // holds while notifying, so a wakeup can't be missed
+            bool any=false;
+            for(unsigned k=0; k<farm->workers.size() && !any; k++){
+                std::lock_guard<std::mutex> wg(farm->workers[k]->lock);
+                any=!farm->workers[k]->queue.empty();
+            }
+            if(!any)
+                farm->workAvailable.wait(guard);
+            continue;
+        }
+
+        // Run one slice of the next active job
+        if(next>=active.size())
+            next=0;
+        farm_job_t *j=active[next];
+        uint64_t done;
+        mips_cpu_get_instruction_count(j->ctxt.cpu, &done);
+        uint64_t left=j->job.maxSteps-done;
+        mips_error err=mips_cpu_run(j->ctxt.cpu, left<sg_sliceSteps ? left : sg_sliceSteps, 0);
+        mips_cpu_get_instruction_count(j->ctxt.cpu, &done);
+
+        if(err || done>=j->job.maxSteps){
+            finish_job(farm, j, err);
+            active.erase(active.begin()+next);
+        }else{
+            next++;
+        }
+
+        if(farm->stopping)
+            break;
+    }
+}
+
+extern "C" void mips_farm_job_init(mips_farm_job *job, const uint8_t *image, uint32_t imageLength)
+{
+    memset(job, 0, sizeof(*job));
+    job->image=image;
+    job->imageLength=imageLength;
+    job->loadAddress=0;
+    job->memSize=1<<20;
+    job->initial.pc=0;
+    job->initial.pcN=4;
+    job->initial.regs[29]=job->memSize;
+    job->maxSteps=1<<20;
+}
+
+extern "C" mips_farm_h mips_farm_create(unsigned threads)
+{
+    if(threads==0){
+        threads=std::thread::hardware_concurrency();
+        if(threads==0)
+            threads=1;
+    }
+
+    mips_farm_impl *farm=new mips_farm_impl;
+    farm->submitted=0;
+    farm->completed=0;
+    farm->nextWorker=0;
+    farm->stopping=false;
+
+    for(unsigned i=0; i<threads; i++){
+        farm->workers.push_back(std::unique_ptr<farm_worker_t>(new farm_worker_t));
+    }
+    try{
+        for(unsigned i=0; i<threads; i++){
+            farm->workers[i]->thread=std::thread(worker_main, farm, i);
+        }
+    }catch(const std::system_error &){
+        mips_farm_free(farm);
+        return 0;
+    }
+    return farm;
+}
+
+extern "C" mips_error mips_farm_submit(mips_farm_h farm, const mips_farm_job *job, unsigned *jobId)
+{
+    if(farm==0)
+        return mips_ErrorInvalidHandle;
+    if(job==0 || jobId==0 || job->memSize==0 || (job->memSize%4)!=0)
+        return mips_ErrorInvalidArgument;
+    if(job->imageLength>0 && job->image==0)
+        return mips_ErrorInvalidArgument;
+    if(job->loadAddress>job->memSize || job->imageLength>job->memSize-job->loadAddress)
+        return mips_ErrorInvalidArgument;
+
+    std::unique_ptr<farm_job_t> j(new farm_job_t);
+    j->job=*job;
+    j->ctxt.cpu=0;
+    j->ctxt.mem=0;
+    j->done=false;
+
+    std::lock_guard<std::mutex> guard(farm->lock);
+    unsigned id=(unsigned)farm->jobs.size();
+    farm->jobs.push_back(std::move(j));
+    farm->submitted++;
+
+    farm_worker_t *w=farm->workers[farm->nextWorker].get();
+    farm->nextWorker=(farm->nextWorker+1)%farm->workers.size();
+    {
+        std::lock_guard<std::mutex> wg(w->lock);
+        w->queue.push_back(id);
+    }
+    farm->workAvailable.notify_all();
+
+    *jobId=id;
+    return mips_Success;
+}
+
+extern "C" mips_error mips_farm_wait(mips_farm_h farm)
+{
+    if(farm==0)
+        return mips_ErrorInvalidHandle;
+
+    std::unique_lock<std::mutex> guard(farm->lock);
+    while(farm->completed!=farm->submitted){
+        farm->allDone.wait(guard);
+    }
+    return mips_Success;
+}
+
+extern "C" mips_error mips_farm_get_result(mips_farm_h farm, unsigned jobId, mips_farm_result *result)
+{
+    if(farm==0)
+        return mips_ErrorInvalidHandle;
+    if(result==0)
+        return mips_ErrorInvalidArgument;
+
+    std::lock_guard<std::mutex> guard(farm->lock);
+    if(jobId>=farm->jobs.size() || !farm->jobs[jobId]->done)
+        return mips_ErrorInvalidArgument;
+    *result=farm->jobs[jobId]->result;
+    return mips_Success;
+}
+
+extern "C" void mips_farm_free(mips_farm_h farm)
+{
+    if(farm==0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(farm->lock);
+        farm->stopping=true;
+        farm->workAvailable.notify_all();
+    }
+    for(unsigned i=0; i<farm->workers.size(); i++){
+        if(farm->workers[i]->thread.joinable())
+            farm->workers[i]->thread.join();
+    }
+
+    // Abandoned jobs may still hold a context
+    for(unsigned i=0; i<farm->jobs.size(); i++){
+        farm_job_t *j=farm->jobs[i].get();
+        if(j->ctxt.cpu){
+            mips_cpu_free(j->ctxt.cpu);
+            mips_mem_free(j->ctxt.mem);
+        }
+    }
+    for(std::multimap<uint32_t,farm_context_t>::iterator it=farm->pool.begin(); it!=farm->pool.end(); ++it){
+        mips_cpu_free(it->second.cpu);
+        mips_mem_free(it->second.mem);
+    }
+    delete farm;
+}
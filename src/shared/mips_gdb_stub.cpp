@@ -0,0 +1,801 @@
+/* This file is an implementation of the functions
+   defined in mips_gdb.h. It only uses the public CPU
+   and memory APIs, so should work with any CPU which
+   implements mips_cpu_run.h and mips_breakpoint.h.
+*/
+#include "mips.h"
+#include "mips_gdb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MIPS_GDB_SOCKETS 1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+// Register numbers used by gdb for MIPS
+enum{
+    gdb_reg_status=32,
+    gdb_reg_lo=33,
+    gdb_reg_hi=34,
+    gdb_reg_badvaddr=35,
+    gdb_reg_cause=36,
+    gdb_reg_pc=37,
+    gdb_reg_f0=38,
+    gdb_reg_fcsr=70,
+    gdb_reg_fir=71,
+    gdb_reg_count=72
+};
+
+struct mips_gdb_stub
+{
+    mips_cpu_h cpu;
+    mips_mem_h mem;
+
+    int listenFd;
+    int clientFd;
+    std::string unixPath;   // Removed when the stub is freed
+
+    bool noAck;
+    std::string input;      // Bytes received but not yet processed
+
+    mips_error lastStop;
+    // Breakpoints and watchpoints inserted by the debugger
+    std::set<uint32_t> breakpoints;
+    std::set<std::pair<uint32_t,uint32_t> > watchpoints;
+};
+
+#ifdef MIPS_GDB_SOCKETS
+
+// Instructions to execute between checks for Ctrl-C or a new connection
+static const uint64_t sg_attachedChunk=1<<16;
+static const uint64_t sg_detachedChunk=1<<24;
+
+static const char sg_hex[]="0123456789abcdef";
+
+static int from_hex(char c)
+{
+    if(c>='0' && c<='9') return c-'0';
+    if(c>='a' && c<='f') return c-'a'+10;
+    if(c>='A' && c<='F') return c-'A'+10;
+    return -1;
+}
+
+static void append_hex32(std::string &s, uint32_t v)
+{
+    // Registers are sent in target (big-endian) byte order
+    for(int i=28; i>=0; i-=4){
+        s+=sg_hex[(v>>i)&0xF];
+    }
+}
+
+static bool parse_hex(const char *&p, uint32_t &v)
+{
+    v=0;
+    const char *start=p;
+    while(from_hex(*p)>=0){
+        v=(v<<4)|from_hex(*p);
+        p++;
+    }
+    return p!=start;
+}
+
+static std::string target_xml()
+{
+    char tmp[128];
+    std::string x=
+        "<?xml version=\"1.0\"?>"
+        "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        "<target version=\"1.0\"><architecture>mips</architecture>"
+        "<feature name=\"org.gnu.gdb.mips.cpu\">";
+    for(int i=0; i<32; i++){
+        sprintf(tmp, "<reg name=\"r%d\" bitsize=\"32\" regnum=\"%d\"/>", i, i);
+        x+=tmp;
+    }
+    x+=
+        "<reg name=\"lo\" bitsize=\"32\" regnum=\"33\"/>"
+        "<reg name=\"hi\" bitsize=\"32\" regnum=\"34\"/>"
+        "<reg name=\"pc\" bitsize=\"32\" regnum=\"37\"/>"
+        "</feature>"
+        "<feature name=\"org.gnu.gdb.mips.cp0\">"
+        "<reg name=\"status\" bitsize=\"32\" regnum=\"32\"/>"
+        "<reg name=\"badvaddr\" bitsize=\"32\" regnum=\"35\"/>"
+        "<reg name=\"cause\" bitsize=\"32\" regnum=\"36\"/>"
+        "</feature>"
+        "<feature name=\"org.gnu.gdb.mips.fpu\">";
+    for(int i=0; i<32; i++){
+        sprintf(tmp, "<reg name=\"f%d\" bitsize=\"32\" type=\"ieee_single\" regnum=\"%d\"/>", i, 38+i);
+        x+=tmp;
+    }
+    x+=
+        "<reg name=\"fcsr\" bitsize=\"32\" group=\"float\" regnum=\"70\"/>"
+        "<reg name=\"fir\" bitsize=\"32\" group=\"float\" regnum=\"71\"/>"
+        "</feature></target>";
+    return x;
+}
+
+static uint32_t get_reg(const mips_cpu_arch_state &arch, unsigned index)
+{
+    if(index<32) return arch.regs[index];
+    if(index>=gdb_reg_f0 && index<gdb_reg_f0+32) return arch.fpr[index-gdb_reg_f0];
+    switch(index){
+    case gdb_reg_lo: return arch.lo;
+    case gdb_reg_hi: return arch.hi;
+    case gdb_reg_pc: return arch.pc;
+    case gdb_reg_fcsr: return arch.fcsr;
+    case gdb_reg_fir: return 0x00130000;   // Same as CFC1 $0
+    default: return 0;
+    }
+}
+
+/* Returns false if the register is not writable */
+static bool set_reg(mips_cpu_arch_state &arch, unsigned index, uint32_t value)
+{
+    if(index<32){
+        if(index>0)
+            arch.regs[index]=value;
+        return true;
+    }
+    if(index>=gdb_reg_f0 && index<gdb_reg_f0+32){
+        arch.fpr[index-gdb_reg_f0]=value;
+        return true;
+    }
+    switch(index){
+    case gdb_reg_lo: arch.lo=value; return true;
+    case gdb_reg_fcsr: arch.fcsr=value&0xFE83FFFF; return true;
+    case gdb_reg_hi: arch.hi=value; return true;
+    case gdb_reg_pc:
+        // Same as mips_cpu_set_pc, we cannot be in a delay slot
+        if(value!=arch.pc){
+            arch.pc=value;
+            arch.pcN=value+4;
+        }
+        return true;
+    default: return false;
+    }
+}
+
+/* Only a change of pc needs mips_cpu_set_arch_state, which throws
+   away the history and forgets that the CPU stopped at a breakpoint. */
+static void write_regs(mips_gdb_stub *stub, const mips_cpu_arch_state &arch)
+{
+    uint32_t pc;
+    mips_cpu_get_pc(stub->cpu, &pc);
+    if(arch.pc==pc){
+        mips_cpu_set_registers(stub->cpu, &arch);
+    }else{
+        mips_cpu_set_arch_state(stub->cpu, &arch);
+    }
+}
+
+/* Memory transactions have to cover whole blocks, so work out the
+   aligned range containing [address,address+length). */
+static void aligned_range(uint32_t address, uint32_t length, uint32_t &base, uint32_t &cb)
+{
+    base=address&~3u;
+    cb=((address+length+3)&~3u)-base;
+}
+
+static std::string read_memory(mips_gdb_stub *stub, uint32_t address, uint32_t length)
+{
+    uint32_t base, cb;
+    aligned_range(address, length, base, cb);
+
+    std::vector<uint8_t> buffer(cb ? cb : 4);
+    if(cb>0 && mips_mem_read(stub->mem, base, cb, &buffer[0]))
+        return "E0e";   // EFAULT
+
+    std::string res;
+    for(uint32_t i=0; i<length; i++){
+        uint8_t b=buffer[address-base+i];
+        res+=sg_hex[b>>4];
+        res+=sg_hex[b&0xF];
+    }
+    return res;
+}
+
+static std::string write_memory(mips_gdb_stub *stub, uint32_t address, uint32_t length, const char *hex)
+{
+    uint32_t base, cb;
+    aligned_range(address, length, base, cb);
+    if(length==0)
+        return "OK";
+
+    std::vector<uint8_t> buffer(cb);
+    // Only need the old contents if the ends are not aligned
+    if((address!=base || length!=cb) && mips_mem_read(stub->mem, base, cb, &buffer[0]))
+        return "E0e";
+
+    for(uint32_t i=0; i<length; i++){
+        int hi=from_hex(hex[2*i]), lo= hi<0 ? -1 : from_hex(hex[2*i+1]);
+        if(hi<0 || lo<0)
+            return "E16";   // EINVAL
+        buffer[address-base+i]=(uint8_t)((hi<<4)|lo);
+    }
+    if(mips_mem_write(stub->mem, base, cb, &buffer[0]))
+        return "E0e";
+    return "OK";
+}
+
+/* Builds the stop reply for the reason execution stopped */
+static std::string stop_reply(mips_gdb_stub *stub, mips_error err)
+{
+    char tmp[64];
+    uint32_t code;
+
+    switch(err){
+    case mips_StopExit:
+        if(mips_cpu_get_exit_code(stub->cpu, &code))
+            code=0;
+        sprintf(tmp, "W%02x", code&0xFF);
+        return tmp;
+    case mips_StopWatchpoint:
+    {
+        uint32_t address;
+        unsigned flags;
+        if(!mips_cpu_get_watch_hit(stub->cpu, &address, &flags)){
+            sprintf(tmp, "T05%swatch:%x;", flags==mips_watch_Read ? "r" : "", address);
+            return tmp;
+        }
+        return "S05";
+    }
+    case mips_StopHistoryStart:
+        return "T05replaylog:begin;";
+    case mips_Success:
+    case mips_StopBreakpoint:
+    case mips_ExceptionBreak:
+        return "S05";   // SIGTRAP
+    case mips_ExceptionInvalidInstruction:
+        return "S04";   // SIGILL
+    case mips_ExceptionArithmeticOverflow:
+    case mips_ExceptionFloatingPoint:
+        return "S08";   // SIGFPE
+    case mips_ExceptionInvalidAlignment:
+        return "S0a";   // SIGBUS
+    case mips_ExceptionInvalidAddress:
+    case mips_ExceptionAccessViolation:
+    case mips_ExceptionUninitialisedRead:
+        return "S0b";   // SIGSEGV
+    default:
+        return "S06";   // SIGABRT
+    }
+}
+
+static void close_client(mips_gdb_stub *stub)
+{
+    if(stub->clientFd>=0){
+        close(stub->clientFd);
+        stub->clientFd=-1;
+    }
+    stub->input.clear();
+    stub->noAck=false;
+
+    // Don't leave the debugger's breakpoints behind
+    std::set<uint32_t>::const_iterator bit=stub->breakpoints.begin();
+    while(bit!=stub->breakpoints.end()){
+        mips_cpu_clear_breakpoint(stub->cpu, *bit);
+        ++bit;
+    }
+    stub->breakpoints.clear();
+
+    std::set<std::pair<uint32_t,uint32_t> >::const_iterator wit=stub->watchpoints.begin();
+    while(wit!=stub->watchpoints.end()){
+        mips_cpu_remove_watchpoint(stub->cpu, wit->first, wit->second);
+        ++wit;
+    }
+    stub->watchpoints.clear();
+}
+
+static bool accept_client(mips_gdb_stub *stub, bool wait)
+{
+    if(!wait){
+        struct pollfd p;
+        p.fd=stub->listenFd;
+        p.events=POLLIN;
+        if(poll(&p, 1, 0)<=0)
+            return false;
+    }
+    int fd=accept(stub->listenFd, 0, 0);
+    if(fd<0)
+        return false;
+
+    int one=1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));    // Fails harmlessly for unix sockets
+
+    stub->clientFd=fd;
+    stub->input.clear();
+    stub->noAck=false;
+    stub->lastStop=mips_Success;
+    return true;
+}
+
+/* Reads whatever is available, blocking if wait is true. Returns
+   false if the client went away. */
+static bool receive(mips_gdb_stub *stub, bool wait)
+{
+    if(!wait){
+        struct pollfd p;
+        p.fd=stub->clientFd;
+        p.events=POLLIN;
+        if(poll(&p, 1, 0)<=0)
+            return true;
+    }
+    char buffer[4096];
+    ssize_t got;
+    do{
+        got=recv(stub->clientFd, buffer, sizeof(buffer), 0);
+    }while(got<0 && errno==EINTR);
+    if(got<=0)
+        return false;
+    stub->input.append(buffer, got);
+    return true;
+}
+
+static bool send_all(mips_gdb_stub *stub, const std::string &data)
+{
+    size_t done=0;
+    while(done<data.size()){
+        ssize_t got=send(stub->clientFd, data.data()+done, data.size()-done, 0);
+        if(got<0 && errno==EINTR)
+            continue;
+        if(got<=0)
+            return false;
+        done+=got;
+    }
+    return true;
+}
+
+static bool send_packet(mips_gdb_stub *stub, const std::string &payload)
+{
+    unsigned sum=0;
+    for(size_t i=0; i<payload.size(); i++){
+        sum+=(uint8_t)payload[i];
+    }
+    std::string packet="$"+payload+"#";
+    packet+=sg_hex[(sum>>4)&0xF];
+    packet+=sg_hex[sum&0xF];
+    return send_all(stub, packet);
+}
+
+enum packet_status_t
+{
+    packet_none,        // Need more input
+    packet_ready,       // A complete packet was extracted
+    packet_interrupt    // Ctrl-C outside of a packet
+};
+
+/* Pulls the next packet or interrupt out of the input buffer. Acks
+   ('+' and '-') are discarded, as the transport is reliable. */
+static packet_status_t next_packet(mips_gdb_stub *stub, std::string &payload)
+{
+    std::string &in=stub->input;
+    size_t i=0;
+    while(i<in.size() && in[i]!='$'){
+        if(in[i]==0x03){
+            in.erase(0, i+1);
+            return packet_interrupt;
+        }
+        i++;
+    }
+    in.erase(0, i);
+    if(in.empty())
+        return packet_none;
+
+    size_t hash=in.find('#');
+    if(hash==std::string::npos || hash+2>=in.size())
+        return packet_none;
+
+    payload=in.substr(1, hash-1);
+    in.erase(0, hash+3);
+    if(!stub->noAck)
+        send_all(stub, "+");
+    return packet_ready;
+}
+
+/* Runs until something stops the program, or the debugger interrupts.
+   Returns false if the client went away. */
+static bool resume(mips_gdb_stub *stub, bool step, mips_error &err)
+{
+    if(step){
+        err=mips_cpu_step(stub->cpu);
+        return true;
+    }
+    while(1){
+        err=mips_cpu_run(stub->cpu, sg_attachedChunk, 0);
+        if(err)
+            return true;
+        if(!receive(stub, false))
+            return false;
+        if(stub->input.find((char)0x03)!=std::string::npos){
+            stub->input.erase(stub->input.find((char)0x03), 1);
+            err=mips_Success;   // Reported as SIGINT below
+            return true;
+        }
+    }
+}
+
+static std::string handle_breakpoint(mips_gdb_stub *stub, bool insert, const char *args)
+{
+    uint32_t type, address, kind;
+    const char *p=args;
+    if(!parse_hex(p, type) || *p++!=',' || !parse_hex(p, address) || *p++!=',' || !parse_hex(p, kind))
+        return "E16";
+
+    mips_error err;
+    if(type==0 || type==1){
+        // Software and hardware breakpoints are the same thing here
+        if(insert){
+            err=mips_cpu_set_breakpoint(stub->cpu, address);
+            if(!err)
+                stub->breakpoints.insert(address);
+        }else{
+            err=mips_cpu_clear_breakpoint(stub->cpu, address);
+            stub->breakpoints.erase(address);
+        }
+    }else if(type>=2 && type<=4){
+        unsigned flags = type==2 ? mips_watch_Write : type==3 ? mips_watch_Read : mips_watch_Read|mips_watch_Write;
+        std::pair<uint32_t,uint32_t> key(address, kind);
+        if(insert){
+            err=mips_cpu_add_watchpoint(stub->cpu, address, kind, flags);
+            if(!err)
+                stub->watchpoints.insert(key);
+        }else{
+            err=mips_cpu_remove_watchpoint(stub->cpu, address, kind);
+            stub->watchpoints.erase(key);
+        }
+    }else{
+        return "";
+    }
+    return err ? "E16" : "OK";
+}
+
+static std::string handle_query(mips_gdb_stub *stub, const std::string &pkt)
+{
+    (void)stub;
+    if(pkt.compare(0, 10, "qSupported")==0){
+        return "PacketSize=4000;qXfer:features:read+;QStartNoAckMode+;swbreak-;hwbreak-;ReverseStep+;ReverseContinue+";
+    }
+    if(pkt=="qAttached"){
+        return "1";
+    }
+    if(pkt=="qC"){
+        return "QC1";
+    }
+    if(pkt=="qfThreadInfo"){
+        return "m1";
+    }
+    if(pkt=="qsThreadInfo"){
+        return "l";
+    }
+    if(pkt.compare(0, 31, "qXfer:features:read:target.xml:")==0){
+        const char *p=pkt.c_str()+31;
+        uint32_t offset, length;
+        if(!parse_hex(p, offset) || *p++!=',' || !parse_hex(p, length))
+            return "E16";
+        std::string xml=target_xml();
+        if(offset>=xml.size())
+            return "l";
+        std::string part=xml.substr(offset, length);
+        return (offset+part.size()>=xml.size() ? "l" : "m")+part;
+    }
+    return "";
+}
+
+/* Services packets from an attached debugger. Returns true
+   if the debugger killed the program. */
+static bool serve_client(mips_gdb_stub *stub)
+{
+    std::string pkt;
+    while(1){
+        packet_status_t status=next_packet(stub, pkt);
+        if(status==packet_none){
+            if(!receive(stub, true)){
+                close_client(stub);
+                return false;
+            }
+            continue;
+        }
+        if(status==packet_interrupt){
+            // Already stopped, so just report where we are
+            send_packet(stub, "S02");
+            continue;
+        }
+
+        std::string reply;
+        const char *args=pkt.c_str()+1;
+        mips_cpu_arch_state arch;
+
+        switch(pkt.empty() ? 0 : pkt[0]){
+        case '?':
+            reply=stop_reply(stub, stub->lastStop);
+            break;
+        case 'g':
+            mips_cpu_get_arch_state(stub->cpu, &arch);
+            for(unsigned i=0; i<gdb_reg_count; i++){
+                append_hex32(reply, get_reg(arch, i));
+            }
+            break;
+        case 'G':
+            mips_cpu_get_arch_state(stub->cpu, &arch);
+            for(unsigned i=0; i<gdb_reg_count && 8*(i+1)<=pkt.size()-1; i++){
+                const char *p=args+8*i;
+                uint32_t v=0;
+                for(int j=0; j<8; j++){
+                    v=(v<<4)|(from_hex(p[j])&0xF);
+                }
+                set_reg(arch, i, v);
+            }
+            write_regs(stub, arch);
+            reply="OK";
+            break;
+        case 'p':
+        {
+            uint32_t index;
+            const char *p=args;
+            if(!parse_hex(p, index) || index>=gdb_reg_count){
+                reply="E16";
+            }else{
+                mips_cpu_get_arch_state(stub->cpu, &arch);
+                append_hex32(reply, get_reg(arch, index));
+            }
+            break;
+        }
+        case 'P':
+        {
+            uint32_t index, v;
+            const char *p=args;
+            if(!parse_hex(p, index) || *p++!='=' || !parse_hex(p, v)){
+                reply="E16";
+            }else{
+                mips_cpu_get_arch_state(stub->cpu, &arch);
+                if(set_reg(arch, index, v)){
+                    write_regs(stub, arch);
+                }
+                reply="OK";
+            }
+            break;
+        }
+        case 'm':
+        {
+            uint32_t address, length;
+            const char *p=args;
+            if(!parse_hex(p, address) || *p++!=',' || !parse_hex(p, length) || length>0x800){
+                reply="E16";
+            }else{
+                reply=read_memory(stub, address, length);
+            }
+            break;
+        }
+        case 'M':
+        {
+            uint32_t address, length;
+            const char *p=args;
+            if(!parse_hex(p, address) || *p++!=',' || !parse_hex(p, length) || *p++!=':' || strlen(p)!=2*length){
+                reply="E16";
+            }else{
+                reply=write_memory(stub, address, length, p);
+            }
+            break;
+        }
+        case 'c':
+        case 's':
+        {
+            uint32_t address;
+            const char *p=args;
+            if(parse_hex(p, address)){
+                mips_cpu_set_pc(stub->cpu, address);
+            }
+            mips_error err;
+            if(!resume(stub, pkt[0]=='s', err)){
+                close_client(stub);
+                stub->lastStop=err;
+                return false;
+            }
+            stub->lastStop=err;
+            if(err==mips_Success && pkt[0]=='c'){
+                reply="S02";    // Interrupted
+            }else{
+                reply=stop_reply(stub, err);
+            }
+            break;
+        }
+        case 'b':
+        {
+            // Reverse execution, only available if the history is turned on
+            mips_error err;
+            if(pkt=="bs"){
+                err=mips_cpu_reverse_step(stub->cpu, 1);
+            }else if(pkt=="bc"){
+                err=mips_cpu_reverse_continue(stub->cpu);
+            }else{
+                break;
+            }
+            if(err==mips_ErrorInvalidArgument){
+                reply="E01";
+            }else{
+                stub->lastStop=err;
+                reply=stop_reply(stub, err);
+            }
+            break;
+        }
+        case 'Z':
+        case 'z':
+            reply=handle_breakpoint(stub, pkt[0]=='Z', args);
+            break;
+        case 'H':
+        case 'T':
+            reply="OK";     // Only one thread
+            break;
+        case 'D':
+            send_packet(stub, "OK");
+            close_client(stub);
+            return false;
+        case 'k':
+            close_client(stub);
+            return true;
+        case 'q':
+            reply=handle_query(stub, pkt);
+            break;
+        case 'Q':
+            if(pkt=="QStartNoAckMode"){
+                send_packet(stub, "OK");
+                stub->noAck=true;
+                continue;
+            }
+            break;
+        default:
+            break;  // Empty reply means unsupported (e.g. vCont, X)
+        }
+
+        if(!send_packet(stub, reply)){
+            close_client(stub);
+            return false;
+        }
+    }
+}
+
+static int open_listener(const char *address, std::string &unixPath)
+{
+    int fd;
+    if(strncmp(address, "unix:", 5)==0){
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family=AF_UNIX;
+        if(strlen(address+5)>=sizeof(sa.sun_path))
+            return -1;
+        strcpy(sa.sun_path, address+5);
+
+        fd=socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd<0)
+            return -1;
+        unlink(sa.sun_path);
+        if(bind(fd, (struct sockaddr*)&sa, sizeof(sa))){
+            close(fd);
+            return -1;
+        }
+        unixPath=sa.sun_path;
+    }else{
+        std::string host="127.0.0.1";
+        const char *port=strrchr(address, ':');
+        if(port){
+            host=std::string(address, port-address);
+            port++;
+        }else{
+            port=address;
+        }
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family=AF_INET;
+        sa.sin_port=htons((uint16_t)atoi(port));
+        if(host=="localhost")
+            host="127.0.0.1";
+        if(inet_pton(AF_INET, host.c_str(), &sa.sin_addr)!=1)
+            return -1;
+
+        fd=socket(AF_INET, SOCK_STREAM, 0);
+        if(fd<0)
+            return -1;
+        int one=1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr*)&sa, sizeof(sa))){
+            close(fd);
+            return -1;
+        }
+    }
+    if(listen(fd, 1)){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+extern "C" mips_gdb_h mips_gdb_create(mips_cpu_h cpu, mips_mem_h mem, const char *address)
+{
+    if(cpu==0 || mem==0 || address==0)
+        return 0;
+
+    std::string unixPath;
+    int fd=open_listener(address, unixPath);
+    if(fd<0)
+        return 0;
+
+    mips_gdb_stub *stub=new mips_gdb_stub;
+    stub->cpu=cpu;
+    stub->mem=mem;
+    stub->listenFd=fd;
+    stub->clientFd=-1;
+    stub->unixPath=unixPath;
+    stub->noAck=false;
+    stub->lastStop=mips_Success;
+    return stub;
+}
+
+extern "C" mips_error mips_gdb_run(mips_gdb_h stub, int waitForClient)
+{
+    if(stub==0)
+        return mips_ErrorInvalidHandle;
+
+    if(waitForClient && stub->clientFd<0){
+        accept_client(stub, true);
+    }
+
+    while(1){
+        if(stub->clientFd>=0){
+            // Attached: the debugger starts stopped, and decides what to do
+            if(serve_client(stub))
+                return mips_Success;
+            // Detached, so carry on as normal
+        }
+
+        mips_error err=mips_cpu_run(stub->cpu, sg_detachedChunk, 0);
+        if(err){
+            stub->lastStop=err;
+            return err;
+        }
+        accept_client(stub, false);
+    }
+}
+
+extern "C" void mips_gdb_free(mips_gdb_h stub)
+{
+    if(stub){
+        close_client(stub);
+        close(stub->listenFd);
+        if(!stub->unixPath.empty())
+            unlink(stub->unixPath.c_str());
+        delete stub;
+    }
+}
+
+#else
+
+extern "C" mips_gdb_h mips_gdb_create(mips_cpu_h, mips_mem_h, const char *)
+{
+    return 0;
+}
+
+extern "C" mips_error mips_gdb_run(mips_gdb_h, int)
+{
+    return mips_ErrorNotImplemented;
+}
+
+extern "C" void mips_gdb_free(mips_gdb_h)
+{
+}
+
+#endif
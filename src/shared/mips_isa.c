@@ -0,0 +1,120 @@
+/* This file is an implementation of the functions and tables
+   defined in mips_isa.h, all expanded from MIPS_ISA_INSTRUCTIONS.
+   It is C rather than C++ so that the decode table can use
+   designated initialisers, which means two instructions with the
+   same encoding give an "initialized field overwritten" warning.
+*/
+#include "mips_isa.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+/* The decode table holds op values in bytes */
+typedef char mips_isa_ops_fit_in_a_byte[mips_isa_Count<=256 ? 1 : -1];
+
+#define MIPS_ISA_OPCODE_Primary(code) code
+#define MIPS_ISA_OPCODE_Special(code) 0
+#define MIPS_ISA_OPCODE_RegImm(code) 1
+#define MIPS_ISA_OPCODE_Cop1(code) 0x11
+#define MIPS_ISA_OPCODE_Cop1Bc(code) 0x11
+#define MIPS_ISA_OPCODE_Cop1S(code) 0x11
+#define MIPS_ISA_OPCODE_Cop1D(code) 0x11
+#define MIPS_ISA_OPCODE_Cop1W(code) 0x11
+
+#define MIPS_ISA_SUB_Primary(code) -1
+#define MIPS_ISA_SUB_Special(code) code
+#define MIPS_ISA_SUB_RegImm(code) code
+#define MIPS_ISA_SUB_Cop1(code) -1
+#define MIPS_ISA_SUB_Cop1Bc(code) -1
+#define MIPS_ISA_SUB_Cop1S(code) -1
+#define MIPS_ISA_SUB_Cop1D(code) -1
+#define MIPS_ISA_SUB_Cop1W(code) -1
+
+#define MIPS_ISA_INFO(name, format, table, code, kind, operands, description) \
+	{ #name, mips_isa_format_##format, mips_isa_class_##kind, \
+	  MIPS_ISA_OPCODE_##table(code), MIPS_ISA_SUB_##table(code), operands, description },
+
+const mips_isa_info mips_isa_instructions[mips_isa_Count]={
+	{ "<INVALID>", mips_isa_format_R, mips_isa_class_System, -1, -1, "", "Not an instruction" },
+	MIPS_ISA_INSTRUCTIONS(MIPS_ISA_INFO)
+};
+
+#define MIPS_ISA_DISPATCH(name, format, table, code, kind, operands, description) \
+	[MIPS_ISA_DISPATCH_##table+(code)]=mips_isa_##name,
+
+/* Everything not listed is zero, i.e. mips_isa_Invalid */
+const uint8_t mips_isa_dispatch[MIPS_ISA_DISPATCH_SIZE]={
+	MIPS_ISA_INSTRUCTIONS(MIPS_ISA_DISPATCH)
+};
+
+mips_isa_op mips_isa_find(const char *name)
+{
+	unsigned i, j;
+
+	if(name==0)
+		return mips_isa_Invalid;
+
+	for(i=1;i<mips_isa_Count;i++){
+		const char *n=mips_isa_instructions[i].name;
+		for(j=0; n[j] && (toupper((unsigned char)name[j])==n[j] || (name[j]=='.' && n[j]=='_')); j++)
+			;
+		if(n[j]==0 && name[j]==0)
+			return (mips_isa_op)i;
+	}
+	return mips_isa_Invalid;
+}
+
+unsigned mips_isa_disassemble(uint32_t instr, uint32_t pc, char *dst, unsigned size)
+{
+	mips_isa_op op=mips_isa_decode(instr);
+	const mips_isa_info *info=mips_isa_instructions+op;
+	unsigned rs=(instr>>21)&0x1F, rt=(instr>>16)&0x1F, rd=(instr>>11)&0x1F;
+	char buf[64];
+	char *p=buf;
+	const char *t;
+
+	if(op==mips_isa_Invalid){
+		return (unsigned)snprintf(dst, size, ".word 0x%08x", instr);
+	}
+	if(instr==0){
+		return (unsigned)snprintf(dst, size, "nop");
+	}
+
+	for(t=info->name; *t; t++){
+		*p++ = *t=='_' ? '.' : (char)tolower((unsigned char)*t);
+	}
+	if(info->operands[0]){
+		*p++=' ';
+	}
+	for(t=info->operands; *t; t++){
+		switch(*t){
+		case 'd': p+=sprintf(p, "$%u", rd); break;
+		case 's': p+=sprintf(p, "$%u", rs); break;
+		case 't': p+=sprintf(p, "$%u", rt); break;
+		case 'D': p+=sprintf(p, "$f%u", (instr>>6)&0x1F); break;
+		case 'S': p+=sprintf(p, "$f%u", rd); break;
+		case 'T': p+=sprintf(p, "$f%u", rt); break;
+		case 'h': p+=sprintf(p, "%u", (instr>>6)&0x1F); break;
+		case 'i': p+=sprintf(p, "%d", (int)(int16_t)(instr&0xFFFF)); break;
+		case 'u': p+=sprintf(p, "0x%x", instr&0xFFFF); break;
+		case 'c': p+=sprintf(p, "0x%x", (instr>>6)&0xFFFFF); break;
+		case 'b':
+			p+=sprintf(p, "0x%08x", pc+4+((uint32_t)(int32_t)(int16_t)(instr&0xFFFF)<<2));
+			break;
+		case 'j':
+			p+=sprintf(p, "0x%08x", ((pc+4)&0xF0000000) | ((instr&0x03FFFFFF)<<2));
+			break;
+		case ',':
+			*p++=',';
+			*p++=' ';
+			break;
+		default:
+			*p++=*t;
+			break;
+		}
+	}
+	*p=0;
+
+	return (unsigned)snprintf(dst, size, "%s", buf);
+}
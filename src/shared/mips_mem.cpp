@@ -0,0 +1,331 @@
+/* This file is an implementation of the functions
+   defined in mips_mem.h which are common to all kinds
+   of memory. Each transaction is checked here, and then
+   passed on to the provider. Anything a provider doesn't
+   implement itself is built out of plain reads and writes.
+*/
+#include "mips_mem.h"
+#include "mips_mem_provider.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+#include <vector>
+
+/* Providers are small, and are created and freed at a high rate when
+   lots of short simulations are run (e.g. by mips_farm), so released
+   ones are kept for re-use rather than going back to the heap. */
+static const size_t sg_providerPoolMax=64;
+
+static std::mutex sg_providerPoolLock;
+static std::vector<struct mips_mem_provider*> sg_providerPool;
+
+/* One entry per page of the 32-bit address space. This is shared by
+   every memory which has never had its permissions changed, and is
+   never written, so it stays as the OS's zero page rather than taking
+   up a megabyte of real memory. */
+static const unsigned sg_pageShift=12;
+static const size_t sg_pageCount=(size_t)1<<(32-sg_pageShift);
+static uint8_t sg_noneDenied[(size_t)1<<(32-sg_pageShift)];
+
+mips_mem_h mips_mem_create_provider(
+	const struct mips_mem_ops *ops,
+	uint32_t length,
+	uint32_t blockSize,
+	void *context
+){
+	struct mips_mem_provider *mem=0;
+	{
+		std::lock_guard<std::mutex> guard(sg_providerPoolLock);
+		if(!sg_providerPool.empty()){
+			mem=sg_providerPool.back();
+			sg_providerPool.pop_back();
+		}
+	}
+	if(mem){
+		memset(mem, 0, sizeof(struct mips_mem_provider));
+	}else{
+		mem=(struct mips_mem_provider*)calloc(1, sizeof(struct mips_mem_provider));
+		if(mem==0){
+			return 0;
+		}
+	}
+
+	mem->ops=ops;
+	mem->length=length;
+	mem->blockSize=blockSize;
+	mem->context=context;
+	mem->denied=sg_noneDenied;
+
+	return mem;
+}
+
+static mips_error mips_mem_check_transaction(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	unsigned need		// A mips_mem_permission which every page must have
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+
+	if(0 != (address%mem->blockSize) ){
+		return mips_ExceptionInvalidAlignment;
+	}
+	if(0 != ((address+length)%mem->blockSize)){
+		return mips_ExceptionInvalidAlignment;
+	}
+	if((address+length) > mem->length){	// A subtle bug here, maybe?
+		return mips_ExceptionInvalidAddress;
+	}
+	uint64_t end=(uint64_t)address+length;
+	for(uint64_t page=address>>sg_pageShift; (page<<sg_pageShift)<end && page<sg_pageCount; page++){
+		if(mem->denied[page] & need){
+			return mips_ExceptionAccessViolation;
+		}
+	}
+	return mips_Success;
+}
+
+/* Checks a 4-byte transaction at address, with the same rules as
+   any other transaction. The permission table covers every address,
+   so it can be looked at in the same test as the range, and only a
+   failure needs to work out which it was. */
+static inline mips_error mips_mem_check_word(mips_mem_h mem, uint32_t address, unsigned need)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if((address&3) || (address%mem->blockSize) || (4%mem->blockSize)){
+		return mips_ExceptionInvalidAlignment;
+	}
+	bool outside = address > mem->length-4 || mem->length<4;
+	if(outside | ((mem->denied[address>>sg_pageShift] & need)!=0)){
+		return outside ? mips_ExceptionInvalidAddress : mips_ExceptionAccessViolation;
+	}
+	return mips_Success;
+}
+
+mips_error mips_mem_read(
+    mips_mem_h mem,		//!< Handle to target memory
+    uint32_t address,	//!< Byte address to start transaction at
+    uint32_t length,	//!< Number of bytes to transfer
+    uint8_t *dataOut	//!< Receives the target bytes
+)
+{
+	mips_error err=mips_mem_check_transaction(mem, address, length, mips_mem_perm_Read);
+	if(err)
+		return err;
+	return mem->ops->read(mem, address, length, dataOut);
+}
+
+mips_error mips_mem_write(
+	mips_mem_h mem,	//! Handle to target memory
+	uint32_t address,		//! Byte address to start transaction at
+	uint32_t length,			//! Number of bytes to transfer
+	const uint8_t *dataIn	//! Receives the target bytes
+)
+{
+	mips_error err=mips_mem_check_transaction(mem, address, length, mips_mem_perm_Write);
+	if(err)
+		return err;
+	return mem->ops->write(mem, address, length, dataIn);
+}
+
+static inline mips_error mips_mem_load_word(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t *value,
+	unsigned need
+)
+{
+	mips_error err=mips_mem_check_word(mem, address, need);
+	if(err)
+		return err;
+
+	if(mem->ops->read_word)
+		return mem->ops->read_word(mem, address, value);
+
+	uint8_t b[4];
+	err=mem->ops->read(mem, address, 4, b);
+	if(err)
+		return err;
+	*value=((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+	return mips_Success;
+}
+
+mips_error mips_mem_read_word(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t *value
+)
+{
+	return mips_mem_load_word(mem, address, value, mips_mem_perm_Read);
+}
+
+mips_error mips_mem_fetch_word(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t *value
+)
+{
+	return mips_mem_load_word(mem, address, value, mips_mem_perm_Execute);
+}
+
+mips_error mips_mem_write_word(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t value
+)
+{
+	mips_error err=mips_mem_check_word(mem, address, mips_mem_perm_Write);
+	if(err)
+		return err;
+
+	if(mem->ops->write_word)
+		return mem->ops->write_word(mem, address, value);
+
+	uint8_t b[4];
+	b[0]=(uint8_t)(value>>24);
+	b[1]=(uint8_t)(value>>16);
+	b[2]=(uint8_t)(value>>8);
+	b[3]=(uint8_t)value;
+	return mem->ops->write(mem, address, 4, b);
+}
+
+mips_error mips_mem_read_masked(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	uint8_t *dataOut,
+	uint32_t byteMask
+)
+{
+	mips_error err=mips_mem_check_transaction(mem, address, length, mips_mem_perm_Read);
+	if(err)
+		return err;
+	if(length>32 || dataOut==0)
+		return mips_ErrorInvalidArgument;
+
+	if(mem->ops->read_masked)
+		return mem->ops->read_masked(mem, address, length, dataOut, byteMask);
+
+	uint8_t tmp[32];
+	err=mem->ops->read(mem, address, length, tmp);
+	if(err)
+		return err;
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			dataOut[i]=tmp[i];
+		}
+	}
+	return mips_Success;
+}
+
+mips_error mips_mem_write_masked(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	const uint8_t *dataIn,
+	uint32_t byteMask
+)
+{
+	mips_error err=mips_mem_check_transaction(mem, address, length, mips_mem_perm_Write);
+	if(err)
+		return err;
+	if(length>32 || dataIn==0)
+		return mips_ErrorInvalidArgument;
+
+	if(mem->ops->write_masked)
+		return mem->ops->write_masked(mem, address, length, dataIn, byteMask);
+
+	// Without byte-enables, the only option is read-modify-write
+	uint8_t tmp[32];
+	err=mem->ops->read(mem, address, length, tmp);
+	if(err)
+		return err;
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			tmp[i]=dataIn[i];
+		}
+	}
+	return mem->ops->write(mem, address, length, tmp);
+}
+
+mips_error mips_mem_set_permissions(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length,
+	unsigned permissions
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if((address%MIPS_MEM_PAGE_SIZE) || (permissions & ~(unsigned)mips_mem_perm_All))
+		return mips_ErrorInvalidArgument;
+	if(length > mem->length || address > mem->length-length)
+		return mips_ErrorInvalidArgument;
+
+	if(permissions==mips_mem_perm_All && address==0 && length==mem->length){
+		// Everything is allowed again, so go back to the shared table
+		if(mem->denied!=sg_noneDenied){
+			free(mem->denied);
+			mem->denied=sg_noneDenied;
+		}
+		return mips_Success;
+	}
+
+	if(mem->denied==sg_noneDenied){
+		// calloc of this size comes straight from mmap, so only the
+		// parts of the table which are written use real memory
+		mem->denied=(uint8_t*)calloc(sg_pageCount, 1);
+		if(mem->denied==0){
+			mem->denied=sg_noneDenied;
+			return mips_ErrorOutOfMemory;
+		}
+	}
+
+	uint8_t denied=(uint8_t)(mips_mem_perm_All & ~permissions);
+	uint64_t end=(uint64_t)address+length;
+	for(uint64_t page=address>>sg_pageShift; (page<<sg_pageShift)<end; page++){
+		mem->denied[page]=denied;
+	}
+	return mips_Success;
+}
+
+mips_error mips_mem_get_permissions(
+	mips_mem_h mem,
+	uint32_t address,
+	unsigned *permissions
+)
+{
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(permissions==0)
+		return mips_ErrorInvalidArgument;
+	if(address>=mem->length)
+		return mips_ExceptionInvalidAddress;
+
+	*permissions=mips_mem_perm_All & ~(unsigned)mem->denied[address>>sg_pageShift];
+	return mips_Success;
+}
+
+void mips_mem_free(mips_mem_h mem)
+{
+	if(mem){
+		if(mem->ops->release){
+			mem->ops->release(mem);
+		}
+		if(mem->denied!=sg_noneDenied){
+			free(mem->denied);
+		}
+
+		std::lock_guard<std::mutex> guard(sg_providerPoolLock);
+		if(sg_providerPool.size()<sg_providerPoolMax){
+			sg_providerPool.push_back(mem);
+		}else{
+			free(mem);
+		}
+	}
+}
@@ -0,0 +1,391 @@
+/* This file is an implementation of the copy-on-write overlay
+   defined in mips_mem.h. Reads go through to the base memory until
+   a page is first written, at which point the page is copied into
+   storage private to the overlay, and from then on that copy is
+   used for everything. The base is never written.
+
+   Private pages are found through a table with one pointer per
+   4KB page of the base, so a lookup is a shift and a load. The
+   table is calloc-ed, and for large memories that comes straight
+   from mmap, so only the parts of it which are used take up real
+   memory.
+
+   If the base is a RAM with mips_mem_ram_Shadow then the overlay has
+   a shadow of its own, calloc-ed in the same way, which holds the
+   bytes written through the overlay. A byte of a private page is
+   initialised if its own bit is set (the base's bits are copied along
+   with the page), and a byte which still comes from the base is
+   initialised if either bit is set. The base's shadow is only read,
+   and failed reads are recorded in the overlay, so overlays on
+   different threads never touch any state of the base. If the base
+   is itself an overlay, "the base's bit" means whether the byte is
+   initialised in that overlay, which is found in the same way, so a
+   chain of overlays ends at the RAM's shadow.
+*/
+#include "mips_mem.h"
+#include "mips_mem_provider.h"
+#include "mips_mem_ram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned sg_overlayShift=12;
+static const uint32_t sg_overlayPageSize=1u<<12;
+
+struct mips_mem_overlay
+{
+	mips_mem_h base;
+	uint32_t pageCount;
+	uint8_t **pages;	/* Private copy of each page, or NULL to read the base */
+	uint32_t copied;	/* Number of non-NULL entries in pages */
+	uint8_t *shadow;	/* The overlay's own shadow, or NULL if the base has none */
+};
+
+static struct mips_mem_overlay *overlay_of(mips_mem_h mem)
+{
+	return (struct mips_mem_overlay*)mem->context;
+}
+
+static void mips_mem_overlay_release(mips_mem_h mem);
+static mips_error mips_mem_overlay_read_bytes(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+
+static bool mips_mem_is_overlay(mips_mem_h mem)
+{
+	return mem->ops->release==mips_mem_overlay_release;
+}
+
+/* Reads from the base, which has the same length and blockSize, so
+   anything the overlay accepted it will accept too. Permissions are
+   the overlay's own, so the base's are not looked at, and nor is the
+   shadow of a RAM or overlay, which is checked separately by the
+   callers. */
+static mips_error mips_mem_overlay_read_base(mips_mem_h base, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	if(mips_mem_is_ram(base)){
+		mips_mem_ram_read_raw(base, address, length, dataOut);
+		return mips_Success;
+	}
+	if(mips_mem_is_overlay(base)){
+		return mips_mem_overlay_read_bytes(base, address, length, dataOut);
+	}
+	return base->ops->read(base, address, length, dataOut);
+}
+
+static inline bool shadow_bit(const uint8_t *shadow, uint32_t address)
+{
+	return (shadow[address>>3]>>(address&7))&1;
+}
+
+static bool mips_mem_overlay_initialised(mips_mem_h mem, uint32_t address)
+{
+	const struct mips_mem_overlay *o=overlay_of(mem);
+	if(shadow_bit(mem->shadow, address)){
+		return true;
+	}
+	if(o->pages[address>>sg_overlayShift]){
+		return false;
+	}
+	if(mips_mem_is_overlay(o->base)){
+		return mips_mem_overlay_initialised(o->base, address);
+	}
+	return shadow_bit(o->base->shadow, address);
+}
+
+static mips_error mips_mem_overlay_shadow_fault(mips_mem_h mem, uint32_t address)
+{
+	mem->shadowFaulted=1;
+	mem->shadowFault=address;
+	return mips_ExceptionUninitialisedRead;
+}
+
+/* Most bytes are either in a private page, or were initialised in the
+   base, so each page of the read is checked against the one shadow
+   that is most likely to have its bits set, and only if that finds a
+   gap are the bytes from there on looked at individually. */
+static mips_error mips_mem_overlay_check(mips_mem_h mem, uint32_t address, uint32_t length)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	while(length>0){
+		uint32_t todo=sg_overlayPageSize-(address&(sg_overlayPageSize-1));
+		if(todo>length){
+			todo=length;
+		}
+		const uint8_t *shadow=o->pages[address>>sg_overlayShift] ? mem->shadow : o->base->shadow;
+		uint32_t unwritten;
+		if(mips_mem_shadow_find_unwritten(shadow, address, todo, &unwritten)){
+			for(uint32_t a=unwritten; a<address+todo; a++){
+				if(!mips_mem_overlay_initialised(mem, a)){
+					return mips_mem_overlay_shadow_fault(mem, a);
+				}
+			}
+		}
+		address+=todo;
+		length-=todo;
+	}
+	return mips_Success;
+}
+
+/* Finds the private copy of a page, making it if this is the first
+   write to the page. */
+static mips_error mips_mem_overlay_fault(struct mips_mem_overlay *o, uint32_t page, uint8_t **copy)
+{
+	uint8_t *p=o->pages[page];
+	if(p==0){
+		uint32_t address=page<<sg_overlayShift;
+		uint32_t length=o->base->length-address;
+		if(length>sg_overlayPageSize){
+			length=sg_overlayPageSize;
+		}
+		p=(uint8_t*)malloc(sg_overlayPageSize);
+		if(p==0){
+			return mips_ErrorOutOfMemory;
+		}
+		mips_error err=mips_mem_overlay_read_base(o->base, address, length, p);
+		if(err){
+			free(p);
+			return err;
+		}
+		if(o->shadow && mips_mem_is_overlay(o->base)){
+			for(uint32_t a=address; a<address+length; a++){
+				if(mips_mem_overlay_initialised(o->base, a)){
+					o->shadow[a>>3] |= (uint8_t)(1u<<(a&7));
+				}
+			}
+		}else if(o->shadow){
+			// Pages are a whole number of shadow bytes
+			const uint8_t *from=o->base->shadow+(address>>3);
+			uint8_t *to=o->shadow+(address>>3);
+			for(uint32_t i=0; i<(length+7)/8; i++){
+				to[i] |= from[i];
+			}
+		}
+		o->pages[page]=p;
+		o->copied++;
+	}
+	*copy=p;
+	return mips_Success;
+}
+
+/* Transactions can cross pages, so they are split at page boundaries */
+static mips_error mips_mem_overlay_read_bytes(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	while(length>0){
+		uint32_t offset=address&(sg_overlayPageSize-1);
+		uint32_t todo=sg_overlayPageSize-offset;
+		if(todo>length){
+			todo=length;
+		}
+		const uint8_t *p=o->pages[address>>sg_overlayShift];
+		if(p){
+			memcpy(dataOut, p+offset, todo);
+		}else{
+			mips_error err=mips_mem_overlay_read_base(o->base, address, todo, dataOut);
+			if(err){
+				return err;
+			}
+		}
+		address+=todo;
+		dataOut+=todo;
+		length-=todo;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_overlay_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	if(mem->shadow){
+		mips_error err=mips_mem_overlay_check(mem, address, length);
+		if(err){
+			return err;
+		}
+	}
+	return mips_mem_overlay_read_bytes(mem, address, length, dataOut);
+}
+
+static mips_error mips_mem_overlay_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	uint32_t begin=address, total=length;
+	while(length>0){
+		uint32_t offset=address&(sg_overlayPageSize-1);
+		uint32_t todo=sg_overlayPageSize-offset;
+		if(todo>length){
+			todo=length;
+		}
+		uint8_t *p;
+		mips_error err=mips_mem_overlay_fault(o, address>>sg_overlayShift, &p);
+		if(err){
+			return err;
+		}
+		memcpy(p+offset, dataIn, todo);
+		address+=todo;
+		dataIn+=todo;
+		length-=todo;
+	}
+	if(mem->shadow){
+		mips_mem_shadow_mark(mem->shadow, begin, total);
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_overlay_read_word(mips_mem_h mem, uint32_t address, uint32_t *value)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	if(mem->shadow){
+		mips_error err=mips_mem_overlay_check(mem, address, 4);
+		if(err){
+			return err;
+		}
+	}
+	const uint8_t *p=o->pages[address>>sg_overlayShift];
+	if(p==0){
+		mips_mem_h base=o->base;
+		if(base->ops->read_word && !mips_mem_is_ram(base) && !mips_mem_is_overlay(base)){
+			return base->ops->read_word(base, address, value);
+		}
+		uint8_t b[4];
+		mips_error err=mips_mem_overlay_read_base(base, address, 4, b);
+		if(err){
+			return err;
+		}
+		*value=((uint32_t)b[0]<<24) | ((uint32_t)b[1]<<16) | ((uint32_t)b[2]<<8) | b[3];
+		return mips_Success;
+	}
+	p+=address&(sg_overlayPageSize-1);
+	*value=((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+	return mips_Success;
+}
+
+static mips_error mips_mem_overlay_write_word(mips_mem_h mem, uint32_t address, uint32_t value)
+{
+	uint8_t *p;
+	mips_error err=mips_mem_overlay_fault(overlay_of(mem), address>>sg_overlayShift, &p);
+	if(err){
+		return err;
+	}
+	p+=address&(sg_overlayPageSize-1);
+	p[0]=(uint8_t)(value>>24);
+	p[1]=(uint8_t)(value>>16);
+	p[2]=(uint8_t)(value>>8);
+	p[3]=(uint8_t)value;
+	if(mem->shadow){
+		mem->shadow[address>>3] |= (uint8_t)(0xFu<<(address&4));
+	}
+	return mips_Success;
+}
+
+/* Masked transactions are at most 32 bytes and aligned to blockSize,
+   but may still cross a page if blockSize does not divide it */
+static mips_error mips_mem_overlay_read_masked(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut, uint32_t byteMask)
+{
+	if(mem->shadow){
+		for(unsigned i=0; i<length; i++){
+			if(((byteMask>>i)&1) && !mips_mem_overlay_initialised(mem, address+i)){
+				return mips_mem_overlay_shadow_fault(mem, address+i);
+			}
+		}
+	}
+	uint8_t tmp[32];
+	mips_error err=mips_mem_overlay_read_bytes(mem, address, length, tmp);
+	if(err){
+		return err;
+	}
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			dataOut[i]=tmp[i];
+		}
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_overlay_write_masked(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn, uint32_t byteMask)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			uint8_t *p;
+			mips_error err=mips_mem_overlay_fault(o, (address+i)>>sg_overlayShift, &p);
+			if(err){
+				return err;
+			}
+			p[(address+i)&(sg_overlayPageSize-1)]=dataIn[i];
+			if(mem->shadow){
+				mem->shadow[(address+i)>>3] |= (uint8_t)(1u<<((address+i)&7));
+			}
+		}
+	}
+	return mips_Success;
+}
+
+static void mips_mem_overlay_release(mips_mem_h mem)
+{
+	struct mips_mem_overlay *o=overlay_of(mem);
+	for(uint32_t i=0; i<o->pageCount; i++){
+		free(o->pages[i]);
+	}
+	free(o->pages);
+	free(o->shadow);
+	free(o);
+	mem->context=0;
+	mem->shadow=0;
+}
+
+static const struct mips_mem_ops sg_overlayOps={
+	mips_mem_overlay_read,
+	mips_mem_overlay_write,
+	mips_mem_overlay_read_word,
+	mips_mem_overlay_write_word,
+	mips_mem_overlay_read_masked,
+	mips_mem_overlay_write_masked,
+	mips_mem_overlay_release
+};
+
+mips_mem_h mips_mem_create_overlay(mips_mem_h base)
+{
+	if(base==0){
+		return 0;
+	}
+
+	struct mips_mem_overlay *o=(struct mips_mem_overlay*)calloc(1, sizeof(struct mips_mem_overlay));
+	if(o==0){
+		return 0;
+	}
+	o->base=base;
+	o->pageCount=(uint32_t)(((uint64_t)base->length+sg_overlayPageSize-1)>>sg_overlayShift);
+	o->pages=(uint8_t**)calloc(o->pageCount ? o->pageCount : 1, sizeof(uint8_t*));
+	if(o->pages==0){
+		free(o);
+		return 0;
+	}
+
+	if(base->shadow){
+		o->shadow=(uint8_t*)calloc(base->length/8+1, 1);
+		if(o->shadow==0){
+			free(o->pages);
+			free(o);
+			return 0;
+		}
+	}
+
+	mips_mem_h mem=mips_mem_create_provider(&sg_overlayOps, base->length, base->blockSize, o);
+	if(mem==0){
+		free(o->shadow);
+		free(o->pages);
+		free(o);
+		return 0;
+	}
+	mem->shadow=o->shadow;
+	return mem;
+}
+
+mips_error mips_mem_overlay_pages(mips_mem_h mem, uint32_t *count)
+{
+	if(mem==0 || mem->ops!=&sg_overlayOps)
+		return mips_ErrorInvalidHandle;
+	if(count==0)
+		return mips_ErrorInvalidArgument;
+
+	*count=overlay_of(mem)->copied;
+	return mips_Success;
+}
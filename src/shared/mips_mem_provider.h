@@ -0,0 +1,69 @@
+/* Private definition of memory providers. Every mips_mem_h points
+   at one of these, and the functions in mips_mem.cpp check each
+   transaction and then forward it through the ops table, so a
+   provider only has to move the bytes.
+*/
+#ifndef mips_mem_provider_header
+#define mips_mem_provider_header
+
+#include "mips_mem.h"
+
+struct mips_mem_ops
+{
+	/* Transactions have already been checked against length and blockSize */
+	mips_error (*read)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+	mips_error (*write)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn);
+
+	/* These may be NULL, in which case they are built out of read and write */
+	mips_error (*read_word)(mips_mem_h mem, uint32_t address, uint32_t *value);
+	mips_error (*write_word)(mips_mem_h mem, uint32_t address, uint32_t value);
+	mips_error (*read_masked)(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut, uint32_t byteMask);
+	mips_error (*write_masked)(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn, uint32_t byteMask);
+
+	/* Releases anything the provider owns, but not the provider itself */
+	void (*release)(mips_mem_h mem);
+};
+
+struct mips_mem_provider
+{
+	const struct mips_mem_ops *ops;
+	uint32_t length;
+	uint32_t blockSize;
+
+	/* Storage for RAMs (mips_mem_ram.cpp) */
+	uint8_t *data;
+	/* Releases data, or NULL if data came from malloc. */
+	void (*freeData)(uint8_t *data, uint32_t length);
+	/* Values from mips_mem_ram_flags */
+	unsigned flags;
+	/* XOR-ed with byte addresses to find them in data. Non-zero
+	   for mips_mem_ram_HostOrder on little-endian hosts. */
+	uint32_t swizzle;
+	/* One bit per byte, set once the byte has been written, or NULL
+	   without mips_mem_ram_Shadow. shadowFault is the first unwritten
+	   byte of the last read which failed because of it. */
+	uint8_t *shadow;
+	int shadowFaulted;
+	uint32_t shadowFault;
+
+	/* State for other kinds of provider */
+	void *context;
+
+	/* One byte per page (indexed by address>>12) holding the
+	   mips_mem_permission bits which are NOT allowed. Covers the whole
+	   32-bit address space, so it can be read before the address is
+	   known to be in range. Points at a shared all-zero table until
+	   mips_mem_set_permissions is used. */
+	uint8_t *denied;
+};
+
+/* Creates a provider with everything apart from ops, length,
+   blockSize, context and denied zeroed. */
+mips_mem_h mips_mem_create_provider(
+	const struct mips_mem_ops *ops,
+	uint32_t length,
+	uint32_t blockSize,
+	void *context
+);
+
+#endif
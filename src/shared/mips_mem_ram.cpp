@@ -1,112 +1,503 @@
-/* This file is an implementation of the functions
+/* This file is an implementation of the RAM device
    defined in mips_mem.h. It is designed to be
    linked against something which needs an implementation
    of a RAM device following that memory mapping
-   interface.
+   interface. The generic parts of the interface are
+   in mips_mem.cpp.
 */
 #include "mips_mem.h"
+#include "mips_mem_ram.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-struct mips_mem_provider
+#if defined(__SSE2__) || defined(_M_X64)
+#define MIPS_MEM_RAM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__linux__)
+#define MIPS_MEM_RAM_MMAP 1
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static const unsigned sg_placementFlags=
+	mips_mem_ram_HugePages | mips_mem_ram_Prefault | mips_mem_ram_NumaLocal;
+
+/* Flags which need the RAM to start as zero, whatever the placement */
+static const unsigned sg_zeroFlags=
+	mips_mem_ram_Zero | mips_mem_ram_Shadow;
+
+static bool host_is_little_endian()
+{
+	const uint32_t x=1;
+	return *(const uint8_t*)&x==1;
+}
+
+static void mips_mem_release_data(mips_mem_h mem)
+{
+	if(mem->freeData){
+		mem->freeData(mem->data, mem->length);
+	}else{
+		free(mem->data);
+	}
+	mem->data=0;
+	free(mem->shadow);
+	mem->shadow=0;
+}
+
+static mips_error mips_mem_ram_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	uint32_t swizzle=mem->swizzle;
+	for(unsigned i=0; i<length; i++){
+		dataOut[i]=mem->data[(address+i)^swizzle];
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	uint32_t swizzle=mem->swizzle;
+	for(unsigned i=0; i<length; i++){
+		mem->data[(address+i)^swizzle]=dataIn[i];
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_read_word(mips_mem_h mem, uint32_t address, uint32_t *value)
+{
+	const uint8_t *p=mem->data+address;
+	if(mem->flags&mips_mem_ram_HostOrder){
+		memcpy(value, p, 4);	// A single load
+	}else{
+		*value=((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_write_word(mips_mem_h mem, uint32_t address, uint32_t value)
+{
+	uint8_t *p=mem->data+address;
+	if(mem->flags&mips_mem_ram_HostOrder){
+		memcpy(p, &value, 4);
+	}else{
+		p[0]=(uint8_t)(value>>24);
+		p[1]=(uint8_t)(value>>16);
+		p[2]=(uint8_t)(value>>8);
+		p[3]=(uint8_t)value;
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_read_masked(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut, uint32_t byteMask)
+{
+	uint32_t swizzle=mem->swizzle;
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			dataOut[i]=mem->data[(address+i)^swizzle];
+		}
+	}
+	return mips_Success;
+}
+
+static mips_error mips_mem_ram_write_masked(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn, uint32_t byteMask)
+{
+	uint32_t swizzle=mem->swizzle;
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			mem->data[(address+i)^swizzle]=dataIn[i];
+		}
+	}
+	return mips_Success;
+}
+
+void mips_mem_ram_read_raw(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
 {
-	uint32_t length;
-	uint32_t blockSize;
-	uint8_t *data;
+	if(mem->swizzle==0){
+		memcpy(dataOut, mem->data+address, length);
+	}else{
+		mips_mem_ram_read(mem, address, length, dataOut);
+	}
+}
+
+static const struct mips_mem_ops sg_ramOps={
+	mips_mem_ram_read,
+	mips_mem_ram_write,
+	mips_mem_ram_read_word,
+	mips_mem_ram_write_word,
+	mips_mem_ram_read_masked,
+	mips_mem_ram_write_masked,
+	mips_mem_release_data
 };
 
-extern "C" mips_mem_h mips_mem_create_ram(
-	uint32_t cbMem,	//!< Total number of bytes of ram
-	uint32_t blockSize	//!< Granularity in bytes
+/* Shadow memory for mips_mem_ram_Shadow. Bit (address&7) of
+   shadow[address>>3] is set once the byte at address has been written.
+   Each transaction is checked (or marked) against the shadow, and then
+   handed to the normal RAM functions, so a RAM without a shadow pays
+   nothing for it. */
+
+static inline bool shadow_bit(const uint8_t *shadow, uint32_t address)
+{
+	return (shadow[address>>3]>>(address&7))&1;
+}
+
+/* Finds the first byte in [address,address+length) which has not been
+   written, or returns false if they all have. Whole bytes of the
+   shadow (8 bytes of memory) are checked 16 at a time where possible. */
+bool mips_mem_shadow_find_unwritten(const uint8_t *shadow, uint32_t address, uint32_t length, uint32_t *unwritten)
+{
+	uint64_t a=address, end=(uint64_t)address+length;
+
+	while(a<end && (a&7)){
+		if(!shadow_bit(shadow, (uint32_t)a)){
+			*unwritten=(uint32_t)a;
+			return true;
+		}
+		a++;
+	}
+	uint64_t i=a>>3, n=(end-a)>>3;
+#ifdef MIPS_MEM_RAM_SSE2
+	const __m128i ones=_mm_set1_epi8((char)0xFF);
+	while(n>=16 && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(shadow+i)), ones))==0xFFFF){
+		i+=16;
+		n-=16;
+	}
+#endif
+	while(n>0 && shadow[i]==0xFF){
+		i++;
+		n--;
+	}
+	for(a=i<<3; a<end; a++){
+		if(!shadow_bit(shadow, (uint32_t)a)){
+			*unwritten=(uint32_t)a;
+			return true;
+		}
+	}
+	return false;
+}
+
+void mips_mem_shadow_mark(uint8_t *shadow, uint32_t address, uint32_t length)
+{
+	uint64_t a=address, end=(uint64_t)address+length;
+
+	while(a<end && (a&7)){
+		shadow[a>>3] |= (uint8_t)(1u<<(a&7));
+		a++;
+	}
+	if(end-a>=8){
+		memset(shadow+(a>>3), 0xFF, (size_t)((end-a)>>3));	// Vectorised by the library
+		a+=(end-a)&~(uint64_t)7;
+	}
+	while(a<end){
+		shadow[a>>3] |= (uint8_t)(1u<<(a&7));
+		a++;
+	}
+}
+
+static mips_error shadow_fault(mips_mem_h mem, uint32_t address)
+{
+	mem->shadowFaulted=1;
+	mem->shadowFault=address;
+	return mips_ExceptionUninitialisedRead;
+}
+
+static mips_error mips_mem_shadow_read(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut)
+{
+	uint32_t unwritten;
+	if(mips_mem_shadow_find_unwritten(mem->shadow, address, length, &unwritten))
+		return shadow_fault(mem, unwritten);
+	return mips_mem_ram_read(mem, address, length, dataOut);
+}
+
+static mips_error mips_mem_shadow_write(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn)
+{
+	mips_mem_shadow_mark(mem->shadow, address, length);
+	return mips_mem_ram_write(mem, address, length, dataIn);
+}
+
+/* Words are aligned, so their four bits are in one byte of the shadow */
+static mips_error mips_mem_shadow_read_word(mips_mem_h mem, uint32_t address, uint32_t *value)
+{
+	unsigned bits=(mem->shadow[address>>3]>>(address&4))&0xF;
+	if(bits!=0xF){
+		unsigned i=0;
+		while((bits>>i)&1){
+			i++;
+		}
+		return shadow_fault(mem, address+i);
+	}
+	return mips_mem_ram_read_word(mem, address, value);
+}
+
+static mips_error mips_mem_shadow_write_word(mips_mem_h mem, uint32_t address, uint32_t value)
+{
+	mem->shadow[address>>3] |= (uint8_t)(0xFu<<(address&4));
+	return mips_mem_ram_write_word(mem, address, value);
+}
+
+/* Only the enabled bytes have to have been written */
+static mips_error mips_mem_shadow_read_masked(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut, uint32_t byteMask)
+{
+	for(unsigned i=0; i<length; i++){
+		if(((byteMask>>i)&1) && !shadow_bit(mem->shadow, address+i)){
+			return shadow_fault(mem, address+i);
+		}
+	}
+	return mips_mem_ram_read_masked(mem, address, length, dataOut, byteMask);
+}
+
+static mips_error mips_mem_shadow_write_masked(mips_mem_h mem, uint32_t address, uint32_t length, const uint8_t *dataIn, uint32_t byteMask)
+{
+	for(unsigned i=0; i<length; i++){
+		if((byteMask>>i)&1){
+			mem->shadow[(address+i)>>3] |= (uint8_t)(1u<<((address+i)&7));
+		}
+	}
+	return mips_mem_ram_write_masked(mem, address, length, dataIn, byteMask);
+}
+
+static const struct mips_mem_ops sg_shadowRamOps={
+	mips_mem_shadow_read,
+	mips_mem_shadow_write,
+	mips_mem_shadow_read_word,
+	mips_mem_shadow_write_word,
+	mips_mem_shadow_read_masked,
+	mips_mem_shadow_write_masked,
+	mips_mem_release_data
+};
+
+bool mips_mem_is_ram(mips_mem_h mem)
+{
+	return mem && (mem->ops==&sg_ramOps || mem->ops==&sg_shadowRamOps);
+}
+
+mips_mem_h mips_mem_create_ram_from(
+	uint32_t cbMem,
+	uint32_t blockSize,
+	unsigned flags,
+	uint8_t *data,
+	void (*freeData)(uint8_t *data, uint32_t length)
 ){
-	uint8_t *data=(uint8_t*)malloc(cbMem);
-	if(data==0)
-		return 0;
-	
-	struct mips_mem_provider *mem=(struct mips_mem_provider*)malloc(sizeof(struct mips_mem_provider));
+	uint8_t *shadow=0;
+	if(flags&mips_mem_ram_Shadow){
+		shadow=(uint8_t*)calloc(cbMem/8+1, 1);
+		if(shadow==0){
+			return 0;
+		}
+	}
+
+	mips_mem_h mem=mips_mem_create_provider(shadow ? &sg_shadowRamOps : &sg_ramOps, cbMem, blockSize, 0);
 	if(mem==0){
-		free(data);
+		free(shadow);
 		return 0;
 	}
 	
-	mem->length=cbMem;
-	mem->blockSize=blockSize;
+	mem->shadow=shadow;
 	mem->data=data;
+	mem->freeData=freeData;
+	mem->flags=flags;
+	mem->swizzle=((flags&mips_mem_ram_HostOrder) && host_is_little_endian()) ? 3 : 0;
 	
 	return mem;
 }
 
-static mips_error mips_mem_read_write(
-	bool write,
-    mips_mem_h mem,
-    uint32_t address,
-    uint32_t length,
-    uint8_t *dataOut
-)
-{	
-	if(mem==0)
-		return mips_ErrorInvalidHandle;
-	
-	if(0 != (address%mem->blockSize) ){
-		return mips_ExceptionInvalidAlignment;
+#ifdef MIPS_MEM_RAM_MMAP
+
+static const size_t sg_hugePageSize=2<<20;
+
+static size_t round_up(size_t x, size_t align)
+{
+	return (x+align-1)/align*align;
+}
+
+static size_t mapped_length(uint32_t length, size_t align)
+{
+	return round_up(length ? length : 1, align);
+}
+
+static void free_mapped_ram(uint8_t *data, uint32_t length)
+{
+	munmap(data, mapped_length(length, sysconf(_SC_PAGESIZE)));
+}
+
+static void free_huge_ram(uint8_t *data, uint32_t length)
+{
+	munmap(data, mapped_length(length, sg_hugePageSize));
+}
+
+/* Maps len bytes starting on a huge page boundary, by over-allocating
+   and then trimming both ends. Transparent huge pages can only be used
+   for the aligned 2MB regions of a mapping. */
+static uint8_t *map_aligned(size_t len)
+{
+	size_t total=len+sg_hugePageSize;
+	void *p=mmap(0, total, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p==MAP_FAILED)
+		return 0;
+
+	uintptr_t begin=(uintptr_t)p, aligned=round_up(begin, sg_hugePageSize);
+	if(aligned>begin)
+		munmap(p, aligned-begin);
+	if(aligned+len < begin+total)
+		munmap((void*)(aligned+len), begin+total-(aligned+len));
+	return (uint8_t*)aligned;
+}
+
+/* Asks for the pages to come from the node of the calling thread. This
+   goes straight to the system calls, so libnuma isn't needed, and any
+   failure (e.g. a kernel without NUMA support) just leaves the default
+   policy in place. It must happen before the pages are touched. */
+static void bind_to_local_node(uint8_t *data, size_t len)
+{
+#if defined(SYS_getcpu) && defined(SYS_mbind)
+	const int MPOL_PREFERRED=1;
+	const unsigned maxNodes=1024;
+	const unsigned bitsPerLong=8*sizeof(unsigned long);
+
+	unsigned cpu, node;
+	if(syscall(SYS_getcpu, &cpu, &node, 0)!=0 || node>=maxNodes)
+		return;
+
+	unsigned long mask[maxNodes/bitsPerLong];
+	memset(mask, 0, sizeof(mask));
+	mask[node/bitsPerLong] = 1ul<<(node%bitsPerLong);
+	syscall(SYS_mbind, data, len, MPOL_PREFERRED, mask, (unsigned long)maxNodes+1, 0);
+#else
+	(void)data;
+	(void)len;
+#endif
+}
+
+static uint8_t *mips_mem_ram_alloc(
+	uint32_t cbMem,
+	unsigned flags,
+	void (**freeData)(uint8_t *data, uint32_t length)
+){
+	if((flags&sg_placementFlags)==0){
+		*freeData=0;
+		if(flags&sg_zeroFlags)
+			return (uint8_t*)calloc(cbMem ? cbMem : 1, 1);
+		return (uint8_t*)malloc(cbMem);
 	}
-	if(0 != ((address+length)%mem->blockSize)){
-		return mips_ExceptionInvalidAlignment;
+
+	uint8_t *data=0;
+	size_t len;
+	if(flags&mips_mem_ram_HugePages){
+		len=mapped_length(cbMem, sg_hugePageSize);
+#ifdef MAP_HUGETLB
+		void *p=mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(p!=MAP_FAILED)
+			data=(uint8_t*)p;
+#endif
+		if(data==0){
+			// No huge pages reserved, so fall back to transparent ones
+			data=map_aligned(len);
+#ifdef MADV_HUGEPAGE
+			if(data)
+				madvise(data, len, MADV_HUGEPAGE);
+#endif
+		}
+		*freeData=free_huge_ram;
+	}else{
+		len=mapped_length(cbMem, sysconf(_SC_PAGESIZE));
+		void *p=mmap(0, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		data = p==MAP_FAILED ? 0 : (uint8_t*)p;
+		*freeData=free_mapped_ram;
 	}
-	if((address+length) > mem->length){	// A subtle bug here, maybe?
-		return mips_ExceptionInvalidAddress;
+	if(data==0)
+		return 0;
+
+	if(flags&mips_mem_ram_NumaLocal)
+		bind_to_local_node(data, len);
+
+	if(flags&mips_mem_ram_Prefault){
+		// Writing zero to an anonymous page still allocates it
+		size_t step=sysconf(_SC_PAGESIZE);
+		for(size_t i=0; i<len; i+=step){
+			((volatile uint8_t*)data)[i]=0;
+		}
 	}
+	return data;
+}
+
+#else
+
+/* Nothing to be done about placement, but the contents must still
+   match what the mmap version gives. */
+static uint8_t *mips_mem_ram_alloc(
+	uint32_t cbMem,
+	unsigned flags,
+	void (**freeData)(uint8_t *data, uint32_t length)
+){
+	*freeData=0;
+	if(flags&(sg_placementFlags|sg_zeroFlags))
+		return (uint8_t*)calloc(cbMem ? cbMem : 1, 1);
+	return (uint8_t*)malloc(cbMem);
+}
+
+#endif
+
+extern "C" mips_mem_h mips_mem_create_ram(
+	uint32_t cbMem,	//!< Total number of bytes of ram
+	uint32_t blockSize	//!< Granularity in bytes
+){
+	return mips_mem_create_ram_ex(cbMem, blockSize, 0);
+}
+
+extern "C" mips_mem_h mips_mem_create_ram_ex(
+	uint32_t cbMem,
+	uint32_t blockSize,
+	unsigned flags
+){
+	if(flags & ~((unsigned)mips_mem_ram_HostOrder|sg_placementFlags|sg_zeroFlags))
+		return 0;
+	if((flags&mips_mem_ram_HostOrder) && (cbMem%4)!=0)
+		return 0;
+
+	void (*freeData)(uint8_t *data, uint32_t length);
+	uint8_t *data=mips_mem_ram_alloc(cbMem, flags, &freeData);
+	if(data==0)
+		return 0;
 	
-	if(write){
-		for(unsigned i=0; i<length; i++){
-			mem->data[address+i]=dataOut[i];
-		}
-	}else{
-		for(unsigned i=0; i<length; i++){
-			dataOut[i]=mem->data[address+i];
+	mips_mem_h mem=mips_mem_create_ram_from(cbMem, blockSize, flags, data, freeData);
+	if(mem==0){
+		if(freeData){
+			freeData(data, cbMem);
+		}else{
+			free(data);
 		}
+		return 0;
 	}
+	
+	return mem;
+}
+
+extern "C" mips_error mips_mem_get_uninitialised_read(
+	mips_mem_h mem,
+	uint32_t *address
+){
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(address==0 || mem->shadow==0 || !mem->shadowFaulted)
+		return mips_ErrorInvalidArgument;
+
+	*address=mem->shadowFault;
 	return mips_Success;
 }
 
-mips_error mips_mem_read(
-    mips_mem_h mem,		//!< Handle to target memory
-    uint32_t address,	//!< Byte address to start transaction at
-    uint32_t length,	//!< Number of bytes to transfer
-    uint8_t *dataOut	//!< Receives the target bytes
-)
-{	
-	return mips_mem_read_write(
-		false,	// we want to read
-		mem,
-		address,
-		length,
-		dataOut
-	);
-}
-
-mips_error mips_mem_write(
-	mips_mem_h mem,	//! Handle to target memory
-	uint32_t address,		//! Byte address to start transaction at
-	uint32_t length,			//! Number of bytes to transfer
-	const uint8_t *dataIn	//! Receives the target bytes
-)
-{
-	return mips_mem_read_write(
-		true,	// we want to write
-		mem,
-		address,
-		length,
-		(uint8_t*)dataIn
-	);
-}
-
-void mips_mem_free(mips_mem_h mem)
-{
-	if(mem){
-		free(mem->data);
-		mem->data=0;
-		free(mem);
-	}
+extern "C" mips_error mips_mem_set_initialised(
+	mips_mem_h mem,
+	uint32_t address,
+	uint32_t length
+){
+	if(mem==0)
+		return mips_ErrorInvalidHandle;
+	if(mem->shadow==0 || length > mem->length || address > mem->length-length)
+		return mips_ErrorInvalidArgument;
+
+	mips_mem_shadow_mark(mem->shadow, address, length);
+	return mips_Success;
 }
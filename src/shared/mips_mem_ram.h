@@ -0,0 +1,38 @@
+/* Private interface to the RAM provider from mips_mem_ram.cpp. This
+   lets other parts of the shared library (such as checkpointing)
+   reach the storage directly, without going through transactions.
+*/
+#ifndef mips_mem_ram_header
+#define mips_mem_ram_header
+
+#include "mips_mem_provider.h"
+
+/* Creates a RAM around storage that was allocated elsewhere. The
+   RAM takes ownership of data, and will pass it to freeData (or
+   to free if freeData is NULL) when released. The data must already
+   be laid out as the flags say.
+*/
+mips_mem_h mips_mem_create_ram_from(
+	uint32_t cbMem,
+	uint32_t blockSize,
+	unsigned flags,
+	uint8_t *data,
+	void (*freeData)(uint8_t *data, uint32_t length)
+);
+
+/* True if mem was created by one of the RAM functions, so data is valid. */
+bool mips_mem_is_ram(mips_mem_h mem);
+
+/* Copies bytes out of a RAM in address order, without looking at (or
+   changing) its shadow. The range must already have been checked. */
+void mips_mem_ram_read_raw(mips_mem_h mem, uint32_t address, uint32_t length, uint8_t *dataOut);
+
+/* Finds the first byte in [address,address+length) whose bit in a
+   shadow bitmap (as in mips_mem_provider) is clear, or returns false
+   if they are all set. */
+bool mips_mem_shadow_find_unwritten(const uint8_t *shadow, uint32_t address, uint32_t length, uint32_t *unwritten);
+
+/* Sets the shadow bits of [address,address+length). */
+void mips_mem_shadow_mark(uint8_t *shadow, uint32_t address, uint32_t length);
+
+#endif
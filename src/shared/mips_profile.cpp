@@ -0,0 +1,289 @@
+/* This file is an implementation of the profiler defined in
+   mips_profile.h. Like the timer it only uses the public plugin
+   functions, so works with any CPU which raises call and return
+   events.
+
+   The calling-context tree is a vector of nodes, and a child is
+   always created after its parent, so walking the vector backwards
+   visits every node before its parent.
+*/
+#include "mips.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct node
+    {
+        uint32_t function;
+        unsigned parent;
+        std::map<uint32_t,unsigned> children;  // Callee entry point to node
+        uint64_t self;
+        uint64_t calls;
+    };
+
+    struct frame
+    {
+        unsigned node;
+        uint32_t returnAddress;
+    };
+}
+
+struct mips_profile_impl
+{
+    mips_cpu_h cpu;
+    unsigned hookId;
+
+    std::vector<node> nodes;    // nodes[0] is the root
+    std::vector<frame> stack;   // Empty when the root is running
+    uint64_t charged;           // Instruction count already charged to a node
+};
+
+static unsigned current_node(const mips_profile_impl *p)
+{
+    return p->stack.empty() ? 0 : p->stack.back().node;
+}
+
+// Charges everything up to (but not including) the given instruction
+static void charge(mips_profile_impl *p, uint64_t upTo)
+{
+    p->nodes[current_node(p)].self += upTo-p->charged;
+    p->charged=upTo;
+}
+
+/* The CPU was reset, reversed, or restored, so the stack no longer
+   means anything. Carries on from the root, keeping what was charged. */
+static void restart_if_rewound(mips_profile_impl *p, uint64_t count)
+{
+    if(count<p->charged){
+        p->stack.clear();
+        p->charged=count;
+    }
+}
+
+static void on_event(void *context, mips_cpu_h cpu, const mips_plugin_event *e)
+{
+    mips_profile_impl *p=(mips_profile_impl*)context;
+
+    // The instruction has completed, but has not been counted yet
+    uint64_t count;
+    mips_cpu_get_instruction_count(cpu, &count);
+    restart_if_rewound(p, count);
+    charge(p, count+1);
+
+    if(e->kind==mips_plugin_Call){
+        unsigned parent=current_node(p);
+        unsigned child;
+        std::map<uint32_t,unsigned>::iterator it=p->nodes[parent].children.find(e->address);
+        if(it==p->nodes[parent].children.end()){
+            child=(unsigned)p->nodes.size();
+            node n;
+            n.function=e->address;
+            n.parent=parent;
+            n.self=0;
+            n.calls=0;
+            p->nodes.push_back(n);
+            p->nodes[parent].children[e->address]=child;
+        }else{
+            child=it->second;
+        }
+        p->nodes[child].calls++;
+
+        frame f;
+        f.node=child;
+        f.returnAddress=e->pc+8;
+        p->stack.push_back(f);
+    }else{
+        for(size_t i=p->stack.size(); i>0; i--){
+            if(p->stack[i-1].returnAddress==e->address){
+                p->stack.resize(i-1);
+                break;
+            }
+        }
+    }
+}
+
+// Brings the current function's cost up to date with the CPU
+static void sync(mips_profile_impl *p)
+{
+    uint64_t count;
+    if(mips_cpu_get_instruction_count(p->cpu, &count)==mips_Success){
+        restart_if_rewound(p, count);
+        charge(p, count);
+    }
+}
+
+static std::string function_name(uint32_t address, mips_elf_h symbols)
+{
+    char buffer[32];
+    if(symbols){
+        uint32_t offset;
+        const mips_elf_symbol *sym=mips_elf_find_symbol(symbols, address, &offset);
+        if(sym){
+            if(offset==0)
+                return sym->name;
+            snprintf(buffer, sizeof(buffer), "+0x%x", offset);
+            return sym->name+std::string(buffer);
+        }
+    }
+    snprintf(buffer, sizeof(buffer), "0x%08x", address);
+    return buffer;
+}
+
+// Inclusive cost of every node, including all of its descendants
+static std::vector<uint64_t> inclusive_costs(const mips_profile_impl *p)
+{
+    std::vector<uint64_t> inclusive(p->nodes.size());
+    for(size_t i=p->nodes.size(); i>0; i--){
+        inclusive[i-1]+=p->nodes[i-1].self;
+        if(i>1)
+            inclusive[p->nodes[i-1].parent]+=inclusive[i-1];
+    }
+    return inclusive;
+}
+
+extern "C" mips_profile_h mips_profile_create(mips_cpu_h cpu)
+{
+    uint32_t pc;
+    uint64_t count;
+    if(cpu==0 || mips_cpu_get_pc(cpu, &pc) || mips_cpu_get_instruction_count(cpu, &count))
+        return 0;
+
+    mips_profile_impl *p=new mips_profile_impl;
+    p->cpu=cpu;
+    p->charged=count;
+
+    node root;
+    root.function=pc;
+    root.parent=0;
+    root.self=0;
+    root.calls=0;
+    p->nodes.push_back(root);
+
+    mips_error err=mips_cpu_add_plugin_callback(cpu, mips_plugin_Call|mips_plugin_Return,
+        0, 0xFFFFFFFF, on_event, p, &p->hookId);
+    if(err){
+        delete p;
+        return 0;
+    }
+    return p;
+}
+
+extern "C" mips_error mips_profile_get_function(mips_profile_h profile, uint32_t address, mips_profile_function *info)
+{
+    if(profile==0)
+        return mips_ErrorInvalidHandle;
+    if(info==0)
+        return mips_ErrorInvalidArgument;
+
+    sync(profile);
+    std::vector<uint64_t> inclusive=inclusive_costs(profile);
+
+    bool seen=false;
+    info->calls=0;
+    info->exclusive=0;
+    info->inclusive=0;
+    for(size_t i=0; i<profile->nodes.size(); i++){
+        const node &n=profile->nodes[i];
+        if(n.function!=address)
+            continue;
+        seen=true;
+        info->calls+=n.calls;
+        info->exclusive+=n.self;
+
+        // Only the outermost activation counts towards inclusive
+        unsigned a=(unsigned)i;
+        while(a!=0){
+            a=profile->nodes[a].parent;
+            if(profile->nodes[a].function==address)
+                break;
+        }
+        if(a==i || profile->nodes[a].function!=address)
+            info->inclusive+=inclusive[i];
+    }
+    return seen ? mips_Success : mips_ErrorInvalidArgument;
+}
+
+extern "C" mips_error mips_profile_write_collapsed(mips_profile_h profile, FILE *dst, mips_elf_h symbols)
+{
+    if(profile==0)
+        return mips_ErrorInvalidHandle;
+    if(dst==0)
+        return mips_ErrorInvalidArgument;
+
+    sync(profile);
+
+    // Built parent first, so each stack is its parent's plus one name
+    std::vector<std::string> stacks(profile->nodes.size());
+    std::map<uint32_t,std::string> names;
+    for(size_t i=0; i<profile->nodes.size(); i++){
+        const node &n=profile->nodes[i];
+        std::map<uint32_t,std::string>::iterator it=names.find(n.function);
+        if(it==names.end())
+            it=names.insert(std::make_pair(n.function, function_name(n.function, symbols))).first;
+        stacks[i] = i==0 ? it->second : stacks[n.parent]+";"+it->second;
+
+        if(n.self){
+            if(fprintf(dst, "%s %llu\n", stacks[i].c_str(), (unsigned long long)n.self)<0)
+                return mips_ErrorFileWriteError;
+        }
+    }
+    return mips_Success;
+}
+
+extern "C" mips_error mips_profile_write_callgrind(mips_profile_h profile, FILE *dst, mips_elf_h symbols)
+{
+    if(profile==0)
+        return mips_ErrorInvalidHandle;
+    if(dst==0)
+        return mips_ErrorInvalidArgument;
+
+    sync(profile);
+    std::vector<uint64_t> inclusive=inclusive_costs(profile);
+
+    // Merge the contexts of each function, and of each caller/callee pair
+    struct edge
+    {
+        uint64_t calls;
+        uint64_t inclusive;
+    };
+    std::map<uint32_t,uint64_t> self;
+    std::map<uint32_t,std::map<uint32_t,edge> > edges;
+    for(size_t i=0; i<profile->nodes.size(); i++){
+        const node &n=profile->nodes[i];
+        self[n.function]+=n.self;
+        if(i!=0){
+            edge &e=edges[profile->nodes[n.parent].function][n.function];
+            e.calls+=n.calls;
+            e.inclusive+=inclusive[i];
+        }
+    }
+
+    fprintf(dst, "# callgrind format\nversion: 1\ncreator: mips_profile\n");
+    fprintf(dst, "positions: instr\nevents: Instructions\n");
+    fprintf(dst, "summary: %llu\n", (unsigned long long)inclusive[0]);
+
+    for(std::map<uint32_t,uint64_t>::const_iterator it=self.begin(); it!=self.end(); ++it){
+        fprintf(dst, "\nfn=%s\n0x%08x %llu\n", function_name(it->first, symbols).c_str(),
+            it->first, (unsigned long long)it->second);
+
+        const std::map<uint32_t,edge> &callees=edges[it->first];
+        for(std::map<uint32_t,edge>::const_iterator c=callees.begin(); c!=callees.end(); ++c){
+            fprintf(dst, "cfn=%s\ncalls=%llu 0x%08x\n0x%08x %llu\n",
+                function_name(c->first, symbols).c_str(),
+                (unsigned long long)c->second.calls, c->first,
+                it->first, (unsigned long long)c->second.inclusive);
+        }
+    }
+    return ferror(dst) ? mips_ErrorFileWriteError : mips_Success;
+}
+
+extern "C" void mips_profile_free(mips_profile_h profile)
+{
+    if(profile){
+        mips_cpu_remove_plugin(profile->cpu, profile->hookId);
+        delete profile;
+    }
+}
@@ -5,6 +5,8 @@
    some sort of main program to run the tests.
 */
 #include "mips_test.h"
+#include "mips_coverage.h"
+#include "mips_isa.h"
 
 #include <map>
 #include <string>
@@ -12,80 +14,388 @@
 #include <set>
 #include <algorithm>
 #include <string> 
+#include <chrono>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static bool sg_started=false;
 
+typedef std::chrono::steady_clock clock_type;
+
 struct test_info_t
 {
     int testId;
     std::string instruction;
     int status;
     std::string message;
+    
+    clock_type::time_point start;
+    double seconds;
+    uint64_t instructionsStart;
+    uint64_t instructions;
+    
+    bool hasCoverage;           // Whether coverage was available from the CPU
+    bool executed;              // Whether the instruction named by the test completed
+    mips_cpu_coverage coverage;
 };
 
 static std::vector<test_info_t> sg_tests;
 
-struct instr_info_t
+struct report_t
 {
-    const char *instruction;
-    const char *description;
+    mips_test_report_format format;
+    std::string fileName;
+    FILE *dst;
 };
 
-static const instr_info_t sg_instructionsArray[]=
-{
-    {"<INTERNAL>", "Tests of things other than intructions."},
-    {"ADD","Add (with overflow)"},
-    {"ADDI","Add immediate (with overflow)"},
-    {"ADDIU","Add immediate unsigned (no overflow)"},
-    {"ADDU","Add unsigned (no overflow)"},
-    {"AND","Bitwise and"},
-    {"ANDI","Bitwise and immediate"},
-    {"BEQ","Branch on equal"},
-    {"BGEZ","Branch on greater than or equal to zero"},
-    {"BGEZAL","Branch on greater than or equal to zero and link"},
-    {"BGTZ","Branch on greater than zero"},
-    {"BLEZ","Branch on less than or equal to zero"},
-    {"BLTZ","Branch on less than zero"},
-    {"BLTZAL","Branch on less than zero and link"},
-    {"BNE","Branch on not equal"},
-    {"DIV","Divide"},
-    {"DIVU","Divide unsigned"},
-    {"J","Jump"},
-    {"JAL","Jump and link"},
-    {"JR","Jump register"},
-    {"LB","Load byte"},
-    {"LBU","Load byte unsigned"},
-    {"LUI","Load upper immediate"},
-    {"LW","Load word"},
-    {"LWL","Load word left"},
-    {"LWR","Load word right"},
-    {"MFHI","Move from HI"},
-    {"MFLO","Move from LO"},
-    {"MULT","Multiply"},
-    {"MULTU","Multiply unsigned"},
-    {"OR","Bitwise or"},
-    {"ORI","Bitwise or immediate"},
-    {"SB","Store byte"},
-    {"SH","Store half-word"},
-    {"SLL","Shift left logical"},
-    {"SLLV","Shift left logical variable"},
-    {"SLT","Set on less than (signed)"},
-    {"SLTI","Set on less than immediate (signed)"},
-    {"SLTIU","Set on less than immediate unsigned"},
-    {"SLTU","Set on less than unsigned"},
-    {"SRA","Shift right arithmetic"},
-    {"SRL","Shift right logical"},
-    {"SRLV","Shift right logical variable"},
-    {"SUB","Subtract"},
-    {"SUBU","Subtract unsigned"},
-    {"SW","Store word"},
-    {"XOR","Bitwise exclusive or"},
-    {"XORI","Bitwise exclusive or immediate"}
-};
-static const unsigned sg_instructionsCount = sizeof(sg_instructionsArray)/sizeof(sg_instructionsArray[0]);
+static std::vector<report_t> sg_reports;
+
+static mips_cpu_h sg_cpu=0;
+
+// Tests which aren't of an instruction. Everything else is named
+// after an instruction in mips_isa.h.
+static const char sg_internalName[]="<INTERNAL>";
 
 static std::set<std::string> sg_knownInstructions;
 
+// Everything executed by all the tests together
+static bool sg_hasCoverage=false;
+static mips_cpu_coverage sg_coverage;
+
+
+static uint64_t get_instruction_count()
+{
+    uint64_t count=0;
+    if(sg_cpu){
+        if(mips_cpu_get_instruction_count(sg_cpu, &count))
+            count=0;
+    }
+    return count;
+}
+
+/* Internal tests get entry 0 of the table, which has an opcode of -1 */
+static const mips_isa_info *find_instruction(const std::string &name)
+{
+    if(name==sg_internalName)
+        return mips_isa_instructions;
+    mips_isa_op op=mips_isa_find(name.c_str());
+    return op==mips_isa_Invalid ? 0 : mips_isa_instructions+op;
+}
+
+/* Bit for an instruction in one of the by-instruction bitmaps */
+static bool coverage_bit(const mips_isa_info &info, const uint64_t *ops)
+{
+    unsigned op=(unsigned)(&info-mips_isa_instructions);
+    return (ops[op/64]>>(op%64))&1;
+}
+
+/* An instruction counts as executed if it completed, or if it raised
+   an exception (which is what BREAK is meant to do). */
+static bool instruction_executed(const mips_isa_info &info, const mips_cpu_coverage &c)
+{
+    if(info.opcode<0)
+        return true;
+    return coverage_bit(info, c.ops) || coverage_bit(info, c.opsRaised);
+}
+
+static bool is_branch(const mips_isa_info &info)
+{
+    return info.kind==mips_isa_class_Branch;
+}
+
+static void coverage_record_test(test_info_t &info)
+{
+    info.hasCoverage = sg_cpu && mips_cpu_get_coverage(sg_cpu, &info.coverage)==mips_Success;
+    info.executed = true;
+    if(!info.hasCoverage)
+        return;
+    
+    const mips_isa_info *instr=find_instruction(info.instruction);
+    if(instr){
+        info.executed=instruction_executed(*instr, info.coverage);
+    }
+    
+    const mips_cpu_coverage &c=info.coverage;
+    sg_hasCoverage=true;
+    sg_coverage.opcodes |= c.opcodes;
+    sg_coverage.special |= c.special;
+    sg_coverage.regimm |= c.regimm;
+    sg_coverage.taken |= c.taken;
+    sg_coverage.notTaken |= c.notTaken;
+    sg_coverage.regimmTaken |= c.regimmTaken;
+    sg_coverage.regimmNotTaken |= c.regimmNotTaken;
+    sg_coverage.delaySlotOpcodes |= c.delaySlotOpcodes;
+    sg_coverage.delaySlotSpecial |= c.delaySlotSpecial;
+    sg_coverage.exceptions |= c.exceptions;
+    sg_coverage.exceptionOpcodes |= c.exceptionOpcodes;
+    sg_coverage.exceptionSpecial |= c.exceptionSpecial;
+    for(unsigned i=0; i<4; i++){
+        sg_coverage.ops[i] |= c.ops[i];
+        sg_coverage.opsTaken[i] |= c.opsTaken[i];
+        sg_coverage.opsNotTaken[i] |= c.opsNotTaken[i];
+        sg_coverage.opsInDelaySlot[i] |= c.opsInDelaySlot[i];
+        sg_coverage.opsRaised[i] |= c.opsRaised[i];
+    }
+}
+
+static void print_names(const char *title, const std::vector<std::string> &names)
+{
+    fprintf(stderr, "  %-28s", title);
+    if(names.size()==0){
+        fprintf(stderr, " (none)");
+    }
+    for(unsigned i=0; i<names.size(); i++){
+        fprintf(stderr, " %s", names[i].c_str());
+    }
+    fprintf(stderr, "\n");
+}
+
+static void print_coverage(const std::set<std::string> &tested)
+{
+    const mips_cpu_coverage &c=sg_coverage;
+    
+    std::vector<std::string> notExecuted;
+    for(unsigned i=0; i<sg_tests.size(); i++){
+        if(!sg_tests[i].executed){
+            char tmp[16];
+            sprintf(tmp, "%d", sg_tests[i].testId);
+            notExecuted.push_back(std::string(tmp)+"("+sg_tests[i].instruction+")");
+        }
+    }
+    
+    std::vector<std::string> untested, neverTaken, alwaysTaken, delaySlot, raised;
+    for(unsigned i=1; i<mips_isa_Count; i++){
+        const mips_isa_info &info=mips_isa_instructions[i];
+        bool executed=coverage_bit(info, c.ops);
+        if(executed && tested.find(info.name)==tested.end()){
+            untested.push_back(info.name);
+        }
+        if(executed && is_branch(info)){
+            if(!coverage_bit(info, c.opsTaken))
+                neverTaken.push_back(info.name);
+            if(!coverage_bit(info, c.opsNotTaken))
+                alwaysTaken.push_back(info.name);
+        }
+        if(coverage_bit(info, c.opsInDelaySlot)){
+            delaySlot.push_back(info.name);
+        }
+        if(coverage_bit(info, c.opsRaised)){
+            raised.push_back(info.name);
+        }
+    }
+    
+    // Encodings the CPU accepted which aren't in mips_isa.h at all
+    std::vector<std::string> unknown;
+    for(int op=0; op<64; op++){
+        if(op==0 || op==1 || op==0x11 || !((c.opcodes>>op)&1))
+            continue;
+        if(mips_isa_dispatch[MIPS_ISA_DISPATCH_Primary+op]==mips_isa_Invalid){
+            char tmp[32];
+            sprintf(tmp, "opcode=0x%02x", op);
+            unknown.push_back(tmp);
+        }
+    }
+    for(int fn=0; fn<64; fn++){
+        if(!((c.special>>fn)&1))
+            continue;
+        if(mips_isa_dispatch[MIPS_ISA_DISPATCH_Special+fn]==mips_isa_Invalid){
+            char tmp[32];
+            sprintf(tmp, "funct=0x%02x", fn);
+            unknown.push_back(tmp);
+        }
+    }
+    
+    static const char *exceptionNames[]={
+        "Break", "InvalidAddress", "InvalidAlignment", "AccessViolation",
+        "InvalidInstruction", "ArithmeticOverflow", "FloatingPoint",
+        "UninitialisedRead"
+    };
+    std::vector<std::string> exceptions;
+    for(unsigned i=0; i<32; i++){
+        if((c.exceptions>>i)&1){
+            if(i<sizeof(exceptionNames)/sizeof(exceptionNames[0])){
+                exceptions.push_back(exceptionNames[i]);
+            }else{
+                char tmp[32];
+                sprintf(tmp, "0x%04x", 0x2000+i);
+                exceptions.push_back(tmp);
+            }
+        }
+    }
+    
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Coverage:\n");
+    print_names("Tests not executing theirs:", notExecuted);
+    print_names("Executed but not tested:", untested);
+    print_names("Other encodings executed:", unknown);
+    print_names("Branches never taken:", neverTaken);
+    print_names("Branches always taken:", alwaysTaken);
+    print_names("Executed in delay slots:", delaySlot);
+    print_names("Exceptions raised:", exceptions);
+    print_names("Raised by:", raised);
+}
+
+static std::string escape_json(const std::string &s)
+{
+    std::string res;
+    for(unsigned i=0; i<s.size(); i++){
+        char c=s[i];
+        if(c=='"' || c=='\\'){
+            res+='\\';
+            res+=c;
+        }else if((unsigned char)c<0x20){
+            char tmp[8];
+            sprintf(tmp, "\\u%04x", c);
+            res+=tmp;
+        }else{
+            res+=c;
+        }
+    }
+    return res;
+}
+
+static std::string escape_xml(const std::string &s)
+{
+    std::string res;
+    for(unsigned i=0; i<s.size(); i++){
+        switch(s[i]){
+        case '&': res+="&amp;"; break;
+        case '<': res+="&lt;"; break;
+        case '>': res+="&gt;"; break;
+        case '"': res+="&quot;"; break;
+        // Attribute values would turn these into spaces
+        case '\t': res+="&#9;"; break;
+        case '\n': res+="&#10;"; break;
+        case '\r': res+="&#13;"; break;
+        default:
+            // XML can't hold other control characters at all
+            res+=(unsigned char)s[i]<0x20 ? '?' : s[i];
+            break;
+        }
+    }
+    return res;
+}
+
+static void write_report_test(report_t &r, const test_info_t &info)
+{
+    if(r.format==mips_test_report_JsonLines){
+        fprintf(r.dst, "{\"id\":%d,\"instruction\":\"%s\",\"passed\":%s,\"message\":\"%s\",\"seconds\":%.9f,\"instructions\":%llu",
+            info.testId, escape_json(info.instruction).c_str(), info.status==1 ? "true" : "false",
+            escape_json(info.message).c_str(), info.seconds, (unsigned long long)info.instructions
+        );
+        if(info.hasCoverage){
+            fprintf(r.dst, ",\"executed\":%s", info.executed ? "true" : "false");
+        }
+        fprintf(r.dst, "}\n");
+    }else{
+        fprintf(r.dst, "  <testcase classname=\"%s\" name=\"%d\" time=\"%.9f\">\n",
+            escape_xml(info.instruction).c_str(), info.testId, info.seconds
+        );
+        fprintf(r.dst, "    <properties><property name=\"instructions\" value=\"%llu\"/>", (unsigned long long)info.instructions);
+        if(info.hasCoverage){
+            fprintf(r.dst, "<property name=\"executed\" value=\"%s\"/>", info.executed ? "true" : "false");
+        }
+        fprintf(r.dst, "</properties>\n");
+        if(info.status!=1){
+            fprintf(r.dst, "    <failure message=\"%s\"/>\n", escape_xml(info.message).c_str());
+        }
+        fprintf(r.dst, "  </testcase>\n");
+    }
+    fflush(r.dst);  // So that nothing is lost if we crash
+}
+
+static void open_reports()
+{
+    const char *jsonl=getenv("MIPS_TEST_JSONL");
+    if(jsonl && *jsonl)
+        mips_test_add_report(mips_test_report_JsonLines, jsonl);
+    const char *junit=getenv("MIPS_TEST_JUNIT");
+    if(junit && *junit)
+        mips_test_add_report(mips_test_report_JUnit, junit);
+    
+    for(unsigned i=0; i<sg_reports.size(); i++){
+        report_t &r=sg_reports[i];
+        if(r.fileName=="-"){
+            r.dst=stdout;
+        }else{
+            r.dst=fopen(r.fileName.c_str(), "wt");
+            if(!r.dst){
+                fprintf(stderr, "Error:mips_test_begin_suite - Could not create report file '%s'.\n", r.fileName.c_str());
+                exit(1);
+            }
+        }
+        if(r.format==mips_test_report_JUnit){
+            fprintf(r.dst, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+            fprintf(r.dst, "<testsuite name=\"mips\">\n");
+            fflush(r.dst);
+        }
+    }
+}
+
+/* Returns the ids of the slowest tests, slowest first */
+static std::vector<int> find_slowest(unsigned n)
+{
+    std::vector<std::pair<double,int> > times;
+    for(unsigned i=0; i<sg_tests.size(); i++){
+        times.push_back(std::make_pair(-sg_tests[i].seconds, sg_tests[i].testId));
+    }
+    std::sort(times.begin(), times.end());
+    
+    std::vector<int> res;
+    for(unsigned i=0; i<n && i<times.size(); i++){
+        res.push_back(times[i].second);
+    }
+    return res;
+}
+
+static void close_reports(int totalTests, int totalPassed, const std::vector<int> &slowest)
+{
+    for(unsigned i=0; i<sg_reports.size(); i++){
+        report_t &r=sg_reports[i];
+        if(r.format==mips_test_report_JsonLines){
+            fprintf(r.dst, "{\"summary\":true,\"tests\":%d,\"passed\":%d,\"slowest\":[", totalTests, totalPassed);
+            for(unsigned j=0; j<slowest.size(); j++){
+                fprintf(r.dst, "%s%d", j ? "," : "", slowest[j]);
+            }
+            fprintf(r.dst, "]}\n");
+        }else{
+            fprintf(r.dst, "</testsuite>\n");
+        }
+        if(r.dst!=stdout){
+            fclose(r.dst);
+        }else{
+            fflush(r.dst);
+        }
+        r.dst=0;
+    }
+}
+
+extern "C" void mips_test_add_report(mips_test_report_format format, const char *fileName)
+{
+    if(sg_started){
+        fprintf(stderr, "Error:mips_test_add_report - Reports must be added before mips_test_begin_suite.\n");
+        exit(1);
+    }
+    if(fileName==0 || (format!=mips_test_report_JsonLines && format!=mips_test_report_JUnit)){
+        fprintf(stderr, "Error:mips_test_add_report - Invalid format or file name.\n");
+        exit(1);
+    }
+    report_t r;
+    r.format=format;
+    r.fileName=fileName;
+    r.dst=0;
+    sg_reports.push_back(r);
+}
+
+extern "C" void mips_test_set_cpu(mips_cpu_h cpu)
+{
+    sg_cpu=cpu;
+    if(sg_cpu){
+        mips_cpu_set_coverage(sg_cpu, 1);
+    }
+}
 
 extern "C" void mips_test_begin_suite()
 {
@@ -94,11 +404,18 @@ extern "C" void mips_test_begin_suite()
         exit(1);
     }
     
-    // Build up a list of known instruction names
-    for(unsigned i=0; i<sg_instructionsCount; i++){
-        sg_knownInstructions.insert(std::string(sg_instructionsArray[i].instruction));
+    // Build up a list of known instruction names, with dotted
+    // versions of the COP1 ones (ADD.S as well as ADD_S)
+    sg_knownInstructions.insert(sg_internalName);
+    for(unsigned i=1; i<mips_isa_Count; i++){
+        std::string name=mips_isa_instructions[i].name;
+        sg_knownInstructions.insert(name);
+        std::replace(name.begin(), name.end(), '_', '.');
+        sg_knownInstructions.insert(name);
     }
     
+    open_reports();
+    
     sg_started=true;
 }
   
@@ -129,6 +446,15 @@ extern "C" int mips_test_begin_test(const char *instruction)
     }
     
     info.status=-1;
+    info.seconds=0;
+    info.instructions=0;
+    info.hasCoverage=false;
+    info.executed=true;
+    info.instructionsStart=get_instruction_count();
+    if(sg_cpu){
+        mips_cpu_clear_coverage(sg_cpu);
+    }
+    info.start=clock_type::now();   // Do this last, to avoid timing the framework
     sg_tests.push_back(info);
     
     return testId;
@@ -154,9 +480,20 @@ extern "C" void mips_test_end_test(int testId, int passed, const char *msg)
         exit(1);  
     }
     
-    sg_tests.back().status=passed ? 1 : 0;
+    test_info_t &info=sg_tests.back();
+    info.seconds=std::chrono::duration<double>(clock_type::now()-info.start).count();
+    // A test which resets or reverses the CPU can finish behind where it started
+    uint64_t instructionsEnd=get_instruction_count();
+    info.instructions = instructionsEnd>=info.instructionsStart ? instructionsEnd-info.instructionsStart : 0;
+    coverage_record_test(info);
+    
+    info.status=passed ? 1 : 0;
     if(msg){
-        sg_tests.back().message=msg;
+        info.message=msg;
+    }
+    
+    for(unsigned i=0; i<sg_reports.size(); i++){
+        write_report_test(sg_reports[i], info);
     }
 }
 
@@ -231,4 +568,28 @@ extern "C" void mips_test_end_suite()
     fprintf(stderr, "Fully working :            %3u (%5.1lf%%)\n", totalFullyWorking, 100.0*totalFullyWorking/(double)totalTested);
     fprintf(stderr, "Partially working :        %3u (%5.1lf%%)\n", totalPartiallyWorking, 100.0*totalPartiallyWorking/(double)totalTested);
     fprintf(stderr, "Not working at all :       %3u (%5.1lf%%)\n", totalNotWorking, 100.0*totalNotWorking/(double)totalTested);
+    
+    // Tests which take the longest are usually the first place to look for performance problems
+    std::vector<int> slowest=find_slowest(10);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Slowest tests:\n");
+    for(unsigned i=0; i<slowest.size(); i++){
+        const test_info_t &info=sg_tests[slowest[i]];
+        fprintf(stderr, "  %4d %12s %12.6lf s %12llu instrs\n", info.testId, info.instruction.c_str(), info.seconds, (unsigned long long)info.instructions);
+    }
+    
+    if(sg_hasCoverage){
+        std::set<std::string> tested;
+        for(unsigned i=0; i<sg_tests.size(); i++){
+            const mips_isa_info *instr=find_instruction(sg_tests[i].instruction);
+            tested.insert(instr ? instr->name : sg_tests[i].instruction.c_str());
+        }
+        print_coverage(tested);
+    }
+    
+    int totalPassed=0;
+    for(unsigned i=0; i<sg_tests.size(); i++){
+        totalPassed += sg_tests[i].status==1;
+    }
+    close_reports(sg_tests.size(), totalPassed, slowest);
 }
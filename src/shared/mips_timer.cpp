@@ -0,0 +1,98 @@
+/* This file is an implementation of the timer functions
+   defined in mips_event.h. It is an example of a device, so
+   only uses the public event and interrupt functions, and
+   works with any CPU which implements them.
+*/
+#include "mips.h"
+
+struct mips_timer_impl
+{
+    mips_cpu_h cpu;
+    unsigned line;
+
+    bool running;
+    unsigned eventId;
+    uint64_t period;        // Zero for one-shot
+    uint64_t expirations;
+};
+
+static mips_error timer_expired(void *context, mips_cpu_h cpu, uint64_t when)
+{
+    mips_timer_impl *t=(mips_timer_impl*)context;
+
+    t->expirations++;
+    t->running=false;
+    if(t->period && when<UINT64_MAX){
+        // Relative to when it was due, rather than now, so it doesn't drift
+        uint64_t next = t->period > UINT64_MAX-when ? UINT64_MAX : when+t->period;
+        mips_error err=mips_cpu_schedule_event(cpu, next, timer_expired, t, &t->eventId);
+        if(err)
+            return err;
+        t->running=true;
+    }
+    return mips_cpu_raise_interrupt(cpu, t->line);
+}
+
+extern "C" mips_timer_h mips_timer_create(mips_cpu_h cpu, unsigned line)
+{
+    if(cpu==0 || line>=32)
+        return 0;
+
+    mips_timer_impl *t=new mips_timer_impl;
+    t->cpu=cpu;
+    t->line=line;
+    t->running=false;
+    t->eventId=0;
+    t->period=0;
+    t->expirations=0;
+    return t;
+}
+
+extern "C" mips_error mips_timer_start(mips_timer_h timer, uint64_t delay, uint64_t period)
+{
+    if(timer==0)
+        return mips_ErrorInvalidHandle;
+    if(delay==0)
+        return mips_ErrorInvalidArgument;
+
+    mips_timer_stop(timer);
+
+    uint64_t now;
+    mips_error err=mips_cpu_get_instruction_count(timer->cpu, &now);
+    if(err)
+        return err;
+
+    timer->period=period;
+    uint64_t when = delay > UINT64_MAX-now ? UINT64_MAX : now+delay;
+    err=mips_cpu_schedule_event(timer->cpu, when, timer_expired, timer, &timer->eventId);
+    if(err)
+        return err;
+    timer->running=true;
+    return mips_Success;
+}
+
+extern "C" mips_error mips_timer_stop(mips_timer_h timer)
+{
+    if(timer==0)
+        return mips_ErrorInvalidHandle;
+
+    if(timer->running){
+        // This fails if a reset has already cancelled it, which is fine
+        mips_cpu_cancel_event(timer->cpu, timer->eventId);
+        timer->running=false;
+    }
+    return mips_Success;
+}
+
+extern "C" uint64_t mips_timer_get_expirations(mips_timer_h timer)
+{
+    return timer ? timer->expirations : 0;
+}
+
+extern "C" void mips_timer_free(mips_timer_h timer)
+{
+    if(timer){
+        mips_timer_stop(timer);
+        delete timer;
+    }
+}
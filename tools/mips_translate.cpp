@@ -0,0 +1,78 @@
+/* Command line front end to mips_aot_translate. Reads a binary
+   image and writes a C++ translation of it, for compiling into
+   a module that mips_aot_load can use.
+*/
+#include "mips.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+static void usage()
+{
+    fprintf(stderr, "Usage: mips_translate [-b base] [-e entry]... [-s symbol] image.bin output.cpp\n");
+    fprintf(stderr, "  -b base    Address the image is loaded at (default 0)\n");
+    fprintf(stderr, "  -e entry   Another address execution can start at\n");
+    fprintf(stderr, "  -s symbol  Name of the module in the output (default mips_aot_image)\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t base=0;
+    std::vector<uint32_t> entries;
+    const char *symbol=0;
+
+    int i=1;
+    while(i<argc && argv[i][0]=='-'){
+        if(i+1>=argc)
+            usage();
+        if(!strcmp(argv[i], "-b")){
+            base=(uint32_t)strtoul(argv[i+1], 0, 0);
+        }else if(!strcmp(argv[i], "-e")){
+            entries.push_back((uint32_t)strtoul(argv[i+1], 0, 0));
+        }else if(!strcmp(argv[i], "-s")){
+            symbol=argv[i+1];
+        }else{
+            usage();
+        }
+        i+=2;
+    }
+    if(argc-i!=2)
+        usage();
+
+    FILE *src=fopen(argv[i], "rb");
+    if(!src){
+        fprintf(stderr, "Cannot open image '%s'.\n", argv[i]);
+        exit(1);
+    }
+    std::vector<uint8_t> image;
+    uint8_t buffer[4096];
+    size_t got;
+    while((got=fread(buffer, 1, sizeof(buffer), src))>0){
+        image.insert(image.end(), buffer, buffer+got);
+    }
+    fclose(src);
+    image.resize((image.size()+3)&~(size_t)3, 0);
+
+    FILE *dst=fopen(argv[i+1], "w");
+    if(!dst){
+        fprintf(stderr, "Cannot create output '%s'.\n", argv[i+1]);
+        exit(1);
+    }
+    mips_error err=mips_aot_translate(
+        image.empty() ? 0 : &image[0], (uint32_t)image.size(), base,
+        entries.empty() ? 0 : &entries[0], (unsigned)entries.size(),
+        symbol, dst
+    );
+    if(fclose(dst)!=0 && !err)
+        err=mips_ErrorFileWriteError;
+    if(err){
+        fprintf(stderr, "Translation failed with error 0x%x.\n", err);
+        remove(argv[i+1]);
+        exit(1);
+    }
+    return 0;
+}